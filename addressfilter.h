@@ -0,0 +1,158 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - AddressFilter Class Definition
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+"This header should only be included by Visual Leak Detector when building it from source. \
+Applications should never include this header."
+#endif
+
+#include <cstring>
+#include "platform.h" // Provides the counter helpers and, on POSIX systems, the Win32 types.
+
+#define ADDRESSFILTERBITS      20                         // Base 2 logarithm of the number of counters.
+#define ADDRESSFILTERCOUNTERS  (1 << ADDRESSFILTERBITS)   // Number of counters.
+#define ADDRESSFILTERSATURATED 0xFF                       // Value at which a counter sticks.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The AddressFilter Class
+//
+//    An AddressFilter is a counting Bloom filter of addresses. It answers
+//    whether an address may have been inserted, without ever answering "no"
+//    for one that was. It is used to find out, before acquiring any lock,
+//    that a block being freed was never tracked, which is the case for most
+//    frees in processes that exclude many modules or leave leak detection
+//    disabled for long stretches.
+//
+//    Each address is hashed to two counters, which are incremented when it is
+//    inserted and decremented when it is removed. Insertions and removals must
+//    be serialized by the caller, but "maycontain" may be called by any thread
+//    at any time: it only loads the two counters. A thread that frees a block
+//    learned its address, one way or another, after the block was inserted,
+//    so it sees the counters incremented.
+//
+//    A counter that reaches ADDRESSFILTERSATURATED is never decremented again,
+//    so that it can't be decremented on behalf of an address whose increment
+//    it lost. The more addresses are inserted, the more often "maycontain"
+//    answers "yes" for addresses that weren't, but that only costs a lookup.
+//
+class AddressFilter
+{
+public:
+    AddressFilter ()
+    {
+        memset(m_counters, 0x0, sizeof(m_counters));
+    }
+
+    // insert - Inserts an address into the filter.
+    //
+    //   Note: Insertions and removals must be serialized by the caller.
+    //
+    //  - address (IN): The address to insert.
+    //
+    //  Return Value:
+    //
+    //    None.
+    //
+    VOID insert (LPCVOID address)
+    {
+        SIZE_T first;
+        SIZE_T second;
+
+        hash(address, &first, &second);
+        increment(first);
+        increment(second);
+    }
+
+    // maycontain - Determines whether an address may have been inserted into
+    //   the filter (and not removed since). May be called by any thread, at any
+    //   time, without locking.
+    //
+    //  - address (IN): The address to look for.
+    //
+    //  Return Value:
+    //
+    //    Returns FALSE if the address is definitely not in the filter.
+    //    Otherwise, returns TRUE.
+    //
+    BOOL maycontain (LPCVOID address) const
+    {
+        SIZE_T first;
+        SIZE_T second;
+
+        hash(address, &first, &second);
+        return (readcounter(&m_counters[first]) != 0) && (readcounter(&m_counters[second]) != 0);
+    }
+
+    // remove - Removes an address, previously inserted, from the filter.
+    //
+    //   Note: Insertions and removals must be serialized by the caller.
+    //
+    //  - address (IN): The address to remove.
+    //
+    //  Return Value:
+    //
+    //    None.
+    //
+    VOID remove (LPCVOID address)
+    {
+        SIZE_T first;
+        SIZE_T second;
+
+        hash(address, &first, &second);
+        decrement(first);
+        decrement(second);
+    }
+
+private:
+    // Private Helper Functions
+    VOID decrement (SIZE_T index)
+    {
+        if ((m_counters[index] != 0) && (m_counters[index] != ADDRESSFILTERSATURATED)) {
+            addcounter(&m_counters[index], (BYTE)-1);
+        }
+    }
+
+    // Blocks are aligned, so the low bits of their addresses are dropped. Both
+    // counters are taken from the top bits of a single multiplicative hash.
+    static VOID hash (LPCVOID address, SIZE_T *first, SIZE_T *second)
+    {
+        ULONGLONG hashed = ((ULONGLONG)(SIZE_T)address >> 3) * 0x9E3779B97F4A7C15ULL;
+
+        *first = (SIZE_T)(hashed >> (64 - ADDRESSFILTERBITS));
+        *second = (SIZE_T)(hashed >> (64 - 2 * ADDRESSFILTERBITS)) & (ADDRESSFILTERCOUNTERS - 1);
+    }
+
+    VOID increment (SIZE_T index)
+    {
+        if (m_counters[index] != ADDRESSFILTERSATURATED) {
+            addcounter(&m_counters[index], (BYTE)1);
+        }
+    }
+
+    // Private Data
+    BYTE m_counters [ADDRESSFILTERCOUNTERS]; // The counters (only written while insertions are serialized).
+};
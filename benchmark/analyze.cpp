@@ -0,0 +1,1148 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Trace Analysis Tool
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Analyzes a trace file, recorded by setting the TraceFile option, offline.
+//  The blocks outstanding at any point in time during the trace are
+//  reconstructed, and reported the way Visual Leak Detector reports memory
+//  leaks. The call sites whose outstanding blocks grew over an interval can be
+//  reported too. So the traced process only has to record its events, and all
+//  of the analysis is done later, on whichever system the trace is copied to.
+//
+//  Whether a block is outstanding only depends on its last event before the
+//  point in time being analyzed, and a block's last event is simply the one
+//  with the greatest timestamp. So the chunks of events don't need to be put
+//  back in order. They are shared out between worker threads, each of which
+//  keeps the last event it has seen for every block, in maps split into shards
+//  by address. Then the workers' maps are merged, one shard per worker thread.
+//  The memory used is proportional to the number of distinct blocks (heap and
+//  address) in the trace, not to the number of events.
+//
+//  Blocks are numbered as the tracking engine numbers them: by the number of
+//  blocks allocated before them. Only the chunks whose allocations are
+//  interleaved with those of the reported blocks have to be read again to
+//  count them.
+//
+//  Call stacks are symbolized using the modules described in the trace. Their
+//  symbols are read from the symbol cache, or from the module files if the
+//  same builds are present on this system.
+//
+//  Usage: vldanalyze [-a] [-g seconds] [-j threads] [-t seconds] tracefile
+//
+//    -a          Aggregate blocks of the same size with the same call stack.
+//    -g seconds  Also report the call sites whose outstanding blocks grew
+//                during this many seconds before the point in time analyzed.
+//    -j threads  Number of worker threads (default: one per processor).
+//    -t seconds  Point in time to analyze, in seconds since tracing started
+//                (default: the end of the trace).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#define VLDBUILD            // Declares that we are building Visual Leak Detector.
+#include "../callstack.h"   // Provides a class for handling call stacks.
+#include "../map.h"         // Provides a lightweight STL-like map template.
+#include "../platform.h"    // Provides the platform services.
+#ifndef _WIN32
+#include "../symbolizer.h"  // Provides symbol handling services.
+#endif // _WIN32
+#include "../trace.h"       // Provides the trace file reader.
+#include "../utility.h"     // Provides the report formatting functions.
+#include "../vldheap.h"     // Provides internal new and delete operators.
+
+#define CUTOFFS         2    // Points in time at which the blocks are reconstructed (the point analyzed, and the start of the growth interval).
+#define MAPRESERVE      4096 // Number of blocks the maps reserve space for at a time.
+#define MAXWORKERS      64   // Maximum number of worker threads.
+#define STATE_ALLOCATED 0x1  // The block's state has an allocation ("alloc" is set).
+#define STATE_RESIZED   0x2  // The block's state has an allocation or reallocation ("resize", "size" and "stack" are set).
+
+// Identifies an event. Events are ordered as the trace reader merges them: by
+// timestamp, then by thread ID. The events of a thread keep the order they were
+// recorded in, because a thread's chunks are written in order.
+typedef struct eventkey_s {
+    ULONGLONG timestamp; // Time at which the event was recorded.
+    DWORD     threadid;  // Thread ID of the thread that recorded the event.
+    SIZE_T    chunk;     // Index of the chunk holding the event.
+    UINT32    index;     // Index of the event in its chunk.
+
+    BOOL operator < (const struct eventkey_s &other) const
+    {
+        if (timestamp != other.timestamp) {
+            return timestamp < other.timestamp;
+        }
+        if (threadid != other.threadid) {
+            return threadid < other.threadid;
+        }
+        if (chunk != other.chunk) {
+            return chunk < other.chunk;
+        }
+        return index < other.index;
+    }
+} eventkey_t;
+
+// Identifies a block.
+typedef struct blockkey_s {
+    ULONGLONG address; // Address of the block.
+    ULONGLONG heap;    // Handle of the heap the block belongs to.
+
+    BOOL operator < (const struct blockkey_s &other) const
+    {
+        if (heap != other.heap) {
+            return heap < other.heap;
+        }
+        return address < other.address;
+    }
+} blockkey_t;
+
+// The state of a block at a cutoff, as of the events seen so far. Each field
+// is kept from the greatest event of its kind, so the states seen by different
+// workers can be merged in any order.
+typedef struct blockstate_s {
+    eventkey_t alloc;  // The block's last allocation.
+    UINT32     flags;  // STATE_ALLOCATED and STATE_RESIZED.
+    eventkey_t last;   // The block's last event.
+    eventkey_t resize; // The block's last allocation or reallocation.
+    ULONGLONG  size;   // Size, in bytes, of the block as of "resize".
+    UINT32     stack;  // ID of the call stack of "resize".
+    UINT32     type;   // Type of the block's last event, or zero if none has been seen.
+} blockstate_t;
+
+// A block's state at each cutoff.
+typedef struct blockrecord_s {
+    blockkey_t   key;              // Identifies the block.
+    blockstate_t states [CUTOFFS]; // The block's state at each cutoff.
+} blockrecord_t;
+
+typedef Map<blockkey_t, SIZE_T> RecordMap;
+
+// The blocks a worker has seen whose addresses fall in one shard. The records
+// are kept in a growable array, and located by index, because the map's values
+// can't be modified in place.
+typedef struct shard_s {
+    SIZE_T         capacity; // Number of records there is space for.
+    SIZE_T         count;    // Number of records.
+    RecordMap     *map;      // Index of each block's record, by key.
+    blockrecord_t *records;  // The records.
+} shard_t;
+
+// The last destruction of a heap before each cutoff.
+typedef struct heapdestroy_s {
+    UINT32     flags [CUTOFFS];   // STATE_ALLOCATED if the heap was destroyed before the cutoff.
+    ULONGLONG  heap;              // Handle of the heap.
+    eventkey_t last [CUTOFFS];    // The heap's last destruction before the cutoff.
+} heapdestroy_t;
+
+// The allocations in a chunk at or before the point analyzed, which are
+// counted to number the blocks.
+typedef struct chunksummary_s {
+    SIZE_T     allocs; // Number of allocations.
+    eventkey_t first;  // The chunk's first allocation.
+    eventkey_t last;   // The chunk's last allocation.
+} chunksummary_t;
+
+// A block outstanding at the point analyzed.
+typedef struct leak_s {
+    eventkey_t alloc;        // The block's allocation.
+    ULONGLONG  address;      // Address of the block.
+    BOOL       duplicate;    // Set if the block has been aggregated with an earlier one.
+    ULONGLONG  heap;         // Handle of the heap the block belongs to.
+    SIZE_T     serialnumber; // Number of blocks allocated before the block.
+    ULONGLONG  size;         // Size, in bytes, of the block.
+    UINT32     stack;        // ID of the block's call stack.
+} leak_t;
+
+// The blocks outstanding at a call site, at each cutoff.
+typedef struct sitestats_s {
+    ULONGLONG bytes [CUTOFFS]; // Total size, in bytes, of the blocks.
+    SIZE_T    count [CUTOFFS]; // Number of blocks.
+} sitestats_t;
+
+// Each worker thread's context.
+typedef struct worker_s {
+    SIZE_T        *buckets;            // Number of allocations before each leak, and after the previous one (see "numberthread").
+    traceevent_t  *events;             // Buffer the chunks are read into.
+    SIZE_T         eventcount;         // Number of events read.
+    BOOL           failed;             // Set if a chunk could not be read.
+    heapdestroy_t *heaps;              // The heaps destroyed.
+    SIZE_T         heapcount;          // Number of entries in "heaps".
+    UINT32         maxstack;           // Highest call stack ID seen.
+    shard_t        shards [MAXWORKERS]; // The blocks seen, by shard.
+    vldthread_t    thread;             // The worker thread.
+} worker_t;
+
+// Imported global variables.
+extern HANDLE    vldheap;
+extern vldlock_t vldheaplock;
+
+// Global variables.
+static BOOL             aggregate = FALSE; // If TRUE, blocks of the same size with the same call stack are aggregated.
+static CallStack      **callstacks = NULL; // The call stacks rebuilt so far, by ID.
+static SIZE_T           cutoffcount = 1;   // Number of cutoffs in use.
+static ULONGLONG        cutoffs [CUTOFFS]; // Events at or before each cutoff are applied to the blocks' state at that cutoff.
+static heapdestroy_t   *heaps = NULL;      // The heaps destroyed, merged from all workers.
+static SIZE_T           heapcount = 0;     // Number of entries in "heaps".
+static leak_t          *leaks = NULL;      // The blocks outstanding at the point analyzed.
+static SIZE_T           leakcount = 0;     // Number of entries in "leaks".
+static UINT32           maxstack = 0;      // Highest call stack ID seen.
+static volatile LONG    nextchunk = 0;     // Index of the next chunk to be handed to a worker, or of the next shard to be merged.
+static TraceReader      reader;            // The trace file's reader.
+static sitestats_t     *sites = NULL;      // The blocks outstanding at each call site, by call stack ID.
+static chunksummary_t  *summaries = NULL;  // The allocations in each chunk.
+static worker_t        *workers = NULL;    // The workers' contexts.
+static UINT32           workercount = 0;   // Number of workers (and of shards).
+
+// Local helper functions.
+static VOID applyevent (worker_t *worker, const traceevent_t *event, const eventkey_t *key);
+static int compareleakblocks (const void *first, const void *second);
+static int compareleakkeys (const void *first, const void *second);
+static int comparesites (const void *first, const void *second);
+static SIZE_T countleaks (const eventkey_t *key);
+static VOID destroyheap (heapdestroy_t **heaps, SIZE_T *heapcount, ULONGLONG heap, const UINT32 *flags,
+                         const eventkey_t *keys);
+static blockrecord_t* findrecord (shard_t *shard, const blockkey_t *key);
+static const CallStack* getcallstack (UINT32 id);
+static BOOL isoutstanding (const blockrecord_t *record, SIZE_T cutoff);
+static VOID loadmodules ();
+static DWORD __stdcall mergethread (LPVOID context);
+static VOID mergestate (blockstate_t *state, const blockstate_t *other);
+static DWORD __stdcall numberthread (LPVOID context);
+static VOID reportgrowth (double interval);
+static VOID reportleaks (BOOL atend, double time);
+static VOID runworkers (vldthreadproc_t threadproc);
+static DWORD __stdcall scanthread (LPVOID context);
+static SIZE_T shardof (ULONGLONG address);
+static VOID updatekey (eventkey_t *key, UINT32 *flags, UINT32 flag, const eventkey_t *newkey);
+
+// applyevent - Applies an event to the state of its block, or of its heap, at
+//   each cutoff the event is at or before.
+//
+//  - worker (IN/OUT): Context of the worker that read the event.
+//
+//  - event (IN): The event.
+//
+//  - key (IN): Identifies the event.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID applyevent (worker_t *worker, const traceevent_t *event, const eventkey_t *key)
+{
+    blockkey_t     blockkey;
+    SIZE_T         cutoff;
+    UINT32         flags [CUTOFFS] = { 0 };
+    eventkey_t     keys [CUTOFFS];
+    blockrecord_t *record;
+    blockstate_t  *state;
+    UINT32         type = TRACE_EVENT_TYPE(event->type);
+
+    if (type == TRACE_EVENT_HEAPDESTROY) {
+        for (cutoff = 0; cutoff < cutoffcount; cutoff++) {
+            if (event->timestamp <= cutoffs[cutoff]) {
+                flags[cutoff] = STATE_ALLOCATED;
+                keys[cutoff] = *key;
+            }
+        }
+        destroyheap(&worker->heaps, &worker->heapcount, event->heap, flags, keys);
+        return;
+    }
+    if ((type != TRACE_EVENT_ALLOC) && (type != TRACE_EVENT_FREE) && (type != TRACE_EVENT_REALLOC)) {
+        // Unknown event. Skip it.
+        return;
+    }
+
+    blockkey.address = event->address;
+    blockkey.heap = event->heap;
+    record = findrecord(&worker->shards[shardof(event->address)], &blockkey);
+    for (cutoff = 0; cutoff < cutoffcount; cutoff++) {
+        if (event->timestamp > cutoffs[cutoff]) {
+            continue;
+        }
+        state = &record->states[cutoff];
+        if ((state->type == 0) || (state->last < *key)) {
+            state->last = *key;
+            state->type = type;
+        }
+        if (type == TRACE_EVENT_ALLOC) {
+            updatekey(&state->alloc, &state->flags, STATE_ALLOCATED, key);
+        }
+        if ((type != TRACE_EVENT_FREE) && (!(state->flags & STATE_RESIZED) || (state->resize < *key))) {
+            state->flags |= STATE_RESIZED;
+            state->resize = *key;
+            state->size = event->size;
+            state->stack = event->stack;
+        }
+    }
+}
+
+// compareleakblocks - Orders leaks as the tracking engine reports them: by
+//   heap, then by serial number. Used with qsort.
+//
+//  - first (IN): The first leak_t to compare.
+//
+//  - second (IN): The second leak_t to compare.
+//
+//  Return Value:
+//
+//    Returns a negative, zero or positive value if the first leak is ordered
+//    before, with or after the second.
+//
+int compareleakblocks (const void *first, const void *second)
+{
+    const leak_t *firstleak = (const leak_t*)first;
+    const leak_t *secondleak = (const leak_t*)second;
+
+    if (firstleak->heap != secondleak->heap) {
+        return (firstleak->heap < secondleak->heap) ? -1 : 1;
+    }
+    if (firstleak->serialnumber != secondleak->serialnumber) {
+        return (firstleak->serialnumber < secondleak->serialnumber) ? -1 : 1;
+    }
+    return (firstleak->address < secondleak->address) ? -1 : ((firstleak->address > secondleak->address) ? 1 : 0);
+}
+
+// compareleakkeys - Orders leaks by allocation. Used with qsort.
+//
+//  - first (IN): The first leak_t to compare.
+//
+//  - second (IN): The second leak_t to compare.
+//
+//  Return Value:
+//
+//    Returns a negative, zero or positive value if the first leak was
+//    allocated before, with or after the second.
+//
+int compareleakkeys (const void *first, const void *second)
+{
+    const leak_t *firstleak = (const leak_t*)first;
+    const leak_t *secondleak = (const leak_t*)second;
+
+    if (firstleak->alloc < secondleak->alloc) {
+        return -1;
+    }
+    return (secondleak->alloc < firstleak->alloc) ? 1 : 0;
+}
+
+// comparesites - Orders call stack IDs by the growth of their call sites,
+//   greatest first. Used with qsort.
+//
+//  - first (IN): The first call stack ID (UINT32) to compare.
+//
+//  - second (IN): The second call stack ID (UINT32) to compare.
+//
+//  Return Value:
+//
+//    Returns a negative, zero or positive value if the first call site grew
+//    more than, as much as or less than the second.
+//
+int comparesites (const void *first, const void *second)
+{
+    UINT32 firstid = *(const UINT32*)first;
+    SIZE_T firstgrowth = sites[firstid].count[0] - sites[firstid].count[1];
+    UINT32 secondid = *(const UINT32*)second;
+    SIZE_T secondgrowth = sites[secondid].count[0] - sites[secondid].count[1];
+
+    if (firstgrowth != secondgrowth) {
+        return (firstgrowth > secondgrowth) ? -1 : 1;
+    }
+    return (firstid < secondid) ? -1 : ((firstid > secondid) ? 1 : 0);
+}
+
+// countleaks - Counts the leaks allocated at or before an event. The leaks
+//   must be ordered by allocation.
+//
+//  - key (IN): Identifies the event.
+//
+//  Return Value:
+//
+//    Returns the number of leaks allocated at or before the event.
+//
+SIZE_T countleaks (const eventkey_t *key)
+{
+    SIZE_T high = leakcount;
+    SIZE_T low = 0;
+    SIZE_T middle;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (*key < leaks[middle].alloc) {
+            high = middle;
+        }
+        else {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+// destroyheap - Records the destruction of a heap, keeping its last
+//   destruction before each cutoff. Heaps are seldom destroyed, so they are
+//   kept in a plain array.
+//
+//  - heaps (IN/OUT): The array of heaps destroyed, which grows as needed.
+//
+//  - heapcount (IN/OUT): Number of entries in the array.
+//
+//  - heap (IN): Handle of the heap.
+//
+//  - flags (IN): For each cutoff, STATE_ALLOCATED if the heap was destroyed
+//      before the cutoff.
+//
+//  - keys (IN): For each cutoff, the heap's destruction before the cutoff.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID destroyheap (heapdestroy_t **heaps, SIZE_T *heapcount, ULONGLONG heap, const UINT32 *flags, const eventkey_t *keys)
+{
+    SIZE_T         cutoff;
+    heapdestroy_t *destroyed;
+    SIZE_T         index;
+    heapdestroy_t *newheaps;
+
+    for (index = 0; index < *heapcount; index++) {
+        if ((*heaps)[index].heap == heap) {
+            break;
+        }
+    }
+    if (index == *heapcount) {
+        if ((*heapcount & (*heapcount - 1)) == 0) {
+            // The array is full (its size is always a power of two). Double it.
+            newheaps = new heapdestroy_t [(*heapcount == 0) ? 1 : *heapcount * 2];
+            if (*heapcount != 0) {
+                memcpy(newheaps, *heaps, *heapcount * sizeof(heapdestroy_t));
+            }
+            delete [] *heaps;
+            *heaps = newheaps;
+        }
+        memset(&(*heaps)[index], 0x0, sizeof(heapdestroy_t));
+        (*heaps)[index].heap = heap;
+        (*heapcount)++;
+    }
+    destroyed = &(*heaps)[index];
+    for (cutoff = 0; cutoff < cutoffcount; cutoff++) {
+        if (flags[cutoff] != 0) {
+            updatekey(&destroyed->last[cutoff], &destroyed->flags[cutoff], STATE_ALLOCATED, &keys[cutoff]);
+        }
+    }
+}
+
+// findrecord - Finds a block's record in a shard, adding a record with no
+//   events if the block has none yet.
+//
+//  - shard (IN/OUT): The shard the block's address falls in.
+//
+//  - key (IN): Identifies the block.
+//
+//  Return Value:
+//
+//    Returns a pointer to the block's record. It remains valid until another
+//    record is added to the shard.
+//
+blockrecord_t* findrecord (shard_t *shard, const blockkey_t *key)
+{
+    RecordMap::Iterator  recordit;
+    blockrecord_t       *records;
+
+    recordit = shard->map->find(*key);
+    if (recordit != shard->map->end()) {
+        return &shard->records[(*recordit).second];
+    }
+    if (shard->count == shard->capacity) {
+        shard->capacity = (shard->capacity == 0) ? MAPRESERVE : shard->capacity * 2;
+        records = new blockrecord_t [shard->capacity];
+        if (shard->count != 0) {
+            memcpy(records, shard->records, shard->count * sizeof(blockrecord_t));
+        }
+        delete [] shard->records;
+        shard->records = records;
+    }
+    memset(&shard->records[shard->count], 0x0, sizeof(blockrecord_t));
+    shard->records[shard->count].key = *key;
+    shard->map->insert(*key, shard->count);
+    return &shard->records[shard->count++];
+}
+
+// getcallstack - Obtains the call stack with the specified ID. The first time
+//   a call stack is asked for, it is rebuilt from the frames recorded in the
+//   trace.
+//
+//  - id (IN): ID of the call stack to obtain.
+//
+//  Return Value:
+//
+//    Returns a pointer to the call stack, or NULL if there is no call stack
+//    with the specified ID in the trace.
+//
+const CallStack* getcallstack (UINT32 id)
+{
+    CallStack       *callstack;
+    UINT32           count;
+    UINT32           frame;
+    const ULONGLONG *frames;
+
+    if (callstacks[id] != NULL) {
+        return callstacks[id];
+    }
+    if (!reader.getstack(id, &frames, &count)) {
+        return NULL;
+    }
+    callstack = new FastCallStack;
+    for (frame = 0; frame < count; frame++) {
+        callstack->push_back((SIZE_T)frames[frame]);
+    }
+    callstacks[id] = callstack;
+    return callstack;
+}
+
+// isoutstanding - Determines whether a block was outstanding at a cutoff: its
+//   last event before the cutoff allocated or reallocated it, and its heap was
+//   not destroyed after that.
+//
+//  - record (IN): The block's record.
+//
+//  - cutoff (IN): Index of the cutoff.
+//
+//  Return Value:
+//
+//    Returns TRUE if the block was outstanding at the cutoff.
+//
+BOOL isoutstanding (const blockrecord_t *record, SIZE_T cutoff)
+{
+    SIZE_T              index;
+    const blockstate_t *state = &record->states[cutoff];
+
+    if (((state->type != TRACE_EVENT_ALLOC) && (state->type != TRACE_EVENT_REALLOC)) ||
+        !(state->flags & STATE_RESIZED)) {
+        return FALSE;
+    }
+    for (index = 0; index < heapcount; index++) {
+        if (heaps[index].heap == record->key.heap) {
+            return !(heaps[index].flags[cutoff] & STATE_ALLOCATED) || (heaps[index].last[cutoff] < state->last);
+        }
+    }
+    return TRUE;
+}
+
+// loadmodules - Describes the modules recorded in the trace to the symbolizer,
+//   so that the call stacks are symbolized with the traced process' modules
+//   rather than with this process' own. A module described more than once is
+//   only added once (the symbolizer uses the latest description of each
+//   address range).
+//
+//  Return Value:
+//
+//    None.
+//
+VOID loadmodules ()
+{
+#ifndef _WIN32
+    LPCSTR                   environment;
+    SIZE_T                   index;
+    Symbolizer::moduleinfo_t info;
+    const tracemodule_t     *module;
+    SIZE_T                   other;
+    const tracemodule_t     *othermodule;
+    LPCSTR                   otherpath;
+    CHAR                     directory [MAX_PATH];
+    LPCSTR                   path;
+
+    // Use the same symbol cache as the tracking engine does by default.
+    if ((environment = getenv("XDG_CACHE_HOME")) != NULL) {
+        snprintf(directory, MAX_PATH, "%s/vld", environment);
+        symbolizer.setcachedirectory(directory);
+    }
+    else if ((environment = getenv("HOME")) != NULL) {
+        snprintf(directory, MAX_PATH, "%s/.cache/vld", environment);
+        symbolizer.setcachedirectory(directory);
+    }
+
+    for (index = reader.modulecount(); index-- > 0; ) {
+        reader.getmodule(index, &module, &path);
+        for (other = index + 1; other < reader.modulecount(); other++) {
+            reader.getmodule(other, &othermodule, &otherpath);
+            if ((othermodule->low == module->low) && (othermodule->high == module->high) &&
+                (strcmp(otherpath, path) == 0)) {
+                // Already added.
+                break;
+            }
+        }
+        if (other < reader.modulecount()) {
+            continue;
+        }
+        memset(&info, 0x0, sizeof(info));
+        info.bias = (SIZE_T)module->bias;
+        info.buildidsize = (module->buildidsize < SYMBOLMAXBUILDIDSIZE) ? module->buildidsize : SYMBOLMAXBUILDIDSIZE;
+        memcpy(info.buildid, module->buildid, info.buildidsize);
+        info.found = TRUE;
+        info.high = (SIZE_T)module->high;
+        info.low = (SIZE_T)module->low;
+        strncpy(info.path, path, MAX_PATH - 1);
+        symbolizer.addmodule(&info);
+    }
+#endif // _WIN32
+}
+
+// mergestate - Merges the state of a block seen by one worker into the state
+//   seen by another.
+//
+//  - state (IN/OUT): The state to merge into.
+//
+//  - other (IN): The state to merge.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID mergestate (blockstate_t *state, const blockstate_t *other)
+{
+    if ((other->type != 0) && ((state->type == 0) || (state->last < other->last))) {
+        state->last = other->last;
+        state->type = other->type;
+    }
+    if (other->flags & STATE_ALLOCATED) {
+        updatekey(&state->alloc, &state->flags, STATE_ALLOCATED, &other->alloc);
+    }
+    if ((other->flags & STATE_RESIZED) && (!(state->flags & STATE_RESIZED) || (state->resize < other->resize))) {
+        state->flags |= STATE_RESIZED;
+        state->resize = other->resize;
+        state->size = other->size;
+        state->stack = other->stack;
+    }
+}
+
+// mergethread - Merges the blocks every worker has seen into the first
+//   worker's shards. Each thread takes the next shard to be merged until all
+//   of them have been.
+//
+//  - context (IN): Unused.
+//
+//  Return Value:
+//
+//    Always returns zero.
+//
+DWORD __stdcall mergethread (LPVOID)
+{
+    SIZE_T         cutoff;
+    SIZE_T         index;
+    blockrecord_t *other;
+    blockrecord_t *record;
+    UINT32         shard;
+    UINT32         worker;
+
+    while ((shard = (UINT32)(InterlockedIncrement(&nextchunk) - 1)) < workercount) {
+        for (worker = 1; worker < workercount; worker++) {
+            for (index = 0; index < workers[worker].shards[shard].count; index++) {
+                other = &workers[worker].shards[shard].records[index];
+                record = findrecord(&workers[0].shards[shard], &other->key);
+                for (cutoff = 0; cutoff < cutoffcount; cutoff++) {
+                    mergestate(&record->states[cutoff], &other->states[cutoff]);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// numberthread - Counts the allocations made before each leak, so that the
+//   leaks can be numbered. The count for each leak is split into buckets: the
+//   allocations after the previous leak's, and at or before its own, fall in
+//   its bucket. A chunk whose allocations all fall in the same bucket is
+//   counted from its summary. Only the other chunks are read again. Each
+//   thread takes the next chunk to be counted until all of them have been.
+//
+//  - context (IN): Context of the worker.
+//
+//  Return Value:
+//
+//    Always returns zero.
+//
+DWORD __stdcall numberthread (LPVOID context)
+{
+    SIZE_T          bucket;
+    SIZE_T          chunk;
+    UINT32          count;
+    UINT32          index;
+    eventkey_t      key;
+    chunksummary_t *summary;
+    DWORD           threadid;
+    worker_t       *worker = (worker_t*)context;
+
+    while ((chunk = (SIZE_T)(InterlockedIncrement(&nextchunk) - 1)) < reader.chunkcount()) {
+        summary = &summaries[chunk];
+        if (summary->allocs == 0) {
+            continue;
+        }
+        bucket = countleaks(&summary->first);
+        if (bucket == countleaks(&summary->last)) {
+            worker->buckets[bucket] += summary->allocs;
+            continue;
+        }
+        if (!reader.readchunk(chunk, worker->events, &count, &threadid)) {
+            worker->failed = TRUE;
+            continue;
+        }
+        for (index = 0; index < count; index++) {
+            if ((TRACE_EVENT_TYPE(worker->events[index].type) != TRACE_EVENT_ALLOC) ||
+                (worker->events[index].timestamp > cutoffs[0])) {
+                continue;
+            }
+            key.chunk = chunk;
+            key.index = index;
+            key.threadid = threadid;
+            key.timestamp = worker->events[index].timestamp;
+            worker->buckets[countleaks(&key)]++;
+        }
+    }
+    return 0;
+}
+
+// reportgrowth - Reports the call sites whose number of outstanding blocks
+//   grew over the interval before the point analyzed, those that grew the most
+//   first, in the format used by the leak growth monitor.
+//
+//  - interval (IN): Length of the interval, in seconds.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID reportgrowth (double interval)
+{
+    SIZE_T  count = 0;
+    UINT32  id;
+    SIZE_T  index;
+    UINT32 *ids;
+
+    ids = new UINT32 [maxstack + 1];
+    for (id = 0; id <= maxstack; id++) {
+        if (sites[id].count[0] > sites[id].count[1]) {
+            ids[count++] = id;
+        }
+    }
+    qsort(ids, count, sizeof(UINT32), comparesites);
+
+    report(L"Visual Leak Detector: Reporting call sites whose outstanding blocks grew over the last %.3f seconds.\n",
+           interval);
+    for (index = 0; index < count; index++) {
+        id = ids[index];
+        report(L"---------- %lu blocks (%lu new) totalling %lu bytes ----------\n", sites[id].count[0],
+               sites[id].count[0] - sites[id].count[1], (SIZE_T)sites[id].bytes[0]);
+        report(L"  Call Stack:\n");
+        if (getcallstack(id) != NULL) {
+            getcallstack(id)->dump(FALSE);
+        }
+        report(L"\n");
+    }
+    if (count == 0) {
+        report(L"No call sites grew.\n");
+    }
+    delete [] ids;
+}
+
+// reportleaks - Reports the blocks outstanding at the point analyzed, in the
+//   format used by the tracking engine's memory leak report.
+//
+//  - atend (IN): If TRUE, the point analyzed is the end of the trace, and the
+//      blocks are reported as memory leaks. Otherwise they are reported as
+//      outstanding blocks.
+//
+//  - time (IN): The point analyzed, in seconds since tracing started.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID reportleaks (BOOL atend, double time)
+{
+    SIZE_T  duplicates;
+    SIZE_T  index;
+    leak_t *leak;
+    SIZE_T  other;
+
+    if (!atend) {
+        report(L"Visual Leak Detector: Reporting memory blocks outstanding %.3f seconds after tracing started.\n", time);
+    }
+    else if (leakcount != 0) {
+        report(L"WARNING: Visual Leak Detector detected memory leaks!\n");
+    }
+    for (index = 0; index < leakcount; index++) {
+        leak = &leaks[index];
+        if (leak->duplicate) {
+            // This leak has already been aggregated with an earlier one.
+            continue;
+        }
+        report(L"---------- Block %ld at " ADDRESSFORMAT L": %lu bytes ----------\n", leak->serialnumber,
+               (SIZE_T)leak->address, (ULONG)leak->size);
+        if (aggregate) {
+            // Aggregate all other leaks which are duplicates of this one under
+            // this same heading, to cut down on clutter.
+            duplicates = 0;
+            for (other = index + 1; other < leakcount; other++) {
+                if (!leaks[other].duplicate && (leaks[other].size == leak->size) &&
+                    (leaks[other].stack == leak->stack)) {
+                    leaks[other].duplicate = TRUE;
+                    duplicates++;
+                }
+            }
+            if (duplicates) {
+                report(L"A total of %lu leaks match this size and call stack. Showing only the first one.\n",
+                       duplicates + 1);
+            }
+        }
+        report(L"  Call Stack:\n");
+        if (getcallstack(leak->stack) != NULL) {
+            getcallstack(leak->stack)->dump(FALSE);
+        }
+        report(L"\n");
+    }
+
+    // Show a summary.
+    if (leakcount == 0) {
+        report(atend ? L"No memory leaks detected.\n" : L"No memory leaks detected so far.\n");
+    }
+    else if (atend) {
+        report(L"Visual Leak Detector detected %lu memory leak", leakcount);
+        report((leakcount > 1) ? L"s.\n" : L".\n");
+    }
+    else {
+        report(L"Visual Leak Detector found %lu outstanding memory block", leakcount);
+        report((leakcount > 1) ? L"s.\n" : L".\n");
+    }
+}
+
+// runworkers - Runs a thread procedure on every worker, and waits for all of
+//   them to finish. The first worker runs on the calling thread.
+//
+//  - threadproc (IN): The thread procedure, which is passed the worker's
+//      context.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID runworkers (vldthreadproc_t threadproc)
+{
+    UINT32 worker;
+    UINT32 started;
+
+    InterlockedExchange(&nextchunk, 0);
+    for (started = 1; started < workercount; started++) {
+        if (!createthread(&workers[started].thread, threadproc, &workers[started])) {
+            // The threads that did start share the work.
+            break;
+        }
+    }
+    threadproc(&workers[0]);
+    for (worker = 1; worker < started; worker++) {
+        jointhread(workers[worker].thread);
+    }
+}
+
+// scanthread - Reads chunks of events, and applies each event to the state of
+//   its block. Each thread takes the next chunk to be read until all of them
+//   have been.
+//
+//  - context (IN): Context of the worker.
+//
+//  Return Value:
+//
+//    Always returns zero.
+//
+DWORD __stdcall scanthread (LPVOID context)
+{
+    SIZE_T          chunk;
+    UINT32          count;
+    traceevent_t   *event;
+    UINT32          index;
+    eventkey_t      key;
+    chunksummary_t *summary;
+    DWORD           threadid;
+    worker_t       *worker = (worker_t*)context;
+
+    while ((chunk = (SIZE_T)(InterlockedIncrement(&nextchunk) - 1)) < reader.chunkcount()) {
+        if (!reader.readchunk(chunk, worker->events, &count, &threadid)) {
+            worker->failed = TRUE;
+            continue;
+        }
+        summary = &summaries[chunk];
+        key.chunk = chunk;
+        key.threadid = threadid;
+        for (index = 0; index < count; index++) {
+            event = &worker->events[index];
+            if (event->timestamp > cutoffs[0]) {
+                // The first cutoff is the latest.
+                continue;
+            }
+            key.index = index;
+            key.timestamp = event->timestamp;
+            applyevent(worker, event, &key);
+            if (event->stack > worker->maxstack) {
+                worker->maxstack = event->stack;
+            }
+            if (TRACE_EVENT_TYPE(event->type) == TRACE_EVENT_ALLOC) {
+                if (summary->allocs == 0) {
+                    summary->first = key;
+                }
+                summary->last = key;
+                summary->allocs++;
+            }
+        }
+        worker->eventcount += count;
+    }
+    return 0;
+}
+
+// shardof - Determines which shard a block's address falls in. Addresses are
+//   hashed, because blocks are aligned, and those of a heap are clustered.
+//
+//  - address (IN): Address of the block.
+//
+//  Return Value:
+//
+//    Returns the index of the shard.
+//
+SIZE_T shardof (ULONGLONG address)
+{
+    return (SIZE_T)(((address >> 4) * 0x9E3779B97F4A7C15ULL) >> 32) % workercount;
+}
+
+// updatekey - Keeps the greater of two events.
+//
+//  - key (IN/OUT): The event kept so far, if the flag is set.
+//
+//  - flags (IN/OUT): Flags with which the flag is set once an event is kept.
+//
+//  - flag (IN): The flag which is set if an event is kept.
+//
+//  - newkey (IN): The event to keep if it is greater.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID updatekey (eventkey_t *key, UINT32 *flags, UINT32 flag, const eventkey_t *newkey)
+{
+    if (!(*flags & flag) || (*key < *newkey)) {
+        *key = *newkey;
+        *flags |= flag;
+    }
+}
+
+int main (int argc, char *argv [])
+{
+    double         analyzed;
+    LPCSTR         arg;
+    SIZE_T         bucket;
+    SIZE_T         cutoff;
+    SIZE_T         events = 0;
+    BOOL           failed = FALSE;
+    double         growth = 0.0;
+    SIZE_T         index;
+    int            option;
+    LPCSTR         path = NULL;
+    blockrecord_t *record;
+    ULONGLONG      start;
+    ULONGLONG      ticks;
+    double         time = -1.0;
+    SIZE_T         total;
+    UINT32         worker;
+
+    // VLD's internal allocations come from its private heap.
+    vldheap = heapcreate();
+    initlock(&vldheaplock);
+
+    workercount = getprocessorcount();
+    for (option = 1; option < argc; option++) {
+        arg = argv[option];
+        if (strcmp(arg, "-a") == 0) {
+            aggregate = TRUE;
+        }
+        else if ((strcmp(arg, "-g") == 0) && (option + 1 < argc)) {
+            growth = strtod(argv[++option], NULL);
+        }
+        else if ((strcmp(arg, "-j") == 0) && (option + 1 < argc)) {
+            workercount = strtoul(argv[++option], NULL, 10);
+        }
+        else if ((strcmp(arg, "-t") == 0) && (option + 1 < argc)) {
+            time = strtod(argv[++option], NULL);
+        }
+        else if ((arg[0] != '-') && (path == NULL)) {
+            path = arg;
+        }
+        else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "Usage: vldanalyze [-a] [-g seconds] [-j threads] [-t seconds] tracefile\n");
+        return 1;
+    }
+    if (workercount < 1) {
+        workercount = 1;
+    }
+    else if (workercount > MAXWORKERS) {
+        workercount = MAXWORKERS;
+    }
+
+    if (!reader.open(path)) {
+        fprintf(stderr, "vldanalyze: Couldn't read trace file: %s\n", path);
+        return 1;
+    }
+    if (reader.header()->pointersize != sizeof(LPCVOID)) {
+        fprintf(stderr, "vldanalyze: The trace was recorded by a process with %u-bit pointers.\n",
+                reader.header()->pointersize * 8);
+        return 1;
+    }
+
+    // Work out the cutoffs, in timestamp ticks.
+    if (time < 0.0) {
+        cutoffs[0] = reader.endtime();
+        analyzed = (double)(reader.endtime() - reader.header()->starttime) / (double)reader.header()->perffrequency;
+    }
+    else {
+        cutoffs[0] = reader.header()->starttime + (ULONGLONG)(time * (double)reader.header()->perffrequency);
+        analyzed = time;
+    }
+    if (growth > 0.0) {
+        ticks = (ULONGLONG)(growth * (double)reader.header()->perffrequency);
+        cutoffs[1] = (ticks < cutoffs[0]) ? cutoffs[0] - ticks : 0;
+        cutoffcount = 2;
+    }
+
+    start = getperfcounter();
+    workers = new worker_t [workercount];
+    memset(workers, 0x0, workercount * sizeof(worker_t));
+    for (worker = 0; worker < workercount; worker++) {
+        workers[worker].events = new traceevent_t [reader.maxevents() + 1];
+        for (index = 0; index < workercount; index++) {
+            workers[worker].shards[index].map = new RecordMap;
+            workers[worker].shards[index].map->reserve(MAPRESERVE);
+        }
+    }
+    summaries = new chunksummary_t [reader.chunkcount() + 1];
+    memset(summaries, 0x0, (reader.chunkcount() + 1) * sizeof(chunksummary_t));
+
+    // Find the last events of each block, then merge what the workers have
+    // seen, shard by shard. The heaps destroyed are merged beforehand, since
+    // there are few of them.
+    runworkers(scanthread);
+    for (worker = 0; worker < workercount; worker++) {
+        for (index = 0; index < workers[worker].heapcount; index++) {
+            destroyheap(&heaps, &heapcount, workers[worker].heaps[index].heap, workers[worker].heaps[index].flags,
+                        workers[worker].heaps[index].last);
+        }
+        if (workers[worker].maxstack > maxstack) {
+            maxstack = workers[worker].maxstack;
+        }
+        events += workers[worker].eventcount;
+        failed |= workers[worker].failed;
+    }
+    runworkers(mergethread);
+
+    // Gather the outstanding blocks, and the call site statistics.
+    sites = new sitestats_t [maxstack + 1];
+    memset(sites, 0x0, (maxstack + 1) * sizeof(sitestats_t));
+    for (index = 0; index < workercount; index++) {
+        for (total = 0; total < workers[0].shards[index].count; total++) {
+            if (isoutstanding(&workers[0].shards[index].records[total], 0)) {
+                leakcount++;
+            }
+        }
+    }
+    leaks = new leak_t [leakcount + 1];
+    leakcount = 0;
+    for (index = 0; index < workercount; index++) {
+        for (total = 0; total < workers[0].shards[index].count; total++) {
+            record = &workers[0].shards[index].records[total];
+            for (cutoff = 0; cutoff < cutoffcount; cutoff++) {
+                if (isoutstanding(record, cutoff)) {
+                    sites[record->states[cutoff].stack].bytes[cutoff] += record->states[cutoff].size;
+                    sites[record->states[cutoff].stack].count[cutoff]++;
+                }
+            }
+            if (isoutstanding(record, 0)) {
+                // A block reallocated in place without having been allocated is
+                // numbered as if allocated then, as the engine would have.
+                leaks[leakcount].address = record->key.address;
+                leaks[leakcount].alloc = (record->states[0].flags & STATE_ALLOCATED) ? record->states[0].alloc :
+                                         record->states[0].resize;
+                leaks[leakcount].duplicate = FALSE;
+                leaks[leakcount].heap = record->key.heap;
+                leaks[leakcount].serialnumber = 0;
+                leaks[leakcount].size = record->states[0].size;
+                leaks[leakcount].stack = record->states[0].stack;
+                leakcount++;
+            }
+        }
+    }
+
+    // Number the leaks.
+    if (leakcount != 0) {
+        qsort(leaks, leakcount, sizeof(leak_t), compareleakkeys);
+        for (worker = 0; worker < workercount; worker++) {
+            workers[worker].buckets = new SIZE_T [leakcount + 1];
+            memset(workers[worker].buckets, 0x0, (leakcount + 1) * sizeof(SIZE_T));
+        }
+        runworkers(numberthread);
+        total = 0;
+        for (bucket = 0; bucket < leakcount; bucket++) {
+            for (worker = 0; worker < workercount; worker++) {
+                total += workers[worker].buckets[bucket];
+                failed |= workers[worker].failed;
+            }
+            leaks[bucket].serialnumber = total;
+        }
+        qsort(leaks, leakcount, sizeof(leak_t), compareleakblocks);
+    }
+    ticks = getperfcounter() - start;
+
+    if (failed) {
+        fprintf(stderr, "vldanalyze: Couldn't read every chunk of events. The trace file may be truncated.\n");
+    }
+
+    // Report the outstanding blocks, symbolized with the traced process'
+    // modules.
+    callstacks = new CallStack* [maxstack + 1];
+    memset(callstacks, 0x0, (maxstack + 1) * sizeof(CallStack*));
+    loadmodules();
+    setreportencoding(ascii);
+    setreportfile(stdout, FALSE);
+    reportleaks(time < 0.0, analyzed);
+    if (cutoffcount > 1) {
+        reportgrowth(growth);
+    }
+    fflush(stdout);
+
+    printf("Analyzed %lu events in %lu chunks. Took %.3f ms with %u worker threads.\n", (unsigned long)events,
+           (unsigned long)reader.chunkcount(), (double)ticks * 1000.0 / (double)getperffrequency(), workercount);
+
+    // The private heap is not destroyed: blocks freed while the process exits
+    // are still checked against it by the delete operators.
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,397 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Tracking Engine Benchmark
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Benchmark for the portable parts of Visual Leak Detector: the containers,
+//  stack tracing, the stack depot's lookups and report formatting. These are
+//  the operations performed for every allocation and free, and for every
+//  reported block. Each benchmark prints the average time per operation.
+//
+//  Usage: vldbenchmark [iterations]
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#define VLDBUILD          // Declares that we are building Visual Leak Detector.
+#include "../callstack.h" // Provides a class for handling call stacks.
+#include "../map.h"       // Provides a lightweight STL-like map template.
+#include "../platform.h"  // Provides the platform services.
+#include "../set.h"       // Provides a lightweight STL-like set template.
+#include "../utility.h"   // Provides the report formatting functions.
+#include "../vldheap.h"   // Provides internal new and delete operators.
+
+#ifdef _MSC_VER
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+#define DEFAULTITERATIONS 1000000 // Default number of operations performed by each benchmark.
+#define DEPOTSITES        1024    // Number of distinct call stacks in the stack depot benchmark.
+#define STACKDEPTH        24      // Depth, in frames, of the call stacks that are traced.
+#define STACKMAXFRAMES    64      // Maximum number of frames per stack trace, as in VLD's default configuration.
+
+// Imported global variables.
+extern HANDLE    vldheap;
+extern vldlock_t vldheaplock;
+
+// Global variables.
+static ULONGLONG       frequency; // Frequency of the performance counter.
+static volatile SIZE_T sink = 0;  // Results are accumulated here so that they aren't optimized away.
+
+// Local helper functions.
+static VOID benchmarkdepot (SIZE_T iterations);
+static VOID benchmarkmap (SIZE_T iterations);
+static VOID benchmarkreport (SIZE_T iterations);
+static VOID benchmarkset (SIZE_T iterations);
+static VOID benchmarkstacks (SIZE_T iterations);
+static SIZE_T descend (UINT32 depth, CallStack *callstack);
+static ULONGLONG elapsed (ULONGLONG start);
+static VOID result (const char *name, SIZE_T operations, ULONGLONG ticks);
+
+// benchmarkdepot - Times lookups in a stack depot: a map of call stack hash
+//   values to interned call stacks, searched for every allocation (see
+//   VisualLeakDetector::internstack).
+//
+//  - iterations (IN): Number of call stacks to look up.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID benchmarkdepot (SIZE_T iterations)
+{
+    Map<SIZE_T, CallStack*>           depot;
+    Map<SIZE_T, CallStack*>::Iterator depotit;
+    UINT32                            frame;
+    SIZE_T                            hits = 0;
+    SIZE_T                            index;
+    CallStack                        *lookups [DEPOTSITES];
+    CallStack                        *sites [DEPOTSITES];
+    ULONGLONG                         start;
+
+    // Build the call sites, and identical copies of them to be looked up.
+    // Sites share their outermost frames, as real call stacks do.
+    for (index = 0; index < DEPOTSITES; index++) {
+        sites[index] = new FastCallStack;
+        lookups[index] = new FastCallStack;
+        for (frame = 0; frame < STACKDEPTH; frame++) {
+            sites[index]->push_back(0x400000 + (frame * 0x40) + ((frame < 4) ? index * 0x1000 : 0));
+            lookups[index]->push_back(0x400000 + (frame * 0x40) + ((frame < 4) ? index * 0x1000 : 0));
+        }
+        depot.insert(sites[index]->hash(), sites[index]);
+    }
+
+    start = getperfcounter();
+    for (index = 0; index < iterations; index++) {
+        depotit = depot.find(lookups[index % DEPOTSITES]->hash());
+        if ((depotit != depot.end()) && (*(*depotit).second == *lookups[index % DEPOTSITES])) {
+            hits++;
+        }
+    }
+    result("Stack depot lookup", iterations, elapsed(start));
+    sink += hits;
+
+    for (index = 0; index < DEPOTSITES; index++) {
+        delete sites[index];
+        delete lookups[index];
+    }
+}
+
+// benchmarkmap - Times insertions, lookups and erasures of blocks in a Map, as
+//   done by the block maps for every allocation and free.
+//
+//  - iterations (IN): Number of blocks to insert, look up and erase.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID benchmarkmap (SIZE_T iterations)
+{
+    SIZE_T                         address;
+    SIZE_T                         index;
+    Map<LPCVOID, SIZE_T>           map;
+    Map<LPCVOID, SIZE_T>::Iterator mapit;
+    ULONGLONG                      start;
+
+    // Block addresses are scattered, but aligned, like heap blocks are.
+    map.reserve(64);
+    start = getperfcounter();
+    for (index = 0, address = 0x10000; index < iterations; index++, address += 0x9E3779B1 & ~0xF) {
+        map.insert((LPCVOID)address, index);
+    }
+    result("Map insert", iterations, elapsed(start));
+
+    start = getperfcounter();
+    for (index = 0, address = 0x10000; index < iterations; index++, address += 0x9E3779B1 & ~0xF) {
+        mapit = map.find((LPCVOID)address);
+        sink += (*mapit).second;
+    }
+    result("Map find", iterations, elapsed(start));
+
+    start = getperfcounter();
+    for (index = 0, address = 0x10000; index < iterations; index++, address += 0x9E3779B1 & ~0xF) {
+        mapit = map.find((LPCVOID)address);
+        map.erase(mapit);
+    }
+    result("Map erase", iterations, elapsed(start));
+}
+
+// benchmarkreport - Times the formatting of report lines and memory dumps, as
+//   done for every reported block. The report is written to a temporary file.
+//
+//  - iterations (IN): Number of report lines to format. A tenth as many memory
+//      dumps and call stack dumps are formatted.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID benchmarkreport (SIZE_T iterations)
+{
+    CallStack *callstack;
+    BYTE       data [64];
+    FILE      *file;
+    SIZE_T     index;
+    ULONGLONG  start;
+
+    file = tmpfile();
+    if (file == NULL) {
+        printf("Report formatting: unable to create a temporary file.\n");
+        return;
+    }
+    setreportfile(file, FALSE);
+    for (index = 0; index < sizeof(data); index++) {
+        data[index] = (BYTE)index;
+    }
+
+    start = getperfcounter();
+    for (index = 0; index < iterations; index++) {
+        report(L"---------- Block %lu at " ADDRESSFORMAT L": %lu bytes ----------\n", index, (SIZE_T)data, sizeof(data));
+    }
+    result("Report line", iterations, elapsed(start));
+
+    start = getperfcounter();
+    for (index = 0; index < iterations / 10; index++) {
+        dumpmemorya(data, sizeof(data));
+    }
+    result("Report memory dump (64 bytes)", iterations / 10, elapsed(start));
+
+    callstack = new FastCallStack;
+    descend(STACKDEPTH, callstack);
+    start = getperfcounter();
+    for (index = 0; index < iterations / 10; index++) {
+        callstack->dump(FALSE);
+    }
+    result("Report call stack", iterations / 10, elapsed(start));
+    delete callstack;
+
+    setreportfile(NULL, FALSE);
+    fclose(file);
+}
+
+// benchmarkset - Times insertions, lookups and erasures of keys in a Set.
+//
+//  - iterations (IN): Number of keys to insert, look up and erase.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID benchmarkset (SIZE_T iterations)
+{
+    SIZE_T      index;
+    Set<SIZE_T> set;
+    ULONGLONG   start;
+
+    set.reserve(64);
+    start = getperfcounter();
+    for (index = 0; index < iterations; index++) {
+        set.insert(index * 0x9E3779B1);
+    }
+    result("Set insert", iterations, elapsed(start));
+
+    start = getperfcounter();
+    for (index = 0; index < iterations; index++) {
+        sink += *set.find(index * 0x9E3779B1);
+    }
+    result("Set find", iterations, elapsed(start));
+
+    start = getperfcounter();
+    for (index = 0; index < iterations; index++) {
+        set.erase(index * 0x9E3779B1);
+    }
+    result("Set erase", iterations, elapsed(start));
+}
+
+// benchmarkstacks - Times stack traces, as taken for every allocation, with
+//   both stack walking methods, at several stack depths. The results are meant
+//   for choosing between the two methods (see the StackWalkMethod option): the
+//   fast method's cost grows more slowly with depth, but it stops at the first
+//   frame built without a frame pointer.
+//
+//  - iterations (IN): Number of stack traces to take with the fast method, at
+//      each depth. The safe method, being much slower, takes a tenth as many.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID benchmarkstacks (SIZE_T iterations)
+{
+    CallStack           *callstack;
+    UINT32               depth;
+    static const UINT32  depths [] = { STACKDEPTH / 3, STACKDEPTH, STACKMAXFRAMES };
+    SIZE_T               frames;
+    SIZE_T               index;
+    char                 name [64];
+    SIZE_T               safeiterations = (iterations >= 10) ? iterations / 10 : 1;
+    ULONGLONG            start;
+    CallStack           *walkers [2];
+
+    for (depth = 0; depth < sizeof(depths) / sizeof(depths[0]); depth++) {
+        callstack = new FastCallStack;
+        frames = 0;
+        start = getperfcounter();
+        for (index = 0; index < iterations; index++) {
+            frames += descend(depths[depth], callstack);
+        }
+        snprintf(name, sizeof(name), "FastCallStack trace (depth %u)", depths[depth]);
+        result(name, iterations, elapsed(start));
+        printf("%-32s %10lu frames\n", "", (unsigned long)(frames / ((iterations != 0) ? iterations : 1)));
+        delete callstack;
+
+        callstack = new SafeCallStack;
+        frames = 0;
+        start = getperfcounter();
+        for (index = 0; index < safeiterations; index++) {
+            frames += descend(depths[depth], callstack);
+        }
+        snprintf(name, sizeof(name), "SafeCallStack trace (depth %u)", depths[depth]);
+        result(name, safeiterations, elapsed(start));
+        printf("%-32s %10lu frames\n", "", (unsigned long)(frames / safeiterations));
+        delete callstack;
+    }
+
+    // Both methods should trace the same frames within the recursion (beyond
+    // it, the two traces are taken from different call sites).
+    walkers[0] = new FastCallStack;
+    walkers[1] = new SafeCallStack;
+    descend(STACKDEPTH, walkers[0]);
+    descend(STACKDEPTH, walkers[1]);
+    for (index = 0; (index <= STACKDEPTH) && (index < walkers[0]->size()) && (index < walkers[1]->size()); index++) {
+        if ((*walkers[0])[(UINT32)index] != (*walkers[1])[(UINT32)index]) {
+            break;
+        }
+    }
+    printf("%-32s %10lu of %u frames\n", "Stack walkers agree on", (unsigned long)index, STACKDEPTH + 1);
+    delete walkers[0];
+    delete walkers[1];
+}
+
+// descend - Recurses to the requested depth, then traces the stack.
+//
+//  - depth (IN): Number of frames to recurse through before tracing.
+//
+//  - callstack (IN): The CallStack that receives the stack trace.
+//
+//  Return Value:
+//
+//    Returns the number of frames traced.
+//
+NOINLINE SIZE_T descend (UINT32 depth, CallStack *callstack)
+{
+    SIZE_T frames;
+
+    if (depth == 0) {
+        callstack->clear();
+        callstack->getstacktrace(STACKMAXFRAMES, NULL, NULL);
+        return callstack->size();
+    }
+
+    frames = descend(depth - 1, callstack);
+    sink += depth; // Keeps the recursive call from being a tail call.
+
+    return frames;
+}
+
+// elapsed - Obtains the number of performance counter ticks elapsed since the
+//   specified starting time.
+//
+//  - start (IN): Performance counter value at the starting time.
+//
+//  Return Value:
+//
+//    Returns the number of ticks elapsed.
+//
+ULONGLONG elapsed (ULONGLONG start)
+{
+    return getperfcounter() - start;
+}
+
+// result - Prints the result of a benchmark.
+//
+//  - name (IN): Name of the benchmark.
+//
+//  - operations (IN): Number of operations performed by the benchmark.
+//
+//  - ticks (IN): Performance counter ticks taken by the benchmark.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID result (const char *name, SIZE_T operations, ULONGLONG ticks)
+{
+    double nanoseconds = ((double)ticks * 1000000000.0) / (double)frequency;
+
+    printf("%-32s %10lu ops %12.1f ns/op\n", name, (unsigned long)operations,
+           (operations != 0) ? nanoseconds / (double)operations : 0.0);
+}
+
+int main (int argc, char *argv [])
+{
+    SIZE_T iterations = DEFAULTITERATIONS;
+
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 10);
+    }
+
+    // VLD's internal allocations come from its private heap.
+    vldheap = heapcreate();
+    initlock(&vldheaplock);
+    frequency = getperffrequency();
+
+    benchmarkmap(iterations);
+    benchmarkset(iterations);
+    benchmarkstacks(iterations);
+    benchmarkdepot(iterations);
+    benchmarkreport(iterations);
+
+    // The private heap is not destroyed: blocks freed while the process exits
+    // are still checked against it by the delete operators.
+    return 0;
+}
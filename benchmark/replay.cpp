@@ -0,0 +1,217 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Trace Replay Tool
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Replays a trace file, recorded by setting the TraceFile option, through the
+//  tracking engine. Every allocation, reallocation and free of the traced
+//  process is mapped or unmapped in timestamp order, from a single thread, with
+//  the call stack it was recorded with. The time taken is printed, and, like
+//  any process Visual Leak Detector is linked into, the memory leak report is
+//  generated when the tool exits. So a workload can be captured once, and
+//  then used to measure changes to the tracking engine, or to look at the
+//  blocks it leaked with a different configuration.
+//
+//  The memory of the traced process' blocks is not available to the tool, so
+//  the report does not include the blocks' data.
+//
+//  Usage: vldreplay tracefile
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#define VLDBUILD          // Declares that we are building Visual Leak Detector.
+#include "../callstack.h" // Provides a class for handling call stacks.
+#include "../map.h"       // Provides a lightweight STL-like map template.
+#include "../trace.h"     // Provides the trace file reader.
+#include "../vldint.h"    // Provides access to the Visual Leak Detector internals.
+#include "../vldheap.h"   // Provides internal new and delete operators.
+
+// Imported global variables.
+extern VisualLeakDetector vld;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The TraceReplayer Class
+//
+//    Drives the tracking engine from the events read from a trace. It is a
+//    friend of the VisualLeakDetector class.
+//
+class TraceReplayer
+{
+public:
+    static int replay (LPCSTR path);
+
+private:
+    typedef Map<UINT32, CallStack*> StackMap;
+
+    static const CallStack* getcallstack (TraceReader *reader, StackMap *stacks, UINT32 id);
+};
+
+// getcallstack - Obtains the call stack with the specified ID. The first time
+//   a call stack is asked for, it is rebuilt from the frames recorded in the
+//   trace.
+//
+//  - reader (IN): The trace's reader.
+//
+//  - stacks (IN/OUT): The call stacks rebuilt so far, by ID.
+//
+//  - id (IN): ID of the call stack to obtain.
+//
+//  Return Value:
+//
+//    Returns a pointer to the call stack, or NULL if there is no call stack
+//    with the specified ID in the trace.
+//
+const CallStack* TraceReplayer::getcallstack (TraceReader *reader, StackMap *stacks, UINT32 id)
+{
+    CallStack           *callstack;
+    UINT32               count;
+    UINT32               frame;
+    const ULONGLONG     *frames;
+    StackMap::Iterator   stackit;
+
+    stackit = stacks->find(id);
+    if (stackit != stacks->end()) {
+        return (*stackit).second;
+    }
+    if (!reader->getstack(id, &frames, &count)) {
+        return NULL;
+    }
+    callstack = new FastCallStack;
+    for (frame = 0; frame < count; frame++) {
+        callstack->push_back((SIZE_T)frames[frame]);
+    }
+    stacks->insert(id, callstack);
+    return callstack;
+}
+
+// replay - Replays a trace file through the tracking engine.
+//
+//  - path (IN): Path of the trace file.
+//
+//  Return Value:
+//
+//    Returns the process' exit code: zero if the trace was replayed, or one if
+//    the trace file could not be read.
+//
+int TraceReplayer::replay (LPCSTR path)
+{
+    ULONGLONG           counts [TRACE_EVENT_HEAPDESTROY + 1] = { 0 };
+    traceevent_t        event;
+    SIZE_T              events = 0;
+    HANDLE              heap;
+    TraceReader         reader;
+    ULONGLONG           start;
+    StackMap            stacks;
+    StackMap::Iterator  stackit;
+    DWORD               threadid;
+    ULONGLONG           ticks;
+    tls_t              *tls;
+    UINT32              type;
+
+    if (!(vld.m_status & VLD_STATUS_INSTALLED)) {
+        fprintf(stderr, "vldreplay: Visual Leak Detector is not installed.\n");
+        return 1;
+    }
+
+    // None of the tool's own allocations are tracked. Neither can the data of
+    // the traced process' blocks be dumped.
+    VLDDisable();
+    vld.m_maxdatadump = 0;
+
+    if (!reader.open(path)) {
+        fprintf(stderr, "vldreplay: Couldn't read trace file: %s\n", path);
+        return 1;
+    }
+    if (reader.header()->pointersize != sizeof(LPCVOID)) {
+        fprintf(stderr, "vldreplay: The trace was recorded by a process with %u-bit pointers.\n",
+                reader.header()->pointersize * 8);
+        return 1;
+    }
+
+    tls = vld.gettls();
+    start = getperfcounter();
+    while (reader.nextevent(&event, &threadid)) {
+        // The traced process' virtual heap is the tool's virtual heap. All other
+        // heaps keep the handles they had in the traced process.
+        heap = (event.heap == reader.header()->virtualheap) ? VIRTUALHEAP : (HANDLE)(SIZE_T)event.heap;
+        type = TRACE_EVENT_TYPE(event.type);
+        switch (type) {
+        case TRACE_EVENT_ALLOC:
+            tls->replaystack = getcallstack(&reader, &stacks, event.stack);
+            vld.mapblock(heap, (LPCVOID)(SIZE_T)event.address, (SIZE_T)event.size, 0, FALSE);
+            tls->replaystack = NULL;
+            break;
+
+        case TRACE_EVENT_FREE:
+            vld.unmapblock(heap, (LPCVOID)(SIZE_T)event.address);
+            break;
+
+        case TRACE_EVENT_REALLOC:
+            tls->replaystack = getcallstack(&reader, &stacks, event.stack);
+            vld.remapblock(heap, (LPCVOID)(SIZE_T)event.address, (LPCVOID)(SIZE_T)event.address, (SIZE_T)event.size,
+                           0, FALSE, readcounter(&vld.m_serialnumber));
+            tls->replaystack = NULL;
+            break;
+
+        case TRACE_EVENT_HEAPDESTROY:
+            vld.unmapheap(heap);
+            break;
+
+        default:
+            // Unknown event. Skip it.
+            continue;
+        }
+        counts[type]++;
+        events++;
+    }
+    ticks = getperfcounter() - start;
+
+    printf("Replayed %llu allocations, %llu reallocations, %llu frees and %llu heap destructions.\n",
+           counts[TRACE_EVENT_ALLOC], counts[TRACE_EVENT_REALLOC], counts[TRACE_EVENT_FREE],
+           counts[TRACE_EVENT_HEAPDESTROY]);
+    if (events != 0) {
+        printf("Took %.3f ms, %.1f ns per event.\n", (double)ticks * 1000.0 / (double)getperffrequency(),
+               (double)ticks * 1000000000.0 / (double)getperffrequency() / (double)events);
+    }
+    fflush(stdout);
+
+    // The engine keeps pointers to the call stacks it interned, but those are
+    // its own copies (see VisualLeakDetector::tracecallstack).
+    for (stackit = stacks.begin(); stackit != stacks.end(); ++stackit) {
+        delete (*stackit).second;
+    }
+    return 0;
+}
+
+int main (int argc, char *argv [])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: vldreplay tracefile\n");
+        return 1;
+    }
+
+    return TraceReplayer::replay(argv[1]);
+}
@@ -22,25 +22,56 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include <cassert>
+#include <cstring>
+#ifdef _WIN32
 #include <windows.h>
 #ifndef __out_xcount
 #define __out_xcount(x) // Workaround for the specstrings.h bug in the Platform SDK.
 #endif
 #define DBGHELP_TRANSLATE_TCHAR
 #include <dbghelp.h>    // Provides symbol handling services.
+#else
+#include <cstdlib>
+#include <dlfcn.h>      // Provides dladdr, for looking up function names.
+#include <unwind.h>     // Provides the unwinder, for walking the stack.
+#endif // _WIN32
 #define VLDBUILD
 #include "callstack.h"  // This class' header.
+#include "rangetable.h" // Provides tables of address ranges.
+#ifndef _WIN32
+#include "symbolizer.h" // Provides symbol handling services.
+#endif // _WIN32
 #include "utility.h"    // Provides various utility functions.
 #include "vldheap.h"    // Provides internal new and delete operators.
 #include "vldint.h"     // Provides access to VLD internals.
 
 #define MAXSYMBOLNAMELENGTH 256
 
+#ifdef _WIN32
 // Imported global variables.
 extern HANDLE             currentprocess;
 extern HANDLE             currentthread;
 extern CRITICAL_SECTION   stackwalklock;
 extern CRITICAL_SECTION   symbollock;
+#else
+// The state of the safe stack walker's traversal. Each thread has its own,
+// so that walking the stack requires neither locking nor any per-trace setup
+// beyond resetting it, and so that the unwinder's callback can reach it.
+typedef struct unwindstate_s {
+    CallStack        *callstack;  // CallStack receiving the traced frames.
+    UINT32            count;      // Number of frames traced so far.
+    UINT32            maxdepth;   // Maximum number of frames to trace.
+    const RangeTable *skipranges; // Ranges of addresses whose frames are not recorded (may be NULL).
+    SIZE_T            startsp;    // Stack pointer, at the point of the call, of the frame at which the trace begins.
+    BOOL              stopped;    // Set if the trace was ended by the callback, rather than by the unwinder.
+} unwindstate_t;
+
+// Global variables.
+static __thread unwindstate_t unwindstate __attribute__((tls_model("initial-exec")));
+
+// Local helper functions.
+static _Unwind_Reason_Code unwindframe (struct _Unwind_Context *context, LPVOID argument);
+#endif // _WIN32
 
 // Constructor - Initializes the CallStack with an initial size of zero and one
 //   Chunk of capacity.
@@ -181,6 +212,94 @@ VOID CallStack::clear ()
     m_topindex = 0;
 }
 
+// describeframe - Describes a frame of the CallStack by the name of the
+//   function containing it, and by its offset within the module containing it,
+//   so that it can be matched against patterns (such as suppressions).
+//
+//   Note: The symbol handler must be initialized prior to calling this
+//     function.
+//
+//  - frame (IN): Index of the frame to describe.
+//
+//  - info (OUT): Receives the description of the frame. Parts of the
+//      description that aren't available are left empty.
+//
+//  Return Value:
+//
+//    None.
+//
+#ifdef _WIN32
+VOID CallStack::describeframe (UINT32 frame, frameinfo_t *info) const
+{
+    DWORD64           displacement64;
+    SYMBOL_INFO      *functioninfo;
+    LPCWSTR           modulename;
+    IMAGEHLP_MODULE64 moduleinfo;
+    SIZE_T            programcounter;
+    BYTE              symbolbuffer [sizeof(SYMBOL_INFO) + (MAXSYMBOLNAMELENGTH * sizeof(WCHAR)) - 1] = { 0 };
+
+    info->function[0] = '\0';
+    info->module[0] = '\0';
+    info->offset = 0;
+
+    functioninfo = (SYMBOL_INFO*)&symbolbuffer;
+    functioninfo->SizeOfStruct = sizeof(SYMBOL_INFO);
+    functioninfo->MaxNameLen = MAXSYMBOLNAMELENGTH;
+    moduleinfo.SizeOfStruct = sizeof(IMAGEHLP_MODULE64);
+    programcounter = (*this)[frame];
+    EnterCriticalSection(&symbollock);
+    if (SymFromAddrW(currentprocess, programcounter, &displacement64, functioninfo)) {
+        if (wcstombs(info->function, functioninfo->Name, MAXFRAMENAMELENGTH) == (SIZE_T)-1) {
+            info->function[0] = '\0';
+        }
+        info->function[MAXFRAMENAMELENGTH - 1] = '\0';
+    }
+    if (SymGetModuleInfoW64(currentprocess, programcounter, &moduleinfo)) {
+        modulename = wcsrchr(moduleinfo.ImageName, L'\\');
+        modulename = (modulename != NULL) ? modulename + 1 : moduleinfo.ImageName;
+        if (wcstombs(info->module, modulename, MAXFRAMENAMELENGTH) == (SIZE_T)-1) {
+            info->module[0] = '\0';
+        }
+        info->module[MAXFRAMENAMELENGTH - 1] = '\0';
+        info->offset = programcounter - (SIZE_T)moduleinfo.BaseOfImage;
+    }
+    LeaveCriticalSection(&symbollock);
+}
+#else
+VOID CallStack::describeframe (UINT32 frame, frameinfo_t *info) const
+{
+    LPCSTR  function;
+    Dl_info dlinfo;
+    LPCSTR  modulename;
+    SIZE_T  programcounter;
+
+    info->function[0] = '\0';
+    info->module[0] = '\0';
+    info->offset = 0;
+
+    // The address is a return address, so the call instruction itself is the
+    // one just before it. Functions that aren't in the symbol table of their
+    // module may still be known to the dynamic linker.
+    programcounter = (*this)[frame];
+    if (dladdr((LPVOID)(programcounter - 1), &dlinfo) != 0) {
+        if (dlinfo.dli_fname != NULL) {
+            modulename = strrchr(dlinfo.dli_fname, '/');
+            modulename = (modulename != NULL) ? modulename + 1 : dlinfo.dli_fname;
+            strncpy(info->module, modulename, MAXFRAMENAMELENGTH);
+            info->module[MAXFRAMENAMELENGTH - 1] = '\0';
+        }
+        info->offset = programcounter - (SIZE_T)dlinfo.dli_fbase;
+    }
+    else {
+        dlinfo.dli_sname = NULL;
+    }
+    if (symbolizer.findfunction(programcounter - 1, &function) || ((function = dlinfo.dli_sname) != NULL)) {
+        strncpy(info->function, function, MAXFRAMENAMELENGTH);
+        info->function[MAXFRAMENAMELENGTH - 1] = '\0';
+    }
+}
+#endif // _WIN32
+
 // dump - Dumps a nicely formatted rendition of the CallStack, including
 //   symbolic information (function names and line numbers) if available.
 //
@@ -194,6 +313,7 @@ VOID CallStack::clear ()
 //
 //    None.
 //
+#ifdef _WIN32
 VOID CallStack::dump (BOOL showinternalframes) const
 {
     DWORD            displacement;
@@ -260,6 +380,97 @@ VOID CallStack::dump (BOOL showinternalframes) const
         }
     }
 }
+#else
+VOID CallStack::dump (BOOL showinternalframes) const
+{
+    LPCSTR  filename;
+    BOOL    foundline;
+    UINT32  frame;
+    LPCSTR  function;
+    WCHAR   functionname [MAXSYMBOLNAMELENGTH];
+    Dl_info info;
+    DWORD   line;
+    SIZE_T  programcounter;
+    WCHAR   sourcefile [MAX_PATH];
+
+    if (m_status & CALLSTACK_STATUS_INCOMPLETE) {
+        // This call stack appears to be incomplete. Using the unwinder may be
+        // more reliable.
+        report(L"    HINT: The following call stack may be incomplete. Setting \"StackWalkMethod\"\n"
+               L"      in the vld.ini file to \"safe\" instead of \"fast\" may result in a more\n"
+               L"      complete stack trace.\n");
+    }
+
+    // Iterate through each frame in the call stack.
+    for (frame = 0; frame < m_size; frame++) {
+        // Try to get the source file and line number associated with this
+        // program counter address. The address is a return address, so the
+        // call instruction itself is the one just before it.
+        programcounter = (*this)[frame];
+        foundline = symbolizer.findline(programcounter - 1, &filename, &line);
+        if (foundline) {
+            if (mbstowcs(sourcefile, filename, MAX_PATH) == (SIZE_T)-1) {
+                foundline = FALSE;
+            }
+            sourcefile[MAX_PATH - 1] = L'\0';
+            if (!showinternalframes && (strstr(filename, "/malloc.c") || strstr(filename, "/new_op"))) {
+                // Don't show frames in files internal to the heap.
+                continue;
+            }
+        }
+
+        // Try to get the name of the function containing this program counter
+        // address. Functions that aren't in the symbol table of their module
+        // may still be known to the dynamic linker.
+        if ((symbolizer.findfunction(programcounter - 1, &function) ||
+             ((dladdr((LPVOID)programcounter, &info) != 0) && ((function = info.dli_sname) != NULL))) &&
+            (mbstowcs(functionname, function, MAXSYMBOLNAMELENGTH) != (SIZE_T)-1)) {
+            functionname[MAXSYMBOLNAMELENGTH - 1] = L'\0';
+        }
+        else {
+            wcsncpy_s(functionname, MAXSYMBOLNAMELENGTH, L"(Function name unavailable)", _TRUNCATE);
+        }
+
+        // Display the current stack frame's information.
+        if (foundline) {
+            report(L"    %s (%d): %s\n", sourcefile, line, functionname);
+        }
+        else {
+            report(L"    " ADDRESSFORMAT L" (File and line number not available): ", programcounter);
+            report(L"%s\n", functionname);
+        }
+    }
+}
+#endif // _WIN32
+
+// hash - Computes a hash value from the frames in the CallStack. Equal
+//   CallStacks always have equal hash values, so the hash value can be used to
+//   quickly narrow down the search for an identical CallStack.
+//
+//  Return Value:
+//
+//    Returns the hash value.
+//
+SIZE_T CallStack::hash () const
+{
+    const CallStack::chunk_t *chunk = &m_store;
+    SIZE_T                    hash = 2166136261; // FNV offset basis.
+    UINT32                    index;
+    const CallStack::chunk_t *prevchunk = NULL;
+
+    // Walk the chunk list and within each chunk walk the frames array, folding
+    // each frame into the hash value (FNV-1a, a frame at a time).
+    while (prevchunk != m_topchunk) {
+        for (index = 0; index < ((chunk == m_topchunk) ? m_topindex : CALLSTACKCHUNKSIZE); index++) {
+            hash ^= chunk->frames[index];
+            hash *= 16777619; // FNV prime.
+        }
+        prevchunk = chunk;
+        chunk = chunk->next;
+    }
+
+    return hash;
+}
 
 // push_back - Pushes a frame's program counter onto the CallStack. Pushes are
 //   always appended to the back of the chunk list (aka the "top" chunk).
@@ -300,6 +511,37 @@ VOID CallStack::push_back (const SIZE_T programcounter)
     m_size++;
 }
 
+// size - Obtains the number of frames currently stored in the CallStack.
+//
+//  Return Value:
+//
+//    Returns the number of frames in the CallStack.
+//
+UINT32 CallStack::size () const
+{
+    return m_size;
+}
+
+// skipframe - Determines whether a frame is to be left out of the stack trace,
+//   because its program counter lies within one of the ranges of code to be
+//   skipped (such as the heap's internal functions).
+//
+//  - skipranges (IN): Ranges of program counter addresses whose frames are not
+//      to be recorded. May be NULL, if every frame is to be recorded.
+//
+//  - programcounter (IN): The frame's program counter address. It is a return
+//      address, so the call instruction itself is the one just before it.
+//
+//  Return Value:
+//
+//    Returns TRUE if the frame is to be left out of the stack trace. Otherwise
+//    returns FALSE.
+//
+BOOL CallStack::skipframe (const RangeTable *skipranges, SIZE_T programcounter)
+{
+    return (skipranges != NULL) && skipranges->contains(programcounter - 1);
+}
+
 // getstacktrace - Traces the stack as far back as possible, or until 'maxdepth'
 //   frames have been traced. Populates the CallStack with one entry for each
 //   stack frame traced.
@@ -315,23 +557,41 @@ VOID CallStack::push_back (const SIZE_T programcounter)
 //  - framepointer (IN): Frame (base) pointer at which to begin the stack trace.
 //      If NULL, then the stack trace will begin at this function.
 //
+//  - skipranges (IN): Ranges of program counter addresses whose frames are not
+//      to be recorded, nor counted against "maxdepth". May be NULL.
+//
 //  Return Value:
 //
 //    None.
 //
-VOID FastCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer)
+VOID FastCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer, const RangeTable *skipranges)
 {
     UINT32  count = 0;
+    SIZE_T *nextframe;
+    SIZE_T  programcounter;
+    SIZE_T  stackhigh;
+    SIZE_T  stacklow;
 
     if (framepointer == NULL) {
         // Begin the stack trace with the current frame. Obtain the current
         // frame pointer.
         FRAMEPOINTER(framepointer);
     }
+    getstackbounds(&stacklow, &stackhigh);
 
     while (count < maxdepth) {
-        if ((SIZE_T*)*framepointer < framepointer) {
-            if ((SIZE_T*)*framepointer == NULL) {
+        // The return address saved in the current frame is always valid, even
+        // if the caller's frame turns out to be unconventional, so it is
+        // recorded before the frame pointer saved in this frame is checked.
+        programcounter = *(framepointer + 1);
+        if (!skipframe(skipranges, programcounter)) {
+            count++;
+            push_back(programcounter);
+        }
+
+        nextframe = (SIZE_T*)*framepointer;
+        if (nextframe < framepointer) {
+            if (nextframe == NULL) {
                 // Looks like we reached the end of the stack.
                 break;
             }
@@ -342,7 +602,7 @@ VOID FastCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer)
                 break;
             }
         }
-        if ((SIZE_T)*framepointer & (sizeof(SIZE_T*) - 1)) {
+        if ((SIZE_T)nextframe & (sizeof(SIZE_T*) - 1)) {
             // Invalid frame pointer. Frame pointer addresses should always
             // be aligned to the size of a pointer. This probably means that
             // we've encountered a frame that was created by a module built with
@@ -350,15 +610,14 @@ VOID FastCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer)
             m_status |= CALLSTACK_STATUS_INCOMPLETE;
             break;
         }
-        if (IsBadReadPtr((SIZE_T*)*framepointer, sizeof(SIZE_T*))) {
-            // Bogus frame pointer. Again, this probably means that we've
+        if (((SIZE_T)nextframe < stacklow) || ((SIZE_T)(nextframe + 2) > stackhigh)) {
+            // Bogus frame pointer: the frame it points to is not on this
+            // thread's stack. Again, this probably means that we've
             // encountered a frame built with FPO optimization.
             m_status |= CALLSTACK_STATUS_INCOMPLETE;
             break;
         }
-        count++;
-        push_back(*(framepointer + 1));
-        framepointer = (SIZE_T*)*framepointer;
+        framepointer = nextframe;
     }
 }
 
@@ -377,11 +636,15 @@ VOID FastCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer)
 //  - framepointer (IN): Frame (base) pointer at which to begin the stack trace.
 //      If NULL, then the stack trace will begin at this function.
 //
+//  - skipranges (IN): Ranges of program counter addresses whose frames are not
+//      to be recorded, nor counted against "maxdepth". May be NULL.
+//
 //  Return Value:
 //
 //    None.
 //
-VOID SafeCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer)
+#ifdef _WIN32
+VOID SafeCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer, const RangeTable *skipranges)
 {
     DWORD        architecture;
     CONTEXT      context;
@@ -424,7 +687,6 @@ VOID SafeCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer)
     // Walk the stack.
     EnterCriticalSection(&stackwalklock);
     while (count < maxdepth) {
-        count++;
         if (!StackWalk64(architecture, currentprocess, currentthread, &frame, &context, NULL,
                          SymFunctionTableAccess64, SymGetModuleBase64, NULL)) {
             // Couldn't trace back through any more frames.
@@ -436,7 +698,80 @@ VOID SafeCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer)
         }
 
         // Push this frame's program counter onto the CallStack.
-        push_back((SIZE_T)frame.AddrPC.Offset);
+        if (!skipframe(skipranges, (SIZE_T)frame.AddrPC.Offset)) {
+            count++;
+            push_back((SIZE_T)frame.AddrPC.Offset);
+        }
     }
     LeaveCriticalSection(&stackwalklock);
 }
+#else
+// On POSIX systems, the safe stack walker uses the unwinder from the C++
+// runtime, which walks frames by interpreting the unwind tables (.eh_frame) of
+// each module. Unlike the fast stack walker, it can walk through frames built
+// without frame pointers, but it is much slower. The unwinder is linked
+// directly, instead of going through backtrace(), because the C library loads
+// the unwinder on the first call to backtrace(), which allocates memory and
+// would re-enter VLD from within its own allocation handlers.
+VOID SafeCallStack::getstacktrace (UINT32 maxdepth, SIZE_T *framepointer, const RangeTable *skipranges)
+{
+    if (framepointer == NULL) {
+        // Begin the stack trace with the current frame. Obtain the current
+        // frame pointer.
+        FRAMEPOINTER(framepointer);
+    }
+
+    // The unwinder always begins with the current frame. Frames up to, and
+    // including, the frame that owns the given frame pointer are skipped. The
+    // first frame traced is its caller, whose stack pointer at the point of the
+    // call lies just above the saved frame pointer and return address.
+    unwindstate.callstack  = this;
+    unwindstate.count      = 0;
+    unwindstate.maxdepth   = maxdepth;
+    unwindstate.skipranges = skipranges;
+    unwindstate.startsp    = (SIZE_T)(framepointer + 2);
+    unwindstate.stopped    = FALSE;
+    if ((_Unwind_Backtrace(unwindframe, NULL) != _URC_END_OF_STACK) && !unwindstate.stopped) {
+        // The unwinder could not find the unwind information for some frame.
+        m_status |= CALLSTACK_STATUS_INCOMPLETE;
+    }
+}
+
+// unwindframe - Callback function for _Unwind_Backtrace. Records the program
+//   counter of each frame beyond the frame at which the stack trace begins.
+//
+//  - context (IN): The unwinder's context for the current frame.
+//
+//  - argument (IN): Unused.
+//
+//  Return Value:
+//
+//    Returns _URC_NO_REASON to continue unwinding, or _URC_NORMAL_STOP once
+//    the end of the stack or the maximum number of frames has been reached.
+//
+_Unwind_Reason_Code unwindframe (struct _Unwind_Context *context, LPVOID argument)
+{
+    SIZE_T programcounter;
+
+    // For each frame, the unwinder's canonical frame address is the frame's
+    // stack pointer at the point where it made the call to the next frame.
+    if ((SIZE_T)_Unwind_GetCFA(context) < unwindstate.startsp) {
+        // Still within the frames that precede the beginning of the trace.
+        return _URC_NO_REASON;
+    }
+    programcounter = (SIZE_T)_Unwind_GetIP(context);
+    if ((programcounter == 0) || (unwindstate.count == unwindstate.maxdepth)) {
+        // End of stack, or the maximum depth has been reached.
+        unwindstate.stopped = TRUE;
+        return _URC_NORMAL_STOP;
+    }
+    if (CallStack::skipframe(unwindstate.skipranges, programcounter)) {
+        // Frames in the skipped ranges are not recorded.
+        return _URC_NO_REASON;
+    }
+    unwindstate.count++;
+    unwindstate.callstack->push_back(programcounter);
+
+    return _URC_NO_REASON;
+}
+#endif // _WIN32
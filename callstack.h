@@ -29,9 +29,20 @@
 Applications should never include this header."
 #endif
 
-#include <windows.h>
+#include "platform.h" // Provides the platform services and, on POSIX systems, the Win32 types.
 
-#define CALLSTACKCHUNKSIZE 32 // Number of frame slots in each CallStack chunk.
+#define CALLSTACKCHUNKSIZE 32  // Number of frame slots in each CallStack chunk.
+#define MAXFRAMENAMELENGTH 256 // Maximum length of the names describing a frame. Longer names are truncated.
+
+class RangeTable;
+
+// Symbolic information describing a frame of a CallStack, in a form that can
+// be matched against patterns (see "CallStack::describeframe").
+typedef struct frameinfo_s {
+    CHAR   function [MAXFRAMENAMELENGTH]; // Name of the function containing the frame (empty if unavailable).
+    CHAR   module [MAXFRAMENAMELENGTH];   // File name of the module containing the frame (empty if unavailable).
+    SIZE_T offset;                        // Offset of the frame's program counter from the module's base address.
+} frameinfo_t;
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -57,16 +68,20 @@ class CallStack
 public:
     CallStack ();
     CallStack (const CallStack &other);
-    ~CallStack ();
+    virtual ~CallStack ();
 
     // Public APIs - see each function definition for details.
     VOID clear ();
+    VOID describeframe (UINT32 frame, frameinfo_t *info) const;
     VOID dump (BOOL showinternalframes) const;
-    virtual VOID getstacktrace (UINT32 maxdepth, SIZE_T *framepointer) = 0;
+    virtual VOID getstacktrace (UINT32 maxdepth, SIZE_T *framepointer, const RangeTable *skipranges) = 0;
+    SIZE_T hash () const;
     CallStack& operator = (const CallStack &other);
     BOOL operator == (const CallStack &other) const;
     SIZE_T operator [] (UINT32 index) const;
     VOID push_back (const SIZE_T programcounter);
+    UINT32 size () const;
+    static BOOL skipframe (const RangeTable *skipranges, SIZE_T programcounter);
 
 protected:
     // Protected data.
@@ -99,7 +114,7 @@ private:
 class FastCallStack : public CallStack
 {
 public:
-    VOID getstacktrace (UINT32 maxdepth, SIZE_T *framepointer);
+    VOID getstacktrace (UINT32 maxdepth, SIZE_T *framepointer, const RangeTable *skipranges);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -112,5 +127,5 @@ public:
 class SafeCallStack : public CallStack
 {
 public:
-    VOID getstacktrace (UINT32 maxdepth, SIZE_T *framepointer);
+    VOID getstacktrace (UINT32 maxdepth, SIZE_T *framepointer, const RangeTable *skipranges);
 };
@@ -351,6 +351,17 @@ public:
         return m_tree.reserve(count);
     }
 
+    // size - Obtains the number of key/value pairs currently stored in the map.
+    //
+    //  Return Value:
+    //
+    //    Returns the number of key/value pairs currently stored in the map.
+    //
+    SIZE_T size () const
+    {
+        return m_tree.size();
+    }
+
 private:
     // Private data
     Tree<Pair<Tk, Tv> > m_tree; // The key/value pairs are actually stored in a tree.
@@ -0,0 +1,1094 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - MarkScanner Class Implementation
+//  Copyright (c) 2005-2006 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+#include <cstdlib>
+#include <emmintrin.h>
+#include <windows.h>
+#include <tlhelp32.h>
+#define VLDBUILD
+#include "markscanner.h" // This class' header.
+#include "ntapi.h"       // Provides access to NT APIs.
+#include "vldheap.h"     // Provides internal new and delete operators.
+
+#define NOTFOUND       ((SIZE_T)-1)                         // Position returned by findblock for addresses that aren't inside any block.
+#define WORDSPERVECTOR (sizeof(__m128i) / sizeof(SIZE_T)) // Number of pointer-sized words checked by each SSE2 comparison.
+
+// Local helper functions.
+static inline VOID acquirelock (volatile LONG *lock);
+static inline VOID releaselock (volatile LONG *lock);
+
+// Constructor - Initializes the MarkScanner. No memory is allocated until
+//   "reserve" or "startworkers" is called.
+//
+MarkScanner::MarkScanner ()
+{
+    m_bucketshift  = 0;
+    m_buckets      = NULL;
+    m_capacity     = 0;
+    m_count        = 0;
+    m_current      = NOTFOUND;
+    m_finished     = 0;
+    m_goevent      = NULL;
+    m_high         = 0;
+    m_low          = 0;
+    m_mark         = MARK_REACHABLE;
+    m_marks        = NULL;
+    m_overflow     = NULL;
+    m_overflowlock = 0;
+    m_overflowsize = 0;
+    m_pending      = 0;
+    m_ranges       = NULL;
+    m_roots        = NULL;
+#ifdef _WIN64
+    m_simd         = TRUE; // SSE2 is part of the x64 architecture.
+#else
+    m_simd         = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+    m_starts       = NULL;
+    m_stopevent    = NULL;
+    m_threadcount  = 0;
+    m_threads      = NULL;
+    m_tlsblocks    = NULL;
+    m_workercount  = 0;
+    m_workers      = NULL;
+}
+
+// Destructor - Stops the worker threads, if they are still running, and frees
+//   all memory used by the MarkScanner.
+//
+MarkScanner::~MarkScanner ()
+{
+    SIZE_T       index;
+    rootrange_t *root;
+    tlsblock_t  *tlsblock;
+
+    stopworkers();
+    while (m_roots != NULL) {
+        root = m_roots;
+        m_roots = root->next;
+        delete root;
+    }
+    while (m_tlsblocks != NULL) {
+        tlsblock = m_tlsblocks;
+        m_tlsblocks = tlsblock->next;
+        delete tlsblock;
+    }
+    if (m_workers != NULL) {
+        for (index = 0; index < m_workercount; index++) {
+            delete [] m_workers[index].items;
+        }
+        delete [] m_workers;
+    }
+    delete [] m_buckets;
+    delete [] (LONG*)m_marks;
+    delete [] m_overflow;
+    delete [] m_ranges;
+    delete [] m_starts;
+}
+
+// addblock - Adds a memory block to the set of blocks to be classified. Blocks
+//   are identified by the order in which they are added, starting at zero.
+//
+//  - address (IN): Address of the block.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::addblock (LPCVOID address, SIZE_T size)
+{
+    markrange_t *range;
+
+    assert(m_count < m_capacity);
+    range = &m_ranges[m_count];
+    range->start = (SIZE_T)address;
+    // A zero-sized block still has an address that can be pointed to.
+    range->end = range->start + ((size != 0) ? size : 1);
+    range->index = m_count;
+    m_marks[m_count] = MARK_UNVISITED;
+    m_count++;
+}
+
+// addmodule - Adds a loaded module's global data to the roots. Every writable
+//   section of the module is scanned, as is the module's static thread local
+//   storage block in every thread. This must be called before "scan", because
+//   it allocates memory.
+//
+//  - module (IN): Handle (base address) of the loaded module.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::addmodule (HMODULE module)
+{
+    IMAGE_DATA_DIRECTORY *directory;
+    IMAGE_DOS_HEADER     *dosheader = (IMAGE_DOS_HEADER*)module;
+    UINT                  index;
+    IMAGE_NT_HEADERS     *ntheaders;
+    rootrange_t          *root;
+    IMAGE_SECTION_HEADER *section;
+    tlsblock_t           *tlsblock;
+    IMAGE_TLS_DIRECTORY  *tlsdirectory;
+
+    if (dosheader->e_magic != IMAGE_DOS_SIGNATURE) {
+        return;
+    }
+    ntheaders = (IMAGE_NT_HEADERS*)((LPBYTE)module + dosheader->e_lfanew);
+    if (ntheaders->Signature != IMAGE_NT_SIGNATURE) {
+        return;
+    }
+
+    // Global variables live in the writable sections (.data, .bss, etc.).
+    section = IMAGE_FIRST_SECTION(ntheaders);
+    for (index = 0; index < ntheaders->FileHeader.NumberOfSections; index++, section++) {
+        if (!(section->Characteristics & IMAGE_SCN_MEM_WRITE)) {
+            continue;
+        }
+        root = new rootrange_t;
+        root->base = (LPBYTE)module + section->VirtualAddress;
+        root->next = m_roots;
+        root->size = section->Misc.VirtualSize;
+        m_roots = root;
+    }
+
+    // Thread local variables live in a separate copy of the module's TLS
+    // template for each thread.
+    directory = &ntheaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_TLS];
+    if ((directory->VirtualAddress == 0) || (directory->Size == 0)) {
+        return;
+    }
+    tlsdirectory = (IMAGE_TLS_DIRECTORY*)((LPBYTE)module + directory->VirtualAddress);
+    if (tlsdirectory->AddressOfIndex == 0) {
+        return;
+    }
+    tlsblock = new tlsblock_t;
+    tlsblock->index = *(DWORD*)(SIZE_T)tlsdirectory->AddressOfIndex;
+    tlsblock->next = m_tlsblocks;
+    tlsblock->size = (SIZE_T)(tlsdirectory->EndAddressOfRawData - tlsdirectory->StartAddressOfRawData) +
+                     tlsdirectory->SizeOfZeroFill;
+    m_tlsblocks = tlsblock;
+}
+
+// allocworkers - Allocates the array of workers, including a deque for each.
+//   The first worker represents the calling thread.
+//
+//  - count (IN): The number of workers to allocate.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::allocworkers (SIZE_T count)
+{
+    SIZE_T        index;
+    markworker_t *worker;
+
+    m_workers = new markworker_t [count];
+    for (index = 0; index < count; index++) {
+        worker = &m_workers[index];
+        worker->goevent = m_goevent;
+        worker->head = 0;
+        worker->items = new SIZE_T [MARK_DEQUECAPACITY];
+        worker->lock = 0;
+        worker->scanner = this;
+        worker->started = FALSE;
+        worker->stopevent = m_stopevent;
+        worker->tail = 0;
+        worker->thread = NULL;
+        worker->threadid = 0;
+    }
+    m_workers[0].started = TRUE;
+    m_workers[0].threadid = GetCurrentThreadId();
+    m_workercount = 1;
+}
+
+// buildindex - Sorts the blocks by address and builds the directory used to
+//   narrow down the search for the block containing an address. Each bucket
+//   in the directory covers an equal, power-of-two sized, part of the range of
+//   addresses spanned by the blocks, so the bucket containing an address is
+//   found with a subtraction and a shift.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::buildindex ()
+{
+    SIZE_T base;
+    SIZE_T bucket;
+    SIZE_T buckets = 1;
+    SIZE_T position;
+
+    qsort(m_ranges, m_count, sizeof(markrange_t), compareranges);
+    for (position = 0; position < m_count; position++) {
+        m_starts[position] = m_ranges[position].start;
+    }
+    m_low = m_starts[0];
+    m_high = m_ranges[m_count - 1].end;
+
+    // Aim for about one block per bucket.
+    while ((buckets < m_count) && (buckets < MARK_MAXBUCKETS)) {
+        buckets <<= 1;
+    }
+    m_bucketshift = 0;
+    while (((m_high - m_low - 1) >> m_bucketshift) >= buckets) {
+        m_bucketshift++;
+    }
+    buckets = ((m_high - m_low - 1) >> m_bucketshift) + 1;
+    m_buckets = new SIZE_T [buckets + 1];
+    position = 0;
+    for (bucket = 0; bucket < buckets; bucket++) {
+        base = m_low + (bucket << m_bucketshift);
+        while ((position < m_count) && (m_starts[position] < base)) {
+            position++;
+        }
+        m_buckets[bucket] = position;
+    }
+    m_buckets[buckets] = m_count;
+}
+
+// checkword - Checks whether a word points into any block, and if so, marks
+//   that block.
+//
+//  - worker (IN): The worker checking the word.
+//
+//  - value (IN): The value of the word.
+//
+//  Return Value:
+//
+//    None.
+//
+inline VOID MarkScanner::checkword (markworker_t *worker, SIZE_T value)
+{
+    SIZE_T position;
+
+    if ((value - m_low) >= (m_high - m_low)) {
+        // Not within the range spanned by the blocks.
+        return;
+    }
+    position = findblock(value);
+    if (position != NOTFOUND) {
+        markblock(worker, position);
+    }
+}
+
+// findblock - Looks up the block, if any, that contains the specified address.
+//
+//  - address (IN): The address to look up. Must be within the range spanned
+//      by the blocks.
+//
+//  Return Value:
+//
+//    Returns the position, in the sorted index, of the block containing the
+//    address. If the address isn't inside any block, NOTFOUND is returned.
+//
+SIZE_T MarkScanner::findblock (SIZE_T address) const
+{
+    SIZE_T bucket = (address - m_low) >> m_bucketshift;
+    SIZE_T high = m_buckets[bucket + 1];
+    SIZE_T low = m_buckets[bucket];
+    SIZE_T middle;
+
+    // Find the last block starting at or below the address. It either starts
+    // within the address' bucket, or is the last block starting before it.
+    while (low < high) {
+        middle = low + ((high - low) / 2);
+        if (m_starts[middle] <= address) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    if ((low == 0) || (address >= m_ranges[low - 1].end)) {
+        return NOTFOUND;
+    }
+    return low - 1;
+}
+
+// getmark - Obtains the classification of a block, as determined by "scan".
+//
+//  - index (IN): Index of the block, in the order in which it was added.
+//
+//  Return Value:
+//
+//    Returns one of MARK_DEFINITE, MARK_INDIRECT or MARK_REACHABLE.
+//
+LONG MarkScanner::getmark (SIZE_T index) const
+{
+    assert(index < m_count);
+    return m_marks[index];
+}
+
+// isworker - Determines if a thread is one of the worker threads.
+//
+//  - threadid (IN): ID of the thread.
+//
+//  Return Value:
+//
+//    Returns TRUE if the thread is a worker thread. Otherwise returns FALSE.
+//
+BOOL MarkScanner::isworker (DWORD threadid) const
+{
+    SIZE_T index;
+
+    for (index = 1; index < m_workercount; index++) {
+        if (m_workers[index].threadid == threadid) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// markblock - Marks a block that has been found to be referenced. If the block
+//   hasn't been reached before, it is queued so that it will be scanned for
+//   references to other blocks.
+//
+//   While following references from the roots, any number of workers may be
+//   marking blocks at once, so each block is claimed with an interlocked
+//   exchange to ensure it's only queued once. References from lost blocks are
+//   followed by the calling thread alone.
+//
+//  - worker (IN): The worker that found the reference.
+//
+//  - position (IN): Position of the block in the sorted index.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::markblock (markworker_t *worker, SIZE_T position)
+{
+    SIZE_T index = m_ranges[position].index;
+
+    if (m_mark == MARK_REACHABLE) {
+        if ((m_marks[index] == MARK_UNVISITED) &&
+            (InterlockedCompareExchange(&m_marks[index], MARK_REACHABLE, MARK_UNVISITED) == MARK_UNVISITED)) {
+            InterlockedIncrement(&m_pending);
+            pushwork(worker, position);
+        }
+    }
+    else if (m_marks[index] == MARK_UNVISITED) {
+        m_marks[index] = MARK_INDIRECT;
+        pushwork(worker, position);
+    }
+    else if ((m_marks[index] == MARK_DEFINITE) && (position != m_current)) {
+        // A block previously thought to be definitely lost is referenced by
+        // another lost block, so it is only indirectly lost. Its references
+        // have already been followed.
+        m_marks[index] = MARK_INDIRECT;
+    }
+}
+
+// popwork - Takes the most recently queued block from a worker's own deque,
+//   or if the deque is empty, from the overflow stack.
+//
+//  - worker (IN): The worker looking for work.
+//
+//  - position (OUT): Receives the position, in the index, of the block.
+//
+//  Return Value:
+//
+//    Returns TRUE if a block was taken. Otherwise returns FALSE.
+//
+BOOL MarkScanner::popwork (markworker_t *worker, SIZE_T *position)
+{
+    if (worker->tail != worker->head) {
+        acquirelock(&worker->lock);
+        if (worker->tail != worker->head) {
+            worker->tail--;
+            *position = worker->items[worker->tail % MARK_DEQUECAPACITY];
+            releaselock(&worker->lock);
+            return TRUE;
+        }
+        releaselock(&worker->lock);
+    }
+    if (m_overflowsize != 0) {
+        acquirelock(&m_overflowlock);
+        if (m_overflowsize != 0) {
+            *position = m_overflow[--m_overflowsize];
+            releaselock(&m_overflowlock);
+            return TRUE;
+        }
+        releaselock(&m_overflowlock);
+    }
+    return FALSE;
+}
+
+// pushwork - Queues a block on a worker's own deque. If the deque is full, the
+//   block is pushed onto the overflow stack instead.
+//
+//  - worker (IN): The worker that found the block.
+//
+//  - position (IN): Position, in the index, of the block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::pushwork (markworker_t *worker, SIZE_T position)
+{
+    acquirelock(&worker->lock);
+    if (worker->tail - worker->head < MARK_DEQUECAPACITY) {
+        worker->items[worker->tail % MARK_DEQUECAPACITY] = position;
+        worker->tail++;
+        releaselock(&worker->lock);
+        return;
+    }
+    releaselock(&worker->lock);
+
+    // Each block is only ever queued once, so the overflow stack always has
+    // room for it.
+    acquirelock(&m_overflowlock);
+    assert(m_overflowsize < m_count);
+    m_overflow[m_overflowsize++] = position;
+    releaselock(&m_overflowlock);
+}
+
+// reserve - Allocates everything needed to scan up to the specified number of
+//   blocks.
+//
+//  - capacity (IN): The maximum number of blocks that will be added.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::reserve (SIZE_T capacity)
+{
+    assert(m_capacity == 0);
+    m_capacity = capacity;
+    m_marks    = new LONG [capacity];
+    m_overflow = new SIZE_T [capacity];
+    m_ranges   = new markrange_t [capacity];
+    m_starts   = new SIZE_T [capacity];
+    if (m_workers == NULL) {
+        // Not scanning in parallel. The calling thread is the only worker.
+        allocworkers(1);
+    }
+}
+
+// resumethreads - Resumes all threads suspended by "suspendthreads".
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::resumethreads ()
+{
+    SIZE_T thread;
+
+    for (thread = 0; thread < m_threadcount; thread++) {
+        ResumeThread(m_threads[thread]);
+        CloseHandle(m_threads[thread]);
+    }
+    delete [] m_threads;
+    m_threadcount = 0;
+    m_threads = NULL;
+}
+
+// scan - Classifies every block that has been added. All other threads in the
+//   process, apart from the worker threads, are suspended for the duration of
+//   the scan.
+//
+//   Note: The caller must ensure that none of the blocks can be freed during
+//     the scan. If any of the blocks are being tracked by VLD, that means
+//     holding the map lock.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::scan ()
+{
+    CONTEXT            context;
+    threadbasicinfo_t  info;
+    SIZE_T             next;
+    SIZE_T             position;
+    markrange_t       *range;
+    rootrange_t       *root;
+    LPCVOID            teb;
+    SIZE_T             thread;
+    markworker_t      *worker = &m_workers[0];
+
+    if (m_count == 0) {
+        return;
+    }
+    buildindex();
+    suspendthreads();
+
+    // Mark everything that can be reached from the roots. The calling thread
+    // scans the roots, while the worker threads steal the blocks it finds.
+    m_mark = MARK_REACHABLE;
+    m_pending = 1;
+    if (m_goevent != NULL) {
+        SetEvent(m_goevent);
+    }
+    for (root = m_roots; root != NULL; root = root->next) {
+        scanrange(worker, root->base, root->size);
+    }
+    context.ContextFlags = CONTEXT_FULL;
+    RtlCaptureContext(&context);
+    scanthread(worker, &context, NtCurrentTeb());
+    for (thread = 0; thread < m_threadcount; thread++) {
+        context.ContextFlags = CONTEXT_FULL;
+        if (GetThreadContext(m_threads[thread], &context) == FALSE) {
+            continue;
+        }
+        teb = NULL;
+        if ((NtQueryInformationThread != NULL) &&
+            (NtQueryInformationThread(m_threads[thread], ThreadBasicInformation, &info, sizeof(info), NULL) ==
+             STATUS_SUCCESS)) {
+            teb = info.tebaddress;
+        }
+        scanthread(worker, &context, teb);
+    }
+    InterlockedDecrement(&m_pending);
+    work(worker);
+    while (m_finished != (LONG)(m_workercount - 1)) {
+        // Wait for the other workers to notice that the scan is complete.
+        YieldProcessor();
+    }
+
+    // Whatever is left is lost. Follow the references from each lost block in
+    // turn. Any lost blocks found that way are only indirectly lost. Lost
+    // memory is usually a small fraction of the heap, so the calling thread
+    // does this alone.
+    m_mark = MARK_INDIRECT;
+    for (position = 0; position < m_count; position++) {
+        if (m_marks[m_ranges[position].index] != MARK_UNVISITED) {
+            continue;
+        }
+        m_current = position;
+        m_marks[m_ranges[position].index] = MARK_DEFINITE;
+        pushwork(worker, position);
+        while (popwork(worker, &next)) {
+            range = &m_ranges[next];
+            scanrange(worker, (LPCVOID)range->start, range->end - range->start);
+        }
+    }
+    m_current = NOTFOUND;
+
+    resumethreads();
+}
+
+// scanrange - Scans a range of memory for pointers to blocks. Only
+//   pointer-aligned values are considered.
+//
+//  - worker (IN): The worker scanning the range.
+//
+//  - base (IN): Address of the start of the range.
+//
+//  - size (IN): Size, in bytes, of the range.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::scanrange (markworker_t *worker, LPCVOID base, SIZE_T size)
+{
+    const SIZE_T *end = (const SIZE_T*)(((SIZE_T)base + size) & ~(sizeof(SIZE_T) - 1));
+    const SIZE_T *word = (const SIZE_T*)(((SIZE_T)base + sizeof(SIZE_T) - 1) & ~(sizeof(SIZE_T) - 1));
+
+    if (word >= end) {
+        return;
+    }
+    __try {
+        scanwords(worker, word, end);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        // Part of the range isn't readable (e.g. a module was unloaded before
+        // its threads were suspended). References found before the fault still
+        // count.
+    }
+}
+
+// scanthread - Scans a thread's roots: its registers, its stack and its thread
+//   local storage.
+//
+//  - worker (IN): The worker scanning the thread.
+//
+//  - context (IN): The thread's context (i.e. its registers).
+//
+//  - teb (IN): Address of the thread's environment block. If NULL, the thread's
+//      local storage is not scanned.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::scanthread (markworker_t *worker, const CONTEXT *context, LPCVOID teb)
+{
+    LPVOID                   expansion;
+    MEMORY_BASIC_INFORMATION region;
+    SIZE_T                   stackpointer;
+    tlsblock_t              *tlsblock;
+    LPVOID                  *tlsblocks;
+
+    scanrange(worker, context, sizeof(CONTEXT));
+
+    // The committed region of the stack that contains the stack pointer extends
+    // all the way up to the base of the stack.
+#ifdef _WIN64
+    stackpointer = context->Rsp;
+#else
+    stackpointer = context->Esp;
+#endif
+    if (VirtualQuery((LPCVOID)stackpointer, &region, sizeof(region)) == sizeof(region)) {
+        scanrange(worker, (LPCVOID)stackpointer, (SIZE_T)region.BaseAddress + region.RegionSize - stackpointer);
+    }
+
+    if (teb == NULL) {
+        return;
+    }
+    scanrange(worker, (LPBYTE)teb + TEB_TLSSLOTS, TLS_MINIMUM_AVAILABLE * sizeof(LPVOID));
+    __try {
+        expansion = *(LPVOID*)((LPBYTE)teb + TEB_TLSEXPANSIONSLOTS);
+        if (expansion != NULL) {
+            scanrange(worker, expansion, TLS_EXPANSION_SLOTS * sizeof(LPVOID));
+        }
+        tlsblocks = *(LPVOID**)((LPBYTE)teb + TEB_THREADLOCALSTORAGEPOINTER);
+        if (tlsblocks != NULL) {
+            for (tlsblock = m_tlsblocks; tlsblock != NULL; tlsblock = tlsblock->next) {
+                if (tlsblocks[tlsblock->index] != NULL) {
+                    scanrange(worker, tlsblocks[tlsblock->index], tlsblock->size);
+                }
+            }
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        // The thread hasn't got static TLS blocks for every module (e.g. it was
+        // created before a module was dynamically loaded).
+    }
+}
+
+// scanwords - Checks each word in an array of pointer-aligned words for
+//   pointers to blocks. Where SSE2 is available, words are first checked
+//   against the range spanned by the blocks a whole vector at a time, and
+//   only vectors containing candidates are checked word by word.
+//
+//   The range check is done as an unsigned comparison of (word - low) with
+//   (high - low). SSE2 only has signed comparisons, so the sign bit of each
+//   32-bit lane is flipped to turn them into unsigned comparisons. 64-bit
+//   words are compared by their high halves, falling back on their low halves
+//   where the high halves are equal.
+//
+//  - worker (IN): The worker scanning the words.
+//
+//  - word (IN): Pointer to the first word.
+//
+//  - end (IN): Pointer just beyond the last word.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::scanwords (markworker_t *worker, const SIZE_T *word, const SIZE_T *end)
+{
+    __m128i bias;
+    __m128i below;
+    __m128i candidates;
+    __m128i flip;
+    SIZE_T  index;
+    __m128i span;
+#ifdef _WIN64
+    __m128i equal;
+#endif
+
+    if (m_simd) {
+        // Check words one at a time until they are aligned for SSE2.
+        while ((word < end) && (((SIZE_T)word & (sizeof(__m128i) - 1)) != 0)) {
+            checkword(worker, *word++);
+        }
+
+        flip = _mm_set1_epi32(0x80000000);
+#ifdef _WIN64
+        bias = _mm_set_epi32((int)(m_low >> 32), (int)m_low, (int)(m_low >> 32), (int)m_low);
+        span = _mm_set_epi32((int)((m_high - m_low) >> 32), (int)(m_high - m_low),
+                             (int)((m_high - m_low) >> 32), (int)(m_high - m_low));
+#else
+        bias = _mm_set1_epi32((int)m_low);
+        span = _mm_set1_epi32((int)(m_high - m_low));
+#endif
+        span = _mm_xor_si128(span, flip);
+        for (; (end - word) >= (ptrdiff_t)WORDSPERVECTOR; word += WORDSPERVECTOR) {
+#ifdef _WIN64
+            candidates = _mm_xor_si128(_mm_sub_epi64(_mm_load_si128((const __m128i*)word), bias), flip);
+            below = _mm_cmpgt_epi32(span, candidates);
+            equal = _mm_cmpeq_epi32(span, candidates);
+            below = _mm_or_si128(_mm_shuffle_epi32(below, _MM_SHUFFLE(3, 3, 1, 1)),
+                                 _mm_and_si128(_mm_shuffle_epi32(equal, _MM_SHUFFLE(3, 3, 1, 1)),
+                                               _mm_shuffle_epi32(below, _MM_SHUFFLE(2, 2, 0, 0))));
+#else
+            candidates = _mm_xor_si128(_mm_sub_epi32(_mm_load_si128((const __m128i*)word), bias), flip);
+            below = _mm_cmpgt_epi32(span, candidates);
+#endif
+            if (_mm_movemask_epi8(below) == 0) {
+                // None of these words point into the range spanned by the
+                // blocks.
+                continue;
+            }
+            for (index = 0; index < WORDSPERVECTOR; index++) {
+                checkword(worker, word[index]);
+            }
+        }
+    }
+
+    // Check any remaining words one at a time.
+    while (word < end) {
+        checkword(worker, *word++);
+    }
+}
+
+// startworkers - Starts the worker threads that will scan in parallel with the
+//   calling thread, one for each additional processor. The worker threads
+//   wait until "scan" is called.
+//
+//   Note: This must be called before the caller takes any lock that might be
+//     needed to allocate memory (e.g. the map lock). Starting a thread runs the
+//     DLL thread attach notifications, which may allocate memory, and the
+//     scan can't start until every worker thread has got past them. It must
+//     not be called while the process is exiting, when new threads never run.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::startworkers ()
+{
+    SIZE_T       count;
+    SIZE_T       index;
+    DWORD        start;
+    SYSTEM_INFO  systeminfo;
+    markworker_t *worker;
+
+    assert(m_workers == NULL);
+    GetSystemInfo(&systeminfo);
+    count = systeminfo.dwNumberOfProcessors;
+    if (count > MARK_MAXWORKERS) {
+        count = MARK_MAXWORKERS;
+    }
+    if (count > 1) {
+        m_goevent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        m_stopevent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if ((m_goevent == NULL) || (m_stopevent == NULL)) {
+            if (m_goevent != NULL) {
+                CloseHandle(m_goevent);
+            }
+            if (m_stopevent != NULL) {
+                CloseHandle(m_stopevent);
+            }
+            m_goevent = NULL;
+            m_stopevent = NULL;
+            count = 1;
+        }
+    }
+    else {
+        count = 1;
+    }
+    allocworkers(count);
+    for (index = 1; index < count; index++) {
+        worker = &m_workers[index];
+        worker->thread = CreateThread(NULL, 0, workerthread, worker, 0, &worker->threadid);
+        if (worker->thread == NULL) {
+            break;
+        }
+        m_workercount++;
+    }
+
+    // Wait for the worker threads to start.
+    start = GetTickCount();
+    for (index = 1; index < m_workercount; index++) {
+        while (m_workers[index].started == FALSE) {
+            if ((GetTickCount() - start) < MARK_STARTTIMEOUT) {
+                Sleep(1);
+                continue;
+            }
+            // A worker thread is stuck before it has started (e.g. the caller
+            // holds the loader lock). Fall back to scanning with the calling
+            // thread alone. The stuck threads will still reference their
+            // worker structures and events once they do start, just to find
+            // that they have been stopped, so those are abandoned rather than
+            // freed.
+            SetEvent(m_stopevent);
+            for (index = 1; index < m_workercount; index++) {
+                CloseHandle(m_workers[index].thread);
+            }
+            m_goevent = NULL;
+            m_stopevent = NULL;
+            allocworkers(1);
+            return;
+        }
+    }
+}
+
+// stealwork - Takes the oldest queued block from another worker's deque.
+//
+//  - worker (IN): The worker looking for work.
+//
+//  - position (OUT): Receives the position, in the index, of the block.
+//
+//  Return Value:
+//
+//    Returns TRUE if a block was stolen. Otherwise returns FALSE.
+//
+BOOL MarkScanner::stealwork (markworker_t *worker, SIZE_T *position)
+{
+    SIZE_T        offset;
+    markworker_t *victim;
+
+    for (offset = 1; offset < m_workercount; offset++) {
+        victim = &m_workers[((worker - m_workers) + offset) % m_workercount];
+        if (victim->tail == victim->head) {
+            continue;
+        }
+        acquirelock(&victim->lock);
+        if (victim->tail != victim->head) {
+            *position = victim->items[victim->head % MARK_DEQUECAPACITY];
+            victim->head++;
+            releaselock(&victim->lock);
+            return TRUE;
+        }
+        releaselock(&victim->lock);
+    }
+    return FALSE;
+}
+
+// stopworkers - Stops the worker threads and waits for them to exit.
+//
+//   Note: Exiting threads run the DLL thread detach notifications, which may
+//     free memory, so the caller must not hold any lock that might be needed
+//     to free memory (e.g. the map lock).
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::stopworkers ()
+{
+    SIZE_T index;
+    HANDLE threads [MARK_MAXWORKERS];
+
+    if (m_stopevent == NULL) {
+        return;
+    }
+    SetEvent(m_stopevent);
+    for (index = 1; index < m_workercount; index++) {
+        threads[index - 1] = m_workers[index].thread;
+    }
+    if (m_workercount > 1) {
+        WaitForMultipleObjects((DWORD)(m_workercount - 1), threads, TRUE, INFINITE);
+    }
+    for (index = 1; index < m_workercount; index++) {
+        CloseHandle(m_workers[index].thread);
+        m_workers[index].thread = NULL;
+    }
+    CloseHandle(m_goevent);
+    CloseHandle(m_stopevent);
+    m_goevent = NULL;
+    m_stopevent = NULL;
+}
+
+// suspendthreads - Suspends every thread in the process, other than the
+//   calling thread and the worker threads.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::suspendthreads ()
+{
+    SIZE_T        count = 0;
+    THREADENTRY32 entry;
+    DWORD         processid = GetCurrentProcessId();
+    HANDLE        snapshot;
+    HANDLE        thread;
+    DWORD         threadid = GetCurrentThreadId();
+
+    snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    // Count the other threads first, so the array of handles can be allocated
+    // before any thread is suspended.
+    entry.dwSize = sizeof(entry);
+    if (Thread32First(snapshot, &entry)) {
+        do {
+            if ((entry.th32OwnerProcessID == processid) && (entry.th32ThreadID != threadid)) {
+                count++;
+            }
+        } while (Thread32Next(snapshot, &entry));
+    }
+    if (count == 0) {
+        CloseHandle(snapshot);
+        return;
+    }
+    m_threads = new HANDLE [count];
+
+    entry.dwSize = sizeof(entry);
+    if (Thread32First(snapshot, &entry)) {
+        do {
+            if ((entry.th32OwnerProcessID != processid) || (entry.th32ThreadID == threadid) ||
+                isworker(entry.th32ThreadID) || (m_threadcount == count)) {
+                continue;
+            }
+            thread = OpenThread(THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION | THREAD_SUSPEND_RESUME, FALSE,
+                                entry.th32ThreadID);
+            if (thread == NULL) {
+                // The thread has already exited.
+                continue;
+            }
+            if (SuspendThread(thread) == (DWORD)-1) {
+                CloseHandle(thread);
+                continue;
+            }
+            m_threads[m_threadcount++] = thread;
+        } while (Thread32Next(snapshot, &entry));
+    }
+    CloseHandle(snapshot);
+}
+
+// work - Scans queued blocks, first from the worker's own deque, and then by
+//   stealing from the other workers, until every block found to be reachable
+//   has been scanned.
+//
+//  - worker (IN): The worker doing the work.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID MarkScanner::work (markworker_t *worker)
+{
+    SIZE_T       position;
+    markrange_t *range;
+
+    for (;;) {
+        if (popwork(worker, &position) || stealwork(worker, &position)) {
+            range = &m_ranges[position];
+            scanrange(worker, (LPCVOID)range->start, range->end - range->start);
+            InterlockedDecrement(&m_pending);
+        }
+        else if (m_pending == 0) {
+            // Every block found to be reachable has been scanned, so no more
+            // can be found.
+            break;
+        }
+        else {
+            YieldProcessor();
+        }
+    }
+}
+
+// compareranges - Comparison function for sorting the index of blocks by
+//   address with qsort.
+//
+//  - first (IN): Pointer to the first markrange_t structure to compare.
+//
+//  - second (IN): Pointer to the second markrange_t structure to compare.
+//
+//  Return Value:
+//
+//    Returns a negative value if the first block starts at a lower address than
+//    the second, a positive value if it starts at a higher address, and zero
+//    if they start at the same address.
+//
+int MarkScanner::compareranges (const void *first, const void *second)
+{
+    const markrange_t *firstrange = (const markrange_t*)first;
+    const markrange_t *secondrange = (const markrange_t*)second;
+
+    if (firstrange->start < secondrange->start) {
+        return -1;
+    }
+    if (firstrange->start > secondrange->start) {
+        return 1;
+    }
+    return 0;
+}
+
+// workerthread - Thread procedure of the worker threads. Waits for the scan to
+//   start, takes part in it, and then waits to be stopped.
+//
+//  - context (IN): Pointer to the thread's worker structure.
+//
+//  Return Value:
+//
+//    Always returns 0.
+//
+DWORD MarkScanner::workerthread (LPVOID context)
+{
+    HANDLE        events [2];
+    markworker_t *worker = (markworker_t*)context;
+
+    InterlockedExchange(&worker->started, TRUE);
+
+    // The stop event comes first, so it wins if the worker was abandoned.
+    events[0] = worker->stopevent;
+    events[1] = worker->goevent;
+    if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != (WAIT_OBJECT_0 + 1)) {
+        return 0;
+    }
+    worker->scanner->work(worker);
+    InterlockedIncrement(&worker->scanner->m_finished);
+    WaitForSingleObject(worker->stopevent, INFINITE);
+
+    return 0;
+}
+
+// acquirelock - Local helper function that acquires a spin lock. Spin locks are
+//   used instead of critical sections while threads are suspended, because
+//   waiting on a contended critical section may need to allocate memory.
+//
+//  - lock (IN): Pointer to the lock.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID acquirelock (volatile LONG *lock)
+{
+    while (InterlockedExchange(lock, 1) != 0) {
+        while (*lock != 0) {
+            YieldProcessor();
+        }
+    }
+}
+
+// releaselock - Local helper function that releases a spin lock.
+//
+//  - lock (IN): Pointer to the lock.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID releaselock (volatile LONG *lock)
+{
+    InterlockedExchange(lock, 0);
+}
@@ -0,0 +1,182 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - MarkScanner Class Definition
+//  Copyright (c) 2005-2006 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+"This header should only be included by Visual Leak Detector when building it from source. \
+Applications should never include this header."
+#endif
+
+#include <windows.h>
+
+// Classifications assigned to blocks by the MarkScanner.
+#define MARK_UNVISITED 0x0 // The block has not been reached (yet).
+#define MARK_DEFINITE  0x1 // The block is definitely lost. No pointer to it was found anywhere.
+#define MARK_INDIRECT  0x2 // The block is indirectly lost. It is only referenced by other lost blocks.
+#define MARK_REACHABLE 0x3 // The block is still reachable from a root (a stack, register, global or TLS slot).
+
+#define MARK_DEQUECAPACITY 4096     // Number of blocks each worker can hold in its own deque.
+#define MARK_MAXBUCKETS    0x100000 // Maximum number of buckets in the directory of the address index.
+#define MARK_MAXWORKERS    16       // Maximum number of threads that scan in parallel, including the calling thread.
+#define MARK_STARTTIMEOUT  1000     // Time, in milliseconds, to wait for the worker threads to start.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The MarkScanner Class
+//
+//    A MarkScanner conservatively determines which of a set of memory blocks
+//    are still referenced by the program. Every pointer-aligned word found in
+//    the roots (the stacks and registers of all threads, the writable sections
+//    of loaded modules and thread local storage) that points anywhere inside
+//    one of the blocks marks that block as reachable. Reachable blocks are in
+//    turn scanned for pointers to other blocks, until no more blocks can be
+//    reached.
+//
+//    The remaining blocks are lost. Those that are referenced by other lost
+//    blocks are only indirectly lost (freeing whatever owns them would free
+//    them too), the rest are definitely lost.
+//
+//    Scanning the reachable blocks, which is where nearly all of the time is
+//    spent, is done in parallel by a number of worker threads. Each worker
+//    keeps the blocks it has found, but not yet scanned, in its own deque.
+//    Workers take work from the tail of their own deque, and when that runs
+//    dry, steal from the head of the other workers' deques. Blocks that don't
+//    fit in a worker's deque spill over into a shared overflow stack.
+//
+//    Words are first checked against the range of addresses spanned by all of
+//    the blocks, several at a time using SSE2, so most words that aren't
+//    pointers are rejected without a lookup. The remaining candidates are
+//    looked up by binary search in a compact, sorted array of the start
+//    addresses of the blocks, narrowed down by a directory of fixed-size
+//    buckets of the address range.
+//
+//    All memory needed for the scan is allocated up front. While the roots
+//    and blocks are being scanned, all other threads are suspended and must
+//    not be waited on, because any of them may be holding a heap lock. For the
+//    same reason, the worker threads must be started before the caller takes
+//    any lock that an allocation might need.
+//
+class MarkScanner
+{
+public:
+    MarkScanner ();
+    ~MarkScanner ();
+
+    // Public APIs - see each function definition for details.
+    VOID addblock (LPCVOID address, SIZE_T size);
+    VOID addmodule (HMODULE module);
+    LONG getmark (SIZE_T index) const;
+    VOID reserve (SIZE_T capacity);
+    VOID scan ();
+    VOID startworkers ();
+    VOID stopworkers ();
+
+private:
+    // Each block is represented in the index by the range of addresses it
+    // occupies.
+    typedef struct markrange_s {
+        SIZE_T end;   // Address just beyond the end of the block.
+        SIZE_T index; // Index of the block, in the order in which it was added.
+        SIZE_T start; // Address of the start of the block.
+    } markrange_t;
+
+    // Each thread taking part in the scan has its own deque of blocks waiting
+    // to be scanned. The calling thread is always the first worker.
+    typedef struct markworker_s {
+        HANDLE           goevent;   // Signaled to start the worker thread scanning.
+        volatile SIZE_T  head;      // Position of the oldest block in the deque (where other workers steal from).
+        SIZE_T          *items;     // Ring buffer holding the positions, in the index, of blocks in the deque.
+        volatile LONG    lock;      // Spin lock serializing access to the deque.
+        MarkScanner     *scanner;   // The MarkScanner the worker belongs to.
+        volatile LONG    started;   // Set once the worker thread has started running.
+        HANDLE           stopevent; // Signaled to make the worker thread exit.
+        volatile SIZE_T  tail;      // Position just beyond the newest block in the deque.
+        HANDLE           thread;    // Handle to the worker thread (NULL for the calling thread).
+        DWORD            threadid;  // ID of the worker thread.
+    } markworker_t;
+
+    // Writable sections of loaded modules are kept on a list of root ranges.
+    typedef struct rootrange_s {
+        LPCVOID             base; // Address of the start of the range.
+        struct rootrange_s *next; // Pointer to the next root range in the list.
+        SIZE_T              size; // Size, in bytes, of the range.
+    } rootrange_t;
+
+    // Each module's static thread local storage (i.e. __declspec(thread)
+    // variables) is found through its TLS index in every thread.
+    typedef struct tlsblock_s {
+        DWORD              index; // The module's TLS index.
+        struct tlsblock_s *next;  // Pointer to the next TLS block in the list.
+        SIZE_T             size;  // Size, in bytes, of the module's TLS block.
+    } tlsblock_t;
+
+    // Private functions - see each function definition for details.
+    VOID   allocworkers (SIZE_T count);
+    VOID   buildindex ();
+    VOID   checkword (markworker_t *worker, SIZE_T value);
+    SIZE_T findblock (SIZE_T address) const;
+    BOOL   isworker (DWORD threadid) const;
+    VOID   markblock (markworker_t *worker, SIZE_T position);
+    BOOL   popwork (markworker_t *worker, SIZE_T *position);
+    VOID   pushwork (markworker_t *worker, SIZE_T position);
+    VOID   resumethreads ();
+    VOID   scanrange (markworker_t *worker, LPCVOID base, SIZE_T size);
+    VOID   scanthread (markworker_t *worker, const CONTEXT *context, LPCVOID teb);
+    VOID   scanwords (markworker_t *worker, const SIZE_T *word, const SIZE_T *end);
+    BOOL   stealwork (markworker_t *worker, SIZE_T *position);
+    VOID   suspendthreads ();
+    VOID   work (markworker_t *worker);
+
+    // Static functions (callbacks)
+    static int compareranges (const void *first, const void *second);
+    static DWORD __stdcall workerthread (LPVOID context);
+
+    // Private data.
+    SIZE_T                m_bucketshift;   // Number of address bits below the bucket number in the index directory.
+    SIZE_T               *m_buckets;       // Directory of the index: position of the first block starting in each bucket.
+    SIZE_T                m_capacity;      // Maximum number of blocks that can be added.
+    SIZE_T                m_count;         // Number of blocks added so far.
+    SIZE_T                m_current;       // Position of the lost block whose references are currently being followed.
+    volatile LONG         m_finished;      // Number of worker threads that have finished scanning.
+    HANDLE                m_goevent;       // Signaled to start the worker threads scanning.
+    SIZE_T                m_high;          // Address just beyond the end of the highest block.
+    SIZE_T                m_low;           // Address of the start of the lowest block.
+    LONG                  m_mark;          // The mark given to blocks found while scanning (reachable or indirect).
+    volatile LONG        *m_marks;         // Classification of each block, by index.
+    SIZE_T               *m_overflow;      // Shared stack of blocks that didn't fit in any worker's deque.
+    volatile LONG         m_overflowlock;  // Spin lock serializing access to the overflow stack.
+    volatile SIZE_T       m_overflowsize;  // Number of blocks on the overflow stack.
+    volatile LONG         m_pending;       // Number of blocks found reachable, but not yet scanned (plus one while roots are scanned).
+    markrange_t          *m_ranges;        // Index of the blocks, sorted by address.
+    rootrange_t          *m_roots;         // List of root ranges found in loaded modules.
+    BOOL                  m_simd;          // If TRUE, SSE2 instructions are used to check words against the address range.
+    SIZE_T               *m_starts;        // Start address of each block in the index, kept apart for fast searching.
+    HANDLE                m_stopevent;     // Signaled to make the worker threads exit.
+    SIZE_T                m_threadcount;   // Number of other threads suspended while scanning.
+    HANDLE               *m_threads;       // Handles to all other threads, suspended while scanning.
+    tlsblock_t           *m_tlsblocks;     // List of static TLS blocks found in loaded modules.
+    SIZE_T                m_workercount;   // Number of workers, including the calling thread.
+    markworker_t         *m_workers;       // Array of workers. The first is the calling thread.
+};
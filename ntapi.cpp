@@ -26,7 +26,8 @@
 
 // Global function pointers for explicit dynamic linking with NT APIs that can't
 // be load-time linked (there is no import library available for these).
-LdrLoadDll_t        LdrLoadDll;
-RtlAllocateHeap_t   RtlAllocateHeap;
-RtlFreeHeap_t       RtlFreeHeap;
-RtlReAllocateHeap_t RtlReAllocateHeap;
+LdrLoadDll_t               LdrLoadDll;
+NtQueryInformationThread_t NtQueryInformationThread;
+RtlAllocateHeap_t          RtlAllocateHeap;
+RtlFreeHeap_t              RtlFreeHeap;
+RtlReAllocateHeap_t        RtlReAllocateHeap;
@@ -42,16 +42,44 @@ typedef struct unicodestring_s {
     PWSTR  buffer;    // The buffer containing the string.
 } unicodestring_t;
 
+// Information class and structure used by NtQueryInformationThread to obtain
+// the address of a thread's environment block (TEB).
+#define ThreadBasicInformation 0
+typedef struct threadbasicinfo_s {
+    NTSTATUS  exitstatus;    // The thread's exit status.
+    PVOID     tebaddress;    // Address of the thread's environment block.
+    HANDLE    processid;     // ID of the process to which the thread belongs.
+    HANDLE    threadid;      // ID of the thread.
+    KAFFINITY affinitymask;  // The thread's processor affinity mask.
+    LONG      priority;      // The thread's current priority.
+    LONG      basepriority;  // The thread's base priority.
+} threadbasicinfo_t;
+
+// Offsets of the thread local storage fields in the (undocumented) thread
+// environment block.
+#ifdef _WIN64
+#define TEB_THREADLOCALSTORAGEPOINTER 0x58   // Pointer to the array of static TLS blocks, by module TLS index.
+#define TEB_TLSEXPANSIONSLOTS         0x1780 // Pointer to the array of TLS slots beyond TLS_MINIMUM_AVAILABLE.
+#define TEB_TLSSLOTS                  0x1480 // The first TLS_MINIMUM_AVAILABLE TLS slots.
+#else
+#define TEB_THREADLOCALSTORAGEPOINTER 0x2c   // Pointer to the array of static TLS blocks, by module TLS index.
+#define TEB_TLSEXPANSIONSLOTS         0xf94  // Pointer to the array of TLS slots beyond TLS_MINIMUM_AVAILABLE.
+#define TEB_TLSSLOTS                  0xe10  // The first TLS_MINIMUM_AVAILABLE TLS slots.
+#endif
+#define TLS_EXPANSION_SLOTS 1024 // Number of TLS slots in the expansion slot array.
+
 // Function pointer types for explicit dynamic linking with functions that can't
 // be load-time linked (no import library is available for these).
 typedef NTSTATUS (__stdcall *LdrLoadDll_t) (LPWSTR, PDWORD, unicodestring_t *, PHANDLE);
+typedef NTSTATUS (__stdcall *NtQueryInformationThread_t) (HANDLE, ULONG, PVOID, ULONG, PULONG);
 typedef LPVOID (__stdcall *RtlAllocateHeap_t) (HANDLE, DWORD, SIZE_T);
 typedef BOOL (__stdcall *RtlFreeHeap_t) (HANDLE, DWORD, LPVOID);
 typedef LPVOID (__stdcall *RtlReAllocateHeap_t) (HANDLE, DWORD, LPVOID, SIZE_T);
 
 // Provide forward declarations for the NT APIs for any source files that
 // include this header.
-extern LdrLoadDll_t        LdrLoadDll;
-extern RtlAllocateHeap_t   RtlAllocateHeap;
-extern RtlFreeHeap_t       RtlFreeHeap;
-extern RtlReAllocateHeap_t RtlReAllocateHeap;
+extern LdrLoadDll_t               LdrLoadDll;
+extern NtQueryInformationThread_t NtQueryInformationThread;
+extern RtlAllocateHeap_t          RtlAllocateHeap;
+extern RtlFreeHeap_t              RtlFreeHeap;
+extern RtlReAllocateHeap_t        RtlReAllocateHeap;
@@ -0,0 +1,248 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Platform Services
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+"This header should only be included by Visual Leak Detector when building it from source. \
+Applications should never include this header."
+#endif
+
+// The tracking engine (the containers, the stack depot, the block maps and the
+// report formatting) depends on the operating system for only a handful of
+// services: locks, thread local storage, the bounds of the current thread's
+// stack, time sources, an output sink for the debugger, a private heap, and
+// (for writing trace files in the background) threads and unbuffered files.
+// These are declared at the bottom of this header, and are implemented for
+// Win32 in platformwin32.cpp and for POSIX systems in platformposix.cpp.
+//
+// On POSIX systems, this header also provides the Win32 types, and the few
+// Microsoft CRT extensions, used by the portable sources, so that the same
+// sources can be built for both.
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef HANDLE           vldfile_t;   // A file open for writing.
+typedef CRITICAL_SECTION vldlock_t;   // A recursive lock.
+typedef HANDLE           vldthread_t; // A thread.
+typedef DWORD            vldtls_t;    // Thread local storage index.
+
+#else // !_WIN32
+#include <climits>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <pthread.h>
+
+// Win32 types used by the portable sources. LONG and ULONG are as wide as
+// "long" (as opposed to always being 32 bits wide), so that they match the
+// "%ld" and "%lu" formats used throughout the reports.
+typedef int                BOOL;
+typedef unsigned char      BYTE;
+typedef char               CHAR;
+typedef uint32_t           DWORD;
+typedef uint64_t           DWORD64;
+typedef uintptr_t          DWORD_PTR;
+typedef void              *HANDLE;
+typedef void              *HMODULE;
+typedef int                INT;
+typedef long               LONG;
+typedef long long          LONGLONG;
+typedef const char        *LPCSTR;
+typedef const void        *LPCVOID;
+typedef const wchar_t     *LPCWSTR;
+typedef char              *LPSTR;
+typedef void              *LPVOID;
+typedef wchar_t           *LPWSTR;
+typedef unsigned char     *PBYTE;
+typedef const wchar_t     *PCWSTR;
+typedef void              *PVOID;
+typedef unsigned short    *PWORD;
+typedef wchar_t           *PWSTR;
+typedef size_t             SIZE_T;
+typedef unsigned int       UINT;
+typedef uint32_t           UINT32;
+typedef unsigned long      ULONG;
+typedef unsigned long long ULONGLONG;
+typedef unsigned short     USHORT;
+typedef wchar_t            WCHAR;
+typedef unsigned short     WORD;
+#define FALSE    0
+#define MAX_PATH PATH_MAX
+#define TRUE     1
+#define VOID     void
+
+// Microsoft-specific keywords have no meaning on other platforms.
+#define __cdecl
+#define __declspec(x)
+#define __stdcall
+
+typedef int             vldfile_t;   // A file open for writing.
+typedef pthread_mutex_t vldlock_t;   // A recursive lock.
+typedef pthread_t       vldthread_t; // A thread.
+typedef pthread_key_t   vldtls_t;    // Thread local storage index.
+
+// Microsoft CRT extensions used by the portable sources. Formatted output
+// follows the Microsoft conventions, where "%s" and "%c" take wide arguments
+// in wide format strings.
+#define _TRUNCATE ((size_t)-1)
+int _snwprintf_s (wchar_t *buffer, size_t size, size_t count, const wchar_t *format, ...);
+int _vsnwprintf_s (wchar_t *buffer, size_t size, size_t count, const wchar_t *format, va_list args);
+int _wcsicmp (const wchar_t *string1, const wchar_t *string2);
+int wcsncat_s (wchar_t *dest, size_t size, const wchar_t *source, size_t count);
+int wcsncpy_s (wchar_t *dest, size_t size, const wchar_t *source, size_t count);
+int wcstombs_s (size_t *converted, char *dest, size_t size, const wchar_t *source, size_t count);
+
+// Interlocked operations, with the same semantics as their Win32 namesakes.
+inline LONG InterlockedCompareExchange (volatile LONG *dest, LONG exchange, LONG comparand)
+{
+    return __sync_val_compare_and_swap(dest, comparand, exchange);
+}
+
+inline LONG InterlockedDecrement (volatile LONG *addend)
+{
+    return __sync_sub_and_fetch(addend, 1);
+}
+
+inline LONG InterlockedExchange (volatile LONG *target, LONG value)
+{
+    __sync_synchronize();
+    return __sync_lock_test_and_set(target, value);
+}
+
+inline LONG InterlockedIncrement (volatile LONG *addend)
+{
+    return __sync_add_and_fetch(addend, 1);
+}
+
+// Platform services only needed on POSIX systems. See function definitions
+// for details.
+BOOL heapcontains (HANDLE heap, LPCVOID mem);
+#endif // _WIN32
+
+// Counters that are only ever updated by one thread at a time (the thread that
+// owns the counter, or the thread holding the lock that guards it), but that
+// may be read by other threads at any time (to add up the statistics of all
+// threads, for example). Updates and reads are atomic, but impose no ordering,
+// so they cost no more than ordinary ones.
+template <typename T> inline VOID addcounter (T *counter, T amount)
+{
+#ifdef _WIN32
+    *(volatile T*)counter = *counter + amount;
+#else
+    __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+#endif // _WIN32
+}
+
+template <typename T> inline T readcounter (const T *counter)
+{
+#ifdef _WIN32
+    return *(const volatile T*)counter;
+#else
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+#endif // _WIN32
+}
+
+// Counters that also publish data written by the thread that owns them: other
+// threads that read the counter with "acquirecounter" see everything the owner
+// wrote before it stored the counter's value with "publishcounter".
+template <typename T> inline T acquirecounter (const T *counter)
+{
+#ifdef _WIN32
+    return *(const volatile T*)counter;
+#else
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+#endif // _WIN32
+}
+
+template <typename T> inline VOID publishcounter (T *counter, T value)
+{
+#ifdef _WIN32
+    *(volatile T*)counter = value;
+#else
+    __atomic_store_n(counter, value, __ATOMIC_RELEASE);
+#endif // _WIN32
+}
+
+// Values that all threads store and read in a single total order, so that a
+// thread that stores one value and then reads another can't miss the store of
+// another thread that does the opposite (see "acquireranges", for example).
+template <typename T> inline T orderedload (const T *value)
+{
+#ifdef _WIN32
+    return *(const volatile T*)value;
+#else
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif // _WIN32
+}
+
+template <typename T> inline VOID orderedstore (T *value, T newvalue)
+{
+#ifdef _WIN32
+    *(volatile T*)value = newvalue;
+    MemoryBarrier();
+#else
+    __atomic_store_n(value, newvalue, __ATOMIC_SEQ_CST);
+#endif // _WIN32
+}
+
+// Threads started with "createthread" run a thread procedure of this type.
+typedef DWORD (__stdcall *vldthreadproc_t) (LPVOID context);
+
+// Thread local storage allocated with "tlsalloc" may have a destructor of this
+// type, which is called when a thread exits with a non-NULL value.
+typedef VOID (*vldtlsdestructor_t) (LPVOID value);
+
+// Platform services. See function definitions for details.
+VOID closefile (vldfile_t file);
+BOOL createfile (vldfile_t *file, LPCWSTR path);
+BOOL createthread (vldthread_t *thread, vldthreadproc_t threadproc, LPVOID context);
+DWORD currentthreadid ();
+VOID debugoutputa (LPCSTR message);
+VOID debugoutputw (LPCWSTR message);
+VOID delay (DWORD milliseconds);
+VOID deletelock (vldlock_t *lock);
+VOID detachthread (vldthread_t thread);
+VOID enterlock (vldlock_t *lock);
+ULONGLONG getperfcounter ();
+ULONGLONG getperffrequency ();
+DWORD getprocessorcount ();
+VOID getstackbounds (SIZE_T *low, SIZE_T *high);
+DWORD gettickcount ();
+LPVOID heapalloc (HANDLE heap, SIZE_T size);
+HANDLE heapcreate ();
+VOID heapdestroy (HANDLE heap);
+BOOL heapfree (HANDLE heap, LPVOID mem);
+VOID initlock (vldlock_t *lock);
+VOID jointhread (vldthread_t thread);
+VOID leavelock (vldlock_t *lock);
+BOOL threadexited (vldthread_t thread);
+BOOL tlsalloc (vldtls_t *index, vldtlsdestructor_t destructor);
+VOID tlsfree (vldtls_t index);
+LPVOID tlsgetvalue (vldtls_t index);
+VOID tlssetvalue (vldtls_t index, LPVOID value);
+BOOL tryenterlock (vldlock_t *lock);
+BOOL writefile (vldfile_t file, LPCVOID data, SIZE_T size);
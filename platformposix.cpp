@@ -0,0 +1,1016 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Platform Services for POSIX Systems
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <cwchar>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define VLDBUILD         // Declares that we are building Visual Leak Detector.
+#include "platform.h"    // Provides the declarations of the platform services.
+
+#define FORMATLENGTH       1024       // Maximum length, in characters, of a translated format string.
+#define HEAPBLOCKOVERHEAD  16         // Size, in bytes, of the header preceding each block in a private heap.
+#define HEAPCOMMITSIZE     0x100000   // Private heaps are committed in increments of this many bytes.
+#define HEAPMINRESERVESIZE 0x1000000  // Smallest range of addresses that will be reserved for a private heap.
+#define HEAPRESERVESIZE    ((SIZE_T)1 << ((sizeof(SIZE_T) == 8) ? 36 : 28)) // Range of addresses reserved for a private heap.
+#define HEAPSIZECLASSES    32         // Number of block sizes (powers of two, from 16 bytes up).
+#define STRUNCATE          80         // Returned by the Microsoft string functions when a string is truncated.
+
+// Private heaps are carved out of a contiguous range of addresses reserved
+// when the heap is created, so that blocks allocated from a private heap can be
+// told apart from all others by their address alone. The range is committed
+// as the heap grows. Block sizes are rounded up to a power of two, and freed
+// blocks are kept on a free list for their size. The heap's own bookkeeping
+// lives at the start of the range.
+typedef struct privateheap_s {
+    PBYTE     committed;                   // End of the committed part of the heap's range.
+    PBYTE     end;                         // End of the heap's range.
+    LPVOID    freelists [HEAPSIZECLASSES]; // Lists of free blocks, by size class.
+    vldlock_t lock;                        // Serializes access to the heap.
+    PBYTE     next;                        // Start of the part of the heap's range that has never been allocated.
+    PBYTE     start;                       // Start of the heap's range.
+} privateheap_t;
+
+// Threads started by "createthread" are handed their thread procedure, and its
+// context, in this structure.
+typedef struct threadstart_s {
+    LPVOID          context;    // Context passed to the thread procedure.
+    vldthreadproc_t threadproc; // The thread procedure.
+} threadstart_t;
+
+// Thread local variables. The initial-exec model guarantees that accessing
+// them never allocates memory.
+static __thread SIZE_T stackhigh __attribute__((tls_model("initial-exec"))) = 0; // Cached base of the thread's stack.
+static __thread SIZE_T stacklow __attribute__((tls_model("initial-exec"))) = 0;  // Cached limit of the thread's stack.
+
+// Local helper functions.
+static LPVOID threadstart (LPVOID parameter);
+static BOOL translateformat (LPWSTR translated, LPCWSTR format);
+
+// closefile - Closes a file previously created by "createfile".
+//
+//  - file (IN): The file to close.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID closefile (vldfile_t file)
+{
+    close(file);
+}
+
+// createfile - Creates a file, or truncates an existing one, and opens it for
+//   writing. Writes to the file are not buffered, so that no memory is
+//   allocated.
+//
+//  - file (OUT): Receives the opened file.
+//
+//  - path (IN): Path of the file to create.
+//
+//  Return Value:
+//
+//    Returns TRUE if the file was created. Otherwise returns FALSE.
+//
+BOOL createfile (vldfile_t *file, LPCWSTR path)
+{
+    SIZE_T converted;
+    CHAR   filename [MAX_PATH];
+
+    if (wcstombs_s(&converted, filename, MAX_PATH, path, _TRUNCATE) != 0) {
+        return FALSE;
+    }
+    *file = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    return (*file != -1);
+}
+
+// createthread - Starts a new thread.
+//
+//  - thread (OUT): Receives the new thread, which must eventually be joined
+//      with "jointhread" or detached with "detachthread".
+//
+//  - threadproc (IN): The thread procedure run by the new thread.
+//
+//  - context (IN): Context passed to the thread procedure.
+//
+//  Return Value:
+//
+//    Returns TRUE if the thread was started. Otherwise returns FALSE.
+//
+BOOL createthread (vldthread_t *thread, vldthreadproc_t threadproc, LPVOID context)
+{
+    threadstart_t *start;
+
+    start = (threadstart_t*)malloc(sizeof(threadstart_t));
+    if (start == NULL) {
+        return FALSE;
+    }
+    start->context = context;
+    start->threadproc = threadproc;
+    if (pthread_create(thread, NULL, threadstart, start) != 0) {
+        free(start);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// currentthreadid - Obtains the ID of the calling thread.
+//
+//  Return Value:
+//
+//    Returns the calling thread's ID.
+//
+DWORD currentthreadid ()
+{
+#ifdef SYS_gettid
+    return (DWORD)syscall(SYS_gettid);
+#else
+    return (DWORD)(SIZE_T)pthread_self();
+#endif // SYS_gettid
+}
+
+// debugoutputa - Sends an ASCII string to the debugger for display. There is
+//   no debugger output on POSIX systems, so the string goes to the standard
+//   error stream instead. It is written directly to the file descriptor, so
+//   that no memory is allocated.
+//
+//  - message (IN): The string to be displayed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID debugoutputa (LPCSTR message)
+{
+    SIZE_T  length = strlen(message);
+    ssize_t written;
+
+    while (length != 0) {
+        written = write(STDERR_FILENO, message, length);
+        if (written <= 0) {
+            if ((written < 0) && (errno == EINTR)) {
+                continue;
+            }
+            break;
+        }
+        message += written;
+        length -= written;
+    }
+}
+
+// debugoutputw - Sends a Unicode string to the debugger for display (see
+//   "debugoutputa"). The string is converted to multibyte characters a piece
+//   at a time.
+//
+//  - message (IN): The string to be displayed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID debugoutputw (LPCWSTR message)
+{
+    CHAR      buffer [256 + MB_LEN_MAX];
+    SIZE_T    converted;
+    SIZE_T    length = 0;
+    mbstate_t state;
+
+    memset(&state, 0x0, sizeof(state));
+    for (; *message != L'\0'; message++) {
+        converted = wcrtomb(buffer + length, *message, &state);
+        if (converted == (SIZE_T)-1) {
+            // Not representable. Substitute a question mark.
+            buffer[length] = '?';
+            converted = 1;
+            memset(&state, 0x0, sizeof(state));
+        }
+        length += converted;
+        if (length >= 256) {
+            buffer[length] = '\0';
+            debugoutputa(buffer);
+            length = 0;
+        }
+    }
+    buffer[length] = '\0';
+    debugoutputa(buffer);
+}
+
+// delay - Suspends the calling thread for a while.
+//
+//  - milliseconds (IN): The number of milliseconds to suspend the thread for.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID delay (DWORD milliseconds)
+{
+    struct timespec duration;
+
+    duration.tv_sec = milliseconds / 1000;
+    duration.tv_nsec = (milliseconds % 1000) * 1000000;
+    while ((nanosleep(&duration, &duration) != 0) && (errno == EINTR)) {
+        // Interrupted by a signal. Sleep for the remaining time.
+    }
+}
+
+// deletelock - Releases the resources used by a lock that is no longer needed.
+//
+//  - lock (IN): Pointer to the lock to delete.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID deletelock (vldlock_t *lock)
+{
+    pthread_mutex_destroy(lock);
+}
+
+// detachthread - Releases the resources of a thread started by "createthread",
+//   without waiting for it to exit.
+//
+//  - thread (IN): The thread to detach.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID detachthread (vldthread_t thread)
+{
+    pthread_detach(thread);
+}
+
+// enterlock - Acquires a lock, waiting for it if it is held by another thread.
+//   A thread may acquire a lock it already holds. It must then release the
+//   lock once for each time it acquired it.
+//
+//  - lock (IN): Pointer to the lock to acquire.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID enterlock (vldlock_t *lock)
+{
+    pthread_mutex_lock(lock);
+}
+
+// getperfcounter - Obtains the current value of the high-resolution
+//   performance counter, which is the monotonic clock.
+//
+//  Return Value:
+//
+//    Returns the current value of the performance counter, in nanoseconds.
+//
+ULONGLONG getperfcounter ()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (ULONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// getperffrequency - Obtains the frequency of the high-resolution performance
+//   counter.
+//
+//  Return Value:
+//
+//    Returns the frequency of the performance counter, in ticks per second.
+//
+ULONGLONG getperffrequency ()
+{
+    return 1000000000;
+}
+
+// getprocessorcount - Obtains the number of processors available to the
+//   process.
+//
+//  Return Value:
+//
+//    Returns the number of processors (at least one).
+//
+DWORD getprocessorcount ()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (count > 0) ? (DWORD)count : 1;
+}
+
+// getstackbounds - Obtains the range of addresses occupied by the calling
+//   thread's stack. Looking up the range is expensive (for the main thread,
+//   the C library parses /proc/self/maps), so each thread looks up its range
+//   only once and caches it.
+//
+//  - low (OUT): Receives the lowest address of the stack, or zero if the
+//      range could not be determined.
+//
+//  - high (OUT): Receives the address just beyond the base (highest address)
+//      of the stack, or zero if the range could not be determined.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID getstackbounds (SIZE_T *low, SIZE_T *high)
+{
+    pthread_attr_t attributes;
+    LPVOID         base;
+    size_t         size;
+
+    if (stackhigh == 0) {
+        if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+            if (pthread_attr_getstack(&attributes, &base, &size) == 0) {
+                stacklow = (SIZE_T)base;
+                stackhigh = (SIZE_T)base + size;
+            }
+            pthread_attr_destroy(&attributes);
+        }
+    }
+
+    *low = stacklow;
+    *high = stackhigh;
+}
+
+// gettickcount - Obtains the number of milliseconds elapsed since an arbitrary
+//   point in the past, from the monotonic clock. Like its Win32 counterpart,
+//   the count wraps around to zero after 49.7 days.
+//
+//  Return Value:
+//
+//    Returns the tick count.
+//
+DWORD gettickcount ()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (DWORD)((ULONGLONG)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+// heapalloc - Allocates a memory block from a private heap. Each block is
+//   preceded by a header that records its size class.
+//
+//  - heap (IN): Handle to the heap from which to allocate the block.
+//
+//  - size (IN): Size, in bytes, of the block to allocate.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL if the allocation
+//    failed.
+//
+LPVOID heapalloc (HANDLE heap, SIZE_T size)
+{
+    PBYTE          block;
+    SIZE_T         blocksize = 1 << 4;
+    PBYTE          commit;
+    privateheap_t *privateheap = (privateheap_t*)heap;
+    SIZE_T         sizeclass = 0;
+
+    while (blocksize < size + HEAPBLOCKOVERHEAD) {
+        if (sizeclass == HEAPSIZECLASSES - 1) {
+            // Too large for any heap.
+            return NULL;
+        }
+        blocksize <<= 1;
+        sizeclass++;
+    }
+
+    enterlock(&privateheap->lock);
+    block = (PBYTE)privateheap->freelists[sizeclass];
+    if (block != NULL) {
+        // Reuse a free block of the same size.
+        privateheap->freelists[sizeclass] = *(LPVOID*)(block + HEAPBLOCKOVERHEAD);
+    }
+    else {
+        if ((SIZE_T)(privateheap->end - privateheap->next) < blocksize) {
+            // The heap's range is exhausted.
+            leavelock(&privateheap->lock);
+            return NULL;
+        }
+        block = privateheap->next;
+        if (block + blocksize > privateheap->committed) {
+            // Commit enough of the range to hold the block.
+            commit = privateheap->start + (((block + blocksize - privateheap->start) + HEAPCOMMITSIZE - 1) /
+                                           HEAPCOMMITSIZE) * HEAPCOMMITSIZE;
+            if (commit > privateheap->end) {
+                commit = privateheap->end;
+            }
+            if (mprotect(privateheap->committed, commit - privateheap->committed, PROT_READ | PROT_WRITE) != 0) {
+                leavelock(&privateheap->lock);
+                return NULL;
+            }
+            privateheap->committed = commit;
+        }
+        privateheap->next += blocksize;
+    }
+    leavelock(&privateheap->lock);
+
+    *(SIZE_T*)block = sizeclass;
+
+    return block + HEAPBLOCKOVERHEAD;
+}
+
+// heapcontains - Determines whether a memory block belongs to a private heap.
+//   Only the block's address is checked, so this is cheap enough to be done
+//   for every block freed in the process.
+//
+//  - heap (IN): Handle to the heap. May be NULL, in which case no block
+//      belongs to it.
+//
+//  - mem (IN): Pointer to the memory block.
+//
+//  Return Value:
+//
+//    Returns TRUE if the block lies within the heap's range of addresses.
+//    Otherwise returns FALSE.
+//
+BOOL heapcontains (HANDLE heap, LPCVOID mem)
+{
+    privateheap_t *privateheap = (privateheap_t*)heap;
+
+    if (privateheap == NULL) {
+        return FALSE;
+    }
+
+    return (((PBYTE)mem >= privateheap->start) && ((PBYTE)mem < privateheap->end));
+}
+
+// heapcreate - Creates a private heap. A range of addresses is reserved for
+//   the heap, but memory is only committed as the heap grows. If the full range
+//   can't be reserved, successively smaller ranges are tried.
+//
+//  Return Value:
+//
+//    Returns a handle to the newly created heap, or NULL if the heap could not
+//    be created.
+//
+HANDLE heapcreate ()
+{
+    LPVOID         base = MAP_FAILED;
+    privateheap_t *privateheap;
+    SIZE_T         size;
+
+    for (size = HEAPRESERVESIZE; size >= HEAPMINRESERVESIZE; size >>= 1) {
+        base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base != MAP_FAILED) {
+            break;
+        }
+    }
+    if ((base == MAP_FAILED) || (mprotect(base, HEAPCOMMITSIZE, PROT_READ | PROT_WRITE) != 0)) {
+        return NULL;
+    }
+
+    // The heap's bookkeeping occupies the start of the range. Blocks follow
+    // it, aligned to the size of the block header.
+    privateheap = (privateheap_t*)base;
+    memset(privateheap, 0x0, sizeof(privateheap_t));
+    privateheap->committed = (PBYTE)base + HEAPCOMMITSIZE;
+    privateheap->end = (PBYTE)base + size;
+    privateheap->next = (PBYTE)base + ((sizeof(privateheap_t) + HEAPBLOCKOVERHEAD - 1) & ~(HEAPBLOCKOVERHEAD - 1));
+    privateheap->start = (PBYTE)base;
+    initlock(&privateheap->lock);
+
+    return (HANDLE)privateheap;
+}
+
+// heapdestroy - Destroys a private heap previously created by "heapcreate",
+//   along with any blocks still allocated from it.
+//
+//  - heap (IN): Handle to the heap to destroy.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID heapdestroy (HANDLE heap)
+{
+    privateheap_t *privateheap = (privateheap_t*)heap;
+
+    deletelock(&privateheap->lock);
+    munmap(privateheap->start, privateheap->end - privateheap->start);
+}
+
+// heapfree - Frees a memory block previously allocated by "heapalloc". The
+//   block is put on the free list for its size. The pages of large blocks are
+//   given back to the system until the block is reused.
+//
+//  - heap (IN): Handle to the heap from which the block was allocated.
+//
+//  - mem (IN): Pointer to the block to free.
+//
+//  Return Value:
+//
+//    Always returns TRUE.
+//
+BOOL heapfree (HANDLE heap, LPVOID mem)
+{
+    PBYTE          block = (PBYTE)mem - HEAPBLOCKOVERHEAD;
+    SIZE_T         blocksize;
+    SIZE_T         high;
+    SIZE_T         low;
+    SIZE_T         pagesize;
+    privateheap_t *privateheap = (privateheap_t*)heap;
+    SIZE_T         sizeclass = *(SIZE_T*)block;
+
+    blocksize = (SIZE_T)1 << (sizeclass + 4);
+    if (blocksize >= HEAPCOMMITSIZE) {
+        // Discard the whole pages of the block, except the one holding the
+        // header and the free list link.
+        pagesize = sysconf(_SC_PAGESIZE);
+        low = ((SIZE_T)mem + sizeof(LPVOID) + pagesize - 1) & ~(pagesize - 1);
+        high = ((SIZE_T)block + blocksize) & ~(pagesize - 1);
+        if (high > low) {
+            madvise((LPVOID)low, high - low, MADV_DONTNEED);
+        }
+    }
+
+    enterlock(&privateheap->lock);
+    *(LPVOID*)mem = privateheap->freelists[sizeclass];
+    privateheap->freelists[sizeclass] = block;
+    leavelock(&privateheap->lock);
+
+    return TRUE;
+}
+
+// initlock - Initializes a recursive lock.
+//
+//  - lock (IN): Pointer to the lock to initialize.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID initlock (vldlock_t *lock)
+{
+    pthread_mutexattr_t attributes;
+
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+// jointhread - Waits for a thread started by "createthread" to exit, and
+//   releases the thread's resources.
+//
+//  - thread (IN): The thread to join.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID jointhread (vldthread_t thread)
+{
+    pthread_join(thread, NULL);
+}
+
+// leavelock - Releases a lock previously acquired by "enterlock".
+//
+//  - lock (IN): Pointer to the lock to release.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID leavelock (vldlock_t *lock)
+{
+    pthread_mutex_unlock(lock);
+}
+
+// threadexited - Determines whether a thread started by "createthread" is known
+//   to have exited. Whether a POSIX thread has returned can't be told without
+//   joining it, so this is never known. Unlike on Windows, though, threads
+//   aren't terminated when the process exits until the process's destructors
+//   have run, so a thread procedure that signals when it is done always gets
+//   to do so.
+//
+//  - thread (IN): The thread to check.
+//
+//  Return Value:
+//
+//    Always returns FALSE.
+//
+BOOL threadexited (vldthread_t /*thread*/)
+{
+    return FALSE;
+}
+
+// tlsalloc - Allocates a thread local storage index. Each thread has its own
+//   value for the index, which is initially NULL.
+//
+//  - index (OUT): Receives the allocated index.
+//
+//  - destructor (IN): Function called with a thread's value when the thread
+//      exits, if the value isn't NULL (may be NULL).
+//
+//  Return Value:
+//
+//    Returns TRUE if an index was allocated. Otherwise returns FALSE.
+//
+BOOL tlsalloc (vldtls_t *index, vldtlsdestructor_t destructor)
+{
+    return (pthread_key_create(index, destructor) == 0);
+}
+
+// tlsfree - Frees a thread local storage index previously allocated by
+//   "tlsalloc".
+//
+//  - index (IN): The index to free.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID tlsfree (vldtls_t index)
+{
+    pthread_key_delete(index);
+}
+
+// tlsgetvalue - Obtains the calling thread's value for a thread local storage
+//   index.
+//
+//  - index (IN): The thread local storage index.
+//
+//  Return Value:
+//
+//    Returns the calling thread's value for the index.
+//
+LPVOID tlsgetvalue (vldtls_t index)
+{
+    return pthread_getspecific(index);
+}
+
+// tlssetvalue - Sets the calling thread's value for a thread local storage
+//   index.
+//
+//  - index (IN): The thread local storage index.
+//
+//  - value (IN): The calling thread's new value for the index.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID tlssetvalue (vldtls_t index, LPVOID value)
+{
+    pthread_setspecific(index, value);
+}
+
+// tryenterlock - Acquires a lock, unless it is held by another thread.
+//
+//  - lock (IN): Pointer to the lock to acquire.
+//
+//  Return Value:
+//
+//    Returns TRUE if the lock was acquired, in which case it must be released
+//    by "leavelock". Returns FALSE if another thread holds the lock.
+//
+BOOL tryenterlock (vldlock_t *lock)
+{
+    return (pthread_mutex_trylock(lock) == 0);
+}
+
+// writefile - Writes data to a file previously created by "createfile".
+//
+//  - file (IN): The file to write to.
+//
+//  - data (IN): Pointer to the data to write.
+//
+//  - size (IN): Size, in bytes, of the data.
+//
+//  Return Value:
+//
+//    Returns TRUE if all of the data was written. Otherwise returns FALSE.
+//
+BOOL writefile (vldfile_t file, LPCVOID data, SIZE_T size)
+{
+    const BYTE *remaining = (const BYTE*)data;
+    ssize_t     written;
+
+    while (size != 0) {
+        written = write(file, remaining, size);
+        if (written <= 0) {
+            if ((written < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return FALSE;
+        }
+        remaining += written;
+        size -= written;
+    }
+
+    return TRUE;
+}
+
+// threadstart - Local helper function that starts the thread procedure of a
+//   thread started by "createthread".
+//
+//  - parameter (IN): Pointer to the threadstart_t structure describing the
+//      thread procedure. The structure is freed.
+//
+//  Return Value:
+//
+//    Always returns NULL.
+//
+LPVOID threadstart (LPVOID parameter)
+{
+    threadstart_t start = *(threadstart_t*)parameter;
+
+    free(parameter);
+    start.threadproc(start.context);
+
+    return NULL;
+}
+
+// translateformat - Local helper function that translates a format string
+//   following the Microsoft conventions for wide format strings, where "%s"
+//   and "%c" take wide arguments, to the standard conventions, where they take
+//   narrow arguments unless qualified with "l".
+//
+//  - translated (OUT): Buffer, of FORMATLENGTH characters, that receives the
+//      translated format string.
+//
+//  - format (IN): The format string to translate.
+//
+//  Return Value:
+//
+//    Returns TRUE if the format string was translated. Returns FALSE if the
+//    translated format string would not fit in the buffer.
+//
+BOOL translateformat (LPWSTR translated, LPCWSTR format)
+{
+    SIZE_T length = 0;
+    BOOL   qualified;
+
+    while (*format != L'\0') {
+        // Leave room for an inserted qualifier and the terminator.
+        if (length + 3 > FORMATLENGTH) {
+            return FALSE;
+        }
+        translated[length++] = *format;
+        if (*format++ != L'%') {
+            continue;
+        }
+        if (*format == L'%') {
+            translated[length++] = *format++;
+            continue;
+        }
+
+        // Copy the flags, width and precision, then any length modifier.
+        while ((*format != L'\0') && wcschr(L"-+ #0123456789.*", *format) && (length + 3 <= FORMATLENGTH)) {
+            translated[length++] = *format++;
+        }
+        qualified = FALSE;
+        while ((*format != L'\0') && wcschr(L"hlLqjzt", *format) && (length + 3 <= FORMATLENGTH)) {
+            qualified = TRUE;
+            translated[length++] = *format++;
+        }
+        if (length + 3 > FORMATLENGTH) {
+            return FALSE;
+        }
+        if (!qualified) {
+            if ((*format == L's') || (*format == L'c')) {
+                // Wide by Microsoft convention.
+                translated[length++] = L'l';
+            }
+            else if ((*format == L'S') || (*format == L'C')) {
+                // Narrow by Microsoft convention.
+                translated[length++] = (*format++ == L'S') ? L's' : L'c';
+            }
+        }
+    }
+    translated[length] = L'\0';
+
+    return TRUE;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Microsoft CRT Extensions
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// _snwprintf_s - Writes formatted output to a wide string buffer.
+//
+//  - buffer (OUT): Buffer that receives the formatted output.
+//
+//  - size (IN): Size, in characters, of the buffer.
+//
+//  - count (IN): Maximum number of characters to write, or _TRUNCATE to write
+//      as many as fit in the buffer.
+//
+//  - format (IN): Format string, following the Microsoft conventions.
+//
+//  - ... (IN): Arguments to be formatted using the specified format string.
+//
+//  Return Value:
+//
+//    Returns the number of characters written, not counting the terminator,
+//    or -1 if the output was truncated.
+//
+int _snwprintf_s (wchar_t *buffer, size_t size, size_t count, const wchar_t *format, ...)
+{
+    va_list args;
+    int     result;
+
+    va_start(args, format);
+    result = _vsnwprintf_s(buffer, size, count, format, args);
+    va_end(args);
+
+    return result;
+}
+
+// _vsnwprintf_s - Writes formatted output, from a list of arguments, to a wide
+//   string buffer. The output is always terminated.
+//
+//  - buffer (OUT): Buffer that receives the formatted output.
+//
+//  - size (IN): Size, in characters, of the buffer.
+//
+//  - count (IN): Maximum number of characters to write, or _TRUNCATE to write
+//      as many as fit in the buffer.
+//
+//  - format (IN): Format string, following the Microsoft conventions.
+//
+//  - args (IN): Arguments to be formatted using the specified format string.
+//
+//  Return Value:
+//
+//    Returns the number of characters written, not counting the terminator,
+//    or -1 if the output was truncated.
+//
+int _vsnwprintf_s (wchar_t *buffer, size_t size, size_t count, const wchar_t *format, va_list args)
+{
+    size_t limit = size;
+    int    result;
+    WCHAR  translated [FORMATLENGTH];
+
+    if ((count != _TRUNCATE) && (count < size)) {
+        limit = count + 1;
+    }
+    if (!translateformat(translated, format)) {
+        buffer[0] = L'\0';
+        return -1;
+    }
+    result = vswprintf(buffer, limit, translated, args);
+    if (result < 0) {
+        buffer[limit - 1] = L'\0';
+    }
+
+    return result;
+}
+
+// _wcsicmp - Compares two wide strings, ignoring case.
+//
+//  - string1 (IN): The first string to compare.
+//
+//  - string2 (IN): The second string to compare.
+//
+//  Return Value:
+//
+//    Returns zero if the strings are equal, a negative value if the first
+//    string is less than the second, or a positive value otherwise.
+//
+int _wcsicmp (const wchar_t *string1, const wchar_t *string2)
+{
+    return wcscasecmp(string1, string2);
+}
+
+// wcsncat_s - Appends characters of a wide string to another.
+//
+//  - dest (IN/OUT): The string to append to.
+//
+//  - size (IN): Size, in characters, of the destination buffer.
+//
+//  - source (IN): The string to append.
+//
+//  - count (IN): Maximum number of characters to append, or _TRUNCATE to
+//      append as many as fit in the buffer.
+//
+//  Return Value:
+//
+//    Returns zero on success, STRUNCATE if the result was truncated, or ERANGE
+//    if it didn't fit and truncation wasn't requested.
+//
+int wcsncat_s (wchar_t *dest, size_t size, const wchar_t *source, size_t count)
+{
+    size_t length = wcslen(dest);
+
+    if (length >= size) {
+        return EINVAL;
+    }
+
+    return wcsncpy_s(dest + length, size - length, source, count);
+}
+
+// wcsncpy_s - Copies characters of a wide string to a buffer. The copy is
+//   always terminated.
+//
+//  - dest (OUT): Buffer that receives the copy.
+//
+//  - size (IN): Size, in characters, of the destination buffer.
+//
+//  - source (IN): The string to copy.
+//
+//  - count (IN): Maximum number of characters to copy, or _TRUNCATE to copy
+//      as many as fit in the buffer.
+//
+//  Return Value:
+//
+//    Returns zero on success, STRUNCATE if the copy was truncated, or ERANGE
+//    if it didn't fit and truncation wasn't requested.
+//
+int wcsncpy_s (wchar_t *dest, size_t size, const wchar_t *source, size_t count)
+{
+    size_t length = wcslen(source);
+
+    if ((count != _TRUNCATE) && (count < length)) {
+        length = count;
+    }
+    if (length >= size) {
+        if (count != _TRUNCATE) {
+            dest[0] = L'\0';
+            return ERANGE;
+        }
+        wmemcpy(dest, source, size - 1);
+        dest[size - 1] = L'\0';
+        return STRUNCATE;
+    }
+    wmemcpy(dest, source, length);
+    dest[length] = L'\0';
+
+    return 0;
+}
+
+// wcstombs_s - Converts a wide string to multibyte characters. The converted
+//   string is always terminated.
+//
+//  - converted (OUT): Receives the number of bytes written, including the
+//      terminator.
+//
+//  - dest (OUT): Buffer that receives the converted string.
+//
+//  - size (IN): Size, in bytes, of the destination buffer.
+//
+//  - source (IN): The string to convert.
+//
+//  - count (IN): Must be _TRUNCATE: as much of the string as fits in the
+//      buffer is converted.
+//
+//  Return Value:
+//
+//    Returns zero on success, or EILSEQ if the string contains a character
+//    that can't be converted.
+//
+int wcstombs_s (size_t *converted, char *dest, size_t size, const wchar_t *source, size_t /*count*/)
+{
+    size_t length = wcstombs(dest, source, size);
+
+    if (length == (size_t)-1) {
+        dest[0] = '\0';
+        *converted = 0;
+        return EILSEQ;
+    }
+    if (length == size) {
+        // Truncated.
+        dest[size - 1] = '\0';
+        length = size - 1;
+    }
+    *converted = length + 1;
+
+    return 0;
+}
@@ -0,0 +1,474 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Platform Services for Win32
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#define VLDBUILD         // Declares that we are building Visual Leak Detector.
+#include "ntapi.h"       // Provides access to NT APIs.
+#include "platform.h"    // Provides the declarations of the platform services.
+
+// closefile - Closes a file previously created by "createfile".
+//
+//  - file (IN): The file to close.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID closefile (vldfile_t file)
+{
+    CloseHandle(file);
+}
+
+// createfile - Creates a file, or truncates an existing one, and opens it for
+//   writing.
+//
+//  - file (OUT): Receives the opened file.
+//
+//  - path (IN): Path of the file to create.
+//
+//  Return Value:
+//
+//    Returns TRUE if the file was created. Otherwise returns FALSE.
+//
+BOOL createfile (vldfile_t *file, LPCWSTR path)
+{
+    *file = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    return (*file != INVALID_HANDLE_VALUE);
+}
+
+// createthread - Starts a new thread.
+//
+//  - thread (OUT): Receives the new thread, which must eventually be joined
+//      with "jointhread" or detached with "detachthread".
+//
+//  - threadproc (IN): The thread procedure run by the new thread.
+//
+//  - context (IN): Context passed to the thread procedure.
+//
+//  Return Value:
+//
+//    Returns TRUE if the thread was started. Otherwise returns FALSE.
+//
+BOOL createthread (vldthread_t *thread, vldthreadproc_t threadproc, LPVOID context)
+{
+    *thread = CreateThread(NULL, 0, threadproc, context, 0, NULL);
+
+    return (*thread != NULL);
+}
+
+// currentthreadid - Obtains the ID of the calling thread.
+//
+//  Return Value:
+//
+//    Returns the calling thread's ID.
+//
+DWORD currentthreadid ()
+{
+    return GetCurrentThreadId();
+}
+
+// debugoutputa - Sends an ASCII string to the debugger for display.
+//
+//  - message (IN): The string to be displayed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID debugoutputa (LPCSTR message)
+{
+    OutputDebugStringA(message);
+}
+
+// debugoutputw - Sends a Unicode string to the debugger for display.
+//
+//  - message (IN): The string to be displayed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID debugoutputw (LPCWSTR message)
+{
+    OutputDebugStringW(message);
+}
+
+// delay - Suspends the calling thread for a while.
+//
+//  - milliseconds (IN): The number of milliseconds to suspend the thread for.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID delay (DWORD milliseconds)
+{
+    Sleep(milliseconds);
+}
+
+// deletelock - Releases the resources used by a lock that is no longer needed.
+//
+//  - lock (IN): Pointer to the lock to delete.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID deletelock (vldlock_t *lock)
+{
+    DeleteCriticalSection(lock);
+}
+
+// detachthread - Releases the resources of a thread started by "createthread",
+//   without waiting for it to exit.
+//
+//  - thread (IN): The thread to detach.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID detachthread (vldthread_t thread)
+{
+    CloseHandle(thread);
+}
+
+// enterlock - Acquires a lock, waiting for it if it is held by another thread.
+//   A thread may acquire a lock it already holds. It must then release the
+//   lock once for each time it acquired it.
+//
+//  - lock (IN): Pointer to the lock to acquire.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID enterlock (vldlock_t *lock)
+{
+    EnterCriticalSection(lock);
+}
+
+// getperfcounter - Obtains the current value of the high-resolution
+//   performance counter.
+//
+//  Return Value:
+//
+//    Returns the current value of the performance counter, in ticks.
+//
+ULONGLONG getperfcounter ()
+{
+    LARGE_INTEGER counter;
+
+    QueryPerformanceCounter(&counter);
+
+    return counter.QuadPart;
+}
+
+// getperffrequency - Obtains the frequency of the high-resolution performance
+//   counter.
+//
+//  Return Value:
+//
+//    Returns the frequency of the performance counter, in ticks per second.
+//
+ULONGLONG getperffrequency ()
+{
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceFrequency(&frequency);
+
+    return frequency.QuadPart;
+}
+
+// getprocessorcount - Obtains the number of processors available to the
+//   process.
+//
+//  Return Value:
+//
+//    Returns the number of processors (at least one).
+//
+DWORD getprocessorcount ()
+{
+    SYSTEM_INFO systeminfo;
+
+    GetSystemInfo(&systeminfo);
+
+    return systeminfo.dwNumberOfProcessors;
+}
+
+// getstackbounds - Obtains the range of addresses occupied by the calling
+//   thread's stack. The range is read from the thread's information block, so
+//   this is cheap enough to be done for every stack trace.
+//
+//  - low (OUT): Receives the lowest address of the stack that is currently
+//      committed.
+//
+//  - high (OUT): Receives the address just beyond the base (highest address)
+//      of the stack.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID getstackbounds (SIZE_T *low, SIZE_T *high)
+{
+    NT_TIB *tib = (NT_TIB*)NtCurrentTeb();
+
+    *low = (SIZE_T)tib->StackLimit;
+    *high = (SIZE_T)tib->StackBase;
+}
+
+// gettickcount - Obtains the number of milliseconds elapsed since the system
+//   was started. The count wraps around to zero after 49.7 days.
+//
+//  Return Value:
+//
+//    Returns the tick count.
+//
+DWORD gettickcount ()
+{
+    return GetTickCount();
+}
+
+// heapalloc - Allocates a memory block from a private heap. The heap APIs are
+//   called through their NT implementation so that allocations from the
+//   private heap are never seen by VLD's own IAT patches.
+//
+//  - heap (IN): Handle to the heap from which to allocate the block.
+//
+//  - size (IN): Size, in bytes, of the block to allocate.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL if the allocation
+//    failed.
+//
+LPVOID heapalloc (HANDLE heap, SIZE_T size)
+{
+    return RtlAllocateHeap(heap, 0x0, size);
+}
+
+// heapcreate - Creates a private heap.
+//
+//  Return Value:
+//
+//    Returns a handle to the newly created heap.
+//
+HANDLE heapcreate ()
+{
+    return HeapCreate(0x0, 0, 0);
+}
+
+// heapdestroy - Destroys a private heap previously created by "heapcreate",
+//   along with any blocks still allocated from it.
+//
+//  - heap (IN): Handle to the heap to destroy.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID heapdestroy (HANDLE heap)
+{
+    HeapDestroy(heap);
+}
+
+// heapfree - Frees a memory block previously allocated by "heapalloc".
+//
+//  - heap (IN): Handle to the heap from which the block was allocated.
+//
+//  - mem (IN): Pointer to the block to free.
+//
+//  Return Value:
+//
+//    Returns TRUE if the block was freed. Otherwise returns FALSE.
+//
+BOOL heapfree (HANDLE heap, LPVOID mem)
+{
+    return RtlFreeHeap(heap, 0x0, mem);
+}
+
+// initlock - Initializes a lock.
+//
+//  - lock (IN): Pointer to the lock to initialize.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID initlock (vldlock_t *lock)
+{
+    InitializeCriticalSection(lock);
+}
+
+// jointhread - Waits for a thread started by "createthread" to exit, and
+//   releases the thread's resources.
+//
+//  - thread (IN): The thread to join.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID jointhread (vldthread_t thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+// leavelock - Releases a lock previously acquired by "enterlock".
+//
+//  - lock (IN): Pointer to the lock to release.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID leavelock (vldlock_t *lock)
+{
+    LeaveCriticalSection(lock);
+}
+
+// threadexited - Determines whether a thread started by "createthread" has
+//   exited, whether by returning from its thread procedure or by being
+//   terminated (as all other threads are when the process exits).
+//
+//  - thread (IN): The thread to check.
+//
+//  Return Value:
+//
+//    Returns TRUE if the thread has exited. Otherwise returns FALSE.
+//
+BOOL threadexited (vldthread_t thread)
+{
+    return (WaitForSingleObject(thread, 0) == WAIT_OBJECT_0);
+}
+
+// tlsalloc - Allocates a thread local storage index. Each thread has its own
+//   value for the index, which is initially NULL.
+//
+//  - index (OUT): Receives the allocated index.
+//
+//  - destructor (IN): Function called with a thread's value when the thread
+//      exits. Windows thread local storage has no destructors, so it is
+//      ignored: threads' values are only freed when the process exits.
+//
+//  Return Value:
+//
+//    Returns TRUE if an index was allocated. Otherwise returns FALSE.
+//
+BOOL tlsalloc (vldtls_t *index, vldtlsdestructor_t destructor)
+{
+    UNREFERENCED_PARAMETER(destructor);
+    *index = TlsAlloc();
+
+    return (*index != TLS_OUT_OF_INDEXES);
+}
+
+// tlsfree - Frees a thread local storage index previously allocated by
+//   "tlsalloc".
+//
+//  - index (IN): The index to free.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID tlsfree (vldtls_t index)
+{
+    TlsFree(index);
+}
+
+// tlsgetvalue - Obtains the calling thread's value for a thread local storage
+//   index.
+//
+//  - index (IN): The thread local storage index.
+//
+//  Return Value:
+//
+//    Returns the calling thread's value for the index.
+//
+LPVOID tlsgetvalue (vldtls_t index)
+{
+    return TlsGetValue(index);
+}
+
+// tlssetvalue - Sets the calling thread's value for a thread local storage
+//   index.
+//
+//  - index (IN): The thread local storage index.
+//
+//  - value (IN): The calling thread's new value for the index.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID tlssetvalue (vldtls_t index, LPVOID value)
+{
+    TlsSetValue(index, value);
+}
+
+// tryenterlock - Acquires a lock, unless it is held by another thread.
+//
+//  - lock (IN): Pointer to the lock to acquire.
+//
+//  Return Value:
+//
+//    Returns TRUE if the lock was acquired, in which case it must be released
+//    by "leavelock". Returns FALSE if another thread holds the lock.
+//
+BOOL tryenterlock (vldlock_t *lock)
+{
+    return TryEnterCriticalSection(lock);
+}
+
+// writefile - Writes data to a file previously created by "createfile".
+//
+//  - file (IN): The file to write to.
+//
+//  - data (IN): Pointer to the data to write.
+//
+//  - size (IN): Size, in bytes, of the data.
+//
+//  Return Value:
+//
+//    Returns TRUE if all of the data was written. Otherwise returns FALSE.
+//
+BOOL writefile (vldfile_t file, LPCVOID data, SIZE_T size)
+{
+    const BYTE *remaining = (const BYTE*)data;
+    DWORD       written;
+
+    while (size != 0) {
+        if (!WriteFile(file, remaining, (size > MAXDWORD) ? MAXDWORD : (DWORD)size, &written, NULL) ||
+            (written == 0)) {
+            return FALSE;
+        }
+        remaining += written;
+        size -= written;
+    }
+
+    return TRUE;
+}
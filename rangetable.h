@@ -0,0 +1,304 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - RangeTable Class Definition
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+"This header should only be included by Visual Leak Detector when building it from source. \
+Applications should never include this header."
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include "platform.h" // Provides the platform services and, on POSIX systems, the Win32 types.
+#include "vldheap.h"  // Provides internal new and delete operators.
+
+#define RANGELISTRESERVE 16 // Initial number of ranges a RangeList can hold.
+
+// A range of addresses, such as the code of a function.
+typedef struct addressrange_s {
+    SIZE_T high; // Address just beyond the end of the range.
+    SIZE_T low;  // Lowest address within the range.
+} addressrange_t;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The RangeTable Class
+//
+//    A RangeTable is a sorted array of address ranges, such as the ranges of
+//    code occupied by the functions whose frames are left out of call stacks.
+//    Finding whether an address lies within one of the ranges is a binary
+//    search, which takes no lock and allocates nothing, so that it can be done
+//    for every frame while the stack is being walked.
+//
+//    A RangeTable is never modified once it has been built. Ranges are added
+//    (when a module is loaded, for example) by building a new RangeTable that
+//    supersedes the current one. Threads walking the stack may still be
+//    searching a superseded table, so its owner must not free it until they
+//    are done (see VisualLeakDetector::setranges).
+//
+class RangeTable
+{
+public:
+    // Constructor - Builds a table holding the ranges of a superseded table,
+    //   plus the specified ranges. Overlapping or adjacent ranges are merged.
+    //
+    //  - superseded (IN): Pointer to the table being superseded, whose ranges
+    //      are copied into the new table. May be NULL.
+    //
+    //  - ranges (IN): Array of the ranges to be added. Empty ranges are
+    //      ignored.
+    //
+    //  - count (IN): Number of elements in the "ranges" array.
+    //
+    RangeTable (const RangeTable *superseded, const addressrange_t *ranges, SIZE_T count)
+    {
+        SIZE_T index;
+        SIZE_T merged = 0;
+        SIZE_T total = count;
+
+        if (superseded != NULL) {
+            total += superseded->m_count;
+        }
+        m_ranges = new addressrange_t [(total != 0) ? total : 1];
+        m_count = 0;
+        for (index = 0; (superseded != NULL) && (index < superseded->m_count); index++) {
+            m_ranges[m_count++] = superseded->m_ranges[index];
+        }
+        for (index = 0; index < count; index++) {
+            if (ranges[index].low < ranges[index].high) {
+                m_ranges[m_count++] = ranges[index];
+            }
+        }
+
+        // Sort the ranges by address, and merge the ones that overlap.
+        qsort(m_ranges, m_count, sizeof(addressrange_t), compareranges);
+        for (index = 0; index < m_count; index++) {
+            if ((merged != 0) && (m_ranges[index].low <= m_ranges[merged - 1].high)) {
+                if (m_ranges[index].high > m_ranges[merged - 1].high) {
+                    m_ranges[merged - 1].high = m_ranges[index].high;
+                }
+            }
+            else {
+                m_ranges[merged++] = m_ranges[index];
+            }
+        }
+        m_count = merged;
+    }
+
+    ~RangeTable ()
+    {
+        delete [] m_ranges;
+    }
+
+    // operator [] - Obtains one of the table's (merged) ranges, in order of
+    //   address.
+    //
+    //  - index (IN): Index of the range to obtain.
+    //
+    //  Return Value:
+    //
+    //    Returns a reference to the range.
+    //
+    const addressrange_t& operator [] (SIZE_T index) const
+    {
+        return m_ranges[index];
+    }
+
+    // contains - Determines whether an address lies within any of the table's
+    //   ranges.
+    //
+    //  - address (IN): The address to look for.
+    //
+    //  Return Value:
+    //
+    //    Returns TRUE if the address lies within one of the ranges. Otherwise
+    //    returns FALSE.
+    //
+    BOOL contains (SIZE_T address) const
+    {
+        SIZE_T high = m_count;
+        SIZE_T low = 0;
+        SIZE_T middle;
+
+        while (low < high) {
+            middle = low + (high - low) / 2;
+            if (address < m_ranges[middle].low) {
+                high = middle;
+            }
+            else if (address >= m_ranges[middle].high) {
+                low = middle + 1;
+            }
+            else {
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    }
+
+    // size - Obtains the number of (merged) ranges in the table.
+    //
+    //  Return Value:
+    //
+    //    Returns the number of ranges in the table.
+    //
+    SIZE_T size () const
+    {
+        return m_count;
+    }
+
+private:
+    // Tables are never copied (they are superseded instead).
+    RangeTable (const RangeTable &);
+    RangeTable& operator = (const RangeTable &);
+
+    // Private Helper Functions
+    static int compareranges (const void *first, const void *second)
+    {
+        SIZE_T firstlow = ((const addressrange_t*)first)->low;
+        SIZE_T secondlow = ((const addressrange_t*)second)->low;
+
+        if (firstlow < secondlow) {
+            return -1;
+        }
+        if (firstlow > secondlow) {
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // Private Data
+    SIZE_T          m_count;  // Number of ranges in the table.
+    addressrange_t *m_ranges; // The ranges, sorted by address, none overlapping another.
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The RangeList Class
+//
+//    A RangeList collects address ranges, as they are found, before they are
+//    added to a RangeTable. It grows as needed and is freed once the table has
+//    been built.
+//
+class RangeList
+{
+public:
+    RangeList ()
+    {
+        m_capacity = 0;
+        m_count = 0;
+        m_ranges = NULL;
+    }
+
+    ~RangeList ()
+    {
+        delete [] m_ranges;
+    }
+
+    // add - Adds a range to the list.
+    //
+    //  - low (IN): Lowest address within the range.
+    //
+    //  - high (IN): Address just beyond the end of the range.
+    //
+    //  Return Value:
+    //
+    //    None.
+    //
+    VOID add (SIZE_T low, SIZE_T high)
+    {
+        addressrange_t *ranges;
+
+        if (m_count == m_capacity) {
+            // Grow the array of ranges.
+            m_capacity = (m_capacity != 0) ? m_capacity * 2 : RANGELISTRESERVE;
+            ranges = new addressrange_t [m_capacity];
+            if (m_count != 0) {
+                memcpy(ranges, m_ranges, m_count * sizeof(addressrange_t));
+            }
+            delete [] m_ranges;
+            m_ranges = ranges;
+        }
+        m_ranges[m_count].high = high;
+        m_ranges[m_count].low = low;
+        m_count++;
+    }
+
+    // contains - Determines whether an address lies within any of the ranges
+    //   collected so far. The list isn't sorted, so this is a linear search.
+    //
+    //  - address (IN): The address to look for.
+    //
+    //  Return Value:
+    //
+    //    Returns TRUE if the address lies within one of the ranges. Otherwise
+    //    returns FALSE.
+    //
+    BOOL contains (SIZE_T address) const
+    {
+        SIZE_T index;
+
+        for (index = 0; index < m_count; index++) {
+            if ((address >= m_ranges[index].low) && (address < m_ranges[index].high)) {
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    }
+
+    // ranges - Obtains the ranges collected so far.
+    //
+    //  Return Value:
+    //
+    //    Returns a pointer to the array of ranges, which remains valid until
+    //    another range is added.
+    //
+    const addressrange_t* ranges () const
+    {
+        return m_ranges;
+    }
+
+    // size - Obtains the number of ranges collected so far.
+    //
+    //  Return Value:
+    //
+    //    Returns the number of ranges in the list.
+    //
+    SIZE_T size () const
+    {
+        return m_count;
+    }
+
+private:
+    RangeList (const RangeList &);
+    RangeList& operator = (const RangeList &);
+
+    // Private Data
+    SIZE_T          m_capacity; // Number of ranges the array can hold.
+    SIZE_T          m_count;    // Number of ranges in the array.
+    addressrange_t *m_ranges;   // The ranges, in the order they were added.
+};
@@ -230,7 +230,7 @@ public:
         //
         Tk& operator * ()
         {
-            return m_node->key;
+            return this->m_node->key;
         }
     };
 
@@ -331,6 +331,17 @@ public:
         return m_tree.reserve(count);
     }
 
+    // size - Obtains the number of keys currently stored in the Set.
+    //
+    //  Return Value:
+    //
+    //    Returns the number of keys currently stored in the Set.
+    //
+    SIZE_T size () const
+    {
+        return m_tree.size();
+    }
+
 private:
     // Private data
     Tree<Tk> m_tree; // The keys are actually stored in a tree.
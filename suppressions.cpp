@@ -0,0 +1,344 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - SuppressionList Class Implementation
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#define VLDBUILD           // Declares that we are building Visual Leak Detector.
+#include "suppressions.h"  // Provides the SuppressionList class definition.
+#include "utility.h"       // Provides various utility functions.
+#include "vldheap.h"       // Provides internal new and delete operators.
+
+// Constructor - Initializes private data. The list is empty until "load" is
+//   called.
+//
+SuppressionList::SuppressionList ()
+{
+    m_framecapacity       = 0;
+    m_framecount          = 0;
+    m_frames              = NULL;
+    m_suppressioncapacity = 0;
+    m_suppressioncount    = 0;
+    m_suppressions        = NULL;
+}
+
+// Destructor - Frees the signatures.
+//
+SuppressionList::~SuppressionList ()
+{
+    SIZE_T index;
+
+    for (index = 0; index < m_framecount; index++) {
+        delete [] m_frames[index].pattern;
+    }
+    delete [] m_frames;
+    delete [] m_suppressions;
+}
+
+// addframe - Parses a line of the suppression file into a frame, and adds it
+//   to the signature being loaded.
+//
+//  - text (IN): The line, without any surrounding white space.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID SuppressionList::addframe (LPCSTR text)
+{
+    SIZE_T              digit;
+    suppressionframe_t *frame;
+    suppressionframe_t *frames;
+    SIZE_T              length;
+    SIZE_T              offset = 0;
+    LPCSTR              plus;
+    LPCSTR              position;
+
+    if (m_framecount == m_framecapacity) {
+        // Grow the array of frames.
+        m_framecapacity = (m_framecapacity != 0) ? m_framecapacity * 2 : SUPPRESSIONLISTRESERVE;
+        frames = new suppressionframe_t [m_framecapacity];
+        if (m_framecount != 0) {
+            memcpy(frames, m_frames, m_framecount * sizeof(suppressionframe_t));
+        }
+        delete [] m_frames;
+        m_frames = frames;
+    }
+    frame = &m_frames[m_framecount++];
+    frame->offset = 0;
+    frame->type = SUPPRESSION_FRAME_FUNCTION;
+    length = strlen(text);
+    if (strcmp(text, "...") == 0) {
+        frame->type = SUPPRESSION_FRAME_ANY;
+        length = 0;
+    }
+    else if (((plus = strrchr(text, '+')) != NULL) && (plus != text) && (plus[1] == '0') &&
+             ((plus[2] == 'x') || (plus[2] == 'X')) && (plus[3] != '\0')) {
+        // Frames given by module and offset end in "+0x" and hexadecimal
+        // digits. Anything else (such as "operator+") is a function name.
+        for (position = plus + 3; *position != '\0'; position++) {
+            if ((*position >= '0') && (*position <= '9')) {
+                digit = *position - '0';
+            }
+            else if ((*position >= 'a') && (*position <= 'f')) {
+                digit = *position - 'a' + 10;
+            }
+            else if ((*position >= 'A') && (*position <= 'F')) {
+                digit = *position - 'A' + 10;
+            }
+            else {
+                break;
+            }
+            offset = (offset << 4) | digit;
+        }
+        if (*position == '\0') {
+            frame->offset = offset;
+            frame->type = SUPPRESSION_FRAME_MODULE;
+            length = plus - text;
+        }
+    }
+    frame->pattern = new CHAR [length + 1];
+    memcpy(frame->pattern, text, length);
+    frame->pattern[length] = '\0';
+}
+
+// addsuppression - Adds the signature that has just been loaded to the list.
+//
+//  - first (IN): Index of the signature's first frame. The signature is made
+//      of every frame added since. If there are none, nothing is added.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID SuppressionList::addsuppression (SIZE_T first)
+{
+    suppression_t *suppressions;
+
+    if (m_framecount == first) {
+        return;
+    }
+    if (m_suppressioncount == m_suppressioncapacity) {
+        // Grow the array of suppressions.
+        m_suppressioncapacity = (m_suppressioncapacity != 0) ? m_suppressioncapacity * 2 : SUPPRESSIONLISTRESERVE;
+        suppressions = new suppression_t [m_suppressioncapacity];
+        if (m_suppressioncount != 0) {
+            memcpy(suppressions, m_suppressions, m_suppressioncount * sizeof(suppression_t));
+        }
+        delete [] m_suppressions;
+        m_suppressions = suppressions;
+    }
+    m_suppressions[m_suppressioncount].count = m_framecount - first;
+    m_suppressions[m_suppressioncount].first = first;
+    m_suppressioncount++;
+}
+
+// load - Loads the signatures from a suppression file (see the description of
+//   the SuppressionList class for its format), adding them to the list.
+//
+//  - path (IN): Path of the suppression file.
+//
+//  Return Value:
+//
+//    Returns TRUE if the file was read. Otherwise returns FALSE.
+//
+BOOL SuppressionList::load (LPCWSTR path)
+{
+    LPSTR  end;
+    FILE  *file;
+    SIZE_T first;
+    CHAR   line [MAXSUPPRESSIONLINE];
+    LPSTR  text;
+
+#ifdef _WIN32
+    if (_wfopen_s(&file, path, L"r") != 0) {
+        return FALSE;
+    }
+#else
+    if (wcstombs(line, path, MAXSUPPRESSIONLINE) == (SIZE_T)-1) {
+        return FALSE;
+    }
+    line[MAXSUPPRESSIONLINE - 1] = '\0';
+    if ((file = fopen(line, "r")) == NULL) {
+        return FALSE;
+    }
+#endif // _WIN32
+
+    first = m_framecount;
+    while (fgets(line, MAXSUPPRESSIONLINE, file) != NULL) {
+        // Strip the white space (and the line ending) around the line.
+        text = line;
+        while ((*text == ' ') || (*text == '\t')) {
+            text++;
+        }
+        end = text + strlen(text);
+        while ((end > text) && ((end[-1] == ' ') || (end[-1] == '\t') || (end[-1] == '\r') || (end[-1] == '\n'))) {
+            end--;
+        }
+        *end = '\0';
+
+        if (*text == '\0') {
+            // A blank line ends the signature.
+            addsuppression(first);
+            first = m_framecount;
+        }
+        else if ((*text != ';') && (*text != '#')) {
+            addframe(text);
+        }
+    }
+    addsuppression(first);
+    fclose(file);
+
+    return TRUE;
+}
+
+// match - Determines whether a call stack matches any of the signatures.
+//
+//  - callstack (IN): The call stack to match.
+//
+//  Return Value:
+//
+//    Returns TRUE if the call stack matches one of the signatures. Otherwise
+//    returns FALSE.
+//
+BOOL SuppressionList::match (const CallStack *callstack) const
+{
+    BOOL        *described;
+    SIZE_T       index;
+    frameinfo_t *infos;
+    BOOL         matched = FALSE;
+
+    if (m_suppressioncount == 0) {
+        return FALSE;
+    }
+
+    // Each frame is described the first time a signature needs it, and the
+    // description is kept for the other signatures.
+    described = new BOOL [callstack->size() + 1];
+    memset(described, 0x0, (callstack->size() + 1) * sizeof(BOOL));
+    infos = new frameinfo_t [callstack->size() + 1];
+    for (index = 0; index < m_suppressioncount; index++) {
+        if (matchsuppression(&m_suppressions[index], callstack, infos, described)) {
+            matched = TRUE;
+            break;
+        }
+    }
+    delete [] described;
+    delete [] infos;
+
+    return matched;
+}
+
+// matchframe - Determines whether a frame of a call stack matches a frame of a
+//   signature (other than "...").
+//
+//  - frame (IN): The signature's frame.
+//
+//  - callstack (IN): The call stack.
+//
+//  - index (IN): Index of the call stack's frame.
+//
+//  - infos (IN/OUT): Descriptions of the call stack's frames.
+//
+//  - described (IN/OUT): Indicates which of the call stack's frames have
+//      already been described.
+//
+//  Return Value:
+//
+//    Returns TRUE if the frames match. Otherwise returns FALSE.
+//
+BOOL SuppressionList::matchframe (const suppressionframe_t *frame, const CallStack *callstack, UINT32 index,
+                                  frameinfo_t *infos, BOOL *described) const
+{
+    if (!described[index]) {
+        callstack->describeframe(index, &infos[index]);
+        described[index] = TRUE;
+    }
+    if (frame->type == SUPPRESSION_FRAME_MODULE) {
+        return ((infos[index].offset == frame->offset) && (infos[index].module[0] != '\0') &&
+                matchpattern(frame->pattern, infos[index].module)) ? TRUE : FALSE;
+    }
+
+    return matchpattern(frame->pattern, infos[index].function);
+}
+
+// matchsuppression - Determines whether the leading frames of a call stack
+//   match a signature. Like "*" in a pattern, "..." first tries to match no
+//   frames at all, and then one more frame each time the rest of the signature
+//   fails to match.
+//
+//  - suppression (IN): The signature.
+//
+//  - callstack (IN): The call stack.
+//
+//  - infos (IN/OUT): Descriptions of the call stack's frames.
+//
+//  - described (IN/OUT): Indicates which of the call stack's frames have
+//      already been described.
+//
+//  Return Value:
+//
+//    Returns TRUE if the call stack matches the signature. Otherwise returns
+//    FALSE.
+//
+BOOL SuppressionList::matchsuppression (const suppression_t *suppression, const CallStack *callstack,
+                                        frameinfo_t *infos, BOOL *described) const
+{
+    const suppressionframe_t *frames = &m_frames[suppression->first];
+    UINT32                    index = 0;
+    SIZE_T                    position = 0;
+    UINT32                    retryindex = 0;
+    SIZE_T                    retryposition = 0;
+
+    while (position < suppression->count) {
+        if (frames[position].type == SUPPRESSION_FRAME_ANY) {
+            position++;
+            retryposition = position;
+            retryindex = index;
+        }
+        else if ((index < callstack->size()) && matchframe(&frames[position], callstack, index, infos, described)) {
+            position++;
+            index++;
+        }
+        else if ((retryposition != 0) && (retryindex < callstack->size())) {
+            position = retryposition;
+            index = ++retryindex;
+        }
+        else {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+// size - Obtains the number of signatures in the list.
+//
+//  Return Value:
+//
+//    Returns the number of signatures.
+//
+SIZE_T SuppressionList::size () const
+{
+    return m_suppressioncount;
+}
@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - SuppressionList Class Definition
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+"This header should only be included by Visual Leak Detector when building it from source. \
+Applications should never include this header."
+#endif
+
+#include "callstack.h" // Provides a class for handling call stacks.
+#include "platform.h"  // Provides the platform services and, on POSIX systems, the Win32 types.
+
+#define MAXSUPPRESSIONLINE      1024 // Maximum length, in characters, of a line of a suppression file.
+#define SUPPRESSIONLISTRESERVE  16   // Initial number of frames (and of suppressions) a SuppressionList can hold.
+
+// Each frame of a suppression's signature is matched against one frame of a
+// call stack or, for "...", against any number of frames.
+typedef struct suppressionframe_s {
+    SIZE_T offset;                     // Offset of the program counter within the module (module frames only).
+    LPSTR  pattern;                    // Pattern the function name (or module name, for module frames) must match.
+    UINT32 type;                       // Type of frame:
+#define SUPPRESSION_FRAME_ANY      0x1 //   Matches any number of frames, including none.
+#define SUPPRESSION_FRAME_FUNCTION 0x2 //   Matches a frame in a function whose name matches the pattern.
+#define SUPPRESSION_FRAME_MODULE   0x3 //   Matches the frame at the offset within a module matching the pattern.
+} suppressionframe_t;
+
+// A suppression is a signature made of consecutive frames of the list.
+typedef struct suppression_s {
+    SIZE_T count; // Number of frames in the signature.
+    SIZE_T first; // Index of the signature's first frame.
+} suppression_t;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The SuppressionList Class
+//
+//    A SuppressionList holds the signatures of known, accepted leaks, loaded
+//    from a suppression file. Leaks whose call stacks match any of the
+//    signatures are left out of leak reports.
+//
+//    In the suppression file, each signature is a block of lines, one per
+//    frame, starting from the frame nearest to the allocation. Blocks are
+//    separated by blank lines. Lines starting with ";" or "#" are comments.
+//    Each frame is one of:
+//
+//      - A function name, in which "*" matches any sequence of characters and
+//        "?" matches any single character (e.g. "CConfig::*").
+//      - A module name and the offset of a program counter from the module's
+//        base address, in hexadecimal (e.g. "libfoo.so+0x1a2b").
+//      - "...", which matches any number of frames, including none.
+//
+//    A signature matches a call stack if its frames match the call stack's
+//    leading frames. The rest of the call stack doesn't matter.
+//
+//    Matching a call stack requires its frames to be symbolized, which is
+//    expensive. Only the frames the signatures need are symbolized, and only
+//    once however many signatures they are matched against. Callers should
+//    remember the outcome for each call stack, rather than matching the same
+//    call stack again.
+//
+class SuppressionList
+{
+public:
+    SuppressionList ();
+    ~SuppressionList ();
+
+    // Public APIs - see each function definition for details.
+    BOOL load (LPCWSTR path);
+    BOOL match (const CallStack *callstack) const;
+    SIZE_T size () const;
+
+private:
+    // Private functions - see each function definition for details.
+    VOID addframe (LPCSTR text);
+    VOID addsuppression (SIZE_T first);
+    BOOL matchframe (const suppressionframe_t *frame, const CallStack *callstack, UINT32 index, frameinfo_t *infos,
+                     BOOL *described) const;
+    BOOL matchsuppression (const suppression_t *suppression, const CallStack *callstack, frameinfo_t *infos,
+                           BOOL *described) const;
+
+    // Private data.
+    SIZE_T              m_framecapacity;       // Number of frames "m_frames" can hold.
+    SIZE_T              m_framecount;          // Number of frames in "m_frames".
+    suppressionframe_t *m_frames;              // The frames of all signatures.
+    SIZE_T              m_suppressioncapacity; // Number of suppressions "m_suppressions" can hold.
+    SIZE_T              m_suppressioncount;    // Number of suppressions in "m_suppressions".
+    suppression_t      *m_suppressions;        // The suppressions.
+};
@@ -0,0 +1,1752 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Symbolizer Class Implementation
+//  Copyright (c) 2005-2006 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>      // Provides __cxa_demangle, for demangling C++ function names.
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>        // Provides dl_iterate_phdr, and the native ELF types.
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VLDBUILD
+#include "symbolizer.h"  // This class' header.
+#include "vldheap.h"     // Provides internal new and delete operators.
+
+#define BUFFERMINCAPACITY 0x1000           // Initial capacity, in bytes, of growable buffers.
+#define DEBUGFILEPREFIX   "/usr/lib/debug/.build-id/" // Directory holding separate debugging information files.
+#define NOFILE            ((UINT32)-1)     // File table index of lines whose source file is unknown.
+
+// DWARF constants used by the line number program (see the DWARF standard,
+// section 6.2).
+#define DW_FORM_block      0x09
+#define DW_FORM_data1      0x0b
+#define DW_FORM_data2      0x05
+#define DW_FORM_data4      0x06
+#define DW_FORM_data8      0x07
+#define DW_FORM_data16     0x1e
+#define DW_FORM_line_strp  0x1f
+#define DW_FORM_string     0x08
+#define DW_FORM_strp       0x0e
+#define DW_FORM_udata      0x0f
+#define DW_LNCT_directory_index 0x2
+#define DW_LNCT_path            0x1
+#define DW_LNE_define_file  0x03
+#define DW_LNE_end_sequence 0x01
+#define DW_LNE_set_address  0x02
+#define DW_LNS_advance_line      0x03
+#define DW_LNS_advance_pc        0x02
+#define DW_LNS_const_add_pc      0x08
+#define DW_LNS_copy              0x01
+#define DW_LNS_fixed_advance_pc  0x09
+#define DW_LNS_set_file          0x04
+
+// A growable buffer, allocated from VLD's private heap, into which the tables
+// of a symbol image are collected.
+typedef struct buffer_s {
+    PBYTE  data;     // The buffer's contents.
+    SIZE_T capacity; // Size, in bytes, of the allocated buffer.
+    SIZE_T size;     // Size, in bytes, of the contents.
+} buffer_t;
+
+// A memory-mapped ELF file.
+typedef struct elffile_s {
+    PBYTE              base;     // Address at which the file is mapped (NULL if the file is not open).
+    const ElfW(Shdr)  *sections; // The file's section header table.
+    UINT               count;    // Number of entries in the section header table.
+    SIZE_T             size;     // Size, in bytes, of the file.
+} elffile_t;
+
+// Context passed through dl_iterate_phdr by "Symbolizer::enummodules".
+typedef struct enumcontext_s {
+    LPVOID                    context;    // Context to pass to the callback function.
+    Symbolizer::moduleproc_t  moduleproc; // Callback function called for each module.
+} enumcontext_t;
+
+// The process-wide Symbolizer. It is constructed before, and destroyed after,
+// VisualLeakDetector, which has the next initialization priority.
+__attribute__((init_priority(101))) Symbolizer symbolizer;
+
+// Local helper functions.
+static LPVOID appendbuffer (buffer_t *buffer, LPCVOID data, SIZE_T size);
+static ULONGLONG appendstring (buffer_t *strings, LPCSTR string);
+static BOOL buildimage (const Symbolizer::moduleinfo_t *moduleinfo, PBYTE *image, SIZE_T *imagesize);
+static VOID closeelf (elffile_t *elf);
+static int comparefunctions (const void *first, const void *second);
+static int comparelines (const void *first, const void *second);
+static VOID describemodule (struct dl_phdr_info *info, Symbolizer::moduleinfo_t *moduleinfo);
+static int enummodulescallback (struct dl_phdr_info *info, size_t size, void *context);
+static BOOL findsection (const elffile_t *elf, LPCSTR name, const BYTE **data, SIZE_T *size);
+static int findmodulecallback (struct dl_phdr_info *info, size_t size, void *context);
+static VOID freebuffer (buffer_t *buffer);
+static VOID imagetables (PBYTE image, Symbolizer::imagefunction_t **functions, Symbolizer::imageline_t **lines,
+                         ULONGLONG **files, LPCSTR *strings);
+static VOID makedirectories (LPCSTR path);
+static BOOL openelf (LPCSTR path, elffile_t *elf);
+static VOID readfunctions (const elffile_t *elf, buffer_t *functions, buffer_t *strings);
+static VOID readlines (const elffile_t *elf, buffer_t *lines, buffer_t *files, buffer_t *strings);
+static BOOL readlineunit (const BYTE *unit, const BYTE *end, BOOL dwarf64, const BYTE *linestrings,
+                          SIZE_T linestringsize, const BYTE *strings, SIZE_T stringsize, buffer_t *lines,
+                          buffer_t *files, buffer_t *names);
+static BOOL readpath (const BYTE **cursor, const BYTE *end, UINT form, BOOL dwarf64, const BYTE *linestrings,
+                      SIZE_T linestringsize, const BYTE *strings, SIZE_T stringsize, LPCSTR *path);
+static ULONGLONG readsleb128 (const BYTE **cursor, const BYTE *end);
+static ULONGLONG readuleb128 (const BYTE **cursor, const BYTE *end);
+static ULONGLONG readunsigned (const BYTE **cursor, const BYTE *end, SIZE_T size);
+static VOID stripparameters (LPSTR name);
+
+// Constructor - Initializes the Symbolizer with no modules and no symbol cache.
+//
+Symbolizer::Symbolizer ()
+{
+    m_cachedirectory[0] = '\0';
+    m_foreign = FALSE;
+    initlock(&m_lock);
+    m_modules = NULL;
+}
+
+// Destructor - Frees the symbol images of all modules. The lock is left alone,
+//   as threads that are still running may be tracing (but not dumping) call
+//   stacks while the process exits.
+//
+Symbolizer::~Symbolizer ()
+{
+    cleanup();
+}
+
+// addmodule - Adds a module that is not loaded into this process, such as a
+//   module of a traced process whose call stacks are being analyzed offline.
+//   The module's symbol image is loaded from the symbol cache, under the
+//   module's build ID, or built from the module's file. Once a module has been
+//   added, addresses are only looked up in the added modules, never in the
+//   modules loaded into this process.
+//
+//  - moduleinfo (IN): Describes the module, as it was loaded into the other
+//      process ("address" and "found" are ignored).
+//
+//  Return Value:
+//
+//    None.
+//
+VOID Symbolizer::addmodule (const moduleinfo_t *moduleinfo)
+{
+    enterlock(&m_lock);
+    m_foreign = TRUE;
+    loadmodule(moduleinfo);
+    leavelock(&m_lock);
+}
+
+// cleanup - Frees the symbol images of all modules. Modules are looked up in
+//   again, and their symbol images are reloaded, as needed. Added modules are
+//   forgotten.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID Symbolizer::cleanup ()
+{
+    module_t *module;
+
+    enterlock(&m_lock);
+    while (m_modules != NULL) {
+        module = m_modules;
+        m_modules = module->next;
+        if (module->mapped) {
+            munmap(module->image, module->size);
+        }
+        else {
+            delete [] module->image;
+        }
+        delete module;
+    }
+    m_foreign = FALSE;
+    leavelock(&m_lock);
+}
+
+// enumfunctions - Enumerates the functions of a module, along with the source
+//   file each one was compiled from. The module's symbol image is loaded, if it
+//   hasn't been already.
+//
+//   Note: The callback function is called with the Symbolizer's lock held, so
+//     it must not call back into the Symbolizer.
+//
+//  - moduleaddress (IN): Any address within the module.
+//
+//  - functionproc (IN): Callback function called for each function, with its
+//      name, the path of its source file (NULL if unknown), and the run-time
+//      addresses of its first byte and of the byte just beyond its end.
+//
+//  - context (IN): Context passed to the callback function.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID Symbolizer::enumfunctions (SIZE_T moduleaddress, functionproc_t functionproc, LPVOID context)
+{
+    ULONGLONG        count;
+    LPCSTR           filename;
+    ULONGLONG       *files;
+    imagefunction_t *functions;
+    imageheader_t   *header;
+    ULONGLONG        high;
+    ULONGLONG        index;
+    imageline_t     *lines;
+    ULONGLONG        low;
+    ULONGLONG        middle;
+    module_t        *module;
+    LPCSTR           strings;
+
+    enterlock(&m_lock);
+    module = findmodule(moduleaddress);
+    if ((module != NULL) && (module->image != NULL)) {
+        header = (imageheader_t*)module->image;
+        imagetables(module->image, &functions, &lines, &files, &strings);
+        count = header->functioncount;
+        for (index = 0; index < count; index++) {
+            // Binary search for the last line starting at, or before, the
+            // function's first byte.
+            low = 0;
+            high = header->linecount;
+            while (low < high) {
+                middle = low + (high - low) / 2;
+                if (lines[middle].address <= functions[index].address) {
+                    low = middle + 1;
+                }
+                else {
+                    high = middle;
+                }
+            }
+            filename = NULL;
+            if ((low > 0) && (lines[low - 1].line != 0) && (lines[low - 1].file < header->filecount)) {
+                filename = strings + files[lines[low - 1].file];
+            }
+            functionproc(strings + functions[index].name, filename, (SIZE_T)functions[index].address + module->bias,
+                         (SIZE_T)(functions[index].address + functions[index].size) + module->bias, context);
+        }
+    }
+    leavelock(&m_lock);
+}
+
+// enummodules - Enumerates the modules loaded into the process.
+//
+//  - moduleproc (IN): Callback function called for each module.
+//
+//  - context (IN): Context passed to the callback function.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID Symbolizer::enummodules (moduleproc_t moduleproc, LPVOID context)
+{
+    enumcontext_t enumcontext;
+
+    enumcontext.context = context;
+    enumcontext.moduleproc = moduleproc;
+    dl_iterate_phdr(enummodulescallback, &enumcontext);
+}
+
+// findfunction - Looks up the name of the function containing the specified
+//   address. C++ function names are demangled, without their parameter lists,
+//   as the Debug Help Library reports them.
+//
+//  - programcounter (IN): The address to look up.
+//
+//  - functionname (OUT): Receives a pointer to the function's name. The name
+//      remains valid until the Symbolizer is cleaned up.
+//
+//  Return Value:
+//
+//    Returns TRUE if the function was found. Otherwise returns FALSE.
+//
+BOOL Symbolizer::findfunction (SIZE_T programcounter, LPCSTR *functionname)
+{
+    ULONGLONG        address;
+    ULONGLONG        count;
+    ULONGLONG       *files;
+    BOOL             found = FALSE;
+    imagefunction_t *functions;
+    ULONGLONG        high;
+    imageline_t     *lines;
+    ULONGLONG        low;
+    ULONGLONG        middle;
+    module_t        *module;
+    LPCSTR           strings;
+
+    enterlock(&m_lock);
+    module = findmodule(programcounter);
+    if ((module != NULL) && (module->image != NULL)) {
+        // Binary search for the last function starting at, or before, the
+        // address.
+        imagetables(module->image, &functions, &lines, &files, &strings);
+        address = programcounter - module->bias;
+        count = ((imageheader_t*)module->image)->functioncount;
+        low = 0;
+        high = count;
+        while (low < high) {
+            middle = low + (high - low) / 2;
+            if (functions[middle].address <= address) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        if ((low > 0) && (address < functions[low - 1].address + functions[low - 1].size)) {
+            *functionname = strings + functions[low - 1].name;
+            found = TRUE;
+        }
+    }
+    leavelock(&m_lock);
+
+    return found;
+}
+
+// findline - Looks up the source file and line number from which the code at
+//   the specified address was generated.
+//
+//  - programcounter (IN): The address to look up.
+//
+//  - filename (OUT): Receives a pointer to the path of the source file. The
+//      path remains valid until the Symbolizer is cleaned up.
+//
+//  - line (OUT): Receives the line number.
+//
+//  Return Value:
+//
+//    Returns TRUE if the source file and line number were found. Otherwise
+//    returns FALSE.
+//
+BOOL Symbolizer::findline (SIZE_T programcounter, LPCSTR *filename, DWORD *line)
+{
+    ULONGLONG        address;
+    ULONGLONG       *files;
+    BOOL             found = FALSE;
+    imagefunction_t *functions;
+    imageheader_t   *header;
+    ULONGLONG        high;
+    imageline_t     *lines;
+    ULONGLONG        low;
+    ULONGLONG        middle;
+    module_t        *module;
+    LPCSTR           strings;
+
+    enterlock(&m_lock);
+    module = findmodule(programcounter);
+    if ((module != NULL) && (module->image != NULL)) {
+        // Binary search for the last line starting at, or before, the address.
+        // If that is the end of a sequence, then the address isn't covered by
+        // the line number table.
+        header = (imageheader_t*)module->image;
+        imagetables(module->image, &functions, &lines, &files, &strings);
+        address = programcounter - module->bias;
+        low = 0;
+        high = header->linecount;
+        while (low < high) {
+            middle = low + (high - low) / 2;
+            if (lines[middle].address <= address) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        if ((low > 0) && (lines[low - 1].line != 0) && (lines[low - 1].file < header->filecount)) {
+            *filename = strings + files[lines[low - 1].file];
+            *line = lines[low - 1].line;
+            found = TRUE;
+        }
+    }
+    leavelock(&m_lock);
+
+    return found;
+}
+
+// findmodule - Finds the module containing the specified address. The first
+//   time an address in a module is looked up, the module's symbol image is
+//   loaded from the symbol cache, or built from the module's symbol table and
+//   debugging information (and then saved to the symbol cache).
+//
+//   Note: The caller must hold the Symbolizer's lock.
+//
+//  - programcounter (IN): The address to look up.
+//
+//  Return Value:
+//
+//    Returns a pointer to the module_t describing the module, or NULL if the
+//    address isn't inside any loaded module.
+//
+Symbolizer::module_t* Symbolizer::findmodule (SIZE_T programcounter)
+{
+    module_t     *module;
+    moduleinfo_t  moduleinfo;
+
+    for (module = m_modules; module != NULL; module = module->next) {
+        if ((programcounter >= module->low) && (programcounter < module->high)) {
+            return module;
+        }
+    }
+    if (m_foreign) {
+        // Only the added modules are looked up in.
+        return NULL;
+    }
+
+    // This module hasn't been looked up in yet.
+    memset(&moduleinfo, 0x0, sizeof(moduleinfo));
+    moduleinfo.address = programcounter;
+    dl_iterate_phdr(findmodulecallback, &moduleinfo);
+    if (!moduleinfo.found) {
+        return NULL;
+    }
+
+    return loadmodule(&moduleinfo);
+}
+
+// loadcachedimage - Maps a module's symbol image from the symbol cache.
+//
+//  - module (IN/OUT): The module whose symbol image is to be loaded.
+//
+//  - cachepath (IN): Path of the module's symbol cache file.
+//
+//  Return Value:
+//
+//    Returns TRUE if a valid symbol image was loaded. Otherwise returns FALSE.
+//
+BOOL Symbolizer::loadcachedimage (module_t *module, LPCSTR cachepath)
+{
+    int            file;
+    imageheader_t *header;
+    LPVOID         image;
+    struct stat    s;
+    ULONGLONG      size;
+
+    file = open(cachepath, O_RDONLY | O_CLOEXEC);
+    if (file == -1) {
+        return FALSE;
+    }
+    if ((fstat(file, &s) != 0) || ((SIZE_T)s.st_size < sizeof(imageheader_t))) {
+        close(file);
+        return FALSE;
+    }
+    image = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (image == MAP_FAILED) {
+        return FALSE;
+    }
+
+    // Make sure that the file is a complete symbol image in the current
+    // format. Each table's size is checked separately to rule out overflows.
+    header = (imageheader_t*)image;
+    size = sizeof(imageheader_t);
+    if ((memcmp(header->magic, SYMBOLCACHEMAGIC, sizeof(header->magic)) != 0) ||
+        (header->version != SYMBOLCACHEVERSION) ||
+        (header->functioncount > (ULONGLONG)s.st_size / sizeof(imagefunction_t)) ||
+        (header->linecount > (ULONGLONG)s.st_size / sizeof(imageline_t)) ||
+        (header->stringsize > (ULONGLONG)s.st_size)) {
+        munmap(image, s.st_size);
+        return FALSE;
+    }
+    size += header->functioncount * sizeof(imagefunction_t) + header->linecount * sizeof(imageline_t) +
+            header->filecount * sizeof(ULONGLONG) + header->stringsize;
+    if ((size != (ULONGLONG)s.st_size) || (header->stringsize == 0) ||
+        (((LPCSTR)image)[s.st_size - 1] != '\0')) {
+        munmap(image, s.st_size);
+        return FALSE;
+    }
+
+    module->image  = (PBYTE)image;
+    module->mapped = TRUE;
+    module->size   = s.st_size;
+
+    return TRUE;
+}
+
+// loadmodule - Adds a module to the list of modules looked up in. Its symbol
+//   image is loaded from the symbol cache, or built from the module's symbol
+//   table and debugging information (and then saved to the symbol cache).
+//
+//   Note: The caller must hold the Symbolizer's lock.
+//
+//  - moduleinfo (IN): Describes the module.
+//
+//  Return Value:
+//
+//    Returns a pointer to the module_t describing the module.
+//
+Symbolizer::module_t* Symbolizer::loadmodule (const moduleinfo_t *moduleinfo)
+{
+    CHAR      cachepath [MAX_PATH];
+    SIZE_T    index;
+    SIZE_T    length;
+    module_t *module;
+
+    module = new module_t;
+    module->bias   = moduleinfo->bias;
+    module->high   = moduleinfo->high;
+    module->image  = NULL;
+    module->low    = moduleinfo->low;
+    module->mapped = FALSE;
+    module->size   = 0;
+
+    // Symbol images are cached under the module's build ID.
+    cachepath[0] = '\0';
+    if ((m_cachedirectory[0] != '\0') && (moduleinfo->buildidsize != 0)) {
+        length = snprintf(cachepath, MAX_PATH, "%s/", m_cachedirectory);
+        for (index = 0; (index < moduleinfo->buildidsize) && (length + 2 < MAX_PATH); index++) {
+            length += snprintf(cachepath + length, MAX_PATH - length, "%02x", moduleinfo->buildid[index]);
+        }
+        snprintf(cachepath + length, MAX_PATH - length, ".sym");
+    }
+    if ((cachepath[0] == '\0') || !loadcachedimage(module, cachepath)) {
+        if (buildimage(moduleinfo, &module->image, &module->size) && (cachepath[0] != '\0')) {
+            saveimage(module, cachepath);
+        }
+    }
+
+    module->next = m_modules;
+    m_modules = module;
+
+    return module;
+}
+
+// saveimage - Saves a module's symbol image to the symbol cache. The image is
+//   written to a temporary file, which then replaces the cache file, so that
+//   processes running concurrently never see a partially written image.
+//
+//  - module (IN): The module whose symbol image is to be saved.
+//
+//  - cachepath (IN): Path of the module's symbol cache file.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID Symbolizer::saveimage (const module_t *module, LPCSTR cachepath)
+{
+    int     file;
+    SIZE_T  offset = 0;
+    CHAR    temporarypath [MAX_PATH];
+    ssize_t written;
+
+    makedirectories(m_cachedirectory);
+    snprintf(temporarypath, MAX_PATH, "%s.%d", cachepath, (int)getpid());
+    file = open(temporarypath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file == -1) {
+        return;
+    }
+    while (offset < module->size) {
+        written = write(file, module->image + offset, module->size - offset);
+        if (written <= 0) {
+            if ((written == -1) && (errno == EINTR)) {
+                continue;
+            }
+            break;
+        }
+        offset += written;
+    }
+    close(file);
+    if ((offset != module->size) || (rename(temporarypath, cachepath) != 0)) {
+        unlink(temporarypath);
+    }
+}
+
+// setcachedirectory - Sets the directory in which symbol images are cached.
+//   The directory is created when the first image is saved to it.
+//
+//  - directory (IN): Path of the directory. If NULL or empty, then symbol
+//      images are not cached.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID Symbolizer::setcachedirectory (LPCSTR directory)
+{
+    enterlock(&m_lock);
+    if (directory == NULL) {
+        m_cachedirectory[0] = '\0';
+    }
+    else {
+        strncpy(m_cachedirectory, directory, MAX_PATH - 1);
+        m_cachedirectory[MAX_PATH - 1] = '\0';
+    }
+    leavelock(&m_lock);
+}
+
+// appendbuffer - Appends data to a growable buffer, growing it as needed.
+//
+//  - buffer (IN/OUT): The buffer to append to.
+//
+//  - data (IN): The data to append. If NULL, then the appended space is left
+//      uninitialized.
+//
+//  - size (IN): Size, in bytes, of the data.
+//
+//  Return Value:
+//
+//    Returns a pointer to the appended data, within the buffer.
+//
+LPVOID appendbuffer (buffer_t *buffer, LPCVOID data, SIZE_T size)
+{
+    SIZE_T capacity;
+    PBYTE  grown;
+
+    if (buffer->size + size > buffer->capacity) {
+        capacity = (buffer->capacity != 0) ? buffer->capacity : BUFFERMINCAPACITY;
+        while (capacity < buffer->size + size) {
+            capacity *= 2;
+        }
+        grown = new BYTE [capacity];
+        if (buffer->data != NULL) {
+            memcpy(grown, buffer->data, buffer->size);
+            delete [] buffer->data;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    if (data != NULL) {
+        memcpy(buffer->data + buffer->size, data, size);
+    }
+    buffer->size += size;
+
+    return buffer->data + buffer->size - size;
+}
+
+// appendstring - Appends a NUL-terminated string to a string table.
+//
+//  - strings (IN/OUT): The string table.
+//
+//  - string (IN): The string to append.
+//
+//  Return Value:
+//
+//    Returns the offset of the string within the string table.
+//
+ULONGLONG appendstring (buffer_t *strings, LPCSTR string)
+{
+    SIZE_T offset = strings->size;
+
+    appendbuffer(strings, string, strlen(string) + 1);
+
+    return offset;
+}
+
+// buildimage - Builds the symbol image of a module, from its symbol table and
+//   the line number information in its debugging information. If the module
+//   has no debugging information, then its separate debugging information
+//   file, if installed, is used instead.
+//
+//  - moduleinfo (IN): Describes the module.
+//
+//  - image (OUT): Receives a pointer to the symbol image, allocated from VLD's
+//      private heap.
+//
+//  - imagesize (OUT): Receives the size, in bytes, of the symbol image.
+//
+//  Return Value:
+//
+//    Returns TRUE if the symbol image was built. Returns FALSE if the module's
+//    file could not be read or if it has no symbols at all.
+//
+BOOL buildimage (const Symbolizer::moduleinfo_t *moduleinfo, PBYTE *image, SIZE_T *imagesize)
+{
+    SIZE_T                      count;
+    elffile_t                   debugfile = { NULL, NULL, 0, 0 };
+    buffer_t                    files = { NULL, 0, 0 };
+    buffer_t                    functions = { NULL, 0, 0 };
+    Symbolizer::imageheader_t  *header;
+    SIZE_T                      index;
+    SIZE_T                      length;
+    buffer_t                    lines = { NULL, 0, 0 };
+    elffile_t                   module;
+    UINT                        part;
+    const buffer_t             *parts [4];
+    CHAR                        path [MAX_PATH];
+    const BYTE                 *section;
+    SIZE_T                      sectionsize;
+    buffer_t                    strings = { NULL, 0, 0 };
+    Symbolizer::imagefunction_t *unique;
+
+    if (!openelf(moduleinfo->path, &module)) {
+        return FALSE;
+    }
+    if (!findsection(&module, ".debug_line", &section, &sectionsize) && (moduleinfo->buildidsize > 1)) {
+        // Look for the separate debugging information file. Its name is made
+        // from the build ID, in hexadecimal, after the first byte.
+        length = snprintf(path, MAX_PATH, DEBUGFILEPREFIX "%02x/", moduleinfo->buildid[0]);
+        for (index = 1; (index < moduleinfo->buildidsize) && (length + 2 < MAX_PATH); index++) {
+            length += snprintf(path + length, MAX_PATH - length, "%02x", moduleinfo->buildid[index]);
+        }
+        snprintf(path + length, MAX_PATH - length, ".debug");
+        openelf(path, &debugfile);
+    }
+
+    // Offset zero of the string table is an empty string, used for unknown
+    // names.
+    appendstring(&strings, "");
+    if (debugfile.base != NULL) {
+        readfunctions(&debugfile, &functions, &strings);
+        readlines(&debugfile, &lines, &files, &strings);
+        closeelf(&debugfile);
+    }
+    if (functions.size == 0) {
+        readfunctions(&module, &functions, &strings);
+    }
+    if (lines.size == 0) {
+        readlines(&module, &lines, &files, &strings);
+    }
+    closeelf(&module);
+
+    if ((functions.size == 0) && (lines.size == 0)) {
+        freebuffer(&files);
+        freebuffer(&functions);
+        freebuffer(&lines);
+        freebuffer(&strings);
+        return FALSE;
+    }
+
+    // Sort the tables for binary searching. Of the functions at the same
+    // address (aliases), only the first is kept.
+    count = functions.size / sizeof(Symbolizer::imagefunction_t);
+    if (count != 0) {
+        qsort(functions.data, count, sizeof(Symbolizer::imagefunction_t), comparefunctions);
+    }
+    unique = (Symbolizer::imagefunction_t*)functions.data;
+    for (index = 1, length = (count != 0) ? 1 : 0; index < count; index++) {
+        if (unique[index].address != unique[length - 1].address) {
+            unique[length++] = unique[index];
+        }
+    }
+    functions.size = length * sizeof(Symbolizer::imagefunction_t);
+    if (lines.size != 0) {
+        qsort(lines.data, lines.size / sizeof(Symbolizer::imageline_t), sizeof(Symbolizer::imageline_t), comparelines);
+    }
+
+    // Lay out the symbol image.
+    *imagesize = sizeof(Symbolizer::imageheader_t) + functions.size + lines.size + files.size + strings.size;
+    *image = new BYTE [*imagesize];
+    header = (Symbolizer::imageheader_t*)*image;
+    memset(header, 0x0, sizeof(Symbolizer::imageheader_t));
+    memcpy(header->magic, SYMBOLCACHEMAGIC, sizeof(header->magic));
+    header->version       = SYMBOLCACHEVERSION;
+    header->filecount     = (UINT32)(files.size / sizeof(ULONGLONG));
+    header->functioncount = functions.size / sizeof(Symbolizer::imagefunction_t);
+    header->linecount     = lines.size / sizeof(Symbolizer::imageline_t);
+    header->stringsize    = strings.size;
+    index = sizeof(Symbolizer::imageheader_t);
+    parts[0] = &functions;
+    parts[1] = &lines;
+    parts[2] = &files;
+    parts[3] = &strings;
+    for (part = 0; part < sizeof(parts) / sizeof(parts[0]); part++) {
+        if (parts[part]->size != 0) {
+            // Empty buffers have no storage to copy from.
+            memcpy(*image + index, parts[part]->data, parts[part]->size);
+            index += parts[part]->size;
+        }
+    }
+
+    freebuffer(&files);
+    freebuffer(&functions);
+    freebuffer(&lines);
+    freebuffer(&strings);
+
+    return TRUE;
+}
+
+// closeelf - Unmaps an ELF file mapped by "openelf".
+//
+//  - elf (IN/OUT): The ELF file.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID closeelf (elffile_t *elf)
+{
+    if (elf->base != NULL) {
+        munmap(elf->base, elf->size);
+        elf->base = NULL;
+    }
+}
+
+// comparefunctions - Orders functions by address, for qsort.
+//
+//  - first (IN): The first function.
+//
+//  - second (IN): The second function.
+//
+//  Return Value:
+//
+//    Returns a negative value, zero or a positive value if the first function
+//    is at a lower, the same, or a higher address than the second.
+//
+int comparefunctions (const void *first, const void *second)
+{
+    const Symbolizer::imagefunction_t *function1 = (const Symbolizer::imagefunction_t*)first;
+    const Symbolizer::imagefunction_t *function2 = (const Symbolizer::imagefunction_t*)second;
+
+    if (function1->address != function2->address) {
+        return (function1->address < function2->address) ? -1 : 1;
+    }
+
+    // Larger functions first, so that aliases of a whole function win over
+    // local labels.
+    if (function1->size != function2->size) {
+        return (function1->size > function2->size) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// comparelines - Orders lines by address, for qsort. At the same address, the
+//   end of one sequence comes before the start of another.
+//
+//  - first (IN): The first line.
+//
+//  - second (IN): The second line.
+//
+//  Return Value:
+//
+//    Returns a negative value, zero or a positive value if the first line
+//    sorts before, with, or after the second.
+//
+int comparelines (const void *first, const void *second)
+{
+    const Symbolizer::imageline_t *line1 = (const Symbolizer::imageline_t*)first;
+    const Symbolizer::imageline_t *line2 = (const Symbolizer::imageline_t*)second;
+
+    if (line1->address != line2->address) {
+        return (line1->address < line2->address) ? -1 : 1;
+    }
+    if ((line1->line == 0) != (line2->line == 0)) {
+        return (line1->line == 0) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// describemodule - Collects information about a loaded module: its address
+//   range, path and build ID.
+//
+//  - info (IN): Describes the module, as passed to dl_iterate_phdr callbacks.
+//
+//  - moduleinfo (OUT): Receives the information about the module.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID describemodule (struct dl_phdr_info *info, Symbolizer::moduleinfo_t *moduleinfo)
+{
+    SIZE_T             end;
+    SIZE_T             high = 0;
+    UINT               index;
+    ssize_t            length;
+    SIZE_T             low = (SIZE_T)-1;
+    const ElfW(Nhdr)  *note;
+    const BYTE        *notes;
+    const BYTE        *notesend;
+    const ElfW(Phdr)  *segment;
+    SIZE_T             start;
+
+    for (index = 0; index < info->dlpi_phnum; index++) {
+        segment = &info->dlpi_phdr[index];
+        if (segment->p_type == PT_LOAD) {
+            start = info->dlpi_addr + segment->p_vaddr;
+            end = start + segment->p_memsz;
+            if (start < low) {
+                low = start;
+            }
+            if (end > high) {
+                high = end;
+            }
+        }
+    }
+    moduleinfo->bias = info->dlpi_addr;
+    moduleinfo->buildidsize = 0;
+    moduleinfo->high = high;
+    moduleinfo->low  = low;
+    if ((info->dlpi_name == NULL) || (info->dlpi_name[0] == '\0')) {
+        // The main program has no name.
+        length = readlink("/proc/self/exe", moduleinfo->path, MAX_PATH - 1);
+        moduleinfo->path[(length > 0) ? length : 0] = '\0';
+    }
+    else {
+        strncpy(moduleinfo->path, info->dlpi_name, MAX_PATH - 1);
+        moduleinfo->path[MAX_PATH - 1] = '\0';
+    }
+
+    // The build ID is found in the notes, which are loaded into memory.
+    for (index = 0; index < info->dlpi_phnum; index++) {
+        segment = &info->dlpi_phdr[index];
+        if (segment->p_type != PT_NOTE) {
+            continue;
+        }
+        notes = (const BYTE*)(info->dlpi_addr + segment->p_vaddr);
+        notesend = notes + segment->p_memsz;
+        while (notes + sizeof(ElfW(Nhdr)) <= notesend) {
+            note = (const ElfW(Nhdr)*)notes;
+            notes += sizeof(ElfW(Nhdr)) + ((note->n_namesz + 3) & ~3) + ((note->n_descsz + 3) & ~3);
+            if ((note->n_type == NT_GNU_BUILD_ID) && (note->n_namesz == 4) &&
+                (memcmp(note + 1, "GNU", 4) == 0) && (note->n_descsz <= SYMBOLMAXBUILDIDSIZE) &&
+                (notes <= notesend)) {
+                memcpy(moduleinfo->buildid, (const BYTE*)(note + 1) + 4, note->n_descsz);
+                moduleinfo->buildidsize = note->n_descsz;
+                return;
+            }
+        }
+    }
+}
+
+// enummodulescallback - Callback function for dl_iterate_phdr. Collects
+//   information about each loaded module, and passes it on to the callback
+//   function given to "Symbolizer::enummodules".
+//
+//  - info (IN): Describes the module.
+//
+//  - size (IN): Size of the structure pointed to by "info".
+//
+//  - context (IN): Pointer to the enumcontext_t holding the callback function.
+//
+//  Return Value:
+//
+//    Always returns zero, to continue the enumeration.
+//
+int enummodulescallback (struct dl_phdr_info *info, size_t, void *context)
+{
+    enumcontext_t            *enumcontext = (enumcontext_t*)context;
+    Symbolizer::moduleinfo_t  moduleinfo;
+
+    memset(&moduleinfo, 0x0, sizeof(moduleinfo));
+    describemodule(info, &moduleinfo);
+    moduleinfo.address = moduleinfo.low;
+    moduleinfo.found = TRUE;
+    enumcontext->moduleproc(&moduleinfo, enumcontext->context);
+
+    return 0;
+}
+
+// findmodulecallback - Callback function for dl_iterate_phdr. Checks whether
+//   a loaded module contains the address being looked up and, if so, collects
+//   information about the module.
+//
+//  - info (IN): Describes the module.
+//
+//  - size (IN): Size of the structure pointed to by "info".
+//
+//  - context (IN/OUT): Pointer to the moduleinfo_t being filled in.
+//
+//  Return Value:
+//
+//    Returns non-zero, to stop the enumeration, once the module has been
+//    found. Otherwise returns zero.
+//
+int findmodulecallback (struct dl_phdr_info *info, size_t, void *context)
+{
+    SIZE_T                    end;
+    UINT                      index;
+    Symbolizer::moduleinfo_t *moduleinfo = (Symbolizer::moduleinfo_t*)context;
+    const ElfW(Phdr)         *segment;
+    SIZE_T                    start;
+
+    for (index = 0; index < info->dlpi_phnum; index++) {
+        segment = &info->dlpi_phdr[index];
+        if (segment->p_type == PT_LOAD) {
+            start = info->dlpi_addr + segment->p_vaddr;
+            end = start + segment->p_memsz;
+            if ((moduleinfo->address >= start) && (moduleinfo->address < end)) {
+                describemodule(info, moduleinfo);
+                moduleinfo->found = TRUE;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// findsection - Finds a section of an ELF file, by name.
+//
+//  - elf (IN): The ELF file.
+//
+//  - name (IN): Name of the section.
+//
+//  - data (OUT): Receives a pointer to the section's contents.
+//
+//  - size (OUT): Receives the size, in bytes, of the section's contents.
+//
+//  Return Value:
+//
+//    Returns TRUE if the section was found, and its contents are present in
+//    the file. Compressed sections are not supported, so they are treated as
+//    absent.
+//
+BOOL findsection (const elffile_t *elf, LPCSTR name, const BYTE **data, SIZE_T *size)
+{
+    const ElfW(Ehdr) *header = (const ElfW(Ehdr)*)elf->base;
+    UINT              index;
+    const ElfW(Shdr) *names;
+
+    if (header->e_shstrndx >= elf->count) {
+        return FALSE;
+    }
+    names = &elf->sections[header->e_shstrndx];
+    for (index = 0; index < elf->count; index++) {
+        if ((elf->sections[index].sh_name >= names->sh_size) ||
+            (strncmp((LPCSTR)elf->base + names->sh_offset + elf->sections[index].sh_name, name,
+                     names->sh_size - elf->sections[index].sh_name) != 0)) {
+            continue;
+        }
+        if ((elf->sections[index].sh_type == SHT_NOBITS) || (elf->sections[index].sh_flags & SHF_COMPRESSED) ||
+            (elf->sections[index].sh_offset + elf->sections[index].sh_size > elf->size)) {
+            return FALSE;
+        }
+        *data = elf->base + elf->sections[index].sh_offset;
+        *size = elf->sections[index].sh_size;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// freebuffer - Frees a growable buffer.
+//
+//  - buffer (IN/OUT): The buffer to free.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID freebuffer (buffer_t *buffer)
+{
+    if (buffer->data != NULL) {
+        delete [] buffer->data;
+    }
+    buffer->data = NULL;
+    buffer->capacity = 0;
+    buffer->size = 0;
+}
+
+// imagetables - Locates the tables within a symbol image.
+//
+//  - image (IN): The symbol image.
+//
+//  - functions (OUT): Receives a pointer to the function table.
+//
+//  - lines (OUT): Receives a pointer to the line table.
+//
+//  - files (OUT): Receives a pointer to the file table.
+//
+//  - strings (OUT): Receives a pointer to the string table.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID imagetables (PBYTE image, Symbolizer::imagefunction_t **functions, Symbolizer::imageline_t **lines,
+                  ULONGLONG **files, LPCSTR *strings)
+{
+    Symbolizer::imageheader_t *header = (Symbolizer::imageheader_t*)image;
+
+    *functions = (Symbolizer::imagefunction_t*)(header + 1);
+    *lines = (Symbolizer::imageline_t*)(*functions + header->functioncount);
+    *files = (ULONGLONG*)(*lines + header->linecount);
+    *strings = (LPCSTR)(*files + header->filecount);
+}
+
+// makedirectories - Creates a directory, along with any missing directories
+//   above it.
+//
+//  - path (IN): Path of the directory.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID makedirectories (LPCSTR path)
+{
+    CHAR   directory [MAX_PATH];
+    LPSTR  separator;
+
+    snprintf(directory, MAX_PATH, "%s", path);
+    for (separator = strchr(directory + 1, '/'); separator != NULL; separator = strchr(separator + 1, '/')) {
+        *separator = '\0';
+        mkdir(directory, 0755);
+        *separator = '/';
+    }
+    mkdir(directory, 0755);
+}
+
+// openelf - Maps an ELF file into memory, and checks that it is an ELF file
+//   for the architecture that VLD was built for.
+//
+//  - path (IN): Path of the file.
+//
+//  - elf (OUT): Receives the mapped file.
+//
+//  Return Value:
+//
+//    Returns TRUE if the file was mapped. Otherwise returns FALSE.
+//
+BOOL openelf (LPCSTR path, elffile_t *elf)
+{
+    int               file;
+    const ElfW(Ehdr) *header;
+    LPVOID            mapped;
+    struct stat       s;
+
+    elf->base = NULL;
+    file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file == -1) {
+        return FALSE;
+    }
+    if ((fstat(file, &s) != 0) || ((SIZE_T)s.st_size < sizeof(ElfW(Ehdr)))) {
+        close(file);
+        return FALSE;
+    }
+    mapped = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED) {
+        return FALSE;
+    }
+
+    header = (const ElfW(Ehdr)*)mapped;
+    if ((memcmp(header->e_ident, ELFMAG, SELFMAG) != 0) ||
+        (header->e_ident[EI_CLASS] != ((sizeof(SIZE_T) == 8) ? ELFCLASS64 : ELFCLASS32)) ||
+        (header->e_shentsize != sizeof(ElfW(Shdr))) ||
+        (header->e_shoff + (SIZE_T)header->e_shnum * sizeof(ElfW(Shdr)) > (SIZE_T)s.st_size)) {
+        munmap(mapped, s.st_size);
+        return FALSE;
+    }
+
+    elf->base     = (PBYTE)mapped;
+    elf->count    = header->e_shnum;
+    elf->sections = (const ElfW(Shdr)*)(elf->base + header->e_shoff);
+    elf->size     = s.st_size;
+
+    return TRUE;
+}
+
+// readfunctions - Reads the function symbols from an ELF file's symbol table.
+//   If the file has no full symbol table (because it was stripped), then the
+//   dynamic symbol table, which only holds the exported functions, is read.
+//
+//  - elf (IN): The ELF file.
+//
+//  - functions (IN/OUT): The function table to which the functions are added.
+//
+//  - strings (IN/OUT): The string table to which the functions' names are
+//      added.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID readfunctions (const elffile_t *elf, buffer_t *functions, buffer_t *strings)
+{
+    CHAR                         *demangled;
+    Symbolizer::imagefunction_t   function;
+    UINT                          index;
+    LPCSTR                        name;
+    const ElfW(Shdr)             *names;
+    int                           status;
+    const ElfW(Sym)              *symbol;
+    const ElfW(Shdr)             *symbols = NULL;
+    SIZE_T                        symbolindex;
+
+    for (index = 0; index < elf->count; index++) {
+        if (elf->sections[index].sh_type == SHT_SYMTAB) {
+            symbols = &elf->sections[index];
+            break;
+        }
+        if (elf->sections[index].sh_type == SHT_DYNSYM) {
+            symbols = &elf->sections[index];
+        }
+    }
+    if ((symbols == NULL) || (symbols->sh_link >= elf->count) ||
+        (symbols->sh_offset + symbols->sh_size > elf->size)) {
+        return;
+    }
+    names = &elf->sections[symbols->sh_link];
+    if ((names->sh_type != SHT_STRTAB) || (names->sh_offset + names->sh_size > elf->size)) {
+        return;
+    }
+
+    for (symbolindex = 0; symbolindex < symbols->sh_size / sizeof(ElfW(Sym)); symbolindex++) {
+        symbol = (const ElfW(Sym)*)(elf->base + symbols->sh_offset) + symbolindex;
+        if (((ELF64_ST_TYPE(symbol->st_info) != STT_FUNC) && (ELF64_ST_TYPE(symbol->st_info) != STT_GNU_IFUNC)) ||
+            (symbol->st_shndx == SHN_UNDEF) || (symbol->st_size == 0) || (symbol->st_name >= names->sh_size)) {
+            continue;
+        }
+        name = (LPCSTR)elf->base + names->sh_offset + symbol->st_name;
+        if (memchr(name, '\0', names->sh_size - symbol->st_name) == NULL) {
+            continue;
+        }
+
+        function.address = symbol->st_value;
+        function.size = symbol->st_size;
+        demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+        if (demangled != NULL) {
+            stripparameters(demangled);
+            function.name = appendstring(strings, demangled);
+            free(demangled);
+        }
+        else {
+            function.name = appendstring(strings, name);
+        }
+        appendbuffer(functions, &function, sizeof(function));
+    }
+}
+
+// readlines - Reads the line number table from an ELF file's DWARF debugging
+//   information (the .debug_line section). Each unit of the section holds the
+//   line number program of one compilation unit. DWARF versions 2 to 5 are
+//   supported.
+//
+//  - elf (IN): The ELF file.
+//
+//  - lines (IN/OUT): The line table to which the lines are added.
+//
+//  - files (IN/OUT): The file table to which the source files are added.
+//
+//  - strings (IN/OUT): The string table to which the source files' paths are
+//      added.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID readlines (const elffile_t *elf, buffer_t *lines, buffer_t *files, buffer_t *strings)
+{
+    const BYTE *cursor;
+    BOOL        dwarf64;
+    const BYTE *end;
+    const BYTE *linestrings = NULL;
+    SIZE_T      linestringsize = 0;
+    const BYTE *section;
+    SIZE_T      sectionsize;
+    const BYTE *stringsection = NULL;
+    SIZE_T      stringsize = 0;
+    ULONGLONG   unitlength;
+
+    if (!findsection(elf, ".debug_line", &section, &sectionsize)) {
+        return;
+    }
+    findsection(elf, ".debug_line_str", &linestrings, &linestringsize);
+    findsection(elf, ".debug_str", &stringsection, &stringsize);
+
+    cursor = section;
+    end = section + sectionsize;
+    while (cursor + 4 <= end) {
+        // Each unit begins with its length, in the 32-bit or 64-bit format.
+        unitlength = readunsigned(&cursor, end, 4);
+        dwarf64 = FALSE;
+        if (unitlength == 0xffffffff) {
+            unitlength = readunsigned(&cursor, end, 8);
+            dwarf64 = TRUE;
+        }
+        if (unitlength > (ULONGLONG)(end - cursor)) {
+            break;
+        }
+        readlineunit(cursor, cursor + unitlength, dwarf64, linestrings, linestringsize, stringsection, stringsize,
+                     lines, files, strings);
+        cursor += unitlength;
+    }
+}
+
+// readlineunit - Reads one unit of the line number table: its header, which
+//   lists the unit's source files, and its line number program, which is run
+//   to generate the unit's lines.
+//
+//  - unit (IN): Start of the unit, just after its length.
+//
+//  - end (IN): End of the unit.
+//
+//  - dwarf64 (IN): Set if the unit is in the 64-bit DWARF format.
+//
+//  - linestrings, linestringsize (IN): The .debug_line_str section, if any.
+//
+//  - strings, stringsize (IN): The .debug_str section, if any.
+//
+//  - lines, files, names (IN/OUT): The line, file and string tables to which
+//      the unit's lines and source files are added.
+//
+//  Return Value:
+//
+//    Returns TRUE if the unit was read. Returns FALSE if it is malformed, or
+//    uses features that aren't supported.
+//
+BOOL readlineunit (const BYTE *unit, const BYTE *end, BOOL dwarf64, const BYTE *linestrings,
+                   SIZE_T linestringsize, const BYTE *strings, SIZE_T stringsize, buffer_t *lines,
+                   buffer_t *files, buffer_t *names)
+{
+    ULONGLONG                address = 0;
+    ULONGLONG                adjusted;
+    const BYTE              *cursor = unit;
+    ULONGLONG                count;
+    ULONGLONG                directory;
+    buffer_t                 directories = { NULL, 0, 0 };
+    LPCSTR                   directoryname;
+    UINT                     entry;
+    UINT                     entryformat [16][2];
+    UINT                     entryformatcount;
+    ULONGLONG                file = 1;
+    LPCSTR                   filename;
+    ULONGLONG                headerlength;
+    ULONGLONG                index;
+    ULONGLONG                length;
+    LONGLONG                 line = 1;
+    INT                      linebase;
+    UINT                     linerange;
+    UINT                     mininstructionlength;
+    Symbolizer::imageline_t  newline;
+    const BYTE              *next;
+    UINT                     opcode;
+    UINT                     opcodebase;
+    const BYTE              *opcodelengths;
+    CHAR                     path [MAX_PATH];
+    const BYTE              *program;
+    ULONGLONG                pathoffset;
+    Symbolizer::imageline_t *previous;
+    BOOL                     success = FALSE;
+    buffer_t                 unitfiles = { NULL, 0, 0 };
+    UINT32                   unitfile;
+    UINT                     version;
+
+    // Read the header.
+    version = (UINT)readunsigned(&cursor, end, 2);
+    if ((version < 2) || (version > 5)) {
+        return FALSE;
+    }
+    if (version >= 5) {
+        // Skip the address size and segment selector size.
+        cursor += 2;
+    }
+    headerlength = readunsigned(&cursor, end, dwarf64 ? 8 : 4);
+    if (headerlength > (ULONGLONG)(end - cursor)) {
+        return FALSE;
+    }
+    program = cursor + headerlength;
+    mininstructionlength = (UINT)readunsigned(&cursor, end, 1);
+    if (version >= 4) {
+        // Skip the maximum number of operations per instruction. VLIW
+        // architectures aren't supported.
+        cursor++;
+    }
+    cursor++; // Skip the default value of the is_stmt register.
+    linebase = (INT)(signed char)readunsigned(&cursor, end, 1);
+    linerange = (UINT)readunsigned(&cursor, end, 1);
+    opcodebase = (UINT)readunsigned(&cursor, end, 1);
+    opcodelengths = cursor;
+    if ((linerange == 0) || (opcodebase == 0) || (cursor + opcodebase - 1 > program)) {
+        return FALSE;
+    }
+    cursor += opcodebase - 1;
+
+    // Read the include directories and source files. In DWARF 5, they are
+    // described by lists of (content type, form) pairs, and indices start
+    // from zero. Before DWARF 5, they are lists of strings, and file indices
+    // start from one (directory zero is the compilation directory).
+    if (version >= 5) {
+        for (entry = 0; entry < 2; entry++) {
+            entryformatcount = (UINT)readunsigned(&cursor, program, 1);
+            if (entryformatcount > 16) {
+                goto done;
+            }
+            for (index = 0; index < entryformatcount; index++) {
+                entryformat[index][0] = (UINT)readuleb128(&cursor, program);
+                entryformat[index][1] = (UINT)readuleb128(&cursor, program);
+            }
+            count = readuleb128(&cursor, program);
+            for (; count > 0; count--) {
+                directory = 0;
+                filename = "";
+                for (index = 0; index < entryformatcount; index++) {
+                    if (entryformat[index][0] == DW_LNCT_path) {
+                        if (!readpath(&cursor, program, entryformat[index][1], dwarf64, linestrings, linestringsize,
+                                      strings, stringsize, &filename)) {
+                            goto done;
+                        }
+                    }
+                    else if ((entryformat[index][0] == DW_LNCT_directory_index) &&
+                             ((entryformat[index][1] == DW_FORM_udata) || (entryformat[index][1] == DW_FORM_data1) ||
+                              (entryformat[index][1] == DW_FORM_data2))) {
+                        directory = (entryformat[index][1] == DW_FORM_udata) ? readuleb128(&cursor, program) :
+                                    readunsigned(&cursor, program, (entryformat[index][1] == DW_FORM_data1) ? 1 : 2);
+                    }
+                    else {
+                        // Skip any other content.
+                        switch (entryformat[index][1]) {
+                        case DW_FORM_block:  length = readuleb128(&cursor, program); break;
+                        case DW_FORM_data1:  length = 1; break;
+                        case DW_FORM_data2:  length = 2; break;
+                        case DW_FORM_data4:  length = 4; break;
+                        case DW_FORM_data8:  length = 8; break;
+                        case DW_FORM_data16: length = 16; break;
+                        case DW_FORM_udata:  readuleb128(&cursor, program); length = 0; break;
+                        case DW_FORM_line_strp:
+                        case DW_FORM_strp:
+                        case DW_FORM_string:
+                            if (!readpath(&cursor, program, entryformat[index][1], dwarf64, linestrings,
+                                          linestringsize, strings, stringsize, &directoryname)) {
+                                goto done;
+                            }
+                            length = 0;
+                            break;
+                        default:
+                            goto done;
+                        }
+                        if (length > (ULONGLONG)(program - cursor)) {
+                            goto done;
+                        }
+                        cursor += length;
+                    }
+                }
+                if (entry == 0) {
+                    appendbuffer(&directories, &filename, sizeof(filename));
+                    continue;
+                }
+                directoryname = (directory < directories.size / sizeof(LPCSTR)) ?
+                                ((LPCSTR*)directories.data)[directory] : "";
+                if ((filename[0] == '/') || (directoryname[0] == '\0')) {
+                    snprintf(path, MAX_PATH, "%s", filename);
+                }
+                else {
+                    snprintf(path, MAX_PATH, "%s/%s", directoryname, filename);
+                }
+                pathoffset = appendstring(names, path);
+                unitfile = (UINT32)(files->size / sizeof(ULONGLONG));
+                appendbuffer(files, &pathoffset, sizeof(pathoffset));
+                appendbuffer(&unitfiles, &unitfile, sizeof(unitfile));
+            }
+        }
+    }
+    else {
+        // Directory zero, the compilation directory, isn't listed.
+        directoryname = "";
+        appendbuffer(&directories, &directoryname, sizeof(directoryname));
+        while ((cursor < program) && (*cursor != '\0')) {
+            directoryname = (LPCSTR)cursor;
+            cursor += strnlen(directoryname, program - cursor) + 1;
+            appendbuffer(&directories, &directoryname, sizeof(directoryname));
+        }
+        cursor++;
+        // File zero doesn't exist.
+        unitfile = NOFILE;
+        appendbuffer(&unitfiles, &unitfile, sizeof(unitfile));
+        while ((cursor < program) && (*cursor != '\0')) {
+            filename = (LPCSTR)cursor;
+            cursor += strnlen(filename, program - cursor) + 1;
+            directory = readuleb128(&cursor, program);
+            readuleb128(&cursor, program); // Modification time.
+            readuleb128(&cursor, program); // File size.
+            directoryname = (directory < directories.size / sizeof(LPCSTR)) ?
+                            ((LPCSTR*)directories.data)[directory] : "";
+            if ((filename[0] == '/') || (directoryname[0] == '\0')) {
+                snprintf(path, MAX_PATH, "%s", filename);
+            }
+            else {
+                snprintf(path, MAX_PATH, "%s/%s", directoryname, filename);
+            }
+            pathoffset = appendstring(names, path);
+            unitfile = (UINT32)(files->size / sizeof(ULONGLONG));
+            appendbuffer(files, &pathoffset, sizeof(pathoffset));
+            appendbuffer(&unitfiles, &unitfile, sizeof(unitfile));
+        }
+    }
+
+    // Run the line number program. Each row it generates is added to the line
+    // table, unless it merely repeats the previous row's line.
+    cursor = program;
+    while (cursor < end) {
+        opcode = *cursor++;
+        if (opcode >= opcodebase) {
+            // Special opcode: advances both the address and the line, then
+            // appends a row.
+            adjusted = opcode - opcodebase;
+            address += (adjusted / linerange) * mininstructionlength;
+            line += linebase + (LONGLONG)(adjusted % linerange);
+        }
+        else if (opcode == 0) {
+            // Extended opcode.
+            length = readuleb128(&cursor, end);
+            if ((length == 0) || (length > (ULONGLONG)(end - cursor))) {
+                goto done;
+            }
+            next = cursor + length;
+            opcode = *cursor++;
+            if (opcode == DW_LNE_set_address) {
+                address = readunsigned(&cursor, next, (SIZE_T)(length - 1));
+            }
+            cursor = next;
+            if (opcode != DW_LNE_end_sequence) {
+                continue;
+            }
+
+            // End of a sequence: mark the end of the last row's range, and
+            // reset the registers.
+            newline.address = address;
+            newline.file = NOFILE;
+            newline.line = 0;
+            appendbuffer(lines, &newline, sizeof(newline));
+            address = 0;
+            file = 1;
+            line = 1;
+            continue;
+        }
+        else {
+            // Standard opcode.
+            switch (opcode) {
+            case DW_LNS_copy:
+                break;
+            case DW_LNS_advance_pc:
+                address += readuleb128(&cursor, end) * mininstructionlength;
+                continue;
+            case DW_LNS_advance_line:
+                line += (LONGLONG)readsleb128(&cursor, end);
+                continue;
+            case DW_LNS_set_file:
+                file = readuleb128(&cursor, end);
+                continue;
+            case DW_LNS_const_add_pc:
+                address += ((255 - opcodebase) / linerange) * mininstructionlength;
+                continue;
+            case DW_LNS_fixed_advance_pc:
+                address += readunsigned(&cursor, end, 2);
+                continue;
+            default:
+                // Skip the operands of any other standard opcode.
+                for (index = 0; index < opcodelengths[opcode - 1]; index++) {
+                    readuleb128(&cursor, end);
+                }
+                continue;
+            }
+        }
+
+        // Append a row.
+        newline.address = address;
+        newline.file = (file < unitfiles.size / sizeof(UINT32)) ? ((UINT32*)unitfiles.data)[file] : NOFILE;
+        newline.line = ((line > 0) && (newline.file != NOFILE)) ? (UINT32)line : 0;
+        if (lines->size >= sizeof(Symbolizer::imageline_t)) {
+            previous = (Symbolizer::imageline_t*)(lines->data + lines->size) - 1;
+            if ((previous->line != 0) && (previous->address == address)) {
+                // A later row for the same address replaces the earlier one.
+                *previous = newline;
+                continue;
+            }
+            if ((previous->line != 0) && (previous->file == newline.file) && (previous->line == newline.line)) {
+                continue;
+            }
+        }
+        appendbuffer(lines, &newline, sizeof(newline));
+    }
+    success = TRUE;
+
+done:
+    freebuffer(&directories);
+    freebuffer(&unitfiles);
+
+    return success;
+}
+
+// readpath - Reads a path (a directory or file name) from the header of a
+//   DWARF 5 line number table unit.
+//
+//  - cursor (IN/OUT): Position of the path, advanced beyond it.
+//
+//  - end (IN): End of the data that may be read.
+//
+//  - form (IN): The form in which the path is encoded: either inline, or as
+//      an offset into one of the string sections.
+//
+//  - dwarf64 (IN): Set if offsets are in the 64-bit DWARF format.
+//
+//  - linestrings, linestringsize (IN): The .debug_line_str section, if any.
+//
+//  - strings, stringsize (IN): The .debug_str section, if any.
+//
+//  - path (OUT): Receives a pointer to the path.
+//
+//  Return Value:
+//
+//    Returns TRUE if the path was read. Otherwise returns FALSE.
+//
+BOOL readpath (const BYTE **cursor, const BYTE *end, UINT form, BOOL dwarf64, const BYTE *linestrings,
+               SIZE_T linestringsize, const BYTE *strings, SIZE_T stringsize, LPCSTR *path)
+{
+    ULONGLONG offset;
+
+    switch (form) {
+    case DW_FORM_string:
+        *path = (LPCSTR)*cursor;
+        *cursor += strnlen(*path, end - *cursor) + 1;
+        return (*cursor <= end);
+
+    case DW_FORM_line_strp:
+    case DW_FORM_strp:
+        offset = readunsigned(cursor, end, dwarf64 ? 8 : 4);
+        if (form == DW_FORM_strp) {
+            linestrings = strings;
+            linestringsize = stringsize;
+        }
+        if ((linestrings == NULL) || (offset >= linestringsize) ||
+            (memchr(linestrings + offset, '\0', linestringsize - offset) == NULL)) {
+            return FALSE;
+        }
+        *path = (LPCSTR)linestrings + offset;
+        return TRUE;
+
+    default:
+        return FALSE;
+    }
+}
+
+// readsleb128 - Reads a signed LEB128-encoded value.
+//
+//  - cursor (IN/OUT): Position of the value, advanced beyond it.
+//
+//  - end (IN): End of the data that may be read.
+//
+//  Return Value:
+//
+//    Returns the value, sign extended to 64 bits.
+//
+ULONGLONG readsleb128 (const BYTE **cursor, const BYTE *end)
+{
+    BYTE      byte = 0;
+    UINT      shift = 0;
+    ULONGLONG value = 0;
+
+    while (*cursor < end) {
+        byte = *(*cursor)++;
+        if (shift < 64) {
+            value |= (ULONGLONG)(byte & 0x7f) << shift;
+        }
+        shift += 7;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    if ((shift < 64) && (byte & 0x40)) {
+        value |= ~(ULONGLONG)0 << shift;
+    }
+
+    return value;
+}
+
+// readuleb128 - Reads an unsigned LEB128-encoded value.
+//
+//  - cursor (IN/OUT): Position of the value, advanced beyond it.
+//
+//  - end (IN): End of the data that may be read.
+//
+//  Return Value:
+//
+//    Returns the value.
+//
+ULONGLONG readuleb128 (const BYTE **cursor, const BYTE *end)
+{
+    BYTE      byte;
+    UINT      shift = 0;
+    ULONGLONG value = 0;
+
+    while (*cursor < end) {
+        byte = *(*cursor)++;
+        if (shift < 64) {
+            value |= (ULONGLONG)(byte & 0x7f) << shift;
+        }
+        shift += 7;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+
+    return value;
+}
+
+// readunsigned - Reads an unsigned, little endian, fixed-size value.
+//
+//  - cursor (IN/OUT): Position of the value, advanced beyond it.
+//
+//  - end (IN): End of the data that may be read.
+//
+//  - size (IN): Size, in bytes, of the value (at most 8).
+//
+//  Return Value:
+//
+//    Returns the value, or zero if it lies beyond the end of the data.
+//
+ULONGLONG readunsigned (const BYTE **cursor, const BYTE *end, SIZE_T size)
+{
+    SIZE_T    index;
+    ULONGLONG value = 0;
+
+    if ((size > 8) || (size > (SIZE_T)(end - *cursor))) {
+        *cursor = end;
+        return 0;
+    }
+    for (index = 0; index < size; index++) {
+        value |= (ULONGLONG)(*cursor)[index] << (index * 8);
+    }
+    *cursor += size;
+
+    return value;
+}
+
+// stripparameters - Removes the parameter list (and any qualifiers following
+//   it) from a demangled function name.
+//
+//  - name (IN/OUT): The demangled function name.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID stripparameters (LPSTR name)
+{
+    LPSTR  character;
+    SIZE_T depth = 0;
+    LPSTR  end;
+
+    end = strrchr(name, ')');
+    if (end == NULL) {
+        return;
+    }
+    for (character = end; character >= name; character--) {
+        if (*character == ')') {
+            depth++;
+        }
+        else if ((*character == '(') && (--depth == 0)) {
+            if (character != name) {
+                *character = '\0';
+            }
+            return;
+        }
+    }
+}
@@ -0,0 +1,149 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Symbolizer Class Definition
+//  Copyright (c) 2005-2006 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+"This header should only be included by Visual Leak Detector when building it from source. \
+Applications should never include this header."
+#endif
+
+#include "platform.h" // Provides the platform services and, on POSIX systems, the Win32 types.
+
+#define SYMBOLCACHEMAGIC     "VLDSYMS" // Identifies symbol cache files (including the terminating NUL, 8 bytes).
+#define SYMBOLCACHEVERSION   1         // Version of the symbol cache file format.
+#define SYMBOLMAXBUILDIDSIZE 64        // Maximum size, in bytes, of a module's build ID.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The Symbolizer Class
+//
+//    On POSIX systems, the Symbolizer takes the place of the Debug Help
+//    Library: it looks up the function, source file and line number for the
+//    program counter addresses in call stacks.
+//
+//    The module containing an address is found among the modules loaded into
+//    the process. The first time a module is looked up in, the function
+//    symbols in its ELF symbol table, and the line number table in its DWARF
+//    debugging information (.debug_line), are read into a "symbol image": a
+//    single, position independent block holding sorted tables of functions and
+//    line numbers, plus the names they refer to. If the module was built
+//    without debugging information, then the separate debugging information
+//    file installed for it (in /usr/lib/debug/.build-id) is read instead.
+//
+//    Reading the debugging information of large modules is slow, so symbol
+//    images are also saved in a cache directory, under the module's build ID.
+//    As long as the module is not rebuilt, later runs of any program that loads
+//    it simply map the cached image into memory.
+//
+//    Modules are never forgotten once they have been looked up in, so the
+//    strings returned by the lookup functions remain valid until the
+//    Symbolizer is cleaned up.
+//
+//    Call stacks recorded by another process (in a trace) can be symbolized
+//    too, by adding the modules that were loaded into that process. The
+//    modules' symbols are then read from the symbol cache, or from the module
+//    files, if they are present on this system.
+//
+class Symbolizer
+{
+public:
+    Symbolizer ();
+    ~Symbolizer ();
+
+    // Information about a module: where it is loaded, and where its symbols
+    // are to be found.
+    typedef struct moduleinfo_s {
+        SIZE_T address;                        // The address being looked up.
+        SIZE_T bias;                           // Difference between the module's run-time and link-time addresses.
+        BYTE   buildid [SYMBOLMAXBUILDIDSIZE]; // The module's build ID.
+        SIZE_T buildidsize;                    // Size, in bytes, of the module's build ID (zero if it has none).
+        BOOL   found;                          // Set if a module containing the address was found.
+        SIZE_T high;                           // Address just beyond the module's highest loaded segment.
+        SIZE_T low;                            // Address of the module's lowest loaded segment.
+        CHAR   path [MAX_PATH];                // Path of the module's file.
+    } moduleinfo_t;
+
+    typedef VOID (*functionproc_t) (LPCSTR functionname, LPCSTR filename, SIZE_T low, SIZE_T high, LPVOID context);
+    typedef VOID (*moduleproc_t) (const moduleinfo_t *moduleinfo, LPVOID context);
+
+    // Public APIs - see each function definition for details.
+    VOID addmodule (const moduleinfo_t *moduleinfo);
+    VOID cleanup ();
+    VOID enumfunctions (SIZE_T moduleaddress, functionproc_t functionproc, LPVOID context);
+    static VOID enummodules (moduleproc_t moduleproc, LPVOID context);
+    BOOL findfunction (SIZE_T programcounter, LPCSTR *functionname);
+    BOOL findline (SIZE_T programcounter, LPCSTR *filename, DWORD *line);
+    VOID setcachedirectory (LPCSTR directory);
+
+    // Symbol image layout. The image is made of the header, followed by the
+    // function table, the line table, the file table and the string table.
+    typedef struct imageheader_s {
+        CHAR      magic [8];     // SYMBOLCACHEMAGIC.
+        UINT32    version;       // SYMBOLCACHEVERSION.
+        UINT32    filecount;     // Number of entries in the file table.
+        ULONGLONG functioncount; // Number of entries in the function table.
+        ULONGLONG linecount;     // Number of entries in the line table.
+        ULONGLONG stringsize;    // Size, in bytes, of the string table.
+    } imageheader_t;
+
+    typedef struct imagefunction_s {
+        ULONGLONG address;       // Link-time address of the function.
+        ULONGLONG size;          // Size, in bytes, of the function.
+        ULONGLONG name;          // Offset of the function's name in the string table.
+    } imagefunction_t;
+
+    typedef struct imageline_s {
+        ULONGLONG address;       // Link-time address of the first instruction generated for the line.
+        UINT32    file;          // Index of the source file in the file table.
+        UINT32    line;          // Line number, or zero if the address is beyond the end of a sequence of instructions.
+    } imageline_t;
+
+private:
+    // Each module looked up in is described by a module_t.
+    typedef struct module_s {
+        struct module_s *next;   // Pointer to the next module in the module list.
+        SIZE_T           bias;   // Difference between the module's run-time and link-time addresses.
+        SIZE_T           high;   // Address just beyond the module's highest loaded segment.
+        PBYTE            image;  // The module's symbol image (NULL if it has no symbol information).
+        SIZE_T           low;    // Address of the module's lowest loaded segment.
+        BOOL             mapped; // If TRUE, the image is a mapped cache file. Otherwise, it was allocated from VLD's private heap.
+        SIZE_T           size;   // Size, in bytes, of the symbol image.
+    } module_t;
+
+    // Private Helper Functions - see each function definition for details.
+    module_t* findmodule (SIZE_T programcounter);
+    BOOL loadcachedimage (module_t *module, LPCSTR cachepath);
+    module_t* loadmodule (const moduleinfo_t *moduleinfo);
+    VOID saveimage (const module_t *module, LPCSTR cachepath);
+
+    // Private Data
+    CHAR       m_cachedirectory [MAX_PATH]; // Directory holding the symbol cache (empty if symbol images are not cached).
+    BOOL       m_foreign;                   // If TRUE, modules have been added: loaded modules are not looked up in.
+    vldlock_t  m_lock;                      // Serializes access to the module list.
+    module_t  *m_modules;                   // List of the modules looked up in so far.
+};
+
+// The process-wide Symbolizer, defined in symbolizer.cpp.
+extern Symbolizer symbolizer;
@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - CRT Block Classification Test
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Test of the classification of blocks allocated by the debug CRT
+//
+//  Blocks used internally by the CRT, and blocks tagged to be ignored, are
+//  never reported as leaks. They are recognized by their "use type", both when
+//  they are allocated (from the type passed to the debug CRT's allocation
+//  functions) and when leaks are reported (from the CRT memory block header
+//  prepended to them). The debug CRT only exists on Windows, so the headers
+//  are synthesized, the way the debug CRT would lay them out.
+//
+//  Usage: vldcrtblocktest
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#undef NDEBUG           // The test's checks are assertions.
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#define VLDBUILD        // Declares that we are building Visual Leak Detector.
+#include "../utility.h" // Provides the CRT block classification functions.
+#include "../vldheap.h" // Provides the CRT memory block header.
+
+#define DATASIZE 24      // Size, in bytes, of the user data portion of the synthetic blocks.
+#define SUBTYPE  0x20000 // Sub-type information, as stored in the upper bits of a client block's "use type".
+
+// A synthetic block allocated by the debug CRT: the CRT memory block header,
+// followed by the user data.
+typedef struct crtblock_s {
+    crtdbgblockheader_t header;
+    unsigned char       data [DATASIZE];
+} crtblock_t;
+
+// checkblock - Synthesizes a block of the specified "use type" and checks how
+//   it is classified, both by its use type and by its header.
+//
+//  - use (IN): The block's "use type".
+//
+//  - user (IN): TRUE if the block is expected to be allocated on behalf of the
+//      program. Otherwise FALSE.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID checkblock (int use, BOOL user)
+{
+    LPCVOID    address = NULL;
+    crtblock_t block;
+    SIZE_T     usersize = 0;
+
+    memset(&block, 0x0, sizeof(block));
+    block.header.line = __LINE__;
+    block.header.size = DATASIZE;
+    block.header.use = use;
+    assert(iscrtuserblock(use) == user);
+    assert(getcrtuserblock(&block, &address, &usersize) == user);
+    if (user) {
+        assert(address == block.data);
+        assert(usersize == DATASIZE);
+    }
+    else {
+        // The outputs are left alone.
+        assert(address == NULL);
+        assert(usersize == 0);
+    }
+}
+
+int main ()
+{
+    assert(sizeof(crtblock_t) == sizeof(crtdbgblockheader_t) + DATASIZE);
+
+    checkblock(CRT_USE_NORMAL, TRUE);
+    checkblock(CRT_USE_CLIENT, TRUE);
+    checkblock(CRT_USE_CLIENT | SUBTYPE, TRUE);
+    checkblock(CRT_USE_INTERNAL, FALSE);
+    checkblock(CRT_USE_INTERNAL | SUBTYPE, FALSE);
+    checkblock(CRT_USE_IGNORE, FALSE);
+    checkblock(CRT_USE_IGNORE | SUBTYPE, FALSE);
+    printf("All CRT blocks were classified correctly.\n");
+
+    return 0;
+}
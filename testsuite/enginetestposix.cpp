@@ -0,0 +1,692 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Tracking Engine Concurrency Test
+//  Copyright (c) 2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Concurrency test for the tracking engine on POSIX systems
+//
+//  Many threads allocate, reallocate and free blocks at the same time, in a
+//  deterministic order of their own, from a fixed set of call sites. The
+//  threads are held at a barrier between phases, and while they wait, the
+//  statistics kept by the engine are checked against the exact numbers implied
+//  by what the threads did:
+//
+//    1. Every thread allocates the same number of blocks from each call site,
+//       so the block map, the stack depot (which must account for every block
+//       allocated from each call site, however many threads race to intern
+//       it) and the per-thread counters in thread local storage are all
+//       exercised at once.
+//    2. Every thread frees a quarter of its blocks and reallocates another
+//       quarter, from a separate call site.
+//    3. Every thread churns through short-lived blocks while the main thread
+//       keeps capturing snapshots. The blocks left over from the earlier phases
+//       must show up in every snapshot, unchanged.
+//    4. Every thread frees the rest of its blocks.
+//    5. Every thread hands out the blocks of a custom allocator's pool, some in
+//       a batch and some one at a time, resizes some of them and then takes
+//       them all back, reporting each step through the VLDTrack APIs.
+//    6. Every thread hands out and takes back the blocks of its pool again,
+//       through a buffer of its own (see VLDTrackAllocInline), handing some
+//       blocks out anew right after taking them back. The blocks are only
+//       tracked once the buffers are flushed, in the order the steps were
+//       taken, but each one is attributed to the call site it was handed out
+//       to.
+//
+//  Finally, the main thread allocates blocks from a function of its own, and
+//  through the C library's strdup. If the "rules" argument is given, VLD must
+//  have been configured (see rulestest.ini) to exclude the former and include
+//  the latter, although the C library itself is excluded. Then it leaks blocks
+//  from a function of its own, and from one of the call sites, and reports
+//  them, along with blocks from a call site suppressed by its module-relative
+//  offset. If the "suppressions" argument is given, the test writes the
+//  suppression file, and VLD must have been configured (see
+//  suppressionstest.ini) to read it.
+//
+//  Unlike the test suite, this test links Visual Leak Detector into the program
+//  itself, rather than loading it as a shared library. That way, VLD's
+//  allocation functions take precedence over those of the sanitizer runtimes,
+//  so the test can also be run under ThreadSanitizer or AddressSanitizer.
+//
+//  Usage: vldenginetest [threads [rules | suppressions]]
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#undef NDEBUG // The test's checks are assertions.
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include <vld.h>
+
+#define NOINLINE __attribute__((noinline))
+
+#define CHURNBLOCKS     16                  // Number of short-lived blocks each thread holds at once while churning.
+#define CHURNITERATIONS 2000                // Number of short-lived blocks each thread allocates while churning.
+#define DEFAULTTHREADS  64                  // Default number of threads to run simultaneously.
+#define HOUR            3600000             // One hour, in milliseconds.
+#define MAXHEAPSTATS    16                  // Maximum number of heaps whose statistics are examined.
+#define MAXSITESTATS    4096                // Maximum number of call sites whose statistics are examined.
+#define MAXTHREADS      256                 // Maximum number of threads to run simultaneously.
+#define PERSITE         64                  // Number of blocks each thread allocates from each call site.
+#define POOLBLOCKS      64                  // Number of blocks in each thread's pool.
+#define POOLBLOCKSIZE   32                  // Size of the blocks in each thread's pool.
+#define RULEBLOCKS      16                  // Number of blocks the main thread allocates to check the function rules.
+#define SITES           8                   // Number of call sites.
+#define SITESIZE(site)  (16 * ((site) + 1)) // Size of the blocks allocated from each call site.
+#define SUPPRESSIONFILE "vldenginetest.supp" // Suppression file written by the test (see suppressionstest.ini).
+#define THREADBLOCKS    (SITES * PERSITE)   // Number of blocks each thread allocates from the call sites.
+
+typedef struct threadcontext_s {
+    void             *blocks [THREADBLOCKS]; // The blocks allocated from the call sites.
+    VLD_TRACK_BUFFER  buffer;                // Collects the blocks the thread's custom allocator hands out and takes back.
+    unsigned int      order [THREADBLOCKS];  // The order in which the thread visits its blocks.
+    char              pool [POOLBLOCKS][POOLBLOCKSIZE]; // The memory handed out by the thread's custom allocator.
+    unsigned int      seed;                  // Seed for the thread's sequence of random numbers.
+    pthread_t         thread;
+} threadcontext_t;
+
+typedef void* (*site_t) (size_t size);
+
+// Global variables.
+static pthread_barrier_t barrier;                  // Holds the threads between phases.
+static threadcontext_t   contexts [MAXTHREADS];    // Each thread's context.
+static const void       *leakreturn = NULL;        // Address "leakfrom" returns to, in "modulesite".
+static long              finished = 0;             // Number of threads that have finished churning.
+static VLD_HEAP_STATS    heapstats [MAXHEAPSTATS]; // Receives the statistics of every heap.
+static VLD_SITE_STATS    sitestats [MAXSITESTATS]; // Receives the statistics of every call site.
+static unsigned int      threads = DEFAULTTHREADS; // Number of threads running simultaneously.
+
+// The call sites. Each one stamps the blocks it allocates with its own number,
+// so that no two of them have the same code (and can't be merged).
+#define CALLSITE(n) NOINLINE void* site##n (size_t size) { return stamp(malloc(size), n); }
+
+NOINLINE void* stamp (void *block, unsigned char n)
+{
+    assert(block != NULL);
+    *(unsigned char*)block = n;
+    return block;
+}
+
+CALLSITE(0) CALLSITE(1) CALLSITE(2) CALLSITE(3) CALLSITE(4) CALLSITE(5) CALLSITE(6) CALLSITE(7)
+
+static const site_t sites [SITES] = { site0, site1, site2, site3, site4, site5, site6, site7 };
+
+NOINLINE void* churnsite (size_t size)
+{
+    return stamp(malloc(size), SITES);
+}
+
+NOINLINE void* resizesite (void *block, size_t size)
+{
+    return stamp(realloc(block, size), SITES + 1);
+}
+
+// The custom allocator's call sites. The blocks are reported before they are
+// stamped, so that the calls to the VLDTrack APIs can't be made tail calls.
+NOINLINE void* poolbatchsite (void **blocks, size_t count)
+{
+    VLDTrackAllocs((const void* const*)blocks, count, POOLBLOCKSIZE);
+    return stamp(blocks[0], SITES + 2);
+}
+
+NOINLINE void* poolsite (void *block)
+{
+    VLDTrackAlloc(block, POOLBLOCKSIZE);
+    return stamp(block, SITES + 3);
+}
+
+NOINLINE void* poolresizesite (void *block)
+{
+    VLDTrackRealloc(block, block, POOLBLOCKSIZE / 2);
+    return stamp(block, SITES + 4);
+}
+
+// The custom allocator that collects the blocks it hands out in a buffer, and
+// its call sites. The blocks' call stacks are not traced: each block is
+// attributed to the call site that called the allocator.
+NOINLINE void* poolbuffer (VLD_TRACK_BUFFER *buffer, void *block)
+{
+    VLDTrackAllocInline(buffer, block, POOLBLOCKSIZE);
+    return stamp(block, SITES + 9);
+}
+
+NOINLINE void* poolevensite (VLD_TRACK_BUFFER *buffer, void *block)
+{
+    return stamp(poolbuffer(buffer, block), SITES + 10);
+}
+
+NOINLINE void* pooloddsite (VLD_TRACK_BUFFER *buffer, void *block)
+{
+    return stamp(poolbuffer(buffer, block), SITES + 11);
+}
+
+// The call site excluded by the function rules.
+NOINLINE void* excludedsite (size_t size)
+{
+    return stamp(malloc(size), SITES + 5);
+}
+
+// The call site whose leaks are suppressed.
+NOINLINE void* suppressedsite (size_t size)
+{
+    return stamp(malloc(size), SITES + 6);
+}
+
+// Allocates the blocks of the call site whose leaks are suppressed by module
+// and offset, and records the address it returns to, which is the frame the
+// suppression matches. If the size is zero, nothing is allocated.
+NOINLINE void* leakfrom (size_t size)
+{
+    leakreturn = __builtin_return_address(0);
+    if (size == 0) {
+        return NULL;
+    }
+    return stamp(malloc(size), SITES + 7);
+}
+
+// The call site whose leaks are suppressed by module and offset.
+NOINLINE void* modulesite (size_t size)
+{
+    void *block;
+
+    block = leakfrom(size);
+    return (block != NULL) ? stamp(block, SITES + 8) : NULL;
+}
+
+// writesuppressions - Writes the suppression file if the test is run with the
+//   "suppressions" argument. The offset, within the test program, of the frame
+//   suppressed by module and offset is only known once the program has been
+//   built, so the file is written before VLD is constructed and reads it. The C
+//   library passes the program's arguments to constructors.
+__attribute__((constructor(101))) static void writesuppressions (int argc, char *argv [])
+{
+    FILE       *file;
+    Dl_info     info;
+    const char *module;
+    int         status;
+
+    if ((argc <= 2) || (strcmp(argv[2], "suppressions") != 0)) {
+        return;
+    }
+    modulesite(0);
+    status = dladdr((const char*)leakreturn - 1, &info);
+    assert((status != 0) && (info.dli_fname != NULL));
+    module = strrchr(info.dli_fname, '/');
+    module = (module != NULL) ? module + 1 : info.dli_fname;
+
+    file = fopen(SUPPRESSIONFILE, "w");
+    assert(file != NULL);
+    fprintf(file, "; Written by the engine concurrency test.\n"
+                  "\n"
+                  "; Never matches: no block is allocated from the start of the test program.\n"
+                  "%s+0x0\n"
+                  "\n"
+                  "# The test's suppressed call site, called from the test's main function.\n"
+                  "suppressedsite\n"
+                  "...\n"
+                  "main\n"
+                  "\n"
+                  "; The call site suppressed by module and offset.\n"
+                  "leakfrom\n"
+                  "%s+0x%lx\n", module, module,
+            (unsigned long)((const char*)leakreturn - (const char*)info.dli_fbase));
+    fclose(file);
+}
+
+// findsite - Adds up the statistics of the call sites whose blocks are
+//   allocated by the specified function. Ordinarily, there is exactly one. But
+//   if the stack walker can't reliably get past the thread's start routine
+//   (when the sanitizer runtimes' frames have no frame pointers, for example),
+//   the same call site may be interned under a few different call stacks.
+//
+//  - count (IN): Number of call sites in "sitestats".
+//
+//  - function (IN): The function whose blocks are looked for.
+//
+//  - stats (OUT): Receives the statistics.
+//
+//  Return Value:
+//
+//    Returns the number of call sites found.
+size_t findsite (size_t count, const void *function, VLD_SITE_STATS *stats)
+{
+    size_t  found = 0;
+    size_t  index;
+    Dl_info info;
+
+    memset(stats, 0, sizeof(VLD_SITE_STATS));
+    for (index = 0; index < count; index++) {
+        if ((dladdr(sitestats[index].address, &info) != 0) && (info.dli_saddr == function)) {
+            stats->allocs += sitestats[index].allocs;
+            stats->bytes += sitestats[index].bytes;
+            stats->count += sitestats[index].count;
+            stats->frees += sitestats[index].frees;
+            found++;
+        }
+    }
+
+    return found;
+}
+
+// checksites - Checks the statistics of the call sites against the number of
+//   blocks each thread still holds from them.
+//
+//  - kept (IN): Number of blocks each thread holds from each call site.
+//
+//  - resized (IN): Number of reallocated blocks each thread holds, per call
+//      site the blocks were first allocated from.
+void checksites (size_t kept, size_t resized)
+{
+    size_t         count;
+    size_t         found;
+    size_t         index;
+    size_t         resizedbytes = 0;
+    VLD_SITE_STATS site;
+
+    count = VLDGetSiteStats(sitestats, MAXSITESTATS);
+    assert(count <= MAXSITESTATS);
+    assert(VLDGetSiteStats(NULL, 0) == count);
+    for (index = 0; index < SITES; index++) {
+        found = findsite(count, (const void*)sites[index], &site);
+        assert(found != 0);
+        assert(site.allocs == threads * PERSITE);
+        assert(site.frees == threads * (PERSITE - kept));
+        assert(site.count == threads * kept);
+        assert(site.bytes == threads * kept * SITESIZE(index));
+        resizedbytes += threads * resized * SITESIZE(index) * 2;
+    }
+    findsite(count, (const void*)resizesite, &site);
+    assert(site.count == threads * resized * SITES);
+    assert(site.bytes == resizedbytes);
+}
+
+// findvirtualheap - Finds the statistics of the virtual heap, to which the
+//   blocks handed out by custom allocators belong. It is the only heap from
+//   which exactly the expected number of blocks have been allocated.
+//
+//  - allocs (IN): Cumulative number of blocks handed out by the pools.
+//
+//  Return Value:
+//
+//    Returns a pointer to the virtual heap's statistics.
+//
+VLD_HEAP_STATS* findvirtualheap (size_t allocs)
+{
+    size_t          count;
+    VLD_HEAP_STATS *found = NULL;
+    size_t          index;
+
+    count = VLDGetHeapStats(heapstats, MAXHEAPSTATS);
+    assert(count <= MAXHEAPSTATS);
+    for (index = 0; index < count; index++) {
+        if (heapstats[index].allocs == allocs) {
+            assert(found == NULL);
+            found = &heapstats[index];
+        }
+    }
+    assert(found != NULL);
+
+    return found;
+}
+
+// shuffle - Randomly orders a thread's visits to its blocks.
+void shuffle (threadcontext_t *context)
+{
+    unsigned int index;
+    unsigned int other;
+    unsigned int swap;
+
+    for (index = 0; index < THREADBLOCKS; index++) {
+        context->order[index] = index;
+    }
+    for (index = THREADBLOCKS - 1; index > 0; index--) {
+        other = rand_r(&context->seed) % (index + 1);
+        swap = context->order[index];
+        context->order[index] = context->order[other];
+        context->order[other] = swap;
+    }
+}
+
+void* runthread (void *param)
+{
+    void            *churn [CHURNBLOCKS] = { NULL };
+    threadcontext_t *context = (threadcontext_t*)param;
+    unsigned int     block;
+    unsigned int     index;
+    void            *poolblocks [POOLBLOCKS];
+    unsigned int     site;
+
+    // Phase 1: Allocate blocks from each call site, in random order.
+    pthread_barrier_wait(&barrier);
+    shuffle(context);
+    for (index = 0; index < THREADBLOCKS; index++) {
+        block = context->order[index];
+        site = block % SITES;
+        context->blocks[block] = sites[site](SITESIZE(site));
+    }
+    pthread_barrier_wait(&barrier);
+
+    // Phase 2: Free a quarter of the blocks and reallocate another quarter,
+    // again in random order. Blocks are assigned to call sites in turn, so
+    // each call site loses the same number of blocks.
+    pthread_barrier_wait(&barrier);
+    shuffle(context);
+    for (index = 0; index < THREADBLOCKS; index++) {
+        block = context->order[index];
+        site = block % SITES;
+        switch ((block / SITES) % 4) {
+            case 0:
+                free(context->blocks[block]);
+                context->blocks[block] = NULL;
+                break;
+
+            case 1:
+                context->blocks[block] = resizesite(context->blocks[block], SITESIZE(site) * 2);
+                break;
+        }
+    }
+    pthread_barrier_wait(&barrier);
+
+    // Phase 3: Churn through short-lived blocks, while snapshots are taken.
+    pthread_barrier_wait(&barrier);
+    for (index = 0; index < CHURNITERATIONS; index++) {
+        free(churn[index % CHURNBLOCKS]);
+        churn[index % CHURNBLOCKS] = churnsite(1 + rand_r(&context->seed) % 256);
+    }
+    for (index = 0; index < CHURNBLOCKS; index++) {
+        free(churn[index]);
+    }
+    __sync_fetch_and_add(&finished, 1);
+    pthread_barrier_wait(&barrier);
+
+    // Phase 4: Free the remaining blocks.
+    pthread_barrier_wait(&barrier);
+    for (index = 0; index < THREADBLOCKS; index++) {
+        free(context->blocks[index]);
+    }
+    pthread_barrier_wait(&barrier);
+
+    // Phase 5: Hand out the blocks of the pool, the first half of them in a
+    // batch and the other half one at a time. Then resize every fourth block in
+    // place, and take the blocks back, the first half of them one at a time and
+    // the other half in a batch.
+    pthread_barrier_wait(&barrier);
+    for (index = 0; index < POOLBLOCKS; index++) {
+        poolblocks[index] = context->pool[index];
+    }
+    poolbatchsite(poolblocks, POOLBLOCKS / 2);
+    for (index = POOLBLOCKS / 2; index < POOLBLOCKS; index++) {
+        poolsite(poolblocks[index]);
+    }
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    for (index = 0; index < POOLBLOCKS; index += 4) {
+        poolresizesite(poolblocks[index]);
+    }
+    for (index = 0; index < POOLBLOCKS / 2; index++) {
+        VLDTrackFree(poolblocks[index]);
+    }
+    VLDTrackFrees((const void* const*)&poolblocks[POOLBLOCKS / 2], POOLBLOCKS / 2);
+    pthread_barrier_wait(&barrier);
+
+    // Phase 6: Hand out the blocks of the pool through the thread's buffer.
+    // Then take them back, handing every other block out once more, and
+    // taking it back again, before moving on to the next one.
+    pthread_barrier_wait(&barrier);
+    for (index = 0; index < POOLBLOCKS; index++) {
+        if ((index % 2) == 0) {
+            poolevensite(&context->buffer, poolblocks[index]);
+        }
+        else {
+            pooloddsite(&context->buffer, poolblocks[index]);
+        }
+    }
+    VLDTrackFlush(&context->buffer);
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    for (index = 0; index < POOLBLOCKS; index++) {
+        VLDTrackFreeInline(&context->buffer, poolblocks[index]);
+        if ((index % 2) == 0) {
+            poolevensite(&context->buffer, poolblocks[index]);
+            VLDTrackFreeInline(&context->buffer, poolblocks[index]);
+        }
+    }
+    VLDTrackFlush(&context->buffer);
+    pthread_barrier_wait(&barrier);
+
+    return NULL;
+}
+
+int main (int argc, char *argv [])
+{
+    VLD_STATS       after;
+    unsigned int    baselineleaks;
+    VLD_STATS       before;
+    size_t          blocks;
+    size_t          bytes;
+    size_t          checkpoint;
+    VLD_HEAP_STATS *heap;
+    unsigned int    index;
+    unsigned int    leaks;
+    VLD_SITE_STATS  pool;
+    void           *ruleblocks [RULEBLOCKS];
+    bool            rules = false;
+    size_t          site;
+    size_t          snapshots = 0;
+    int             status;
+    bool            suppressions = false;
+
+    if (argc > 1) {
+        threads = (unsigned int)strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        rules = (strcmp(argv[2], "rules") == 0);
+        suppressions = (strcmp(argv[2], "suppressions") == 0);
+    }
+    assert((threads > 0) && (threads <= MAXTHREADS));
+    printf("Running %u threads.\n", threads);
+
+    status = pthread_barrier_init(&barrier, NULL, threads + 1);
+    assert(status == 0);
+    for (index = 0; index < threads; index++) {
+        contexts[index].seed = index + 1;
+        status = pthread_create(&contexts[index].thread, NULL, runthread, &contexts[index]);
+        assert(status == 0);
+    }
+    baselineleaks = VLDGetLeaksCount();
+
+    // Phase 1.
+    VLDGetStats(&before);
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    VLDGetStats(&after);
+    bytes = 0;
+    for (site = 0; site < SITES; site++) {
+        bytes += threads * PERSITE * SITESIZE(site);
+    }
+    assert(after.allocs - before.allocs == threads * THREADBLOCKS);
+    assert(after.blocks - before.blocks == threads * THREADBLOCKS);
+    assert(after.bytes - before.bytes == bytes);
+    assert(after.frees == before.frees);
+    assert(after.untracked == 0);
+    checksites(PERSITE, 0);
+    printf("Allocated %u blocks.\n", threads * THREADBLOCKS);
+
+    // Phase 2.
+    before = after;
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    VLDGetStats(&after);
+    assert(after.reallocs - before.reallocs == threads * THREADBLOCKS / 4);
+    assert(before.blocks - after.blocks == threads * THREADBLOCKS / 4);
+    assert(after.bytes - before.bytes == 0);
+    checksites(PERSITE / 2, PERSITE / 4);
+    printf("Freed %u blocks and reallocated %u blocks.\n", threads * THREADBLOCKS / 4, threads * THREADBLOCKS / 4);
+
+    // Phase 3. The blocks left over from the earlier phases, and nothing but
+    // them and the short-lived blocks, must be captured by every snapshot. The
+    // threads' counters only ever grow.
+    blocks = baselineleaks + threads * THREADBLOCKS * 3 / 4;
+    pthread_barrier_wait(&barrier);
+    do {
+        before = after;
+        leaks = VLDGetLeaksCount();
+        assert((leaks >= blocks) && (leaks <= blocks + threads * CHURNBLOCKS));
+        checksites(PERSITE / 2, PERSITE / 4);
+        VLDGetStats(&after);
+        assert((after.allocs >= before.allocs) && (after.frees >= before.frees));
+        if (snapshots % 16 == 0) {
+            status = VLDReportOlderThan(HOUR);
+            assert(status == 0);
+        }
+        snapshots++;
+    } while (__sync_fetch_and_add(&finished, 0) < (long)threads);
+    pthread_barrier_wait(&barrier);
+    assert(VLDGetLeaksCount() == blocks);
+    checksites(PERSITE / 2, PERSITE / 4);
+    printf("Churned %u blocks while taking %lu snapshots.\n", threads * CHURNITERATIONS, (unsigned long)snapshots);
+
+    // Phase 4.
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    assert(VLDGetLeaksCount() == baselineleaks);
+    checksites(0, 0);
+    printf("Freed all blocks.\n");
+
+    // Phase 5. The pools' blocks are tracked like any others, in a heap of
+    // their own.
+    VLDGetStats(&before);
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    VLDGetStats(&after);
+    blocks = threads * POOLBLOCKS;
+    assert(after.allocs - before.allocs == blocks);
+    assert(VLDGetLeaksCount() == baselineleaks + blocks);
+    heap = findvirtualheap(blocks);
+    assert(heap->blocks == blocks);
+    assert(heap->bytes == blocks * POOLBLOCKSIZE);
+    site = VLDGetSiteStats(sitestats, MAXSITESTATS);
+    assert(site <= MAXSITESTATS);
+    findsite(site, (const void*)poolbatchsite, &pool);
+    assert((pool.allocs == blocks / 2) && (pool.count == blocks / 2));
+    findsite(site, (const void*)poolsite, &pool);
+    assert((pool.allocs == blocks / 2) && (pool.count == blocks / 2));
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    assert(VLDGetLeaksCount() == baselineleaks);
+    heap = findvirtualheap(blocks);
+    assert((heap->blocks == 0) && (heap->frees == blocks));
+    assert(heap->peakbytes == blocks * POOLBLOCKSIZE);
+    site = VLDGetSiteStats(sitestats, MAXSITESTATS);
+    assert(site <= MAXSITESTATS);
+    findsite(site, (const void*)poolresizesite, &pool);
+    assert((pool.allocs == blocks / 4) && (pool.frees == blocks / 4) && (pool.count == 0));
+    printf("Handed out and took back %lu pool blocks.\n", (unsigned long)blocks);
+
+    // Phase 6. Every block is accounted for once the buffers are flushed. A
+    // block handed out anew, at the same address, is tracked after the block
+    // that was taken back before it.
+    VLDGetStats(&before);
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    VLDGetStats(&after);
+    assert(after.allocs - before.allocs == blocks);
+    assert(VLDGetLeaksCount() == baselineleaks + blocks);
+    heap = findvirtualheap(blocks * 2);
+    assert(heap->blocks == blocks);
+    site = VLDGetSiteStats(sitestats, MAXSITESTATS);
+    assert(site <= MAXSITESTATS);
+    findsite(site, (const void*)poolevensite, &pool);
+    assert((pool.allocs == blocks / 2) && (pool.count == blocks / 2));
+    findsite(site, (const void*)pooloddsite, &pool);
+    assert((pool.allocs == blocks / 2) && (pool.count == blocks / 2));
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+    VLDGetStats(&after);
+    assert(after.allocs - before.allocs == blocks + blocks / 2);
+    assert(VLDGetLeaksCount() == baselineleaks);
+    heap = findvirtualheap(blocks * 2 + blocks / 2);
+    assert((heap->blocks == 0) && (heap->frees == blocks * 2 + blocks / 2));
+    site = VLDGetSiteStats(sitestats, MAXSITESTATS);
+    assert(site <= MAXSITESTATS);
+    findsite(site, (const void*)poolevensite, &pool);
+    assert((pool.allocs == blocks) && (pool.frees == blocks) && (pool.count == 0));
+    printf("Handed out and took back %lu pool blocks through buffers.\n", (unsigned long)(blocks + blocks / 2));
+
+    // The function rules override the exclusion of the modules.
+    VLDGetStats(&before);
+    for (index = 0; index < RULEBLOCKS; index++) {
+        ruleblocks[index] = excludedsite(SITESIZE(0));
+    }
+    VLDGetStats(&after);
+    assert(after.allocs - before.allocs == (rules ? 0 : RULEBLOCKS));
+    for (index = 0; index < RULEBLOCKS; index++) {
+        free(ruleblocks[index]);
+    }
+    VLDGetStats(&before);
+    for (index = 0; index < RULEBLOCKS; index++) {
+        ruleblocks[index] = strdup("included");
+        assert(ruleblocks[index] != NULL);
+    }
+    VLDGetStats(&after);
+    assert(after.allocs - before.allocs == (rules ? RULEBLOCKS : 0));
+    for (index = 0; index < RULEBLOCKS; index++) {
+        free(ruleblocks[index]);
+    }
+    assert(VLDGetLeaksCount() == baselineleaks);
+    printf("Applied the function rules to %u blocks.\n", RULEBLOCKS * 2);
+
+    // The suppressed leaks are left out of the report. Half of them are
+    // suppressed by function name, and half by module and offset.
+    checkpoint = VLDMarkCheckpoint();
+    for (index = 0; index < RULEBLOCKS; index++) {
+        switch (index % 4) {
+            case 0:
+                ruleblocks[index] = suppressedsite(SITESIZE(0));
+                break;
+
+            case 1:
+                ruleblocks[index] = modulesite(SITESIZE(0));
+                break;
+
+            default:
+                ruleblocks[index] = site0(SITESIZE(0));
+        }
+    }
+    leaks = VLDReportSince(checkpoint);
+    assert(leaks == (suppressions ? RULEBLOCKS / 2 : RULEBLOCKS));
+    for (index = 0; index < RULEBLOCKS; index++) {
+        free(ruleblocks[index]);
+    }
+    printf("Reported %u of %u leaks.\n", leaks, RULEBLOCKS);
+
+    for (index = 0; index < threads; index++) {
+        pthread_join(contexts[index].thread, NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    return 0;
+}
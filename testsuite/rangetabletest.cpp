@@ -0,0 +1,117 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Range Table Test
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Test of the tables of address ranges whose frames are left out of call
+//  stacks
+//
+//  Ranges are added out of order, overlapping and adjacent to one another, and
+//  in several steps, each building a table that supersedes the previous one.
+//  Every table must find exactly the addresses within its ranges, including
+//  the ranges' low bounds but excluding their high bounds. Walking the stack
+//  with a table must leave out the frames whose program counters lie within
+//  its ranges.
+//
+//  Usage: vldrangetabletest
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#undef NDEBUG             // The test's checks are assertions.
+#include <cassert>
+#include <cstdio>
+#define VLDBUILD          // Declares that we are building Visual Leak Detector.
+#include "../callstack.h"  // Provides the check made for each frame.
+#include "../platform.h"   // Provides the platform services.
+#include "../rangetable.h" // Provides the tables of address ranges.
+#include "../vldheap.h"    // Provides internal new and delete operators.
+
+// Imported global variables.
+extern HANDLE    vldheap;
+extern vldlock_t vldheaplock;
+
+// The ranges added to the first table, out of order. The second and third
+// ranges overlap, and the fourth is adjacent to the third.
+static const addressrange_t firstranges [] = {
+    { 0x5000, 0x4000 }, { 0x1800, 0x1000 }, { 0x2000, 0x1400 }, { 0x2800, 0x2000 }, { 0x3000, 0x3000 }
+};
+
+// The ranges added to the second table. The first one bridges two of the
+// first table's ranges.
+static const addressrange_t secondranges [] = {
+    { 0x4000, 0x2800 }, { 0x9000, 0x8000 }
+};
+
+int main ()
+{
+    RangeTable *first;
+    RangeTable *second;
+
+    vldheap = heapcreate();
+    initlock(&vldheaplock);
+
+    // The empty range is ignored. The rest merge into 0x1000-0x2800 and
+    // 0x4000-0x5000.
+    first = new RangeTable(NULL, firstranges, sizeof(firstranges) / sizeof(firstranges[0]));
+    assert(first->size() == 2);
+    assert(!first->contains(0x0fff));
+    assert(first->contains(0x1000));
+    assert(first->contains(0x1c00));
+    assert(first->contains(0x27ff));
+    assert(!first->contains(0x2800));
+    assert(!first->contains(0x3000));
+    assert(first->contains(0x4000));
+    assert(!first->contains(0x5000));
+
+    // The second table holds the first table's ranges too.
+    second = new RangeTable(first, secondranges, sizeof(secondranges) / sizeof(secondranges[0]));
+    assert(second->size() == 2);
+    assert(second->contains(0x1000));
+    assert(second->contains(0x3000));
+    assert(second->contains(0x4fff));
+    assert(!second->contains(0x5000));
+    assert(!second->contains(0x7fff));
+    assert(second->contains(0x8000));
+    assert(!second->contains(0x9000));
+
+    // The superseded table is left as it was, for the threads still using it.
+    assert(first->size() == 2);
+    assert(!first->contains(0x3000));
+    delete first;
+    assert(second->size() == 2);
+    assert(second->contains(0x3000));
+    assert((*second)[0].low == 0x1000);
+    assert((*second)[0].high == 0x5000);
+    assert((*second)[1].low == 0x8000);
+    assert((*second)[1].high == 0x9000);
+
+    // A frame is left out if the call it returns from lies within a range.
+    assert(!CallStack::skipframe(NULL, 0x1001));
+    assert(CallStack::skipframe(second, 0x1001));
+    assert(!CallStack::skipframe(second, 0x1000));
+    assert(CallStack::skipframe(second, 0x5000));
+    delete second;
+    printf("All address ranges were found correctly.\n");
+
+    return 0;
+}
@@ -0,0 +1,335 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Test Suite
+//  Copyright (c) 2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Test suite for Visual Leak Detector on POSIX systems
+//
+//  This is the same test as testsuite.cpp, ported to POSIX threads. Each thread
+//  allocates blocks, using each of the C runtime's allocation functions, from
+//  call stacks of random depth, and frees them in random order. One of the
+//  threads leaks one block of each kind. The leaks are then counted.
+//
+//  When built with _DEBUG, the test is linked with Visual Leak Detector and
+//  checks the number of leaks itself. Otherwise it knows nothing about Visual
+//  Leak Detector, which can then be preloaded into it (with LD_PRELOAD).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#undef NDEBUG // The test's checks are assertions.
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+
+#include <vld.h>
+
+enum action_e {
+    a_aligned,
+    a_calloc,
+    a_ignored,
+    a_malloc,
+    a_new,
+    a_realloc,
+    numactions
+};
+
+#define MAXALLOC     1000                    // Maximum number of allocations of each type to perform, per thread
+#define MAXBLOCKS    (MAXALLOC * numactions) // Total maximum number of allocations, per thread
+#define MAXDEPTH     32                      // Maximum depth of the allocation call stack
+#define MAXSIZE      64                      // Maximum block size to allocate
+#define MINDEPTH     0                       // Minimum depth of the allocation call stack
+#define MINSIZE      16                      // Minimum block size to allocate
+#define NUMDUPLEAKS  0                       // Number of times to duplicate each leak
+#define NUMTHREADS   72                      // Number of threads to run simultaneously
+#define ONCEINAWHILE 10                      // Free a random block approx. once every...
+
+typedef struct blockholder_s {
+    action_e action;
+    void    *block;
+    bool     leak;
+} blockholder_t;
+
+typedef struct threadcontext_s {
+    unsigned int index;
+    bool         leaky;
+    unsigned int seed;
+    pthread_t    thread;
+} threadcontext_t;
+
+__thread blockholder_t blocks [MAXBLOCKS];
+__thread unsigned long counts [numactions] = { 0 };
+__thread unsigned int  seed;
+__thread unsigned long total_allocs = 0;
+
+unsigned long random (unsigned long max)
+{
+    float         d;
+    float         r;
+    unsigned long v;
+
+    r = ((float)rand_r(&seed)) / ((float)RAND_MAX);
+    r *= ((float)max);
+    d = r - ((unsigned long)r);
+    if (d >= 0.5) {
+        v = ((unsigned long)r) + 1;
+    }
+    else {
+        v = (unsigned long)r;
+    }
+
+    return v;
+}
+
+void allocateblock (action_e action, size_t size)
+{
+    unsigned long   index;
+    const char     *name;
+    void          **pblock;
+    int             status;
+
+    // Find the first unused index.
+    for (index = 0; index < MAXBLOCKS; index++) {
+        if (blocks[index].block == NULL) {
+            break;
+        }
+    }
+    blocks[index].action = action;
+
+    // Now do the randomized allocation.
+    pblock = &blocks[index].block;
+    switch (action) {
+        case a_aligned:
+            name = "posix_memalign";
+            status = posix_memalign(pblock, 64, size);
+            assert(status == 0);
+            break;
+
+        case a_calloc:
+            name = "calloc";
+            *pblock = calloc(1, size);
+            break;
+
+        case a_ignored:
+            name = "Ignored";
+            VLDDisable();
+            *pblock = malloc(size);
+            VLDEnable();
+            break;
+
+        case a_malloc:
+            name = "malloc";
+            *pblock = malloc(size);
+            break;
+
+        case a_new:
+            name = "new";
+            *pblock = new unsigned char [size];
+            break;
+
+        case a_realloc:
+            name = "realloc";
+            *pblock = realloc(malloc(MINSIZE / 2), size);
+            break;
+
+        default:
+            assert(false);
+    }
+    assert(*pblock != NULL);
+    counts[action]++;
+    total_allocs++;
+
+    strncpy((char*)*pblock, name, size);
+    ((char*)*pblock)[size - 1] = '\0';
+}
+
+void freeblock (unsigned long index)
+{
+    void *block;
+
+    block = blocks[index].block;
+    switch (blocks[index].action) {
+        case a_aligned:
+        case a_calloc:
+        case a_ignored:
+        case a_malloc:
+        case a_realloc:
+            free(block);
+            break;
+
+        case a_new:
+            delete [] (unsigned char*)block;
+            break;
+
+        default:
+            assert(false);
+    }
+    blocks[index].block = NULL;
+    counts[blocks[index].action]--;
+    total_allocs--;
+}
+
+void recursivelyallocate (unsigned int depth, action_e action, size_t size)
+{
+    if (depth == 0) {
+        allocateblock(action, size);
+    }
+    else {
+        recursivelyallocate(depth - 1, action, size);
+    }
+}
+
+void* runtestsuite (void *param)
+{
+    action_e         action;
+    unsigned short   action_index;
+    bool             allocate_more = true;
+    threadcontext_t *context = (threadcontext_t*)param;
+    unsigned int     depth;
+    unsigned long    index;
+    unsigned int     leaks_selected;
+    size_t           size;
+
+    seed = context->seed;
+
+    for (index = 0; index < MAXBLOCKS; index++) {
+        blocks[index].block = NULL;
+        blocks[index].leak = false;
+    }
+
+    while (allocate_more == true) {
+        // Select a random allocation action and a random size.
+        action = (action_e)random(numactions - 1);
+        size = random(MAXSIZE);
+        if (size < MINSIZE) {
+            size = MINSIZE;
+        }
+        if (counts[action] == MAXALLOC) {
+            // We've done enough of this type of allocation. Select another.
+            continue;
+        }
+
+        // Allocate a block, using recursion to build up a stack of random
+        // depth.
+        depth = random(MAXDEPTH);
+        if (depth < MINDEPTH) {
+            depth = MINDEPTH;
+        }
+        recursivelyallocate(depth, action, size);
+
+        // Every once in a while, free a random block.
+        if (random(ONCEINAWHILE) == ONCEINAWHILE) {
+            index = random(total_allocs);
+            if (blocks[index].block != NULL) {
+                freeblock(index);
+            }
+        }
+
+        // See if we have allocated enough blocks using each type of action.
+        for (action_index = 0; action_index < numactions; action_index++) {
+            if (counts[action_index] < MAXALLOC) {
+                allocate_more = true;
+                break;
+            }
+            allocate_more = false;
+        }
+    }
+
+    if (context->leaky == true) {
+        // This is the leaky thread. Randomly select one block to be leaked from
+        // each type of allocation action.
+        for (action_index = 0; action_index < numactions; action_index++) {
+            leaks_selected = 0;
+            do {
+                index = random(MAXBLOCKS);
+                if ((blocks[index].block != NULL) && (blocks[index].action == (action_e)action_index) &&
+                    (blocks[index].leak == false)) {
+                    blocks[index].leak = true;
+                    leaks_selected++;
+                }
+            } while (leaks_selected < (1 + NUMDUPLEAKS));
+        }
+    }
+
+    // Free all blocks except for those marked as leaks.
+    for (index = 0; index < MAXBLOCKS; index++) {
+        if ((blocks[index].block != NULL) && (blocks[index].leak == false)) {
+            freeblock(index);
+        }
+    }
+
+    // Do a sanity check.
+    if (context->leaky == true) {
+        assert(total_allocs == (numactions * (1 + NUMDUPLEAKS)));
+    }
+    else {
+        assert(total_allocs == 0);
+    }
+
+    return NULL;
+}
+
+int main (int argc, char *argv [])
+{
+    threadcontext_t contexts [NUMTHREADS];
+    struct timespec end;
+    unsigned int    index;
+    unsigned int    leakythread;
+    struct timespec start;
+    int             status;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    seed = (unsigned int)start.tv_nsec;
+
+    // Select a random thread to be the leaker.
+    leakythread = random(NUMTHREADS - 1);
+
+    for (index = 0; index < NUMTHREADS; ++index) {
+        contexts[index].index = index;
+        contexts[index].leaky = (index == leakythread);
+        contexts[index].seed = random(RAND_MAX);
+        status = pthread_create(&contexts[index].thread, NULL, runtestsuite, &contexts[index]);
+        assert(status == 0);
+    }
+
+    // Wait for all threads to terminate.
+    for (index = 0; index < NUMTHREADS; ++index) {
+        pthread_join(contexts[index].thread, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Elapsed Time = %lums\n", (unsigned long)((end.tv_sec - start.tv_sec) * 1000 +
+                                                     (end.tv_nsec - start.tv_nsec) / 1000000));
+
+#ifdef _DEBUG
+    // Every leak should have been detected, except for the one that was
+    // allocated while leak detection was disabled.
+    status = VLDGetLeaksCount();
+    printf("Leaks Detected = %d\n", status);
+    assert(status == (numactions - 1) * (1 + NUMDUPLEAKS));
+#endif // _DEBUG
+
+    return 0;
+}
@@ -0,0 +1,1101 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - TraceWriter and TraceReader Class Implementations
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#define VLDBUILD         // Declares that we are building Visual Leak Detector.
+#include "map.h"         // Provides a lightweight STL-like map template.
+#include "trace.h"       // Provides the TraceWriter and TraceReader class definitions.
+#include "vldheap.h"     // Provides internal new and delete operators.
+
+// Trace files may be larger than "long" can address.
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif // _WIN32
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The TraceWriter Class
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Constructor - Initializes private data. The trace file isn't opened until
+//   "open" is called.
+//
+TraceWriter::TraceWriter ()
+{
+    m_active       = NULL;
+    m_failed       = FALSE;
+    m_free         = NULL;
+    initlock(&m_lock);
+    m_open         = FALSE;
+    m_pending      = NULL;
+    m_pendingcount = 0;
+    m_pendingtail  = NULL;
+    m_queue        = NULL;
+    m_queuetail    = NULL;
+    m_stop         = 0;
+    m_stopped      = 0;
+    initlock(&m_writelock);
+}
+
+// Destructor - Closes the trace file, if it is still open.
+//
+TraceWriter::~TraceWriter ()
+{
+    close();
+    deletelock(&m_lock);
+    deletelock(&m_writelock);
+}
+
+// activatebuffer - Obtains an empty buffer for the calling thread to record
+//   events in, and adds it to the list of active buffers.
+//
+//   Note: The caller must hold the writer's lock.
+//
+//  Return Value:
+//
+//    Returns a pointer to the buffer.
+//
+tracebuffer_t* TraceWriter::activatebuffer ()
+{
+    tracebuffer_t *buffer;
+
+    if (m_free != NULL) {
+        // Reuse a buffer that has already been written.
+        buffer = m_free;
+        m_free = buffer->next;
+    }
+    else {
+        buffer = new tracebuffer_t;
+    }
+    buffer->count = 0;
+    buffer->flushed = 0;
+    buffer->threadid = currentthreadid();
+    buffer->next = m_active;
+    buffer->prev = NULL;
+    if (m_active != NULL) {
+        m_active->prev = buffer;
+    }
+    m_active = buffer;
+
+    return buffer;
+}
+
+// close - Stops the writer thread, writes all of the events and call stacks
+//   that haven't been written yet, and closes the trace file. Events must no
+//   longer be recorded once the trace file has been closed.
+//
+//   If the writer thread was terminated before it stopped (on Windows, all
+//   other threads are terminated when the process exits), it may have been
+//   terminated while writing, in which case its locks are never released. The
+//   rest of the trace is then left unwritten, rather than waiting for the locks
+//   forever.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::close ()
+{
+    tracebuffer_t *buffer;
+
+    if (!m_open) {
+        return;
+    }
+
+    // Wait only until the writer thread signals that it has stopped, or until
+    // it has been terminated. Waiting for it to actually exit would deadlock if
+    // VLD is being unloaded on Windows, because the thread can't exit while the
+    // loader lock is held.
+    InterlockedExchange(&m_stop, 1);
+    while ((readcounter(&m_stopped) == 0) && !threadexited(m_thread)) {
+        delay(1);
+    }
+    detachthread(m_thread);
+    if (readcounter(&m_stopped) != 0) {
+        flush();
+    }
+    else if (tryenterlock(&m_writelock)) {
+        if (tryenterlock(&m_lock)) {
+            flush();
+            leavelock(&m_lock);
+        }
+        leavelock(&m_writelock);
+    }
+    closefile(m_file);
+    m_open = FALSE;
+
+    // Free the buffers. The queue of full buffers was emptied by "flush".
+    while (m_active != NULL) {
+        buffer = m_active;
+        m_active = buffer->next;
+        delete buffer;
+    }
+    while (m_free != NULL) {
+        buffer = m_free;
+        m_free = buffer->next;
+        delete buffer;
+    }
+}
+
+// flush - Writes the call stacks that have been interned and the modules that
+//   have been described, the full buffers that are queued, and the events
+//   recorded so far in the active buffers, to the trace file. Full buffers are
+//   written before active ones, so that each thread's events are written in the
+//   order they were recorded.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::flush ()
+{
+    tracebuffer_t *active = NULL;
+    tracebuffer_t *buffer;
+    queuedchunk_t *chunk;
+    tracebuffer_t *pending;
+    SIZE_T         pendingcount = 0;
+    queuedchunk_t *queue;
+
+    enterlock(&m_writelock);
+
+    // Detach the queues, and take note of the active buffers, but don't write
+    // anything while holding the lock. Threads would otherwise wait for the
+    // file whenever they record an event or intern a call stack. The buffers
+    // taken note of can't be reused until they have been written, because
+    // only this function frees buffers for reuse.
+    enterlock(&m_lock);
+    queue = m_queue;
+    m_queue = NULL;
+    m_queuetail = NULL;
+    pending = m_pending;
+    m_pending = NULL;
+    m_pendingtail = NULL;
+    for (buffer = m_active; buffer != NULL; buffer = buffer->next) {
+        buffer->flushnext = active;
+        active = buffer;
+    }
+    leavelock(&m_lock);
+
+    while (queue != NULL) {
+        chunk = queue;
+        queue = chunk->next;
+        writechunk(&chunk->header, chunk + 1);
+        delete [] (BYTE*)chunk;
+    }
+    for (buffer = pending; buffer != NULL; buffer = buffer->next) {
+        writebuffer(buffer);
+        pendingcount++;
+    }
+    for (buffer = active; buffer != NULL; buffer = buffer->flushnext) {
+        writebuffer(buffer);
+    }
+
+    if (pending != NULL) {
+        // The full buffers have been written, so they can be reused.
+        buffer = pending;
+        while (buffer->next != NULL) {
+            buffer = buffer->next;
+        }
+        enterlock(&m_lock);
+        buffer->next = m_free;
+        m_free = pending;
+        addcounter(&m_pendingcount, (SIZE_T)0 - pendingcount);
+        leavelock(&m_lock);
+    }
+    leavelock(&m_writelock);
+}
+
+// forkprepare - Called just before the process forks. Acquires the writer's
+//   locks, so that they aren't held by the writer thread at the time the
+//   process is copied.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::forkprepare ()
+{
+    enterlock(&m_writelock);
+    enterlock(&m_lock);
+}
+
+// forkrelease - Called in both the parent and the child process just after the
+//   process has forked. Releases the locks acquired by "forkprepare".
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::forkrelease ()
+{
+    leavelock(&m_lock);
+    leavelock(&m_writelock);
+}
+
+// open - Creates the trace file, writes its header and starts the writer
+//   thread.
+//
+//  - path (IN): Path of the trace file. An existing file is overwritten.
+//
+//  - virtualheap (IN): Handle of the virtual heap (see VIRTUALHEAP), so that
+//      blocks of custom allocators can be told apart in the trace.
+//
+//  Return Value:
+//
+//    Returns TRUE if the trace file was opened and the writer thread started.
+//    Otherwise returns FALSE.
+//
+BOOL TraceWriter::open (LPCWSTR path, HANDLE virtualheap)
+{
+    traceheader_t header;
+
+    if (!createfile(&m_file, path)) {
+        return FALSE;
+    }
+    memset(&header, 0x0, sizeof(header));
+    memcpy(header.magic, TRACEMAGIC, sizeof(header.magic));
+    header.version = TRACEVERSION;
+    header.pointersize = sizeof(LPVOID);
+    header.perffrequency = getperffrequency();
+    header.starttime = getperfcounter();
+    header.virtualheap = (ULONGLONG)(SIZE_T)virtualheap;
+    if (!writefile(m_file, &header, sizeof(header))) {
+        closefile(m_file);
+        return FALSE;
+    }
+
+    m_stop = 0;
+    m_stopped = 0;
+    if (!createthread(&m_thread, writerthread, this)) {
+        closefile(m_file);
+        return FALSE;
+    }
+    m_open = TRUE;
+
+    return TRUE;
+}
+
+// queuebuffer - Removes a buffer from the list of active buffers and queues it
+//   to be written.
+//
+//   Note: The caller must hold the writer's lock.
+//
+//  - buffer (IN): Pointer to the buffer.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::queuebuffer (tracebuffer_t *buffer)
+{
+    if (buffer->prev != NULL) {
+        buffer->prev->next = buffer->next;
+    }
+    else {
+        m_active = buffer->next;
+    }
+    if (buffer->next != NULL) {
+        buffer->next->prev = buffer->prev;
+    }
+    buffer->next = NULL;
+    if (m_pendingtail != NULL) {
+        m_pendingtail->next = buffer;
+    }
+    else {
+        m_pending = buffer;
+    }
+    m_pendingtail = buffer;
+    addcounter(&m_pendingcount, (SIZE_T)1);
+}
+
+// queuechunk - Queues a call stack or a module to be written to the trace file.
+//
+//  - chunk (IN): Pointer to the chunk, allocated as an array of bytes. It is
+//      freed once it has been written.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::queuechunk (queuedchunk_t *chunk)
+{
+    chunk->next = NULL;
+    enterlock(&m_lock);
+    if (m_queuetail != NULL) {
+        m_queuetail->next = chunk;
+    }
+    else {
+        m_queue = chunk;
+    }
+    m_queuetail = chunk;
+    leavelock(&m_lock);
+}
+
+// record - Records an event in the calling thread's buffer. No lock is
+//   acquired, unless the buffer is full, in which case it is handed to the
+//   writer thread and replaced with an empty one.
+//
+//  - buffer (IN/OUT): Pointer to the calling thread's buffer. Each thread must
+//      have its own, which must initially be NULL.
+//
+//  - type (IN): Type of the event (see traceevent_t).
+//
+//  - heap (IN): Handle of the heap the block belongs to.
+//
+//  - address (IN): Address of the block.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  - stack (IN): ID of the call stack the block was allocated from.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::record (tracebuffer_t **buffer, UINT32 type, HANDLE heap, LPCVOID address, SIZE_T size,
+                          UINT32 stack)
+{
+    tracebuffer_t *current = *buffer;
+    traceevent_t  *event;
+
+    if (current == NULL) {
+        // This is the first event recorded by the calling thread.
+        enterlock(&m_lock);
+        current = activatebuffer();
+        leavelock(&m_lock);
+        *buffer = current;
+    }
+
+    // The writer thread may write the events recorded so far at any time, so
+    // the event must be filled in before it is published.
+    event = &current->events[current->count];
+    event->address = (ULONGLONG)(SIZE_T)address;
+    event->heap = (ULONGLONG)(SIZE_T)heap;
+    event->size = size;
+    event->stack = stack;
+    event->type = type;
+    event->timestamp = getperfcounter();
+    publishcounter(&current->count, current->count + 1);
+    if (current->count < TRACEBUFFEREVENTS) {
+        return;
+    }
+
+    // The buffer is full. Queue it to be written.
+    enterlock(&m_lock);
+    queuebuffer(current);
+    *buffer = activatebuffer();
+    leavelock(&m_lock);
+
+    while ((readcounter(&m_pendingcount) > TRACEMAXPENDING) && (readcounter(&m_stop) == 0)) {
+        // The writer thread has fallen behind. Give it a chance to catch up.
+        delay(1);
+    }
+}
+
+// release - Releases the buffer of a thread that is exiting. The events
+//   recorded in it that haven't been written yet are queued to be written, and
+//   the buffer is then reused.
+//
+//  - buffer (IN): Pointer to the thread's buffer. The thread must not record
+//      any more events in it.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::release (tracebuffer_t *buffer)
+{
+    enterlock(&m_lock);
+    queuebuffer(buffer);
+    leavelock(&m_lock);
+}
+
+// writebuffer - Writes the events recorded in a buffer that haven't been
+//   written yet, as a chunk of events.
+//
+//   Note: The caller must hold the writer's write lock.
+//
+//  - buffer (IN): Pointer to the buffer.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::writebuffer (tracebuffer_t *buffer)
+{
+    SIZE_T       count = acquirecounter(&buffer->count);
+    tracechunk_t header;
+
+    if (count == buffer->flushed) {
+        // No events have been recorded since the buffer was last written.
+        return;
+    }
+    header.type = TRACE_CHUNK_EVENTS;
+    header.id = buffer->threadid;
+    header.count = (UINT32)(count - buffer->flushed);
+    header.size = header.count * sizeof(traceevent_t);
+    writechunk(&header, &buffer->events[buffer->flushed]);
+    buffer->flushed = count;
+}
+
+// writechunk - Writes a chunk to the trace file. If writing fails, nothing
+//   more is written (events continue to be recorded, but are discarded).
+//
+//   Note: The caller must hold the writer's write lock.
+//
+//  - header (IN): Pointer to the chunk's header.
+//
+//  - payload (IN): Pointer to the chunk's payload.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::writechunk (const tracechunk_t *header, LPCVOID payload)
+{
+    if (m_failed) {
+        return;
+    }
+    if (!writefile(m_file, header, sizeof(tracechunk_t)) || !writefile(m_file, payload, header->size)) {
+        m_failed = TRUE;
+    }
+}
+
+// writemodule - Queues the description of a module loaded into the process to
+//   be written to the trace file.
+//
+//  - low (IN): Address of the module's lowest loaded segment.
+//
+//  - high (IN): Address just beyond the module's highest loaded segment.
+//
+//  - bias (IN): Difference between the module's run-time and link-time
+//      addresses.
+//
+//  - buildid (IN): The module's build ID.
+//
+//  - buildidsize (IN): Size, in bytes, of the module's build ID. Build IDs
+//      larger than TRACEMAXBUILDIDSIZE are left out.
+//
+//  - path (IN): Path of the module's file.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::writemodule (SIZE_T low, SIZE_T high, SIZE_T bias, const BYTE *buildid, SIZE_T buildidsize,
+                               LPCSTR path)
+{
+    queuedchunk_t *chunk;
+    tracemodule_t *module;
+    SIZE_T         size = sizeof(tracemodule_t) + strlen(path) + 1;
+
+    chunk = (queuedchunk_t*)new BYTE [sizeof(queuedchunk_t) + size];
+    chunk->header.type = TRACE_CHUNK_MODULE;
+    chunk->header.id = 0;
+    chunk->header.count = 1;
+    chunk->header.size = (UINT32)size;
+    module = (tracemodule_t*)(chunk + 1);
+    memset(module, 0x0, sizeof(tracemodule_t));
+    module->bias = bias;
+    module->high = high;
+    module->low = low;
+    if (buildidsize <= TRACEMAXBUILDIDSIZE) {
+        memcpy(module->buildid, buildid, buildidsize);
+        module->buildidsize = (UINT32)buildidsize;
+    }
+    strcpy((LPSTR)(module + 1), path);
+    queuechunk(chunk);
+}
+
+// writestack - Queues an interned call stack to be written to the trace file.
+//
+//  - id (IN): ID by which events refer to the call stack.
+//
+//  - callstack (IN): The call stack.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceWriter::writestack (UINT32 id, const CallStack *callstack)
+{
+    queuedchunk_t *chunk;
+    UINT32         count = callstack->size();
+    ULONGLONG     *frames;
+    UINT32         frame;
+
+    chunk = (queuedchunk_t*)new BYTE [sizeof(queuedchunk_t) + count * sizeof(ULONGLONG)];
+    chunk->header.type = TRACE_CHUNK_STACK;
+    chunk->header.id = id;
+    chunk->header.count = count;
+    chunk->header.size = count * sizeof(ULONGLONG);
+    frames = (ULONGLONG*)(chunk + 1);
+    for (frame = 0; frame < count; frame++) {
+        frames[frame] = (*callstack)[frame];
+    }
+    queuechunk(chunk);
+}
+
+// writerthread - Thread procedure of the writer thread. Periodically writes
+//   everything that has been recorded to the trace file, until "close" is
+//   called.
+//
+//  - context (IN): Pointer to the TraceWriter.
+//
+//  Return Value:
+//
+//    Always returns zero.
+//
+DWORD TraceWriter::writerthread (LPVOID context)
+{
+    TraceWriter *writer = (TraceWriter*)context;
+
+    while (readcounter(&writer->m_stop) == 0) {
+        delay(TRACEWRITEINTERVAL);
+        writer->flush();
+    }
+
+    // The writer may be freed as soon as this is set.
+    InterlockedExchange(&writer->m_stopped, 1);
+
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The TraceReader Class
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Constructor - Initializes private data. No trace file is read until "open"
+//   is called.
+//
+TraceReader::TraceReader ()
+{
+    m_chunks      = NULL;
+    m_chunkcount  = 0;
+    m_cursors     = NULL;
+    m_cursorcount = 0;
+    m_endtime     = 0;
+    m_file        = NULL;
+    m_frames      = NULL;
+    m_framecount  = 0;
+    memset(&m_header, 0x0, sizeof(m_header));
+    initlock(&m_lock);
+    m_maxevents   = 0;
+    m_modules     = NULL;
+    m_modulecount = 0;
+    m_stacks      = NULL;
+    m_stackcount  = 0;
+}
+
+// Destructor - Closes the trace file, if it is still open.
+//
+TraceReader::~TraceReader ()
+{
+    close();
+    deletelock(&m_lock);
+}
+
+// chunkcount - Obtains the number of chunks of events in the trace file. The
+//   chunks are numbered from zero, in the order they appear in the file.
+//
+//  Return Value:
+//
+//    Returns the number of chunks of events.
+//
+SIZE_T TraceReader::chunkcount () const
+{
+    return m_chunkcount;
+}
+
+// close - Closes the trace file, and frees everything that was read from it.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceReader::close ()
+{
+    SIZE_T index;
+
+    for (index = 0; index < m_cursorcount; index++) {
+        delete [] m_cursors[index].events;
+    }
+    for (index = 0; index < m_modulecount; index++) {
+        delete [] (BYTE*)m_modules[index];
+    }
+    delete [] m_chunks;
+    delete [] m_cursors;
+    delete [] m_frames;
+    delete [] m_modules;
+    delete [] m_stacks;
+    if (m_file != NULL) {
+        fclose(m_file);
+    }
+    m_chunks      = NULL;
+    m_chunkcount  = 0;
+    m_cursors     = NULL;
+    m_cursorcount = 0;
+    m_endtime     = 0;
+    m_file        = NULL;
+    m_frames      = NULL;
+    m_framecount  = 0;
+    m_maxevents   = 0;
+    m_modules     = NULL;
+    m_modulecount = 0;
+    m_stacks      = NULL;
+    m_stackcount  = 0;
+}
+
+// endtime - Obtains the timestamp of the last event in the trace file.
+//
+//  Return Value:
+//
+//    Returns the timestamp of the last event, or zero if there are no events.
+//
+ULONGLONG TraceReader::endtime () const
+{
+    return m_endtime;
+}
+
+// getmodule - Obtains the description of a module that was loaded into the
+//   traced process.
+//
+//  - index (IN): Index of the module, in the order the modules appear in the
+//      trace file.
+//
+//  - module (OUT): Receives a pointer to the module's description. It remains
+//      valid until the trace file is closed.
+//
+//  - path (OUT): Receives a pointer to the path of the module's file.
+//
+//  Return Value:
+//
+//    Returns TRUE if the trace describes a module with the specified index.
+//    Otherwise returns FALSE.
+//
+BOOL TraceReader::getmodule (SIZE_T index, const tracemodule_t **module, LPCSTR *path) const
+{
+    if (index >= m_modulecount) {
+        return FALSE;
+    }
+    *module = m_modules[index];
+    *path = (LPCSTR)(m_modules[index] + 1);
+
+    return TRUE;
+}
+
+// getstack - Obtains the frames of a call stack.
+//
+//  - id (IN): ID of the call stack.
+//
+//  - frames (OUT): Receives a pointer to the call stack's frames (program
+//      counters). The frames remain valid until the trace file is closed.
+//
+//  - count (OUT): Receives the number of frames in the call stack.
+//
+//  Return Value:
+//
+//    Returns TRUE if the trace contains a call stack with the specified ID.
+//    Otherwise returns FALSE.
+//
+BOOL TraceReader::getstack (UINT32 id, const ULONGLONG **frames, UINT32 *count) const
+{
+    if ((id >= m_stackcount) || (m_stacks[id].first == (SIZE_T)-1)) {
+        return FALSE;
+    }
+    *frames = m_frames + m_stacks[id].first;
+    *count = m_stacks[id].count;
+
+    return TRUE;
+}
+
+// header - Obtains the trace file's header.
+//
+//  Return Value:
+//
+//    Returns a pointer to the header.
+//
+const traceheader_t* TraceReader::header () const
+{
+    return &m_header;
+}
+
+// loadchunk - Reads a chunk of events into a cursor.
+//
+//  - cursor (IN/OUT): Pointer to the cursor.
+//
+//  - chunk (IN): Index, in the chunk index, of the chunk to read. May be
+//      (SIZE_T)-1, if the thread has no more chunks.
+//
+//  Return Value:
+//
+//    Returns TRUE if the chunk was read. Otherwise returns FALSE.
+//
+BOOL TraceReader::loadchunk (cursor_t *cursor, SIZE_T chunk)
+{
+    DWORD threadid;
+
+    if ((chunk == (SIZE_T)-1) || !readchunk(chunk, cursor->events, &cursor->count, &threadid)) {
+        return FALSE;
+    }
+    cursor->chunk = chunk;
+    cursor->index = 0;
+
+    return TRUE;
+}
+
+// maxevents - Obtains the largest number of events in any one chunk, so that
+//   buffers large enough for any chunk can be allocated.
+//
+//  Return Value:
+//
+//    Returns the largest number of events in any one chunk.
+//
+UINT32 TraceReader::maxevents () const
+{
+    return m_maxevents;
+}
+
+// modulecount - Obtains the number of module descriptions in the trace file.
+//
+//  Return Value:
+//
+//    Returns the number of module descriptions.
+//
+SIZE_T TraceReader::modulecount () const
+{
+    return m_modulecount;
+}
+
+// nextevent - Reads the next event, in timestamp order. Events recorded at the
+//   same time by different threads are read in order of thread ID.
+//
+//  - event (OUT): Receives the event.
+//
+//  - threadid (OUT): Receives the thread ID of the thread that recorded the
+//      event.
+//
+//  Return Value:
+//
+//    Returns TRUE if an event was read. Returns FALSE once all of the events
+//    have been read.
+//
+BOOL TraceReader::nextevent (traceevent_t *event, DWORD *threadid)
+{
+    cursor_t *cursor;
+
+    if (m_cursorcount == 0) {
+        return FALSE;
+    }
+
+    // The cursor at the top of the heap holds the earliest event.
+    cursor = &m_cursors[0];
+    *event = cursor->events[cursor->index];
+    *threadid = cursor->threadid;
+    cursor->index++;
+    if ((cursor->index == cursor->count) && !loadchunk(cursor, m_chunks[cursor->chunk].next)) {
+        // That was the thread's last event.
+        delete [] cursor->events;
+        m_cursorcount--;
+        m_cursors[0] = m_cursors[m_cursorcount];
+    }
+    if (m_cursorcount != 0) {
+        siftdown(0);
+    }
+
+    return TRUE;
+}
+
+// open - Opens a trace file. The file's chunks are indexed, and its call
+//   stacks and modules are loaded. If the file was cut short (because the
+//   traced process crashed, for example), everything up to the last complete
+//   chunk is read.
+//
+//  - path (IN): Path of the trace file.
+//
+//  Return Value:
+//
+//    Returns TRUE if the file was opened. Returns FALSE if it could not be
+//    read or isn't a trace file.
+//
+BOOL TraceReader::open (LPCSTR path)
+{
+    SIZE_T                        capacity;
+    const chunkindex_t           *chunk;
+    chunkindex_t                 *chunks;
+    cursor_t                     *cursors;
+    traceevent_t                  event;
+    SIZE_T                        framecapacity = 0;
+    ULONGLONG                    *frames;
+    tracechunk_t                  header;
+    SIZE_T                        index;
+    tracemodule_t                *module;
+    tracemodule_t               **modules;
+    ULONGLONG                     offset;
+    stackindex_t                 *stacks;
+    Map<DWORD, SIZE_T>::Iterator  threadit;
+    Map<DWORD, SIZE_T>            threads;
+
+    close();
+    m_file = fopen(path, "rb");
+    if (m_file == NULL) {
+        return FALSE;
+    }
+    if ((fread(&m_header, sizeof(m_header), 1, m_file) != 1) ||
+        (memcmp(m_header.magic, TRACEMAGIC, sizeof(m_header.magic)) != 0) || (m_header.version != TRACEVERSION)) {
+        close();
+        return FALSE;
+    }
+
+    // Index the chunks of events, linking each thread's chunks together, and
+    // load the call stacks and modules.
+    offset = sizeof(m_header);
+    while (fread(&header, sizeof(header), 1, m_file) == 1) {
+        offset += sizeof(header);
+        if ((header.type == TRACE_CHUNK_EVENTS) && (header.count != 0)) {
+            if ((m_chunkcount & (m_chunkcount - 1)) == 0) {
+                // The index is full (its capacity is always a power of two).
+                capacity = (m_chunkcount == 0) ? 64 : m_chunkcount * 2;
+                chunks = new chunkindex_t [capacity];
+                if (m_chunkcount != 0) {
+                    memcpy(chunks, m_chunks, m_chunkcount * sizeof(chunkindex_t));
+                }
+                delete [] m_chunks;
+                m_chunks = chunks;
+            }
+            m_chunks[m_chunkcount].count = header.count;
+            m_chunks[m_chunkcount].next = (SIZE_T)-1;
+            m_chunks[m_chunkcount].offset = offset;
+            m_chunks[m_chunkcount].threadid = header.id;
+            if (header.count > m_maxevents) {
+                m_maxevents = header.count;
+            }
+            threadit = threads.find(header.id);
+            if (threadit != threads.end()) {
+                // Link the chunk after the thread's previous chunk.
+                index = (*threadit).second;
+                m_chunks[m_cursors[index].last].next = m_chunkcount;
+                m_cursors[index].last = m_chunkcount;
+            }
+            else {
+                // This is the thread's first chunk.
+                if ((m_cursorcount & (m_cursorcount - 1)) == 0) {
+                    capacity = (m_cursorcount == 0) ? 16 : m_cursorcount * 2;
+                    cursors = new cursor_t [capacity];
+                    if (m_cursorcount != 0) {
+                        memcpy(cursors, m_cursors, m_cursorcount * sizeof(cursor_t));
+                    }
+                    delete [] m_cursors;
+                    m_cursors = cursors;
+                }
+                m_cursors[m_cursorcount].chunk = m_chunkcount;
+                m_cursors[m_cursorcount].events = NULL;
+                m_cursors[m_cursorcount].last = m_chunkcount;
+                m_cursors[m_cursorcount].threadid = header.id;
+                threads.insert(header.id, m_cursorcount);
+                m_cursorcount++;
+            }
+            m_chunkcount++;
+        }
+        else if (header.type == TRACE_CHUNK_STACK) {
+            if (header.id >= m_stackcount) {
+                // Make room for call stacks up to this one's ID.
+                capacity = (m_stackcount == 0) ? 256 : m_stackcount;
+                while (capacity <= header.id) {
+                    capacity *= 2;
+                }
+                stacks = new stackindex_t [capacity];
+                if (m_stackcount != 0) {
+                    memcpy(stacks, m_stacks, m_stackcount * sizeof(stackindex_t));
+                }
+                for (index = m_stackcount; index < capacity; index++) {
+                    stacks[index].count = 0;
+                    stacks[index].first = (SIZE_T)-1;
+                }
+                delete [] m_stacks;
+                m_stacks = stacks;
+                m_stackcount = (UINT32)capacity;
+            }
+            if (m_framecount + header.count > framecapacity) {
+                // Make room for this call stack's frames.
+                framecapacity = (framecapacity == 0) ? 4096 : framecapacity * 2;
+                if (framecapacity < m_framecount + header.count) {
+                    framecapacity = m_framecount + header.count;
+                }
+                frames = new ULONGLONG [framecapacity];
+                if (m_framecount != 0) {
+                    memcpy(frames, m_frames, m_framecount * sizeof(ULONGLONG));
+                }
+                delete [] m_frames;
+                m_frames = frames;
+            }
+            if (fread(m_frames + m_framecount, sizeof(ULONGLONG), header.count, m_file) != header.count) {
+                // The file was cut short.
+                break;
+            }
+            m_stacks[header.id].count = header.count;
+            m_stacks[header.id].first = m_framecount;
+            m_framecount += header.count;
+        }
+        else if ((header.type == TRACE_CHUNK_MODULE) && (header.size > sizeof(tracemodule_t))) {
+            if ((m_modulecount & (m_modulecount - 1)) == 0) {
+                capacity = (m_modulecount == 0) ? 64 : m_modulecount * 2;
+                modules = new tracemodule_t* [capacity];
+                if (m_modulecount != 0) {
+                    memcpy(modules, m_modules, m_modulecount * sizeof(tracemodule_t*));
+                }
+                delete [] m_modules;
+                m_modules = modules;
+            }
+            module = (tracemodule_t*)new BYTE [header.size];
+            if (fread(module, header.size, 1, m_file) != 1) {
+                // The file was cut short.
+                delete [] (BYTE*)module;
+                break;
+            }
+            // Make sure the path is terminated, whatever the file holds.
+            ((LPSTR)module)[header.size - 1] = '\0';
+            m_modules[m_modulecount] = module;
+            m_modulecount++;
+        }
+        offset += header.size;
+        if (fseek64(m_file, offset, SEEK_SET) != 0) {
+            break;
+        }
+    }
+
+    // Find the last event, which is the last event of one of the threads.
+    for (index = 0; index < m_cursorcount; index++) {
+        chunk = &m_chunks[m_cursors[index].last];
+        if ((fseek64(m_file, chunk->offset + (chunk->count - 1) * sizeof(traceevent_t), SEEK_SET) == 0) &&
+            (fread(&event, sizeof(event), 1, m_file) == 1) && (event.timestamp > m_endtime)) {
+            m_endtime = event.timestamp;
+        }
+    }
+
+    // Read each thread's first chunk, and arrange the cursors in a heap.
+    index = 0;
+    while (index < m_cursorcount) {
+        m_cursors[index].events = new traceevent_t [m_maxevents];
+        if (!loadchunk(&m_cursors[index], m_cursors[index].chunk)) {
+            delete [] m_cursors[index].events;
+            m_cursorcount--;
+            m_cursors[index] = m_cursors[m_cursorcount];
+            continue;
+        }
+        index++;
+    }
+    for (index = m_cursorcount / 2; index > 0; index--) {
+        siftdown(index - 1);
+    }
+
+    return TRUE;
+}
+
+// readchunk - Reads a chunk of events. Several threads may read chunks at the
+//   same time, but not while events are being read with "nextevent".
+//
+//  - chunk (IN): Index of the chunk, from zero to "chunkcount" minus one.
+//
+//  - events (OUT): Buffer that receives the chunk's events. It must be large
+//      enough for "maxevents" events.
+//
+//  - count (OUT): Receives the number of events in the chunk.
+//
+//  - threadid (OUT): Receives the thread ID of the thread that recorded the
+//      events.
+//
+//  Return Value:
+//
+//    Returns TRUE if the chunk was read. Otherwise returns FALSE.
+//
+BOOL TraceReader::readchunk (SIZE_T chunk, traceevent_t *events, UINT32 *count, DWORD *threadid)
+{
+    BOOL read;
+
+    if (chunk >= m_chunkcount) {
+        return FALSE;
+    }
+    enterlock(&m_lock);
+    read = (fseek64(m_file, m_chunks[chunk].offset, SEEK_SET) == 0) &&
+           (fread(events, sizeof(traceevent_t), m_chunks[chunk].count, m_file) == m_chunks[chunk].count);
+    leavelock(&m_lock);
+    if (!read) {
+        return FALSE;
+    }
+    *count = m_chunks[chunk].count;
+    *threadid = m_chunks[chunk].threadid;
+
+    return TRUE;
+}
+
+// siftdown - Restores the order of the heap of cursors, after the next event
+//   of one of them has changed.
+//
+//  - index (IN): Index of the cursor whose next event has changed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID TraceReader::siftdown (SIZE_T index)
+{
+    SIZE_T          child;
+    const cursor_t *first;
+    const cursor_t *second;
+    cursor_t        swap;
+
+    for (;;) {
+        child = index * 2 + 1;
+        if (child >= m_cursorcount) {
+            break;
+        }
+        if (child + 1 < m_cursorcount) {
+            // Pick the child holding the earlier event.
+            first = &m_cursors[child];
+            second = &m_cursors[child + 1];
+            if ((second->events[second->index].timestamp < first->events[first->index].timestamp) ||
+                ((second->events[second->index].timestamp == first->events[first->index].timestamp) &&
+                 (second->threadid < first->threadid))) {
+                child++;
+            }
+        }
+        first = &m_cursors[index];
+        second = &m_cursors[child];
+        if ((first->events[first->index].timestamp < second->events[second->index].timestamp) ||
+            ((first->events[first->index].timestamp == second->events[second->index].timestamp) &&
+             (first->threadid <= second->threadid))) {
+            break;
+        }
+        swap = m_cursors[index];
+        m_cursors[index] = m_cursors[child];
+        m_cursors[child] = swap;
+        index = child;
+    }
+}
@@ -0,0 +1,265 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - TraceWriter and TraceReader Class Definitions
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifndef VLDBUILD
+#error \
+"This header should only be included by Visual Leak Detector when building it from source. \
+Applications should never include this header."
+#endif
+
+#include <cstdio>
+#include "callstack.h" // Provides a class for handling call stacks.
+#include "platform.h"  // Provides the platform services and, on POSIX systems, the Win32 types.
+
+#define TRACEMAGIC          "VLDTRACE" // Identifies trace files (without the terminating NUL, 8 bytes).
+#define TRACEVERSION        1          // Version of the trace file format.
+#define TRACEBUFFEREVENTS   1024       // Number of events each thread buffers before handing them to the writer.
+#define TRACEMAXBUILDIDSIZE 64         // Maximum size, in bytes, of a module's build ID.
+#define TRACEMAXPENDING     256        // Maximum number of full buffers waiting to be written before threads wait.
+#define TRACEWRITEINTERVAL  10         // Interval, in milliseconds, at which buffered events are written.
+
+// A trace file starts with this header. It is followed by any number of
+// chunks, each made of a tracechunk_t followed by its payload. All fields are
+// in the byte order of the traced process. Readers skip chunks of unknown
+// types.
+typedef struct traceheader_s {
+    CHAR      magic [8];     // TRACEMAGIC.
+    UINT32    version;       // TRACEVERSION.
+    UINT32    pointersize;   // Size, in bytes, of a pointer in the traced process.
+    ULONGLONG perffrequency; // Frequency, in ticks per second, of the event timestamps.
+    ULONGLONG starttime;     // Timestamp at which tracing started.
+    ULONGLONG virtualheap;   // Handle of the traced process' virtual heap (see VIRTUALHEAP).
+} traceheader_t;
+
+typedef struct tracechunk_s {
+    UINT32 type;             // Type of chunk:
+#define TRACE_CHUNK_EVENTS 0x1 //   The payload is an array of traceevent_t, all recorded by the same thread.
+#define TRACE_CHUNK_STACK  0x2 //   The payload is an interned call stack: an array of program counters (ULONGLONG).
+#define TRACE_CHUNK_MODULE 0x3 //   The payload is a tracemodule_t, followed by the module's path (NUL-terminated).
+    UINT32 id;               // Thread ID of the thread that recorded the events, or ID of the call stack.
+    UINT32 count;            // Number of events, or of frames, in the payload (one for modules).
+    UINT32 size;             // Size, in bytes, of the payload.
+} tracechunk_t;
+
+// Each module loaded into the traced process is described by a module chunk, so
+// that the call stacks can be symbolized offline. A module may be described
+// more than once.
+typedef struct tracemodule_s {
+    ULONGLONG bias;                           // Difference between the module's run-time and link-time addresses.
+    ULONGLONG high;                           // Address just beyond the module's highest loaded segment.
+    ULONGLONG low;                            // Address of the module's lowest loaded segment.
+    UINT32    buildidsize;                    // Size, in bytes, of the module's build ID (zero if it has none).
+    BYTE      buildid [TRACEMAXBUILDIDSIZE];  // The module's build ID.
+} tracemodule_t;
+
+// Every block that is mapped, unmapped or remapped by the tracking engine is
+// recorded as one event. Each thread's events are written in the order they
+// were recorded, but the events of different threads are interleaved in
+// chunks, so they must be merged by timestamp to be put back in order.
+typedef struct traceevent_s {
+    ULONGLONG address;           // Address of the block.
+    ULONGLONG heap;              // Handle of the heap the block belongs to.
+    ULONGLONG size;              // Size, in bytes, of the block (zero for frees).
+    UINT32    stack;             // ID of the call stack the block was allocated from (zero for frees).
+    UINT32    type;              // Type of event:
+#define TRACE_EVENT_ALLOC       0x1 //   The block was allocated.
+#define TRACE_EVENT_FREE        0x2 //   The block was freed.
+#define TRACE_EVENT_REALLOC     0x3 //   The block was reallocated in place (a moved block is freed and allocated).
+#define TRACE_EVENT_HEAPDESTROY 0x4 //   The heap was destroyed, with all of its blocks ("address" is zero).
+#define TRACE_EVENT_TYPE(type)  ((type) & 0xFF)
+#define TRACE_EVENT_CRT         0x100 // If set, the block is a CRT block (see "mapblock").
+    ULONGLONG timestamp;         // Time, in performance counter ticks, at which the event was recorded.
+} traceevent_t;
+
+// Each thread records events in its own buffer, without locking. Full buffers
+// are handed to the writer thread, which writes them to the trace file.
+typedef struct tracebuffer_s {
+    SIZE_T                count;                       // Number of events recorded (published by the owner with "publishcounter").
+    traceevent_t          events [TRACEBUFFEREVENTS];  // The recorded events.
+    SIZE_T                flushed;                     // Number of events already written (only accessed while writing).
+    struct tracebuffer_s *flushnext;                   // Next buffer in the list of active buffers being written.
+    struct tracebuffer_s *next;                        // Next buffer in the list the buffer is on.
+    struct tracebuffer_s *prev;                        // Previous buffer in the list of active buffers.
+    DWORD                 threadid;                    // Thread ID of the thread that owns the buffer.
+} tracebuffer_t;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The TraceWriter Class
+//
+//    When tracing is enabled, every event of the tracking engine is streamed
+//    to a compact binary trace file, which can later be replayed or analyzed
+//    offline. Recording an event only appends it to the calling thread's own
+//    buffer. Full buffers are queued, and written by a background thread that
+//    also writes out the partially filled buffers every TRACEWRITEINTERVAL
+//    milliseconds, so that the events of idle threads are not held back. When
+//    a thread exits, its buffer is queued like a full one, and then reused.
+//
+//    The file is only written to after the buffers and call stacks to be
+//    written have been detached from the writer's lists, so that threads
+//    recording events never wait for the file.
+//
+//    Interned call stacks are identified in events by a small integer ID. Each
+//    call stack is written once, in a chunk of its own, when it is interned.
+//
+//    If the writer falls behind by more than TRACEMAXPENDING buffers, threads
+//    that fill another buffer wait for it to catch up, so that the amount of
+//    memory held in buffers stays bounded.
+//
+class TraceWriter
+{
+public:
+    TraceWriter ();
+    ~TraceWriter ();
+
+    // Public APIs - see each function definition for details.
+    VOID close ();
+    VOID forkprepare ();
+    VOID forkrelease ();
+    BOOL open (LPCWSTR path, HANDLE virtualheap);
+    VOID record (tracebuffer_t **buffer, UINT32 type, HANDLE heap, LPCVOID address, SIZE_T size, UINT32 stack);
+    VOID release (tracebuffer_t *buffer);
+    VOID writemodule (SIZE_T low, SIZE_T high, SIZE_T bias, const BYTE *buildid, SIZE_T buildidsize, LPCSTR path);
+    VOID writestack (UINT32 id, const CallStack *callstack);
+
+private:
+    // Call stacks and modules are queued in queuedchunk_t structures, followed
+    // by their payload, until they are written.
+    typedef struct queuedchunk_s {
+        tracechunk_t          header; // The chunk's header.
+        struct queuedchunk_s *next;   // Next chunk in the queue.
+    } queuedchunk_t;
+
+    // Private Helper Functions - see each function definition for details.
+    tracebuffer_t* activatebuffer ();
+    VOID flush ();
+    VOID queuebuffer (tracebuffer_t *buffer);
+    VOID queuechunk (queuedchunk_t *chunk);
+    VOID writebuffer (tracebuffer_t *buffer);
+    VOID writechunk (const tracechunk_t *header, LPCVOID payload);
+
+    // Static functions (callbacks)
+    static DWORD __stdcall writerthread (LPVOID context);
+
+    // Private Data
+    tracebuffer_t *m_active;       // List of the buffers threads are recording events in.
+    BOOL           m_failed;       // If TRUE, writing to the trace file has failed. Events are discarded.
+    vldfile_t      m_file;         // The trace file.
+    tracebuffer_t *m_free;         // List of buffers that have been written, and can be reused.
+    vldlock_t      m_lock;         // Serializes access to the lists of buffers and to the queue of call stacks and modules.
+    BOOL           m_open;         // If TRUE, the trace file is open.
+    tracebuffer_t *m_pending;      // Queue of full buffers waiting to be written (oldest first).
+    SIZE_T         m_pendingcount; // Number of buffers in the queue of full buffers.
+    tracebuffer_t *m_pendingtail;  // Newest buffer in the queue of full buffers.
+    queuedchunk_t *m_queue;        // Queue of call stacks and modules waiting to be written (oldest first).
+    queuedchunk_t *m_queuetail;    // Newest chunk in the queue of call stacks and modules.
+    LONG           m_stop;         // Set to stop the writer thread.
+    LONG           m_stopped;      // Set by the writer thread once it has stopped writing, just before it exits.
+    vldthread_t    m_thread;       // The writer thread.
+    vldlock_t      m_writelock;    // Serializes writing to the trace file. Never acquired while holding "m_lock".
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The TraceReader Class
+//
+//    A TraceReader reads back a trace file written by a TraceWriter. When the
+//    file is opened, its chunks are indexed and its call stacks and modules
+//    are loaded. The events are then read in timestamp order, by merging the
+//    events of every thread, a chunk at a time, so that only one chunk per
+//    thread is held in memory however large the trace is.
+//
+//    Alternatively, the chunks of events can be read directly, in any order,
+//    by several threads at once, for analyses that don't need the events to
+//    be put back in order.
+//
+class TraceReader
+{
+public:
+    TraceReader ();
+    ~TraceReader ();
+
+    // Public APIs - see each function definition for details.
+    SIZE_T chunkcount () const;
+    VOID close ();
+    ULONGLONG endtime () const;
+    BOOL getmodule (SIZE_T index, const tracemodule_t **module, LPCSTR *path) const;
+    BOOL getstack (UINT32 id, const ULONGLONG **frames, UINT32 *count) const;
+    const traceheader_t* header () const;
+    UINT32 maxevents () const;
+    SIZE_T modulecount () const;
+    BOOL nextevent (traceevent_t *event, DWORD *threadid);
+    BOOL open (LPCSTR path);
+    BOOL readchunk (SIZE_T chunk, traceevent_t *events, UINT32 *count, DWORD *threadid);
+
+private:
+    // The events of each thread are read through a cursor, which holds the
+    // thread's current chunk.
+    typedef struct cursor_s {
+        SIZE_T        chunk;    // Index, in the chunk index, of the cursor's current chunk.
+        UINT32        count;    // Number of events in the current chunk.
+        traceevent_t *events;   // The events of the current chunk.
+        UINT32        index;    // Index of the cursor's next event in the current chunk.
+        SIZE_T        last;     // Index, in the chunk index, of the thread's last chunk found so far.
+        DWORD         threadid; // Thread ID of the thread whose events are read through the cursor.
+    } cursor_t;
+
+    // Each chunk of events is indexed by its position in the file. The chunks
+    // of each thread are linked together, in file order.
+    typedef struct chunkindex_s {
+        UINT32    count;    // Number of events in the chunk.
+        SIZE_T    next;     // Index of the thread's next chunk, or (SIZE_T)-1 if this is its last chunk.
+        ULONGLONG offset;   // Offset, in the file, of the chunk's payload.
+        DWORD     threadid; // Thread ID of the thread that recorded the events.
+    } chunkindex_t;
+
+    // The frames of all call stacks are loaded into one array. Each call stack
+    // is located in the array by its ID.
+    typedef struct stackindex_s {
+        UINT32 count;     // Number of frames in the call stack.
+        SIZE_T first;     // Index of the call stack's first frame, or (SIZE_T)-1 if there is no such call stack.
+    } stackindex_t;
+
+    // Private Helper Functions - see each function definition for details.
+    BOOL loadchunk (cursor_t *cursor, SIZE_T chunk);
+    VOID siftdown (SIZE_T index);
+
+    // Private Data
+    chunkindex_t  *m_chunks;      // Index of the chunks of events.
+    SIZE_T         m_chunkcount;  // Number of entries in the chunk index.
+    cursor_t      *m_cursors;     // One cursor per thread, arranged as a binary heap ordered by next timestamp.
+    SIZE_T         m_cursorcount; // Number of cursors in the heap (threads with events left to read).
+    ULONGLONG      m_endtime;     // Timestamp of the last event.
+    FILE          *m_file;        // The trace file.
+    ULONGLONG     *m_frames;      // The frames of all call stacks, one after another.
+    SIZE_T         m_framecount;  // Number of frames in "m_frames".
+    traceheader_t  m_header;      // The trace file's header.
+    vldlock_t      m_lock;        // Serializes reads from the trace file.
+    UINT32         m_maxevents;   // Largest number of events in any one chunk.
+    tracemodule_t **m_modules;    // The modules, each followed by its path.
+    SIZE_T         m_modulecount; // Number of modules in "m_modules".
+    stackindex_t  *m_stacks;      // Location of each call stack's frames, by ID.
+    UINT32         m_stackcount;  // Number of entries in "m_stacks" (the highest call stack ID plus one).
+};
@@ -29,7 +29,9 @@
 Applications should never include this header."
 #endif
 
-#include "vldheap.h" // Provides internal new and delete operators.
+#include <cassert>
+#include "platform.h" // Provides locks.
+#include "vldheap.h"  // Provides internal new and delete operators.
 
 #define TREE_DEFAULT_RESERVE 32 // By default, trees reserve enough space, in advance, for this many nodes.
 
@@ -82,8 +84,9 @@ public:
     // Constructor
     Tree ()
     {
+        m_count      = 0;
         m_freelist   = NULL;
-        InitializeCriticalSection(&m_lock);
+        initlock(&m_lock);
         m_nil.color  = black;
         m_nil.key    = T();
         m_nil.left   = &m_nil;
@@ -109,7 +112,7 @@ public:
         chunk_t *temp;
 
         // Free all the chunks in the chunk list.
-        EnterCriticalSection(&m_lock);
+        enterlock(&m_lock);
         cur = m_store;
         while (cur != NULL) {
             temp = cur;
@@ -117,8 +120,8 @@ public:
             delete [] temp->nodes;
             delete temp;
         }
-        LeaveCriticalSection(&m_lock);
-        DeleteCriticalSection(&m_lock);
+        leavelock(&m_lock);
+        deletelock(&m_lock);
     }
 
     // operator = - Assignment operator. For efficiency, we want to avoid ever
@@ -144,9 +147,9 @@ public:
     {
         node_t *cur;
 
-        EnterCriticalSection(&m_lock);
+        enterlock(&m_lock);
         if (m_root == &m_nil) {
-            LeaveCriticalSection(&m_lock);
+            leavelock(&m_lock);
             return NULL;
         }
 
@@ -154,7 +157,7 @@ public:
         while (cur->left != &m_nil) {
             cur = cur->left;
         }
-        LeaveCriticalSection(&m_lock);
+        leavelock(&m_lock);
 
         return cur;
     }
@@ -177,7 +180,7 @@ public:
         node_t *erasure;
         node_t *sibling;
 
-        EnterCriticalSection(&m_lock);
+        enterlock(&m_lock);
 
         if ((node->left == &m_nil) || (node->right == &m_nil)) {
             // The node to be erased has less than two children. It can be directly
@@ -297,8 +300,9 @@ public:
         // Put the erased node onto the free list.
         erasure->next = m_freelist;
         m_freelist = erasure;
+        m_count--;
 
-        LeaveCriticalSection(&m_lock);
+        leavelock(&m_lock);
     }
 
     // erase - Erases the specified key from the tree. Note that this does
@@ -319,7 +323,7 @@ public:
         node_t *node;
 
         // Find the node to erase.
-        EnterCriticalSection(&m_lock);
+        enterlock(&m_lock);
         node = m_root;
         while (node != &m_nil) {
             if (node->key < key) {
@@ -333,11 +337,11 @@ public:
             else {
                 // Found it.
                 erase(node);
-                LeaveCriticalSection(&m_lock);
+                leavelock(&m_lock);
                 return;
             }
         }
-        LeaveCriticalSection(&m_lock);
+        leavelock(&m_lock);
 
         // 'key' is not in the tree.
         return;
@@ -358,7 +362,7 @@ public:
     {
         node_t *cur;
         
-        EnterCriticalSection(&m_lock);
+        enterlock(&m_lock);
         cur = m_root;
         while (cur != &m_nil) {
             if (cur->key < key) {
@@ -371,11 +375,11 @@ public:
             }
             else {
                 // Found it.
-                LeaveCriticalSection(&m_lock);
+                leavelock(&m_lock);
                 return cur;
             }
         }
-        LeaveCriticalSection(&m_lock);
+        leavelock(&m_lock);
 
         // 'key' is not in the tree.
         return NULL;
@@ -400,7 +404,7 @@ public:
         node_t  *parent;
         node_t  *uncle;
 
-        EnterCriticalSection(&m_lock);
+        enterlock(&m_lock);
 
         // Find the location where the new node should be inserted..
         cur = m_root;
@@ -417,7 +421,7 @@ public:
             }
             else {
                 // Keys in the tree must be unique.
-                LeaveCriticalSection(&m_lock);
+                leavelock(&m_lock);
                 return NULL;
             }
         }
@@ -501,8 +505,9 @@ public:
 
         // The root node is always colored black.
         m_root->color = black;
+        m_count++;
 
-        LeaveCriticalSection(&m_lock);
+        leavelock(&m_lock);
 
         return node;        
     }
@@ -526,7 +531,7 @@ public:
             return NULL;
         }
 
-        EnterCriticalSection(&m_lock);
+        enterlock(&m_lock);
         if (node->right != &m_nil) {
             // 'node' has a right child. Successor is the far left node in
             // the right subtree.
@@ -534,14 +539,14 @@ public:
             while (cur->left != &m_nil) {
                 cur = cur->left;
             }
-            LeaveCriticalSection(&m_lock);
+            leavelock(&m_lock);
             return cur;
         }
         else if (node->parent != &m_nil) {
             // 'node' has no right child, but does have a parent.
             if (node == node->parent->left) {
                 // 'node' is a left child; node's parent is successor.
-                LeaveCriticalSection(&m_lock);
+                leavelock(&m_lock);
                 return node->parent;
             }
             else {
@@ -554,20 +559,20 @@ public:
                         continue;
                     }
                     else {
-                        LeaveCriticalSection(&m_lock);
+                        leavelock(&m_lock);
                         return cur->parent;
                     }
                 }
 
                 // There is no parent greater than 'node'. 'node' is the
                 // maximum node.
-                LeaveCriticalSection(&m_lock);
+                leavelock(&m_lock);
                 return NULL;
             }
         }
         else {
             // 'node' is root and root is the maximum node.
-            LeaveCriticalSection(&m_lock);
+            leavelock(&m_lock);
             return NULL;
         }
     }
@@ -591,7 +596,7 @@ public:
             return NULL;
         }
 
-        EnterCriticalSection(&m_lock);
+        enterlock(&m_lock);
         if (node->left != &m_nil) {
             // 'node' has left child. Predecessor is the far right node in the
             // left subtree.
@@ -599,14 +604,14 @@ public:
             while (cur->right != &m_nil) {
                 cur = cur->right;
             }
-            LeaveCriticalSection(&m_lock);
+            leavelock(&m_lock);
             return cur;
         }
         else if (node->parent != & m_nil) {
             // 'node' has no left child, but does have a parent.
             if (node == node->parent->right) {
                 // 'node' is a right child; node's parent is predecessor.
-                LeaveCriticalSection(&m_lock);
+                leavelock(&m_lock);
                 return node->parent;
             }
             else {
@@ -619,20 +624,20 @@ public:
                         continue;
                     }
                     else {
-                        LeaveCriticalSection(&m_lock);
+                        leavelock(&m_lock);
                         return cur->parent;
                     }
                 }
 
                 // There is no parent less than 'node'. 'node' is the minimum
                 // node.
-                LeaveCriticalSection(&m_lock);
+                leavelock(&m_lock);
                 return NULL;
             }
         }
         else {
             // 'node' is root and root is the minimum node.
-            LeaveCriticalSection(&m_lock);
+            leavelock(&m_lock);
             return NULL;
         }
     }
@@ -670,7 +675,7 @@ public:
             }
         }
 
-        EnterCriticalSection(&m_lock);
+        enterlock(&m_lock);
         if (m_freelist == NULL) {
             // Allocate additional storage.
             // Link a new chunk into the chunk list.
@@ -692,11 +697,22 @@ public:
             chunk->nodes[index].next = NULL;
             m_freelist = chunk->nodes;
         }
-        LeaveCriticalSection(&m_lock);
+        leavelock(&m_lock);
 
         return oldreserve;
     }
 
+    // size - Obtains the number of nodes currently in the tree.
+    //
+    //  Return Value:
+    //
+    //    Returns the number of keys currently stored in the tree.
+    //
+    SIZE_T size () const
+    {
+        return m_count;
+    }
+
 private:
     // _rotateleft: Rotates a pair of nodes counter-clockwise so that the parent
     //   node becomes the left child and the right child becomes the parent.
@@ -775,11 +791,12 @@ private:
     }
 
     // Private data members.
-    node_t                   *m_freelist;  // Pointer to the list of free nodes (reserve storage).
-    mutable CRITICAL_SECTION  m_lock;      // Protects the tree's integrity against concurrent accesses.
-    node_t                    m_nil;       // The tree's nil node. All leaf nodes point to this.
-    UINT32                    m_reserve;   // The size (in nodes) of the chunks of reserve storage.
-    node_t                   *m_root;      // Pointer to the tree's root node.
-    chunk_t                  *m_store;     // Pointer to the start of the chunk list.
-    chunk_t                  *m_storetail; // Pointer to the end of the chunk list.
+    SIZE_T             m_count;     // The number of nodes currently in the tree.
+    node_t            *m_freelist;  // Pointer to the list of free nodes (reserve storage).
+    mutable vldlock_t  m_lock;      // Protects the tree's integrity against concurrent accesses.
+    node_t             m_nil;       // The tree's nil node. All leaf nodes point to this.
+    UINT32             m_reserve;   // The size (in nodes) of the chunks of reserve storage.
+    node_t            *m_root;      // Pointer to the tree's root node.
+    chunk_t           *m_store;     // Pointer to the start of the chunk list.
+    chunk_t           *m_storetail; // Pointer to the end of the chunk list.
 };
@@ -22,7 +22,12 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include <cassert>
+#include <cctype>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwctype>
+#ifdef _WIN32
 #include <windows.h>
 #if _WIN32_WINNT < 0x0600 // Windows XP or earlier, no GetProcessIdOfThread()
 #include <winternl.h>
@@ -32,15 +37,18 @@
 #endif
 #define DBGHELP_TRANSLATE_TCHAR
 #include <dbghelp.h>    // Provides portable executable (PE) image access functions.
+#endif // _WIN32
 #define VLDBUILD        // Declares that we are building Visual Leak Detector.
 #include "utility.h"    // Provides various utility functions and macros.
-#include "vldheap.h"    // Provides internal new and delete operators.
+#include "vldheap.h"    // Provides the CRT memory block header and internal new and delete operators.
 
+#ifdef _WIN32
 // Imported Global Variables
 extern CRITICAL_SECTION imagelock;
+#endif // _WIN32
 
 // Global variables.
-static BOOL        reportdelay = FALSE;     // If TRUE, we sleep for a bit after calling OutputDebugString to give the debugger time to catch up.
+static BOOL        reportdelay = FALSE;     // If TRUE, we sleep for a bit after sending output to the debugger to give it time to catch up.
 static FILE       *reportfile = NULL;       // Pointer to the file, if any, to send the memory leak report to.
 static BOOL        reporttodebugger = TRUE; // If TRUE, a copy of the memory leak report will be sent to the debugger for display.
 static encoding_e  reportencoding = ascii;  // Output encoding of the memory leak report.
@@ -201,6 +209,7 @@ VOID dumpmemoryw (LPCVOID address, SIZE_T size)
     }
 }
 
+#ifdef _WIN32
 // findimport - Determines if the specified module imports the named import
 //   from the named exporting module.
 //
@@ -340,8 +349,41 @@ BOOL findpatch (HMODULE importmodule, LPCSTR exportmodulename, LPCVOID replaceme
     return FALSE;
 }
 
+#endif // _WIN32
+
+// getcrtuserblock - Finds the user data portion of a block allocated by the
+//   debug CRT, which has a CRT memory block header prepended to it.
+//
+//  - block (IN): Pointer to the memory block, including its CRT memory block
+//      header.
+//
+//  - address (OUT): Receives the address of the user data portion of the
+//      block.
+//
+//  - usersize (OUT): Receives the size, in bytes, of the user data portion of
+//      the block.
+//
+//  Return Value:
+//
+//    Returns FALSE if the block is used internally by the CRT, or is tagged to
+//    be ignored, in which case it should not be considered to be a memory leak
+//    and the outputs are not set. Otherwise returns TRUE.
+//
+BOOL getcrtuserblock (LPCVOID block, LPCVOID *address, SIZE_T *usersize)
+{
+    const crtdbgblockheader_t *crtheader = (const crtdbgblockheader_t*)block;
+
+    if (!iscrtuserblock(crtheader->use)) {
+        return FALSE;
+    }
+    *address = CRTDBGBLOCKDATA(block);
+    *usersize = crtheader->size;
+
+    return TRUE;
+}
+
 // insertreportdelay - Sets the report function to sleep for a bit after each
-//   call to OutputDebugString, in order to allow the debugger to catch up.
+//   message sent to the debugger, in order to allow the debugger to catch up.
 //
 //  Return Value:
 //
@@ -352,6 +394,120 @@ VOID insertreportdelay ()
     reportdelay = TRUE;
 }
 
+// iscrtuserblock - Determines whether a debug CRT "use type" is that of a block
+//   allocated on behalf of the program, which may be leaked. Blocks used
+//   internally by the CRT, and blocks tagged to be ignored, are never reported
+//   as leaks (the debug CRT doesn't report them either).
+//
+//  - use (IN): The block's "use type", as passed to the debug CRT's allocation
+//      functions or recorded in its CRT memory block header. Any sub-type
+//      information is ignored.
+//
+//  Return Value:
+//
+//    Returns FALSE if blocks of this use type are not to be considered to be
+//    memory leaks. Otherwise returns TRUE.
+//
+BOOL iscrtuserblock (int use)
+{
+    switch (CRT_USE_TYPE(use)) {
+    case CRT_USE_INTERNAL:
+    case CRT_USE_IGNORE:
+        return FALSE;
+
+    default:
+        return TRUE;
+    }
+}
+
+// matchpattern - Determines whether a string matches a wildcard pattern. In the
+//   pattern, "*" matches any sequence of characters (including none) and "?"
+//   matches any single character. All other characters match only themselves.
+//
+//  - pattern (IN): The pattern to match the string against.
+//
+//  - string (IN): The string to match.
+//
+//  Return Value:
+//
+//    Returns TRUE if the whole string matches the pattern. Otherwise returns
+//    FALSE.
+//
+BOOL matchpattern (LPCSTR pattern, LPCSTR string)
+{
+    LPCSTR retrypattern = NULL;
+    LPCSTR retrystring = NULL;
+
+    while (*string != '\0') {
+        if (*pattern == '*') {
+            // Try matching the rest of the pattern here first. If that fails,
+            // let the wildcard absorb one more character and try again.
+            pattern++;
+            retrypattern = pattern;
+            retrystring = string;
+        }
+        else if ((*pattern == '?') || (*pattern == *string)) {
+            pattern++;
+            string++;
+        }
+        else if (retrypattern != NULL) {
+            pattern = retrypattern;
+            string = ++retrystring;
+        }
+        else {
+            return FALSE;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+
+    return (*pattern == '\0') ? TRUE : FALSE;
+}
+
+// nextlistitem - Extracts the next item from a list of items separated by
+//   commas or semicolons (such as a list of patterns read from the vld.ini
+//   file). White space around each item is ignored, and empty items are
+//   skipped.
+//
+//  - list (IN): The remainder of the list.
+//
+//  - item (OUT): Buffer that receives the item. Items too long to fit are
+//      truncated.
+//
+//  - size (IN): Size, in characters, of the buffer.
+//
+//  Return Value:
+//
+//    Returns a pointer to the remainder of the list, just past the item, to be
+//    passed back in to extract the following item. Returns NULL if there are no
+//    more items in the list.
+//
+LPCWSTR nextlistitem (LPCWSTR list, LPWSTR item, SIZE_T size)
+{
+    SIZE_T length = 0;
+
+    while ((*list == L',') || (*list == L';') || iswspace(*list)) {
+        list++;
+    }
+    if (*list == L'\0') {
+        return NULL;
+    }
+    while ((*list != L'\0') && (*list != L',') && (*list != L';')) {
+        if (length < size - 1) {
+            item[length++] = *list;
+        }
+        list++;
+    }
+    while ((length > 0) && iswspace(item[length - 1])) {
+        length--;
+    }
+    item[length] = L'\0';
+
+    return list;
+}
+
+#ifdef _WIN32
 // moduleispatched - Checks to see if any of the imports listed in the specified
 //   patch table have been patched into the specified importmodule.
 //
@@ -522,6 +678,8 @@ BOOL patchmodule (HMODULE importmodule, patchentry_t patchtable [], UINT tablesi
     return patched;
 }
 
+#endif // _WIN32
+
 // report - Sends a printf-style formatted message to the debugger for display
 //   and/or to a file.
 //
@@ -555,7 +713,7 @@ VOID report (LPCWSTR format, ...)
             fwrite(messagew, sizeof(WCHAR), wcslen(messagew), reportfile);
         }
         if (reporttodebugger) {
-            OutputDebugStringW(messagew);
+            debugoutputw(messagew);
         }
     }
     else {
@@ -570,15 +728,16 @@ VOID report (LPCWSTR format, ...)
             fwrite(messagea, sizeof(CHAR), strlen(messagea), reportfile);
         }
         if (reporttodebugger) {
-            OutputDebugStringA(messagea);
+            debugoutputa(messagea);
         }
     }
 
     if (reporttodebugger && (reportdelay == TRUE)) {
-        Sleep(10); // Workaround the Visual Studio 6 bug where debug strings are sometimes lost if they're sent too fast.
+        delay(10); // Workaround the Visual Studio 6 bug where debug strings are sometimes lost if they're sent too fast.
     }
 }
 
+#ifdef _WIN32
 // restoreimport - Restores the IAT entry for an import previously patched via
 //   a call to "patchimport" to the original address of the import.
 //
@@ -690,6 +849,8 @@ VOID restoremodule (HMODULE importmodule, patchentry_t patchtable [], UINT table
     }
 }
 
+#endif // _WIN32
+
 // setreportencoding - Sets the output encoding of report messages to either
 //   ASCII (the default) or Unicode.
 //
@@ -784,6 +945,7 @@ BOOL strtobool (LPCWSTR s) {
     }
 }
 
+#ifdef _WIN32
 // _GetProcessIdOfThread - Returns the ID of the process owns the thread.
 //
 //  - thread (IN): The handle to the thread.
@@ -838,3 +1000,4 @@ DWORD _GetProcessIdOfThread (HANDLE thread)
 
     return (DWORD)tbi.ClientId.UniqueProcess;
 }
+#endif // _WIN32
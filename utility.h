@@ -30,15 +30,19 @@ Applications should never include this header."
 #endif
 
 #include <cstdio>
-#include <windows.h>
+#include "platform.h" // Provides the platform services and, on POSIX systems, the Win32 types.
 
-#ifdef _WIN64
-#define ADDRESSFORMAT   L"0x%.16X" // Format string for 64-bit addresses
+#if defined(_WIN64)
+#define ADDRESSFORMAT   L"0x%.16X"  // Format string for 64-bit addresses
+#elif defined(_WIN32)
+#define ADDRESSFORMAT   L"0x%.8X"   // Format string for 32-bit addresses
+#elif defined(__LP64__)
+#define ADDRESSFORMAT   L"0x%.16lX" // Format string for 64-bit addresses
 #else
-#define ADDRESSFORMAT   L"0x%.8X"  // Format string for 32-bit addresses
+#define ADDRESSFORMAT   L"0x%.8lX"  // Format string for 32-bit addresses
 #endif // _WIN64
-#define BOM             0xFEFF     // Unicode byte-order mark.
-#define MAXREPORTLENGTH 511        // Maximum length, in characters, of "report" messages.
+#define BOM             0xFEFF      // Unicode byte-order mark.
+#define MAXREPORTLENGTH 511         // Maximum length, in characters, of "report" messages.
 
 // Architecture-specific definitions for x86 and x64
 #if defined(_M_IX86)
@@ -59,6 +63,8 @@ Applications should never include this header."
 
 #if defined(_M_IX86) || defined (_M_X64)
 #define FRAMEPOINTER(fp) __asm {mov fp, BPREG} // Copies the current frame pointer to the supplied variable.
+#elif defined(__GNUC__)
+#define FRAMEPOINTER(fp) ((fp) = (decltype(fp))__builtin_frame_address(0)) // Copies the current frame pointer to the supplied variable.
 #else
 // If you want to retarget Visual Leak Detector to another processor
 // architecture then you'll need to provide an architecture-specific macro to
@@ -78,6 +84,7 @@ enum encoding_e {
     unicode
 };
 
+#ifdef _WIN32
 // This structure allows us to build a table of APIs which should be patched
 // through to replacement functions provided by VLD.
 typedef struct patchentry_s
@@ -87,26 +94,36 @@ typedef struct patchentry_s
     SIZE_T  modulebase;       // The base address of the exporting module (filled in at runtime when the modules are loaded).
     LPCVOID replacement;      // Pointer to the function to which the imported API should be patched through to.
 } patchentry_t;
+#endif // _WIN32
 
 // Utility functions. See function definitions for details.
 VOID dumpmemorya (LPCVOID address, SIZE_T length);
 VOID dumpmemoryw (LPCVOID address, SIZE_T length);
+BOOL getcrtuserblock (LPCVOID block, LPCVOID *address, SIZE_T *usersize);
+VOID insertreportdelay ();
+BOOL iscrtuserblock (int use);
+BOOL matchpattern (LPCSTR pattern, LPCSTR string);
+LPCWSTR nextlistitem (LPCWSTR list, LPWSTR item, SIZE_T size);
+VOID report (LPCWSTR format, ...);
+VOID setreportencoding (encoding_e encoding);
+VOID setreportfile (FILE *file, BOOL copydebugger);
+VOID strapp (LPWSTR *dest, LPCWSTR source);
+BOOL strtobool (LPCWSTR s);
+
+#ifdef _WIN32
+// Import patching functions (Win32 only). See function definitions for
+// details.
 BOOL findimport (HMODULE importmodule, HMODULE exportmodule, LPCSTR exportmodulename, LPCSTR importname);
 BOOL findpatch (HMODULE importmodule, LPCSTR exportmodulename, LPCVOID replacement);
-VOID insertreportdelay ();
 BOOL moduleispatched (HMODULE importmodule, patchentry_t patchtable [], UINT tablesize);
 BOOL patchimport (HMODULE importmodule, HMODULE exportmodule, LPCSTR exportmodulename, LPCSTR importname,
                   LPCVOID replacement);
 BOOL patchmodule (HMODULE importmodule, patchentry_t patchtable [], UINT tablesize);
-VOID report (LPCWSTR format, ...);
 VOID restoreimport (HMODULE importmodule, HMODULE exportmodule, LPCSTR exportmodulename, LPCSTR importname,
                     LPCVOID replacement);
 VOID restoremodule (HMODULE importmodule, patchentry_t patchtable [], UINT tablesize);
-VOID setreportencoding (encoding_e encoding);
-VOID setreportfile (FILE *file, BOOL copydebugger);
-VOID strapp (LPWSTR *dest, LPCWSTR source);
-BOOL strtobool (LPCWSTR s);
 #if _WIN32_WINNT < 0x0600 // Windows XP or earlier, no GetProcessIdOfThread()
 DWORD _GetProcessIdOfThread (HANDLE thread);
 #define GetProcessIdOfThread _GetProcessIdOfThread
-#endif
\ No newline at end of file
+#endif
+#endif // _WIN32
\ No newline at end of file
@@ -26,6 +26,7 @@
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <sys/stat.h>
 #include <windows.h>
 #ifndef __out_xcount
@@ -37,21 +38,33 @@
 #include "callstack.h"   // Provides a class for handling call stacks.
 #include "crtmfcpatch.h" // Provides CRT and MFC patch functions.
 #include "map.h"         // Provides a lightweight STL-like map template.
+#include "markscanner.h" // Provides a class for classifying leaks by reachability.
 #include "ntapi.h"       // Provides access to NT APIs.
+#include "platform.h"    // Provides the platform services.
 #include "set.h"         // Provides a lightweight STL-like set template.
 #include "utility.h"     // Provides various utility functions.
 #include "vldheap.h"     // Provides internal new and delete operators.
 #include "vldint.h"      // Provides access to the Visual Leak Detector internals.
 
-#define BLOCKMAPRESERVE     64  // This should strike a balance between memory use and a desire to minimize heap hits.
 #define HEAPMAPRESERVE      2   // Usually there won't be more than a few heaps in the process, so this should be small.
+#define MAXPATTERNLENGTH    256 // Maximum length, in characters, of a function or source file pattern.
 #define MAXSYMBOLNAMELENGTH 256 // Maximum symbol name length that we will allow. Longer names will be truncated.
 #define MODULESETRESERVE    16  // There are likely to be several modules loaded in the process.
+#define SYMTAGFUNCTION      5   // Symbol tag of functions (SymTagFunction, see cvconst.h).
 
 // Imported global variables.
 extern vldblockheader_t *vldblocklist;
 extern HANDLE            vldheap;
-extern CRITICAL_SECTION  vldheaplock;
+extern vldlock_t         vldheaplock;
+
+// Source files of the C runtime and MFC allocation functions, which are
+// internal to the heap. The frames of the functions defined in these files are
+// left out of call stacks, so that the first frame of a block's call stack is
+// where the program allocated it.
+static LPCWSTR internalfiles [] = {
+    L"*\\afxmem.cpp", L"*\\dbgheap.c", L"*\\dbgnew.cpp", L"*\\malloc.c", L"*\\new.cpp", L"*\\new2.cpp",
+    L"*\\newaop.cpp", L"*\\newaopnt.cpp", L"*\\newopnt.cpp"
+};
 
 // Global variables.
 HANDLE           currentprocess; // Pseudo-handle for the current process.
@@ -214,6 +227,8 @@ VisualLeakDetector::VisualLeakDetector ()
     LPWSTR     symbolpath;
 
     // Initialize configuration options and related private data.
+    _wcsnset_s(m_excludedfunctionlist, MAXMODULELISTLENGTH, '\0', _TRUNCATE);
+    _wcsnset_s(m_forcedfunctionlist, MAXMODULELISTLENGTH, '\0', _TRUNCATE);
     _wcsnset_s(m_forcedmodulelist, MAXMODULELISTLENGTH, '\0', _TRUNCATE);
     m_maxdatadump    = 0xffffffff;
     m_maxtraceframes = 0xffffffff;
@@ -221,6 +236,9 @@ VisualLeakDetector::VisualLeakDetector ()
     m_reportfile     = NULL;
     wcsncpy_s(m_reportfilepath, MAX_PATH, VLD_DEFAULT_REPORT_FILE_NAME, _TRUNCATE);
     m_status         = 0x0;
+    m_suppressionfilepath[0] = L'\0';
+    m_tracefilepath[0] = L'\0';
+    m_tracewriter    = NULL;
 
     // Load configuration options.
     configure();
@@ -237,29 +255,52 @@ VisualLeakDetector::VisualLeakDetector ()
     currentthread     = GetCurrentThread();
     InitializeCriticalSection(&imagelock);
     LdrLoadDll        = (LdrLoadDll_t)GetProcAddress(ntdll, "LdrLoadDll");
+    NtQueryInformationThread = (NtQueryInformationThread_t)GetProcAddress(ntdll, "NtQueryInformationThread");
     processheap       = GetProcessHeap();
     RtlAllocateHeap   = (RtlAllocateHeap_t)GetProcAddress(ntdll, "RtlAllocateHeap");
     RtlFreeHeap       = (RtlFreeHeap_t)GetProcAddress(ntdll, "RtlFreeHeap");
     RtlReAllocateHeap = (RtlReAllocateHeap_t)GetProcAddress(ntdll, "RtlReAllocateHeap");
     InitializeCriticalSection(&stackwalklock);
     InitializeCriticalSection(&symbollock);
-    vldheap           = HeapCreate(0x0, 0, 0);
-    InitializeCriticalSection(&vldheaplock);
+    vldheap           = heapcreate();
+    initlock(&vldheaplock);
 
     // Initialize remaining private data.
+    m_degradation     = VLD_DEGRADE_NONE;
+    m_epoch           = 0;
+    m_excludedranges  = NULL;
+    m_forcedranges    = NULL;
     m_heapmap         = new HeapMap;
     m_heapmap->reserve(HEAPMAPRESERVE);
     m_imalloc         = NULL;
+    m_internalranges  = NULL;
+    m_lasttick        = gettickcount();
     m_leaksfound      = 0;
+    m_livebytes       = 0;
     m_loadedmodules   = NULL;
-    InitializeCriticalSection(&m_loaderlock);
-    InitializeCriticalSection(&m_maplock);
-    InitializeCriticalSection(&m_moduleslock);
+    initlock(&m_loaderlock);
+    initlock(&m_maplock);
+    initlock(&m_moduleslock);
+    m_monitorstop     = NULL;
+    m_monitorstopped  = NULL;
+    m_monitorthread   = NULL;
+    m_peakbytes       = 0;
+    m_perffrequency   = getperffrequency();
+    m_retiredlist     = NULL;
+    m_retiredranges   = new RangeTableSet;
+    m_sampleallocs    = 0;
     m_selftestfile    = __FILE__;
     m_selftestline    = 0;
+    m_serialnumber    = 0;
+    m_snapshotepochs  = new EpochSet;
+    m_stackmap        = new StackMap;
+    m_starttime       = getperfcounter();
+    m_suppressions    = NULL;
+    m_tickwraps       = 0;
     m_tlsindex        = TlsAlloc();
-    InitializeCriticalSection(&m_tlslock);
+    initlock(&m_tlslock);
     m_tlsset          = new TlsSet;
+    m_tracestacks     = 0;
 
     if (m_options & VLD_OPT_SELF_TEST) {
         // Self-test mode has been enabled. Intentionally leak a small amount of
@@ -346,6 +387,29 @@ VisualLeakDetector::VisualLeakDetector ()
     EnumerateLoadedModulesW64(currentprocess, addloadedmodule, newmodules);
     attachtoloadedmodules(newmodules);
     m_loadedmodules = newmodules;
+
+    if (wcslen(m_suppressionfilepath) != 0) {
+        // Leaks that match the signatures in the suppression file are left
+        // out of leak reports.
+        m_suppressions = new SuppressionList;
+        if (!m_suppressions->load(m_suppressionfilepath)) {
+            report(L"WARNING: Visual Leak Detector: Couldn't open suppression file for reading: %s\n",
+                   m_suppressionfilepath);
+            delete m_suppressions;
+            m_suppressions = NULL;
+        }
+    }
+
+    if (wcslen(m_tracefilepath) != 0) {
+        // Tracing has been enabled. Every block mapped, unmapped or remapped
+        // from now on is recorded in the trace file.
+        m_tracewriter = new TraceWriter;
+        if (!m_tracewriter->open(m_tracefilepath, VIRTUALHEAP)) {
+            report(L"WARNING: Visual Leak Detector: Couldn't open trace file for writing: %s\n", m_tracefilepath);
+            delete m_tracewriter;
+            m_tracewriter = NULL;
+        }
+    }
     m_status |= VLD_STATUS_INSTALLED;
 
     report(L"Visual Leak Detector Version " VLDVERSION L" installed.\n");
@@ -358,6 +422,17 @@ VisualLeakDetector::VisualLeakDetector ()
 
     }
     reportconfig();
+
+    if (m_monitorinterval != 0) {
+        // Start the leak growth monitor.
+        m_monitorstop = CreateEvent(NULL, TRUE, FALSE, NULL);
+        m_monitorstopped = CreateEvent(NULL, TRUE, FALSE, NULL);
+        m_monitorthread = CreateThread(NULL, 0, monitorthread, NULL, 0, NULL);
+        if (m_monitorthread == NULL) {
+            report(L"WARNING: Visual Leak Detector: Failed to start the leak growth monitor (error=%lu).\n",
+                   GetLastError());
+        }
+    }
 }
 
 // Destructor - Detaches Visual Leak Detector from all modules loaded in the
@@ -370,14 +445,19 @@ VisualLeakDetector::~VisualLeakDetector ()
     BlockMap            *blockmap;
     size_t               count;
     vldblockheader_t    *header;
-    HANDLE               heap;
     HeapMap::Iterator    heapit;
     SIZE_T               internalleaks = 0;
     const char          *leakfile = NULL;
     WCHAR                leakfilew [MAX_PATH];
     int                  leakline = 0;
     ModuleSet::Iterator  moduleit;
+    stackinfo_t         *nextstack;
+    RangeTableSet::Iterator rangeit;
+    retiredinfo_t       *retired;
+    stackinfo_t         *stack;
+    StackMap::Iterator   stackit;
     HANDLE               thread;
+    HANDLE               monitorhandles [2];
     BOOL                 threadsactive= FALSE;
     TlsSet::Iterator     tlsit;
     DWORD                dwCurProcessID;
@@ -387,6 +467,20 @@ VisualLeakDetector::~VisualLeakDetector ()
         return;
     }
 
+    if (m_monitorthread != NULL) {
+        // Stop the leak growth monitor. If the process is exiting, the monitor
+        // thread has already been terminated. Otherwise, wait only until it
+        // signals that it has stopped; waiting for it to actually exit would
+        // deadlock, because it can't exit while we're holding the loader lock.
+        SetEvent(m_monitorstop);
+        monitorhandles[0] = m_monitorthread;
+        monitorhandles[1] = m_monitorstopped;
+        WaitForMultipleObjects(2, monitorhandles, FALSE, INFINITE);
+        CloseHandle(m_monitorthread);
+        CloseHandle(m_monitorstopped);
+        CloseHandle(m_monitorstop);
+    }
+
     if (m_status & VLD_STATUS_INSTALLED) {
         // Detach Visual Leak Detector from all previously attached modules.
         EnumerateLoadedModulesW64(currentprocess, detachfrommodule, NULL);
@@ -394,9 +488,9 @@ VisualLeakDetector::~VisualLeakDetector ()
         dwCurProcessID = GetCurrentProcessId();
 
         // See if any threads that have ever entered VLD's code are still active.
-        EnterCriticalSection(&m_tlslock);
+        enterlock(&m_tlslock);
         for (tlsit = m_tlsset->begin(); tlsit != m_tlsset->end(); ++tlsit) {
-            if ((*tlsit)->threadid == GetCurrentThreadId()) {
+            if ((*tlsit)->threadid == currentthreadid()) {
                 // Don't wait for the current thread to exit.
                 continue;
             }
@@ -425,7 +519,14 @@ VisualLeakDetector::~VisualLeakDetector ()
             }
             CloseHandle(thread);
         }
-        LeaveCriticalSection(&m_tlslock);
+        leavelock(&m_tlslock);
+
+        if (m_tracewriter != NULL) {
+            // Write out the rest of the trace.
+            m_tracewriter->close();
+            delete m_tracewriter;
+            m_tracewriter = NULL;
+        }
 
         if (m_status & VLD_STATUS_NEVER_ENABLED) {
             // Visual Leak Detector started with leak detection disabled and
@@ -433,11 +534,10 @@ VisualLeakDetector::~VisualLeakDetector ()
             report(L"WARNING: Visual Leak Detector: Memory leak detection was never enabled.\n");
         }
         else {
-            // Generate a memory leak report for each heap in the process.
-            for (heapit = m_heapmap->begin(); heapit != m_heapmap->end(); ++heapit) {
-                heap = (*heapit).first;
-                reportleaks(heap);
-            }
+            // Generate a memory leak report for all heaps in the process,
+            // headed by the statistics.
+            reportstats();
+            reportleaks(NULL);
 
             // Show a summary.
             if (m_leaksfound == 0) {
@@ -447,6 +547,16 @@ VisualLeakDetector::~VisualLeakDetector ()
                 report(L"Visual Leak Detector detected %lu memory leak", m_leaksfound);
                 report((m_leaksfound > 1) ? L"s.\n" : L".\n");
             }
+            if (readcounter(&m_degradation) >= VLD_DEGRADE_SAMPLE) {
+                report(L"NOTE: Visual Leak Detector: Not every block was tracked, to stay within the internal memory\n"
+                       L"  limit. Some memory leaks may not have been detected.\n");
+            }
+
+            if (m_options & VLD_OPT_REPORT_SITES) {
+                // Also show where the outstanding memory was allocated from,
+                // by call site.
+                reportsites();
+            }
         }
 
         // Free resources used by the symbol handler.
@@ -459,19 +569,48 @@ VisualLeakDetector::~VisualLeakDetector ()
         for (heapit = m_heapmap->begin(); heapit != m_heapmap->end(); ++heapit) {
             blockmap = &(*heapit).second->blockmap;
             for (blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
-                delete (*blockit).second->callstack;
                 delete (*blockit).second;
             }
-            delete blockmap;
+            delete (*heapit).second;
         }
         delete m_heapmap;
 
+        // Free any block information still waiting to be reclaimed. All
+        // snapshots have been freed by now, so nothing references it anymore.
+        while (m_retiredlist != NULL) {
+            retired = m_retiredlist;
+            m_retiredlist = retired->next;
+            delete retired->info;
+            delete retired;
+        }
+        delete m_snapshotepochs;
+
+        // Free internally allocated resources used by the stack depot.
+        for (stackit = m_stackmap->begin(); stackit != m_stackmap->end(); ++stackit) {
+            stack = (*stackit).second;
+            while (stack != NULL) {
+                nextstack = stack->next;
+                delete stack->callstack;
+                delete stack;
+                stack = nextstack;
+            }
+        }
+        delete m_stackmap;
+
         // Free internally allocated resources used by the loaded module set.
         for (moduleit = m_loadedmodules->begin(); moduleit != m_loadedmodules->end(); ++moduleit) {
             delete (*moduleit).name;
             delete (*moduleit).path;
         }
         delete m_loadedmodules;
+        delete m_excludedranges;
+        delete m_forcedranges;
+        delete m_internalranges;
+        for (rangeit = m_retiredranges->begin(); rangeit != m_retiredranges->end(); ++rangeit) {
+            delete *rangeit;
+        }
+        delete m_retiredranges;
+        delete m_suppressions;
 
         // Free internally allocated resources used for thread local storage.
         for (tlsit = m_tlsset->begin(); tlsit != m_tlsset->end(); ++tlsit) {
@@ -522,18 +661,28 @@ VisualLeakDetector::~VisualLeakDetector ()
     }
     else {
         // VLD failed to load properly.
+        delete m_excludedranges;
+        delete m_forcedranges;
         delete m_heapmap;
+        delete m_internalranges;
+        for (rangeit = m_retiredranges->begin(); rangeit != m_retiredranges->end(); ++rangeit) {
+            delete *rangeit;
+        }
+        delete m_retiredranges;
+        delete m_snapshotepochs;
+        delete m_stackmap;
+        delete m_suppressions;
         delete m_tlsset;
     }
-    HeapDestroy(vldheap);
+    heapdestroy(vldheap);
 
     DeleteCriticalSection(&imagelock);
-    DeleteCriticalSection(&m_loaderlock);
-    DeleteCriticalSection(&m_maplock);
-    DeleteCriticalSection(&m_moduleslock);
+    deletelock(&m_loaderlock);
+    deletelock(&m_maplock);
+    deletelock(&m_moduleslock);
     DeleteCriticalSection(&stackwalklock);
     DeleteCriticalSection(&symbollock);
-    DeleteCriticalSection(&vldheaplock);
+    deletelock(&vldheaplock);
 
     if (m_tlsindex != TLS_OUT_OF_INDEXES) {
         TlsFree(m_tlsindex);
@@ -595,7 +744,7 @@ VOID VisualLeakDetector::attachtoloadedmodules (ModuleSet *newmodules)
         modulesize  = (DWORD)((*newit).addrhigh - (*newit).addrlow) + 1;
 
         refresh = FALSE;
-        EnterCriticalSection(&m_moduleslock);
+        enterlock(&m_moduleslock);
         oldmodules = m_loadedmodules;
         if (oldmodules != NULL) {
             // This is not the first time we have been called to attach to the
@@ -604,7 +753,7 @@ VOID VisualLeakDetector::attachtoloadedmodules (ModuleSet *newmodules)
             if (oldit != oldmodules->end()) {
                 // We've seen this "new" module loaded in the process before.
                 moduleflags = (*oldit).flags;
-                LeaveCriticalSection(&m_moduleslock);
+                leavelock(&m_moduleslock);
                 if (moduleispatched((HMODULE)modulebase, m_patchtable, tablesize)) {
                     // This module is already attached. Just update the module's
                     // flags, nothing more.
@@ -620,11 +769,11 @@ VOID VisualLeakDetector::attachtoloadedmodules (ModuleSet *newmodules)
                 }
             }
             else {
-                LeaveCriticalSection(&m_moduleslock);
+                leavelock(&m_moduleslock);
             }
         }
         else {
-            LeaveCriticalSection(&m_moduleslock);
+            leavelock(&m_moduleslock);
         }
 
         EnterCriticalSection(&symbollock);
@@ -655,6 +804,16 @@ VOID VisualLeakDetector::attachtoloadedmodules (ModuleSet *newmodules)
             continue;
         }
 
+        if (moduleflags & VLD_MODULE_SYMBOLSLOADED) {
+            // Find any of the heap's internal functions (those of the C runtime
+            // or MFC) that this module defines.
+            resolveinternalranges(modulebase);
+
+            // Find the functions matching the function rules.
+            resolvefunctionranges(modulebase, m_excludedfunctionlist, &m_excludedranges);
+            resolvefunctionranges(modulebase, m_forcedfunctionlist, &m_forcedranges);
+        }
+
         mbstowcs_s(&count, modulenamew, MAXMODULENAME, modulename, _TRUNCATE);
         if ((findimport((HMODULE)modulebase, m_vldbase, "vld.dll", "?vld@@3VVisualLeakDetector@@A") == FALSE) &&
             (wcsstr(vld.m_forcedmodulelist, modulenamew) == NULL)) {
@@ -823,6 +982,21 @@ VOID VisualLeakDetector::configure ()
         m_options |= VLD_OPT_AGGREGATE_DUPLICATES;
     }
 
+    GetPrivateProfileString(L"Options", L"ClassifyLeaks", L"", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == TRUE) {
+        m_options |= VLD_OPT_CLASSIFY_LEAKS;
+    }
+
+    GetPrivateProfileString(L"Options", L"MonitorStats", L"", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == TRUE) {
+        m_options |= VLD_OPT_MONITOR_STATS;
+    }
+
+    GetPrivateProfileString(L"Options", L"ReportSites", L"", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == TRUE) {
+        m_options |= VLD_OPT_REPORT_SITES;
+    }
+
     GetPrivateProfileString(L"Options", L"SelfTest", L"", buffer, BSIZE, inipath);
     if (strtobool(buffer) == TRUE) {
         m_options |= VLD_OPT_SELF_TEST;
@@ -845,15 +1019,27 @@ VOID VisualLeakDetector::configure ()
 
     // Read the integer configuration options.
     m_maxdatadump = GetPrivateProfileInt(L"Options", L"MaxDataDump", VLD_DEFAULT_MAX_DATA_DUMP, inipath);
+    m_maxinternalmemory = (SIZE_T)GetPrivateProfileInt(L"Options", L"MaxInternalMemory", 0, inipath) * 1024;
     m_maxtraceframes = GetPrivateProfileInt(L"Options", L"MaxTraceFrames", VLD_DEFAULT_MAX_TRACE_FRAMES, inipath);
     if (m_maxtraceframes < 1) {
         m_maxtraceframes = VLD_DEFAULT_MAX_TRACE_FRAMES;
     }
+    m_monitorinterval = GetPrivateProfileInt(L"Options", L"MonitorInterval", 0, inipath);
+    m_monitorgrowth = GetPrivateProfileInt(L"Options", L"MonitorGrowthIntervals", VLD_DEFAULT_MONITOR_GROWTH, inipath);
+    if (m_monitorgrowth < 1) {
+        m_monitorgrowth = VLD_DEFAULT_MONITOR_GROWTH;
+    }
 
     // Read the force-include module list.
     GetPrivateProfileString(L"Options", L"ForceIncludeModules", L"", m_forcedmodulelist, MAXMODULELISTLENGTH, inipath);
     _wcslwr_s(m_forcedmodulelist, MAXMODULELISTLENGTH);
 
+    // Read the function rules.
+    GetPrivateProfileString(L"Options", L"ExcludeFunctions", L"", m_excludedfunctionlist, MAXMODULELISTLENGTH,
+                            inipath);
+    GetPrivateProfileString(L"Options", L"ForceIncludeFunctions", L"", m_forcedfunctionlist, MAXMODULELISTLENGTH,
+                            inipath);
+
     // Read the report destination (debugger, file, or both).
     GetPrivateProfileString(L"Options", L"ReportFile", L"", filename, MAX_PATH, inipath);
     if (wcslen(filename) == 0) {
@@ -889,561 +1075,229 @@ VOID VisualLeakDetector::configure ()
     if (_wcsicmp(buffer, L"safe") == 0) {
         m_options |= VLD_OPT_SAFE_STACK_WALK;
     }
-}
-
-// enabled - Determines if memory leak detection is enabled for the current
-//   thread.
-//
-//  Return Value:
-//
-//    Returns true if Visual Leak Detector is enabled for the current thread.
-//    Otherwise, returns false.
-//
-BOOL VisualLeakDetector::enabled ()
-{
-    tls_t *tls = vld.gettls();
 
-    if (!(m_status & VLD_STATUS_INSTALLED)) {
-        // Memory leak detection is not yet enabled because VLD is still
-        // initializing.
-        return FALSE;
+    // Read the suppression file.
+    GetPrivateProfileString(L"Options", L"SuppressionFile", L"", filename, MAX_PATH, inipath);
+    if (wcslen(filename) != 0) {
+        _wfullpath(m_suppressionfilepath, filename, MAX_PATH);
     }
 
-    if (!(tls->flags & VLD_TLS_DISABLED) && !(tls->flags & VLD_TLS_ENABLED)) {
-        // The enabled/disabled state for the current thread has not been 
-        // initialized yet. Use the default state.
-        if (m_options & VLD_OPT_START_DISABLED) {
-            tls->flags |= VLD_TLS_DISABLED;
-        }
-        else {
-            tls->flags |= VLD_TLS_ENABLED;
-        }
+    // Read the trace file.
+    GetPrivateProfileString(L"Options", L"TraceFile", L"", filename, MAX_PATH, inipath);
+    if (wcslen(filename) != 0) {
+        _wfullpath(m_tracefilepath, filename, MAX_PATH);
     }
-
-    return ((tls->flags & VLD_TLS_ENABLED) != 0);
 }
 
-// eraseduplicates - Erases, from the block maps, blocks that appear to be
-//   duplicate leaks of an already identified leak.
+// takeclassifiedsnapshot - Captures a snapshot of all of the memory blocks that
+//   are currently outstanding, and classifies them as definitely lost,
+//   indirectly lost or still reachable, by conservatively scanning the stacks,
+//   registers, global data and thread local storage of the process, and then
+//   the reachable blocks themselves, for references to the blocks. The map
+//   lock is held from the time the snapshot is captured until every block has
+//   been scanned, so that none of the blocks can be freed while they are being
+//   scanned. All other threads are suspended while memory is being scanned.
 //
-//  - element (IN): BlockMap Iterator referencing the block of which to search
-//      for duplicates.
+//   Blocks that aren't tracked by VLD (e.g. blocks allocated by excluded
+//   modules or by the CRT for its own use) are not scanned. Blocks that are
+//   only referenced from such blocks are therefore classified as lost.
 //
-//  Return Value:
+//  - snapshot (OUT): Pointer to a snapshot structure to receive the snapshot.
+//      The classification of each block is stored in its entry's flags. The
+//      snapshot must be freed by calling "freesnapshot".
 //
-//    Returns the number of duplicate blocks erased from the block map.
-//
-SIZE_T VisualLeakDetector::eraseduplicates (const BlockMap::Iterator &element)
-{
-    BlockMap::Iterator  blockit;
-    BlockMap           *blockmap;
-    blockinfo_t        *elementinfo;
-    SIZE_T              erased = 0;
-    HeapMap::Iterator   heapit;
-    blockinfo_t        *info;
-    BlockMap::Iterator  previt;
-
-    elementinfo = (*element).second;
-
-    // Iteratate through all block maps, looking for blocks with the same size
-    // and callstack as the specified element.
-    for (heapit = m_heapmap->begin(); heapit != m_heapmap->end(); ++heapit) {
-        blockmap = &(*heapit).second->blockmap;
-        for (blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
-            if (blockit == element) {
-                // Don't delete the element of which we are searching for
-                // duplicates.
-                continue;
-            }
-            info = (*blockit).second;
-            if ((info->size == elementinfo->size) && (*(info->callstack) == *(elementinfo->callstack))) {
-                // Found a duplicate. Erase it.
-                delete info->callstack;
-                delete info;
-                previt = blockit - 1;
-                blockmap->erase(blockit);
-                blockit = previt;
-                erased++;
-            }
-        }
-    }
-
-    return erased;
-}
-
-// gettls - Obtains the thread local storage structure for the calling thread.
-//
-//  Return Value:
-//
-//    Returns a pointer to the thread local storage structure. (This function
-//    always succeeds).
-//
-tls_t* VisualLeakDetector::gettls ()
-{
-    tls_t *tls;
-    
-    // Get the pointer to this thread's thread local storage structure.
-    tls = (tls_t*)TlsGetValue(m_tlsindex);
-    assert(GetLastError() == ERROR_SUCCESS);
-
-    if (tls == NULL) {
-        // This thread's thread local storage structure has not been allocated.
-        tls = new tls_t;
-        TlsSetValue(m_tlsindex, tls);
-        tls->addrfp = 0x0;
-        tls->flags = 0x0;
-        tls->threadid = GetCurrentThreadId();
-
-        // Add this thread's TLS to the TlsSet.
-        EnterCriticalSection(&m_tlslock);
-        m_tlsset->insert(tls);
-        LeaveCriticalSection(&m_tlslock);
-    }
-
-    return tls;
-}
-
-// mapblock - Tracks memory allocations. Information about allocated blocks is
-//   collected and then the block is mapped to this information.
-//
-//  - heap (IN): Handle to the heap from which the block has been allocated.
-//
-//  - mem (IN): Pointer to the memory block being allocated.
-//
-//  - size (IN): Size, in bytes, of the memory block being allocated.
-//
-//  - framepointer (IN): Framepointer at the time this allocation first entered
-//      VLD's code. This is used from determining the starting point for the
-//      stack trace.
-//
-//  - crtalloc (IN): Should be set to TRUE if this allocation is a CRT memory
-//      block. Otherwise should be FALSE.
+//  - parallel (IN): If TRUE, the reachable blocks are scanned in parallel by
+//      worker threads. This must be FALSE while the process is exiting.
 //
 //  Return Value:
 //
 //    None.
 //
-VOID VisualLeakDetector::mapblock (HANDLE heap, LPCVOID mem, SIZE_T size, SIZE_T framepointer, BOOL crtalloc)
+VOID VisualLeakDetector::takeclassifiedsnapshot (snapshot_t *snapshot, BOOL parallel)
 {
-    blockinfo_t        *blockinfo;
-    BlockMap::Iterator  blockit;
-    BlockMap           *blockmap;
-    HeapMap::Iterator   heapit;
-    static SIZE_T       serialnumber = 0;
+    SIZE_T              index;
+    ModuleSet::Iterator moduleit;
+    MarkScanner         scanner;
 
-    // Record the block's information.
-    blockinfo = new blockinfo_t;
-    if (m_options & VLD_OPT_SAFE_STACK_WALK) {
-        blockinfo->callstack = new SafeCallStack;
+    if (parallel) {
+        // The worker threads need to be started before the map lock is taken,
+        // because starting a thread allocates memory.
+        scanner.startworkers();
     }
-    else {
-        blockinfo->callstack = new FastCallStack;
+
+    enterlock(&m_maplock);
+    takesnapshot(snapshot, NULL, 0);
+    scanner.reserve(snapshot->count);
+    for (index = 0; index < snapshot->count; index++) {
+        scanner.addblock(snapshot->entries[index].address, snapshot->entries[index].size);
     }
-    if (m_options & VLD_OPT_TRACE_INTERNAL_FRAMES) {
-        // Passing NULL for the frame pointer argument will force the stack
-        // trace to begin at the current frame.
-        blockinfo->callstack->getstacktrace(m_maxtraceframes, NULL);
+    enterlock(&m_moduleslock);
+    for (moduleit = m_loadedmodules->begin(); moduleit != m_loadedmodules->end(); ++moduleit) {
+        scanner.addmodule((HMODULE)(*moduleit).addrlow);
     }
-    else {
-        // Start the stack trace at the call that first entered VLD's code.
-        blockinfo->callstack->getstacktrace(m_maxtraceframes, (SIZE_T*)framepointer);
-    }
-    blockinfo->serialnumber = serialnumber++;
-    blockinfo->size = size;
-
-    // Insert the block's information into the block map.
-    EnterCriticalSection(&m_maplock);
-    heapit = m_heapmap->find(heap);
-    if (heapit == m_heapmap->end()) {
-        // We haven't mapped this heap to a block map yet. Do it now.
-        mapheap(heap);
-        heapit = m_heapmap->find(heap);
-        assert(heapit != m_heapmap->end());
-    }
-    if (crtalloc == TRUE) {
-        // The heap that this block was allocated from is a CRT heap.
-        (*heapit).second->flags |= VLD_HEAP_CRT;
-    }
-    blockmap = &(*heapit).second->blockmap;
-    blockit = blockmap->insert(mem, blockinfo);
-    if (blockit == blockmap->end()) {
-        // A block with this address has already been allocated. The
-        // previously allocated block must have been freed (probably by some
-        // mechanism unknown to VLD), or the heap wouldn't have allocated it
-        // again. Replace the previously allocated info with the new info.
-        blockit = blockmap->find(mem);
-        delete (*blockit).second->callstack;
-        delete (*blockit).second;
-        blockmap->erase(blockit);
-        blockmap->insert(mem, blockinfo);
-    }
-    LeaveCriticalSection(&m_maplock);
-}
-
-// mapheap - Tracks heap creation. Creates a block map for tracking individual
-//   allocations from the newly created heap and then maps the heap to this
-//   block map.
-//
-//  - heap (IN): Handle to the newly created heap.
-//
-//  Return Value:
-//
-//    None.
-//
-VOID VisualLeakDetector::mapheap (HANDLE heap)
-{
-    heapinfo_t        *heapinfo;
-    HeapMap::Iterator  heapit;
-
-    // Create a new block map for this heap and insert it into the heap map.
-    heapinfo = new heapinfo_t;
-    heapinfo->blockmap.reserve(BLOCKMAPRESERVE);
-    heapinfo->flags = 0x0;
-    EnterCriticalSection(&m_maplock);
-    heapit = m_heapmap->insert(heap, heapinfo);
-    if (heapit == m_heapmap->end()) {
-        // Somehow this heap has been created twice without being destroyed,
-        // or at least it was destroyed without VLD's knowledge. Unmap the heap
-        // from the existing heapinfo, and remap it to the new one.
-        report(L"WARNING: Visual Leak Detector detected a duplicate heap (" ADDRESSFORMAT L").\n", heap);
-        heapit = m_heapmap->find(heap);
-        unmapheap((*heapit).first);
-        m_heapmap->insert(heap, heapinfo);
-    }
-    LeaveCriticalSection(&m_maplock);
-}
-
-// remapblock - Tracks reallocations. Unmaps a block from its previously
-//   collected information and remaps it to updated information.
-//
-//  Note: If the block itself remains at the same address, then the block's
-//   information can simply be updated rather than having to actually erase and
-//   reinsert the block.
-//
-//  - heap (IN): Handle to the heap from which the memory is being reallocated.
-//
-//  - mem (IN): Pointer to the memory block being reallocated.
-//
-//  - newmem (IN): Pointer to the memory block being returned to the caller
-//      that requested the reallocation. This pointer may or may not be the same
-//      as the original memory block (as pointed to by "mem").
-//
-//  - size (IN): Size, in bytes, of the new memory block.
-//
-//  - framepointer (IN): The frame pointer at which this reallocation entered
-//      VLD's code. Used for determining the starting point of the stack trace.
-//
-//  - crtalloc (IN): Should be set to TRUE if this reallocation is for a CRT
-//      memory block. Otherwise should be set to FALSE.
-//
-//  Return Value:
-//
-//    None.
-//
-VOID VisualLeakDetector::remapblock (HANDLE heap, LPCVOID mem, LPCVOID newmem, SIZE_T size, SIZE_T framepointer,
-                                     BOOL crtalloc)
-{
-    BlockMap::Iterator   blockit;
-    BlockMap            *blockmap;
-    HeapMap::Iterator    heapit;
-    blockinfo_t         *info;
+    leavelock(&m_moduleslock);
 
-    if (newmem != mem) {
-        // The block was not reallocated in-place. Instead the old block was
-        // freed and a new block allocated to satisfy the new size.
-        unmapblock(heap, mem);
-        mapblock(heap, newmem, size, framepointer, crtalloc);
-        return;
-    }
+    scanner.scan();
 
-    // The block was reallocated in-place. Find the existing blockinfo_t
-    // entry in the block map and update it with the new callstack and size.
-    EnterCriticalSection(&m_maplock);
-    heapit = m_heapmap->find(heap);
-    if (heapit == m_heapmap->end()) {
-        // We haven't mapped this heap to a block map yet. Obviously the
-        // block has also not been mapped to a blockinfo_t entry yet either,
-        // so treat this reallocation as a brand-new allocation (this will
-        // also map the heap to a new block map).
-        mapblock(heap, newmem, size, framepointer, crtalloc);
-        LeaveCriticalSection(&m_maplock);
-        return;
-    }
+    for (index = 0; index < snapshot->count; index++) {
+        switch (scanner.getmark(index)) {
+        case MARK_DEFINITE:
+            snapshot->entries[index].flags |= VLD_SNAPSHOT_DEFINITE;
+            break;
 
-    // Find the block's blockinfo_t structure so that we can update it.
-    blockmap = &(*heapit).second->blockmap;
-    blockit = blockmap->find(mem);
-    if (blockit == blockmap->end()) {
-        // The block hasn't been mapped to a blockinfo_t entry yet.
-        // Treat this reallocation as a new allocation.
-        mapblock(heap, newmem, size, framepointer, crtalloc);
-        LeaveCriticalSection(&m_maplock);
-        return;
-    }
+        case MARK_INDIRECT:
+            snapshot->entries[index].flags |= VLD_SNAPSHOT_INDIRECT;
+            break;
 
-    // Found the blockinfo_t entry for this block. Update it with
-    // a new callstack and new size.
-    info = (*blockit).second;
-    info->callstack->clear();
-    if (crtalloc) {
-        // The heap that this block was allocated from is a CRT heap.
-        (*heapit).second->flags |= VLD_HEAP_CRT;
+        default:
+            snapshot->entries[index].flags |= VLD_SNAPSHOT_REACHABLE;
+            break;
+        }
     }
-    LeaveCriticalSection(&m_maplock);
+    leavelock(&m_maplock);
 
-    // Update the block's callstack and size.
-    if (m_options & VLD_OPT_TRACE_INTERNAL_FRAMES) {
-        // Passing NULL for the frame pointer argument will force
-        // the stack trace to begin at the current frame.
-        info->callstack->getstacktrace(m_maxtraceframes, NULL);
-    }
-    else {
-        // Start the stack trace at the call that first entered
-        // VLD's code.
-        info->callstack->getstacktrace(m_maxtraceframes, (SIZE_T*)framepointer);
-    }
-    info->size = size;
+    // The worker threads free memory as they exit, so they can't be stopped
+    // until the map lock has been released.
+    scanner.stopworkers();
 }
 
-// reportconfig - Generates a brief report summarizing Visual Leak Detector's
-//   configuration, as loaded from the vld.ini file.
+// resolvefunctionranges - Finds the code occupied by the functions of a newly
+//   attached module that match a list of function rules (see the
+//   ExcludeFunctions and ForceIncludeFunctions options), and adds it to the
+//   rules' table of ranges. This is done once per module, so that applying the
+//   rules to each allocation is only a matter of searching the table.
+//
+//  - modulebase (IN): The base address of the module, whose symbols must have
+//      been loaded.
+//
+//  - patterns (IN): The list of patterns. A pattern matches the names of
+//      functions or, if it contains a "\" or a "/", the paths of their source
+//      files.
+//
+//  - table (IN/OUT): The table to which the ranges are added.
 //
 //  Return Value:
 //
 //    None.
 //
-VOID VisualLeakDetector::reportconfig ()
+VOID VisualLeakDetector::resolvefunctionranges (DWORD64 modulebase, LPCWSTR patterns, RangeTable **table)
 {
-    if (m_options & VLD_OPT_AGGREGATE_DUPLICATES) {
-        report(L"    Aggregating duplicate leaks.\n");
-    }
-    if (wcslen(m_forcedmodulelist) != 0) {
-        report(L"    Forcing inclusion of these modules in leak detection: %s\n", m_forcedmodulelist);
-    }
-    if (m_maxdatadump != VLD_DEFAULT_MAX_DATA_DUMP) {
-        if (m_maxdatadump == 0) {
-            report(L"    Suppressing data dumps.\n");
-        }
-        else {
-            report(L"    Limiting data dumps to %lu bytes.\n", m_maxdatadump);
-        }
-    }
-    if (m_maxtraceframes != VLD_DEFAULT_MAX_TRACE_FRAMES) {
-        report(L"    Limiting stack traces to %u frames.\n", m_maxtraceframes);
-    }
-    if (m_options & VLD_OPT_UNICODE_REPORT) {
-        report(L"    Generating a Unicode (UTF-16) encoded report.\n");
-    }
-    if (m_options & VLD_OPT_REPORT_TO_FILE) {
-        if (m_options & VLD_OPT_REPORT_TO_DEBUGGER) {
-            report(L"    Outputting the report to the debugger and to %s\n", m_reportfilepath);
+    WCHAR     pattern [MAXPATTERNLENGTH];
+    RangeList ranges;
+
+    EnterCriticalSection(&symbollock);
+    while ((patterns = nextlistitem(patterns, pattern, MAXPATTERNLENGTH)) != NULL) {
+        if ((wcschr(pattern, L'\\') != NULL) || (wcschr(pattern, L'/') != NULL)) {
+            SymEnumLinesW(currentprocess, modulebase, NULL, pattern, addfunctionline, &ranges);
         }
         else {
-            report(L"    Outputting the report to %s\n", m_reportfilepath);
+            SymEnumSymbolsW(currentprocess, modulebase, pattern, addfunctionsymbol, &ranges);
         }
     }
-    if (m_options & VLD_OPT_SLOW_DEBUGGER_DUMP) {
-        report(L"    Outputting the report to the debugger at a slower rate.\n");
-    }
-    if (m_options & VLD_OPT_SAFE_STACK_WALK) {
-        report(L"    Using the \"safe\" (but slow) stack walking method.\n");
-    }
-    if (m_options & VLD_OPT_SELF_TEST) {
-        report(L"    Perfoming a memory leak self-test.\n");
-    }
-    if (m_options & VLD_OPT_START_DISABLED) {
-        report(L"    Starting with memory leak detection disabled.\n");
-    }
-    if (m_options & VLD_OPT_TRACE_INTERNAL_FRAMES) {
-        report(L"    Including heap and VLD internal frames in stack traces.\n");
-    }
+    LeaveCriticalSection(&symbollock);
+    addranges(table, ranges.ranges(), ranges.size());
 }
 
-// reportleaks - Generates a memory leak report for the specified heap.
+// resolveinternalranges - Finds the code occupied by each of the allocation
+//   functions internal to the heap (see "internalfiles") that are defined by a
+//   module, and adds it to the ranges whose frames are left out of call stacks.
+//   The functions are looked up once, when the module is attached, so that
+//   walking the stack only needs to compare each frame's program counter
+//   against the ranges, rather than resolving the frame's symbol.
 //
-//  - heap (IN): Handle to the heap for which to generate a memory leak
-//      report.
+//   The ranges of a module are removed when it is unloaded (see "_LdrLoadDll"),
+//   so that the frames of a module later loaded at the same address are not
+//   mistaken for the heap's.
+//
+//  - modulebase (IN): The base address of the module, whose symbols must have
+//      been loaded.
 //
 //  Return Value:
 //
 //    None.
 //
-VOID VisualLeakDetector::reportleaks (HANDLE heap)
+VOID VisualLeakDetector::resolveinternalranges (DWORD64 modulebase)
 {
-    LPCVOID              address;
-    LPCVOID              block;
-    BlockMap::Iterator   blockit;
-    BlockMap            *blockmap;
-    crtdbgblockheader_t *crtheader;
-    SIZE_T               duplicates;
-    heapinfo_t          *heapinfo;
-    HeapMap::Iterator    heapit;
-    blockinfo_t         *info;
-    SIZE_T               size;
-
-    // Find the heap's information (blockmap, etc).
-    EnterCriticalSection(&m_maplock);
-    heapit = m_heapmap->find(heap);
-    if (heapit == m_heapmap->end()) {
-        // Nothing is allocated from this heap. No leaks.
-        LeaveCriticalSection(&m_maplock);
-        return;
-    }
+    UINT      index;
+    RangeList ranges;
 
-    heapinfo = (*heapit).second;
-    blockmap = &heapinfo->blockmap;
-    for (blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
-        // Found a block which is still in the BlockMap. We've identified a
-        // potential memory leak.
-        block = (*blockit).first;
-        info = (*blockit).second;
-        address = block;
-        size = info->size;
-        if (heapinfo->flags & VLD_HEAP_CRT) {
-            // This block is allocated to a CRT heap, so the block has a CRT
-            // memory block header prepended to it.
-            crtheader = (crtdbgblockheader_t*)block;
-            if (CRT_USE_TYPE(crtheader->use) == CRT_USE_INTERNAL) {
-                // This block is marked as being used internally by the CRT.
-                // The CRT will free the block after VLD is destroyed.
-                continue;
-            }
-            // The CRT header is more or less transparent to the user, so
-            // the information about the contained block will probably be
-            // more useful to the user. Accordingly, that's the information
-            // we'll include in the report.
-            address = CRTDBGBLOCKDATA(block);
-            size = crtheader->size;
-        }
-        // It looks like a real memory leak.
-        if (m_leaksfound == 0) {
-            report(L"WARNING: Visual Leak Detector detected memory leaks!\n");
-        }
-        m_leaksfound++;
-        report(L"---------- Block %ld at " ADDRESSFORMAT L": %u bytes ----------\n", info->serialnumber, address, size);
-        if (m_options & VLD_OPT_AGGREGATE_DUPLICATES) {
-            // Aggregate all other leaks which are duplicates of this one
-            // under this same heading, to cut down on clutter.
-            duplicates = eraseduplicates(blockit);
-            if (duplicates) {
-                report(L"A total of %lu leaks match this size and call stack. Showing only the first one.\n",
-                       duplicates + 1);
-                m_leaksfound += duplicates;
-            }
-        }
-        // Dump the call stack.
-        report(L"  Call Stack:\n");
-        info->callstack->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES);
-        // Dump the data in the user data section of the memory block.
-        if (m_maxdatadump != 0) {
-            report(L"  Data:\n");
-            if (m_options & VLD_OPT_UNICODE_REPORT) {
-                dumpmemoryw(address, (m_maxdatadump < size) ? m_maxdatadump : size);
-            }
-            else {
-                dumpmemorya(address, (m_maxdatadump < size) ? m_maxdatadump : size);
-            }
-        }
-        report(L"\n");
+    EnterCriticalSection(&symbollock);
+    for (index = 0; index < sizeof(internalfiles) / sizeof(internalfiles[0]); index++) {
+        SymEnumLinesW(currentprocess, modulebase, NULL, internalfiles[index], addfunctionline, &ranges);
     }
-
-    LeaveCriticalSection(&m_maplock);
+    LeaveCriticalSection(&symbollock);
+    addranges(&m_internalranges, ranges.ranges(), ranges.size());
 }
 
-// unmapblock - Tracks memory blocks that are freed. Unmaps the specified block
-//   from the block's information, relinquishing internally allocated resources.
+
+////////////////////////////////////////////////////////////////////////////////
 //
-//  - heap (IN): Handle to the heap to which this block is being freed.
+// Static Leak Detection Functions (Callbacks)
 //
-//  - mem (IN): Pointer to the memory block being freed.
+////////////////////////////////////////////////////////////////////////////////
+
+// addfunctionline - Callback function for SymEnumLinesW. Adds the range of the
+//   function containing a line of source code to the ranges being collected,
+//   unless it has already been added.
+//
+//  - lineinfo (IN): Information about the line, including its address.
+//
+//  - context (IN): Pointer to the RangeList collecting the ranges.
 //
 //  Return Value:
 //
-//    None.
+//    Always returns TRUE, which tells SymEnumLinesW to continue enumerating.
 //
-VOID VisualLeakDetector::unmapblock (HANDLE heap, LPCVOID mem)
+BOOL VisualLeakDetector::addfunctionline (PSRCCODEINFOW lineinfo, PVOID context)
 {
-    BlockMap::Iterator  blockit;
-    BlockMap           *blockmap;
-    HeapMap::Iterator   heapit;
-    blockinfo_t        *info;
-
-    // Find this heap's block map.
-    EnterCriticalSection(&m_maplock);
-    heapit = m_heapmap->find(heap);
-    if (heapit == m_heapmap->end()) {
-        // We don't have a block map for this heap. We must not have monitored
-        // this allocation (probably happened before VLD was initialized).
-        LeaveCriticalSection(&m_maplock);
-        return;
+    DWORD64       displacement;
+    SYMBOL_INFOW *functioninfo;
+    RangeList    *ranges = (RangeList*)context;
+    BYTE          symbolbuffer [sizeof(SYMBOL_INFOW) + (MAXSYMBOLNAMELENGTH * sizeof(WCHAR)) - 1] = { 0 };
+
+    if (ranges->contains((SIZE_T)lineinfo->Address)) {
+        // The function containing this line has already been added.
+        return TRUE;
     }
 
-    // Find this block in the block map.
-    blockmap = &(*heapit).second->blockmap;
-    blockit = blockmap->find(mem);
-    if (blockit == blockmap->end()) {
-        // This block is not in the block map. We must not have monitored this
-        // allocation (probably happened before VLD was initialized).
-        LeaveCriticalSection(&m_maplock);
-        return;
+    // Find the function containing the line. The symbol lock is already held
+    // by the caller of SymEnumLinesW.
+    functioninfo = (SYMBOL_INFOW*)&symbolbuffer;
+    functioninfo->SizeOfStruct = sizeof(SYMBOL_INFOW);
+    functioninfo->MaxNameLen = MAXSYMBOLNAMELENGTH;
+    if (SymFromAddrW(currentprocess, lineinfo->Address, &displacement, functioninfo) && (functioninfo->Size != 0)) {
+        ranges->add((SIZE_T)functioninfo->Address, (SIZE_T)(functioninfo->Address + functioninfo->Size));
     }
 
-    // Free the blockinfo_t structure and erase it from the block map.
-    info = (*blockit).second;
-    delete info->callstack;
-    delete info;
-    blockmap->erase(blockit);
-    LeaveCriticalSection(&m_maplock);
+    return TRUE;
 }
 
-// unmapheap - Tracks heap destruction. Unmaps the specified heap from its block
-//   map. The block map is cleared and deleted, relinquishing internally
-//   allocated resources.
+// addfunctionsymbol - Callback function for SymEnumSymbolsW. Adds the range of
+//   a function whose name matches a pattern to the ranges being collected.
 //
-//  - heap (IN): Handle to the heap which is being destroyed.
+//  - symbolinfo (IN): Information about the symbol, including its address and
+//      size.
+//
+//  - symbolsize (IN): Size, in bytes, of the symbol (ignored, the size in the
+//      symbol information is used instead).
+//
+//  - context (IN): Pointer to the RangeList collecting the ranges.
 //
 //  Return Value:
 //
-//    None.
+//    Always returns TRUE, which tells SymEnumSymbolsW to continue enumerating.
 //
-VOID VisualLeakDetector::unmapheap (HANDLE heap)
+BOOL VisualLeakDetector::addfunctionsymbol (PSYMBOL_INFOW symbolinfo, ULONG /*symbolsize*/, PVOID context)
 {
-    BlockMap::Iterator  blockit;
-    BlockMap           *blockmap;
-    heapinfo_t         *heapinfo;
-    HeapMap::Iterator   heapit;
-
-    // Find this heap's block map.
-    EnterCriticalSection(&m_maplock);
-    heapit = m_heapmap->find(heap);
-    if (heapit == m_heapmap->end()) {
-        // This heap hasn't been mapped. We must not have monitored this heap's
-        // creation (probably happened before VLD was initialized).
-        LeaveCriticalSection(&m_maplock);
-        return;
-    }
+    RangeList *ranges = (RangeList*)context;
 
-    // Free all of the blockinfo_t structures stored in the block map.
-    heapinfo = (*heapit).second;
-    blockmap = &heapinfo->blockmap;
-    for (blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
-        delete (*blockit).second->callstack;
-        delete (*blockit).second;
+    if ((symbolinfo->Tag == SYMTAGFUNCTION) && (symbolinfo->Size != 0)) {
+        ranges->add((SIZE_T)symbolinfo->Address, (SIZE_T)(symbolinfo->Address + symbolinfo->Size));
     }
-    delete heapinfo;
 
-    // Remove this heap's block map from the heap map.
-    m_heapmap->erase(heapit);
-    LeaveCriticalSection(&m_maplock);
+    return TRUE;
 }
 
-
-////////////////////////////////////////////////////////////////////////////////
-//
-// Static Leak Detection Functions (Callbacks)
-//
-////////////////////////////////////////////////////////////////////////////////
-
 // addloadedmodule - Callback function for EnumerateLoadedModules64. This
 //   function records information about every module loaded in the process,
 //   each time adding the module's information to the provided ModuleSet (the
@@ -1549,6 +1403,28 @@ BOOL VisualLeakDetector::detachfrommodule (PCWSTR /*modulepath*/, DWORD64 module
     return TRUE;
 }
 
+// monitorthread - Thread procedure of the leak growth monitor. Periodically
+//   samples the call site statistics, until signaled to stop.
+//
+//  - context (IN): User-supplied context (ignored).
+//
+//  Return Value:
+//
+//    Always returns 0.
+//
+DWORD VisualLeakDetector::monitorthread (LPVOID /*context*/)
+{
+    while (WaitForSingleObject(vld.m_monitorstop, vld.m_monitorinterval) == WAIT_TIMEOUT) {
+        vld.reportgrowth();
+        if (vld.m_options & VLD_OPT_MONITOR_STATS) {
+            vld.reportstats();
+        }
+    }
+    SetEvent(vld.m_monitorstopped);
+
+    return 0;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -1767,6 +1643,11 @@ void* VisualLeakDetector::__calloc_dbg (_calloc_dbg_t  p_calloc_dbg,
 
     // _malloc_dbg is a CRT function and allocates from the CRT heap.
     tls->flags |= VLD_TLS_CRTALLOC;
+    if (!iscrtuserblock(type)) {
+        // The block will be used internally by the CRT, or is to be ignored.
+        // Don't bother tracking it.
+        tls->flags |= VLD_TLS_CRTINTERNAL;
+    }
 
     if (tls->addrfp == 0x0) {
         // This is the first call to enter VLD for the current allocation.
@@ -1779,7 +1660,7 @@ void* VisualLeakDetector::__calloc_dbg (_calloc_dbg_t  p_calloc_dbg,
 
     // Reset thread local flags and variables for the next allocation.
     tls->addrfp = 0x0;
-    tls->flags &= ~VLD_TLS_CRTALLOC;
+    tls->flags &= ~(VLD_TLS_CRTALLOC | VLD_TLS_CRTINTERNAL);
 
     return block;
 }
@@ -1818,6 +1699,11 @@ void* VisualLeakDetector::__malloc_dbg (_malloc_dbg_t  p_malloc_dbg,
 
     // _malloc_dbg is a CRT function and allocates from the CRT heap.
     tls->flags |= VLD_TLS_CRTALLOC;
+    if (!iscrtuserblock(type)) {
+        // The block will be used internally by the CRT, or is to be ignored.
+        // Don't bother tracking it.
+        tls->flags |= VLD_TLS_CRTINTERNAL;
+    }
 
     if (tls->addrfp == 0x0) {
         // This is the first call to enter VLD for the current allocation.
@@ -1830,7 +1716,7 @@ void* VisualLeakDetector::__malloc_dbg (_malloc_dbg_t  p_malloc_dbg,
 
     // Reset thread local flags and variables for the next allocation.
     tls->addrfp = 0x0;
-    tls->flags &= ~VLD_TLS_CRTALLOC;
+    tls->flags &= ~(VLD_TLS_CRTALLOC | VLD_TLS_CRTINTERNAL);
 
     return block;
 }
@@ -1869,6 +1755,11 @@ void* VisualLeakDetector::new_dbg_crt (new_dbg_crt_t  pnew_dbg_crt,
 
     // The debug new operator is a CRT function and allocates from the CRT heap.
     tls->flags |= VLD_TLS_CRTALLOC;
+    if (!iscrtuserblock(type)) {
+        // The block will be used internally by the CRT, or is to be ignored.
+        // Don't bother tracking it.
+        tls->flags |= VLD_TLS_CRTINTERNAL;
+    }
 
     if (tls->addrfp == 0x0) {
         // This is the first call to enter VLD for the current allocation.
@@ -1881,7 +1772,7 @@ void* VisualLeakDetector::new_dbg_crt (new_dbg_crt_t  pnew_dbg_crt,
 
     // Reset thread local flags and variables for the next allocation.
     tls->addrfp = 0x0;
-    tls->flags &= ~VLD_TLS_CRTALLOC;
+    tls->flags &= ~(VLD_TLS_CRTALLOC | VLD_TLS_CRTINTERNAL);
 
     return block;
 }
@@ -2016,6 +1907,11 @@ void* VisualLeakDetector::__realloc_dbg (_realloc_dbg_t  p_realloc_dbg,
 
     // _realloc_dbg is a CRT function and allocates from the CRT heap.
     tls->flags |= VLD_TLS_CRTALLOC;
+    if (!iscrtuserblock(type)) {
+        // The block will be used internally by the CRT, or is to be ignored.
+        // Don't bother tracking it.
+        tls->flags |= VLD_TLS_CRTINTERNAL;
+    }
 
     if (tls->addrfp == 0x0) {
         // This is the first call to enter VLD for the current allocation.
@@ -2028,7 +1924,7 @@ void* VisualLeakDetector::__realloc_dbg (_realloc_dbg_t  p_realloc_dbg,
 
     // Reset thread local flags and variables for the next allocation.
     tls->addrfp = 0x0;
-    tls->flags &= ~VLD_TLS_CRTALLOC;
+    tls->flags &= ~(VLD_TLS_CRTALLOC | VLD_TLS_CRTINTERNAL);
 
     return block;
 }
@@ -2139,11 +2035,11 @@ HANDLE VisualLeakDetector::_HeapCreate (DWORD options, SIZE_T initsize, SIZE_T m
     if (symfound == TRUE) {
         if (wcscmp(L"_heap_init", functioninfo->Name) == 0) {
             // HeapCreate was called by _heap_init. This is a static CRT heap.
-            EnterCriticalSection(&vld.m_maplock);
+            enterlock(&vld.m_maplock);
             heapit = vld.m_heapmap->find(heap);
             assert(heapit != vld.m_heapmap->end());
             (*heapit).second->flags |= VLD_HEAP_CRT;
-            LeaveCriticalSection(&vld.m_maplock);
+            leavelock(&vld.m_maplock);
         }
     }
 
@@ -2199,11 +2095,13 @@ NTSTATUS VisualLeakDetector::_LdrLoadDll (LPWSTR searchpath, PDWORD flags, unico
                                           PHANDLE modulehandle)
 {
     ModuleSet::Iterator  moduleit;
+    ModuleSet::Iterator  newit;
     ModuleSet           *newmodules;
     ModuleSet           *oldmodules;
     NTSTATUS             status;
+    ModuleSet            unloaded;
 
-    EnterCriticalSection(&vld.m_loaderlock);
+    enterlock(&vld.m_loaderlock);
 
     // Load the DLL.
     status = LdrLoadDll(searchpath, flags, modulename, modulehandle);
@@ -2215,14 +2113,29 @@ NTSTATUS VisualLeakDetector::_LdrLoadDll (LPWSTR searchpath, PDWORD flags, unico
         newmodules->reserve(MODULESETRESERVE);
         EnumerateLoadedModulesW64(currentprocess, addloadedmodule, newmodules);
 
+        // Forget the functions of any modules that have been unloaded since
+        // the set was last built, before the modules loaded at the same
+        // addresses are attached.
+        for (moduleit = vld.m_loadedmodules->begin(); moduleit != vld.m_loadedmodules->end(); ++moduleit) {
+            newit = newmodules->find(*moduleit);
+            if ((newit == newmodules->end()) || (_stricmp((*newit).path, (*moduleit).path) != 0)) {
+                unloaded.insert(*moduleit);
+            }
+        }
+        if (unloaded.size() != 0) {
+            vld.pruneranges(&vld.m_excludedranges, &unloaded);
+            vld.pruneranges(&vld.m_forcedranges, &unloaded);
+            vld.pruneranges(&vld.m_internalranges, &unloaded);
+        }
+
         // Attach to all modules included in the set.
         vld.attachtoloadedmodules(newmodules);
 
         // Start using the new set of loaded modules.
-        EnterCriticalSection(&vld.m_moduleslock);
+        enterlock(&vld.m_moduleslock);
         oldmodules = vld.m_loadedmodules;
         vld.m_loadedmodules = newmodules;
-        LeaveCriticalSection(&vld.m_moduleslock);
+        leavelock(&vld.m_moduleslock);
 
         // Free resources used by the old module list.
         for (moduleit = oldmodules->begin(); moduleit != oldmodules->end(); ++moduleit) {
@@ -2232,7 +2145,7 @@ NTSTATUS VisualLeakDetector::_LdrLoadDll (LPWSTR searchpath, PDWORD flags, unico
         delete oldmodules;
     }
 
-    LeaveCriticalSection(&vld.m_loaderlock);
+    leavelock(&vld.m_loaderlock);
 
     return status;
 }
@@ -2262,11 +2175,13 @@ LPVOID VisualLeakDetector::_RtlAllocateHeap (HANDLE heap, DWORD flags, SIZE_T si
     moduleinfo_t         moduleinfo;
     ModuleSet::Iterator  moduleit;
     SIZE_T               returnaddress;
+    ULONGLONG            start;
     tls_t               *tls = vld.gettls();
 
     // Allocate the block.
     block = RtlAllocateHeap(heap, flags, size);
-    if ((block != NULL) && vld.enabled()) {
+    if ((block != NULL) && !(tls->flags & VLD_TLS_CRTINTERNAL) && vld.enabled()) {
+        start = getperfcounter();
         if (tls->addrfp == 0x0) {
             // This is the first call to enter VLD for the current allocation.
             // Record the current frame pointer.
@@ -2286,22 +2201,24 @@ LPVOID VisualLeakDetector::_RtlAllocateHeap (HANDLE heap, DWORD flags, SIZE_T si
         returnaddress = *((SIZE_T*)fp + 1);
         moduleinfo.addrhigh = returnaddress;
         moduleinfo.addrlow  = returnaddress;
-        EnterCriticalSection(&vld.m_moduleslock);
+        enterlock(&vld.m_moduleslock);
         moduleit = vld.m_loadedmodules->find(moduleinfo);
         if (moduleit != vld.m_loadedmodules->end()) {
             excluded = (*moduleit).flags & VLD_MODULE_EXCLUDED ? TRUE : FALSE;
         }
-        LeaveCriticalSection(&vld.m_moduleslock);
+        leavelock(&vld.m_moduleslock);
+        excluded = vld.excludedfunction(returnaddress, excluded);
         if (!excluded) {
-            // The module that initiated this allocation is included in leak
-            // detection. Map this block to the specified heap.
+            // The module (or function) that initiated this allocation is
+            // included in leak detection. Map this block to the specified heap.
             vld.mapblock(heap, block, size, fp, crtalloc);
         }
+        addcounter(&tls->time, getperfcounter() - start);
     }
 
     // Reset thread local flags and variables for the next allocation.
     tls->addrfp = 0x0;
-    tls->flags &= ~VLD_TLS_CRTALLOC;
+    tls->flags &= ~(VLD_TLS_CRTALLOC | VLD_TLS_CRTINTERNAL);
 
     return block;
 }
@@ -2323,10 +2240,14 @@ LPVOID VisualLeakDetector::_RtlAllocateHeap (HANDLE heap, DWORD flags, SIZE_T si
 //
 BOOL VisualLeakDetector::_RtlFreeHeap (HANDLE heap, DWORD flags, LPVOID mem)
 {
-    BOOL status;
+    ULONGLONG      start;
+    BOOL           status;
+    tls_t         *tls = vld.gettls();
 
     // Unmap the block from the specified heap.
+    start = getperfcounter();
     vld.unmapblock(heap, mem);
+    addcounter(&tls->time, getperfcounter() - start);
 
     status = RtlFreeHeap(heap, flags, mem);
 
@@ -2355,6 +2276,7 @@ BOOL VisualLeakDetector::_RtlFreeHeap (HANDLE heap, DWORD flags, LPVOID mem)
 //
 LPVOID VisualLeakDetector::_RtlReAllocateHeap (HANDLE heap, DWORD flags, LPVOID mem, SIZE_T size)
 {
+    SIZE_T               checkpoint;
     BOOL                 crtalloc;
     BOOL                 excluded = FALSE;
     SIZE_T               fp;
@@ -2362,12 +2284,21 @@ LPVOID VisualLeakDetector::_RtlReAllocateHeap (HANDLE heap, DWORD flags, LPVOID
     ModuleSet::Iterator  moduleit;
     LPVOID               newmem;
     SIZE_T               returnaddress;
+    ULONGLONG            start;
     tls_t               *tls = vld.gettls();
 
     // Reallocate the block.
+    checkpoint = readcounter(&vld.m_serialnumber);
     newmem = RtlReAllocateHeap(heap, flags, mem, size);
 
-    if (newmem != NULL) {
+    if ((newmem != NULL) && (tls->flags & VLD_TLS_CRTINTERNAL)) {
+        // The block is used internally by the CRT, or is to be ignored, so it
+        // isn't tracked. In case it was tracked before it was reallocated,
+        // unmap it.
+        vld.unmapblock(heap, mem, checkpoint);
+    }
+    else if (newmem != NULL) {
+        start = getperfcounter();
         if (tls->addrfp == 0x0) {
             // This is the first call to enter VLD for the current allocation.
             // Record the current frame pointer.
@@ -2381,28 +2312,30 @@ LPVOID VisualLeakDetector::_RtlReAllocateHeap (HANDLE heap, DWORD flags, LPVOID
         // Reset thread local flags and variables, in case any libraries called
         // into while remapping the block allocate some memory.
         tls->addrfp = 0x0;
-        tls->flags &= ~VLD_TLS_CRTALLOC;
+        tls->flags &=~VLD_TLS_CRTALLOC;
 
         // Find the information for the module that initiated this reallocation.
         returnaddress = *((SIZE_T*)fp + 1);
         moduleinfo.addrhigh = returnaddress;
         moduleinfo.addrlow  = returnaddress;
-        EnterCriticalSection(&vld.m_moduleslock);
+        enterlock(&vld.m_moduleslock);
         moduleit = vld.m_loadedmodules->find(moduleinfo);
         if (moduleit != vld.m_loadedmodules->end()) {
             excluded = (*moduleit).flags & VLD_MODULE_EXCLUDED ? TRUE : FALSE;
         }
-        LeaveCriticalSection(&vld.m_moduleslock);
+        leavelock(&vld.m_moduleslock);
+        excluded = vld.excludedfunction(returnaddress, excluded);
         if (!excluded) {
-            // The module that initiated this allocation is included in leak
-            // detection. Remap the block.
-            vld.remapblock(heap, mem, newmem, size, fp, crtalloc);
+            // The module (or function) that initiated this allocation is
+            // included in leak detection. Remap the block.
+            vld.remapblock(heap, mem, newmem, size, fp, crtalloc, checkpoint);
         }
+        addcounter(&tls->time, getperfcounter() - start);
     }
 
     // Reset thread local flags and variables for the next allocation.
     tls->addrfp = 0x0;
-    tls->flags &= ~VLD_TLS_CRTALLOC;
+    tls->flags &= ~(VLD_TLS_CRTALLOC | VLD_TLS_CRTINTERNAL);
 
     return newmem;
 }
@@ -2539,6 +2472,173 @@ LPVOID VisualLeakDetector::_CoTaskMemRealloc (LPVOID mem, ULONG size)
     return block;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Public Custom Allocator Handlers
+//
+//   Unlike the IAT replacement functions, these don't check whether the caller
+//   is in an excluded module: a custom allocator that reports its blocks wants
+//   them to be tracked.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// trackalloc - Calls to VLDTrackAlloc are routed to this handler. It maps the
+//   block handed out by a custom allocator in the virtual heap.
+//
+//  - fp (IN): Frame pointer from the call that initiated this allocation.
+//
+//  - mem (IN): Pointer to the memory block handed out.
+//
+//  - size (IN): Size, in bytes, of the memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackalloc (SIZE_T fp, LPCVOID mem, SIZE_T size)
+{
+    ULONGLONG start;
+
+    if (enabled()) {
+        start = getperfcounter();
+        mapblock(VIRTUALHEAP, mem, size, fp, FALSE);
+        addcounter(&gettls()->time, getperfcounter() - start);
+    }
+}
+
+// trackallocs - Calls to VLDTrackAllocs are routed to this handler. It maps a
+//   batch of blocks of the same size, handed out by a custom allocator, in the
+//   virtual heap.
+//
+//  - fp (IN): Frame pointer from the call that initiated these allocations.
+//
+//  - mems (IN): Array of pointers to the memory blocks handed out.
+//
+//  - count (IN): Number of elements in the "mems" array.
+//
+//  - size (IN): Size, in bytes, of each memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackallocs (SIZE_T fp, LPCVOID const *mems, SIZE_T count, SIZE_T size)
+{
+    ULONGLONG start;
+
+    if (enabled()) {
+        start = getperfcounter();
+        mapblocks(VIRTUALHEAP, mems, count, size, fp);
+        addcounter(&gettls()->time, getperfcounter() - start);
+    }
+}
+
+// trackallocsfrom - Calls to VLDTrackAllocsFrom are routed to this handler. It
+//   maps a batch of blocks of the same size, handed out by a custom allocator
+//   to the specified callers, in the virtual heap.
+//
+//  - fp (IN): Frame pointer from the call that initiated these allocations.
+//
+//  - mems (IN): Array of pointers to the memory blocks handed out.
+//
+//  - callers (IN): Array of the addresses the custom allocator returned to, one
+//      for each element of the "mems" array.
+//
+//  - count (IN): Number of elements in the "mems" and "callers" arrays.
+//
+//  - size (IN): Size, in bytes, of each memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackallocsfrom (SIZE_T fp, LPCVOID const *mems, LPCVOID const *callers, SIZE_T count,
+                                          SIZE_T size)
+{
+    ULONGLONG start;
+
+    if (enabled()) {
+        start = getperfcounter();
+        mapblocksfrom(VIRTUALHEAP, mems, callers, count, size, fp);
+        addcounter(&gettls()->time, getperfcounter() - start);
+    }
+}
+
+// trackfree - Calls to VLDTrackFree are routed to this handler. It unmaps the
+//   block taken back by a custom allocator from the virtual heap.
+//
+//  - mem (IN): Pointer to the memory block taken back.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackfree (LPCVOID mem)
+{
+    ULONGLONG start;
+
+    start = getperfcounter();
+    unmapblock(VIRTUALHEAP, mem);
+    addcounter(&gettls()->time, getperfcounter() - start);
+}
+
+// trackfrees - Calls to VLDTrackFrees are routed to this handler. It unmaps a
+//   batch of blocks taken back by a custom allocator from the virtual heap.
+//
+//  - mems (IN): Array of pointers to the memory blocks taken back.
+//
+//  - count (IN): Number of elements in the "mems" array.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackfrees (LPCVOID const *mems, SIZE_T count)
+{
+    ULONGLONG start;
+
+    start = getperfcounter();
+    unmapblocks(VIRTUALHEAP, mems, count);
+    addcounter(&gettls()->time, getperfcounter() - start);
+}
+
+// trackrealloc - Calls to VLDTrackRealloc are routed to this handler. It remaps
+//   the block resized by a custom allocator in the virtual heap.
+//
+//  - fp (IN): Frame pointer from the call that initiated this reallocation.
+//
+//  - mem (IN): Pointer to the memory block that was resized (may be NULL if
+//      the block was newly handed out).
+//
+//  - newmem (IN): Pointer to the resized memory block (may be NULL if the
+//      block was taken back).
+//
+//  - size (IN): Size, in bytes, of the resized memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackrealloc (SIZE_T fp, LPCVOID mem, LPCVOID newmem, SIZE_T size)
+{
+    ULONGLONG start;
+
+    start = getperfcounter();
+    if (newmem == NULL) {
+        if (mem != NULL) {
+            // The block was taken back.
+            unmapblock(VIRTUALHEAP, mem);
+        }
+    }
+    else if (enabled()) {
+        remapblock(VIRTUALHEAP, mem, newmem, size, fp, FALSE, (SIZE_T)-1);
+    }
+    else if (mem != NULL) {
+        unmapblock(VIRTUALHEAP, mem);
+    }
+    addcounter(&gettls()->time, getperfcounter() - start);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Public COM IMalloc Implementation Functions
@@ -23,8 +23,75 @@
 
 #pragma once
 
+#include <stddef.h> // Provides the definition of size_t.
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector Types
+//
+
+// Statistics for a single call site, as obtained by VLDGetSiteStats(). A call
+// site is a unique call stack from which memory blocks have been allocated.
+typedef struct vldsitestats_s {
+    const void *address; // Return address of the call that allocated the blocks.
+    size_t      allocs;  // Cumulative number of blocks allocated from the call site.
+    size_t      bytes;   // Total size, in bytes, of the call site's outstanding blocks.
+    size_t      count;   // Number of the call site's outstanding blocks.
+    size_t      frees;   // Cumulative number of the call site's blocks that have been freed.
+    const void *site;    // Identifies the call site. Unique for the lifetime of the process.
+} VLD_SITE_STATS;
+
+// Statistics for a single heap, as obtained by VLDGetHeapStats().
+typedef struct vldheapstats_s {
+    size_t      allocs;    // Cumulative number of blocks allocated from the heap.
+    size_t      blocks;    // Number of the heap's outstanding blocks.
+    size_t      bytes;     // Total size, in bytes, of the heap's outstanding blocks.
+    size_t      frees;     // Cumulative number of the heap's blocks that have been freed.
+    const void *heap;      // Handle to the heap.
+    size_t      peakbytes; // Largest total size, in bytes, the heap's outstanding blocks have ever reached.
+} VLD_HEAP_STATS;
+
+// Statistics for the whole process, as obtained by VLDGetStats(). Besides the
+// memory being tracked, these include Visual Leak Detector's own overhead.
+typedef struct vldstats_s {
+    size_t             allocs;         // Cumulative number of blocks allocated.
+    size_t             blocks;         // Number of outstanding blocks.
+    size_t             bytes;          // Total size, in bytes, of all outstanding blocks.
+    unsigned long long elapsed;        // Time, in microseconds, since Visual Leak Detector was initialized.
+    size_t             frees;          // Cumulative number of blocks freed.
+    size_t             heaps;          // Number of heaps.
+    size_t             internalblocks; // Number of blocks Visual Leak Detector has allocated for its own use.
+    size_t             internalbytes;  // Total size, in bytes, of the blocks Visual Leak Detector has allocated for its own use.
+    size_t             peakbytes;      // Largest total size, in bytes, all outstanding blocks have ever reached.
+    size_t             reallocs;       // Cumulative number of blocks reallocated.
+    size_t             stackwalks;     // Cumulative number of call stacks traced.
+    unsigned long long time;           // Time, in microseconds, summed over all threads, spent tracking allocations and frees.
+    size_t             untracked;      // Number of blocks not tracked, to keep Visual Leak Detector within its memory budget.
+} VLD_STATS;
+
+// A buffer in which the blocks a custom allocator hands out and takes back are
+// collected, so that they can be tracked in batches (see VLDTrackAllocInline()
+// and VLDTrackFreeInline()). Along with each block handed out, the address the
+// allocator returns to is collected, since the block's call stack can no longer
+// be traced once the buffer is flushed. A buffer must be zero-initialized, and
+// must only be used by one thread at a time: typically, each thread has one of
+// its own.
+#define VLD_TRACK_BUFFER_BLOCKS 32 // Number of blocks a buffer holds before it is flushed.
+typedef struct vldtrackbuffer_s {
+    size_t      allocs;                                 // Number of blocks in "allocmems".
+    const void *alloccallers [VLD_TRACK_BUFFER_BLOCKS]; // Addresses the blocks in "allocmems" were handed out to.
+    const void *allocmems [VLD_TRACK_BUFFER_BLOCKS];    // Blocks handed out, not yet tracked.
+    size_t      allocsize;                              // Size, in bytes, of each of the blocks in "allocmems".
+    size_t      frees;                                  // Number of blocks in "freemems".
+    const void *freemems [VLD_TRACK_BUFFER_BLOCKS];     // Blocks taken back, still tracked.
+} VLD_TRACK_BUFFER;
+
+// Visual Leak Detector's own source includes this header only for the types.
+#ifndef VLDBUILD
+
 #ifdef _DEBUG
 
+#ifdef _WIN32
 #pragma comment(lib, "vld.lib")
 
 // Force a symbolic reference to the global VisualLeakDetector class object from
@@ -32,6 +99,30 @@
 // even if no code otherwise imports any of the DLL's exports.
 #pragma comment(linker, "/include:__imp_?vld@@3VVisualLeakDetector@@A")
 
+#define VLDAPI __declspec(dllimport)
+#else
+// On other platforms, the program is linked with the Visual Leak Detector
+// shared library (libvld.so), or the library is preloaded into the program.
+#define VLDAPI
+#endif // _WIN32
+
+// The buffered variants of the VLDTrack APIs are defined in this header, so
+// that they can be inlined into a custom allocator's fast path.
+#ifdef _MSC_VER
+#define VLDINLINE static __inline
+#else
+#define VLDINLINE static inline
+#endif // _MSC_VER
+
+// VLDRETURNADDRESS() evaluates to the address the function it is used in
+// returns to, that is, to the location of the call to that function.
+#ifdef _MSC_VER
+#include <intrin.h>
+#define VLDRETURNADDRESS() _ReturnAddress()
+#else
+#define VLDRETURNADDRESS() __builtin_return_address(0)
+#endif // _MSC_VER
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Visual Leak Detector APIs
@@ -61,7 +152,7 @@ extern "C" {
 //
 //    None.
 //
-__declspec(dllimport) void VLDDisable ();
+VLDAPI void VLDDisable ();
 
 // VLDEnable - Enables Visual Leak Detector's memory leak detection at runtime.
 //   If memory leak detection is already enabled, which it is by default, then
@@ -83,7 +174,407 @@ __declspec(dllimport) void VLDDisable ();
 //
 //    None.
 //
-__declspec(dllimport) void VLDEnable ();
+VLDAPI void VLDEnable ();
+
+// VLDGetHeapStats - Obtains statistics for every heap in the process: the
+//   number and total size of each heap's outstanding blocks, the largest total
+//   size they have ever reached, and the cumulative number of blocks allocated
+//   from and freed back to each heap.
+//
+//  - stats (OUT): Array to receive the statistics. May be NULL if "max" is
+//      zero.
+//
+//  - max (IN): Number of elements in the "stats" array.
+//
+//  Return Value:
+//
+//    Returns the total number of heaps. If this is greater than "max", then
+//    only the first "max" heaps' statistics were obtained.
+//
+VLDAPI size_t VLDGetHeapStats (VLD_HEAP_STATS *stats, size_t max);
+
+// VLDGetLeaksCount - Obtains the number of memory blocks that are currently
+//   outstanding (i.e. the number of memory leaks that would be reported if the
+//   program were to exit right now). This function can be called at any time
+//   while the program is running, from any thread.
+//
+//  Return Value:
+//
+//    Returns the number of memory blocks currently outstanding.
+//
+VLDAPI unsigned int VLDGetLeaksCount ();
+
+// VLDGetSiteStats - Obtains statistics for every call site from which memory
+//   blocks have been allocated: the number and total size of each call site's
+//   outstanding blocks, and the cumulative number of blocks allocated from and
+//   freed back to each call site. The statistics are maintained as blocks are
+//   allocated and freed, so the cost of this function depends only on the
+//   number of call sites, not on the number of outstanding blocks.
+//
+//  - stats (OUT): Array to receive the statistics, sorted by total size of
+//      outstanding blocks (largest first), then by number of outstanding
+//      blocks. May be NULL if "max" is zero.
+//
+//  - max (IN): Number of elements in the "stats" array.
+//
+//  Return Value:
+//
+//    Returns the total number of call sites. If this is greater than "max",
+//    then only the first "max" call sites' statistics were obtained.
+//
+VLDAPI size_t VLDGetSiteStats (VLD_SITE_STATS *stats, size_t max);
+
+// VLDGetStats - Obtains statistics for the whole process: the number of blocks
+//   allocated, freed and reallocated, the number and total size of outstanding
+//   blocks, and Visual Leak Detector's own overhead (the memory it has allocated
+//   for its own use, the number of call stacks it has traced, and the time it
+//   has spent tracking allocations and frees). Each thread keeps its own
+//   counters, which are only added up when this function is called, so keeping
+//   the statistics doesn't slow down allocations.
+//
+//  - stats (OUT): Structure to receive the statistics.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDAPI void VLDGetStats (VLD_STATS *stats);
+
+// VLDMarkCheckpoint - Marks a checkpoint which can later be passed to
+//   VLDReportSince() to report only those memory blocks that were allocated
+//   after the checkpoint was marked.
+//
+//  Return Value:
+//
+//    Returns the checkpoint.
+//
+VLDAPI size_t VLDMarkCheckpoint ();
+
+// VLDReportAges - Generates a report of the ages of the memory blocks currently
+//   outstanding at each call site. Each call site's blocks are tallied in a
+//   histogram of ages, ranging from less than a second to more than a day, and
+//   call sites whose oldest blocks have been outstanding the longest are
+//   reported first. A call site that keeps accumulating old blocks is likely to
+//   be leaking slowly, whereas one whose blocks are all young is likely to be a
+//   cache or working set.
+//
+//  Return Value:
+//
+//    Returns the number of call sites reported.
+//
+VLDAPI size_t VLDReportAges ();
+
+// VLDReportLeaks - Generates a report of all memory blocks that are currently
+//   outstanding, while the program is still running. This function can be
+//   called at any time, from any thread. Other threads are only blocked for as
+//   long as it takes to capture a snapshot of the outstanding blocks; they are
+//   free to continue allocating and freeing memory while the report is being
+//   generated.
+//
+//  Note: Because the reported blocks may be freed by other threads while the
+//    report is being generated, the contents of the blocks are not included in
+//    the report.
+//
+//  Return Value:
+//
+//    Returns the number of memory blocks reported.
+//
+VLDAPI unsigned int VLDReportLeaks ();
+
+// VLDReportOlderThan - Generates a report of the memory blocks that have been
+//   outstanding for at least the specified amount of time. Otherwise, this
+//   function behaves like VLDReportLeaks().
+//
+//  - age (IN): Minimum age, in milliseconds, of the blocks to report.
+//
+//  Return Value:
+//
+//    Returns the number of memory blocks reported.
+//
+VLDAPI unsigned int VLDReportOlderThan (size_t age);
+
+// VLDReportSince - Generates a report of the memory blocks that were allocated
+//   after the specified checkpoint was marked, and which are still outstanding.
+//   This is useful for finding leaks in each iteration of a long-running loop
+//   (e.g. each request handled by a server). The cost of generating the report
+//   depends only on the number of blocks allocated since the checkpoint, not
+//   on the total number of outstanding blocks. Otherwise, this function
+//   behaves like VLDReportLeaks().
+//
+//  - checkpoint (IN): A checkpoint previously obtained from
+//      VLDMarkCheckpoint().
+//
+//  Return Value:
+//
+//    Returns the number of memory blocks reported.
+//
+VLDAPI unsigned int VLDReportSince (size_t checkpoint);
+
+// VLDReportSites - Generates a report of the memory currently outstanding at
+//   each call site, along with each call site's call stack and cumulative
+//   allocation and free counts. Only call sites with outstanding blocks are
+//   reported, largest first.
+//
+//  Return Value:
+//
+//    Returns the number of call sites reported.
+//
+VLDAPI size_t VLDReportSites ();
+
+// VLDReportStats - Generates a report of the statistics obtained by
+//   VLDGetStats() and VLDGetHeapStats().
+//
+//  Return Value:
+//
+//    None.
+//
+VLDAPI void VLDReportStats ();
+
+// VLDTrackAlloc - Tracks a memory block handed out by a custom allocator (e.g.
+//   a memory pool), which Visual Leak Detector would otherwise not know about.
+//   The block is tracked just like a block allocated from a heap, with a call
+//   stack traced from the caller of this function, and is reported as a leak if
+//   it is never passed to VLDTrackFree(). Blocks tracked by this function
+//   belong to a virtual heap of their own, which appears in the statistics
+//   obtained by VLDGetHeapStats().
+//
+//  Note: The memory from which a custom allocator hands out its blocks is
+//    usually allocated from a heap itself, in chunks. To keep such a chunk from
+//    being reported as a leak too, allocate it while memory leak detection is
+//    disabled (see VLDDisable()).
+//
+//  - mem (IN): Pointer to the memory block handed out. If NULL, then calling
+//      this function has no effect.
+//
+//  - size (IN): Size, in bytes, of the memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDAPI void VLDTrackAlloc (const void *mem, size_t size);
+
+// VLDTrackAllocs - Tracks a batch of memory blocks of the same size, handed out
+//   by a custom allocator at once (e.g. when a memory pool carves a new chunk
+//   into blocks). The blocks share a single call stack, traced from the caller
+//   of this function, so tracking the whole batch costs little more than
+//   tracking a single block with VLDTrackAlloc().
+//
+//  - mems (IN): Array of pointers to the memory blocks handed out.
+//
+//  - count (IN): Number of elements in the "mems" array.
+//
+//  - size (IN): Size, in bytes, of each memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDAPI void VLDTrackAllocs (const void *const *mems, size_t count, size_t size);
+
+// VLDTrackAllocsFrom - Tracks a batch of memory blocks of the same size, handed
+//   out by a custom allocator to different callers, some time before this
+//   function is called (e.g. when the blocks were collected in a buffer, see
+//   VLDTrackAllocInline()). Their call stacks can no longer be traced, so each
+//   block's call stack consists of a single frame: the address the allocator
+//   returned to when it handed out the block. Consecutive blocks handed out to
+//   the same caller share their call stack.
+//
+//  - mems (IN): Array of pointers to the memory blocks handed out.
+//
+//  - callers (IN): Array of the addresses the allocator returned to, one for
+//      each element of the "mems" array.
+//
+//  - count (IN): Number of elements in the "mems" and "callers" arrays.
+//
+//  - size (IN): Size, in bytes, of each memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDAPI void VLDTrackAllocsFrom (const void *const *mems, const void *const *callers, size_t count, size_t size);
+
+// VLDTrackFree - Stops tracking a memory block that was handed out by a custom
+//   allocator, and has now been taken back by it.
+//
+//  - mem (IN): Pointer to a memory block previously passed to VLDTrackAlloc(),
+//      VLDTrackAllocs() or VLDTrackRealloc(). If NULL, then calling this
+//      function has no effect.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDAPI void VLDTrackFree (const void *mem);
+
+// VLDTrackFrees - Stops tracking a batch of memory blocks that were handed out
+//   by a custom allocator, and have now been taken back by it at once (e.g.
+//   when a memory pool or an arena is reset). Untracking the whole batch costs
+//   much less than passing each block to VLDTrackFree().
+//
+//  - mems (IN): Array of pointers to memory blocks previously passed to
+//      VLDTrackAlloc(), VLDTrackAllocs() or VLDTrackRealloc().
+//
+//  - count (IN): Number of elements in the "mems" array.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDAPI void VLDTrackFrees (const void *const *mems, size_t count);
+
+// VLDTrackRealloc - Tracks a memory block that was resized by a custom
+//   allocator. The block's call stack is traced again, from the caller of this
+//   function.
+//
+//  - mem (IN): Pointer to the memory block that was resized. If NULL, then the
+//      resized block is tracked as a newly handed out block.
+//
+//  - newmem (IN): Pointer to the resized memory block, which may or may not be
+//      the same as "mem". If NULL, then the block is no longer tracked, as if
+//      it had been passed to VLDTrackFree().
+//
+//  - size (IN): Size, in bytes, of the resized memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDAPI void VLDTrackRealloc (const void *mem, const void *newmem, size_t size);
+
+// VLDTrackFlush - Tracks the blocks collected in a buffer by
+//   VLDTrackAllocInline() and VLDTrackFreeInline(), and empties the buffer. The
+//   blocks handed out are tracked before the blocks taken back. A buffer must
+//   be flushed before the blocks it holds are reported on (for example, before
+//   VLDReportLeaks() is called, or the thread that owns the buffer exits):
+//   until then, the blocks taken back are still tracked, and so still show up
+//   as outstanding, and the blocks handed out are not tracked yet.
+//
+//  - buffer (IN/OUT): Pointer to the buffer.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDINLINE void VLDTrackFlush (VLD_TRACK_BUFFER *buffer)
+{
+    if (buffer->allocs != 0) {
+        VLDTrackAllocsFrom((const void *const *)buffer->allocmems, (const void *const *)buffer->alloccallers,
+                           buffer->allocs, buffer->allocsize);
+        buffer->allocs = 0;
+    }
+    if (buffer->frees != 0) {
+        VLDTrackFrees((const void *const *)buffer->freemems, buffer->frees);
+        buffer->frees = 0;
+    }
+}
+
+// VLDTrackAllocInlineFrom - Collects a memory block handed out by a custom
+//   allocator in a buffer, along with the address the allocator returns to (see
+//   VLDTrackAllocInline()).
+//
+//  - buffer (IN/OUT): Pointer to the buffer.
+//
+//  - mem (IN): Pointer to the memory block handed out.
+//
+//  - size (IN): Size, in bytes, of the memory block.
+//
+//  - caller (IN): Address the allocator returns to.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDINLINE void VLDTrackAllocInlineFrom (VLD_TRACK_BUFFER *buffer, const void *mem, size_t size, const void *caller)
+{
+    if (mem == NULL) {
+        return;
+    }
+    if ((buffer->frees != 0) || ((buffer->allocs != 0) && (buffer->allocsize != size))) {
+        VLDTrackFlush(buffer);
+    }
+    buffer->alloccallers[buffer->allocs] = caller;
+    buffer->allocmems[buffer->allocs++] = mem;
+    buffer->allocsize = size;
+    if (buffer->allocs == VLD_TRACK_BUFFER_BLOCKS) {
+        VLDTrackFlush(buffer);
+    }
+}
+
+// VLDTrackAllocInline - Collects a memory block handed out by a custom
+//   allocator in a buffer, to be tracked along with the other blocks in the
+//   buffer once it is full (see VLDTrackAllocsFrom()). Unless the buffer is
+//   full, this takes no call into Visual Leak Detector, so it is cheap enough
+//   for an allocator's fast path. It must be used in the allocator's function
+//   that hands out the block: since its call stack is not traced, the block is
+//   attributed to the call to that function, which is recorded in the buffer.
+//
+//  - buffer (IN/OUT): Pointer to the buffer. If it holds blocks taken back, or
+//      blocks of another size, then it is flushed first, so that the blocks are
+//      tracked in the order they were handed out and taken back.
+//
+//  - mem (IN): Pointer to the memory block handed out. If NULL, then calling
+//      this function has no effect.
+//
+//  - size (IN): Size, in bytes, of the memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+#define VLDTrackAllocInline(buffer, mem, size) VLDTrackAllocInlineFrom((buffer), (mem), (size), VLDRETURNADDRESS())
+
+// VLDTrackFreeInline - Collects a memory block taken back by a custom allocator
+//   in a buffer, to stop tracking it along with the other blocks in the buffer
+//   once it is full (see VLDTrackFrees()). Unless the buffer is full, this
+//   takes no call into Visual Leak Detector. Blocks are therefore taken back in
+//   batches: until the buffer is flushed, a block taken back is still tracked,
+//   and still shows up as outstanding (e.g. in VLDGetLeaksCount()).
+//
+//  - buffer (IN/OUT): Pointer to the buffer.
+//
+//  - mem (IN): Pointer to a memory block previously handed out. If NULL, then
+//      calling this function has no effect.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDINLINE void VLDTrackFreeInline (VLD_TRACK_BUFFER *buffer, const void *mem)
+{
+    if (mem == NULL) {
+        return;
+    }
+    buffer->freemems[buffer->frees++] = mem;
+    if (buffer->frees == VLD_TRACK_BUFFER_BLOCKS) {
+        VLDTrackFlush(buffer);
+    }
+}
+
+// VLDTrackReallocInline - Tracks a memory block that was resized by a custom
+//   allocator that collects its other blocks in a buffer. The buffer is
+//   flushed first, since it may hold the block being resized, and the block is
+//   then tracked by VLDTrackRealloc() right away.
+//
+//  - buffer (IN/OUT): Pointer to the buffer.
+//
+//  - mem (IN): Pointer to the memory block that was resized (see
+//      VLDTrackRealloc()).
+//
+//  - newmem (IN): Pointer to the resized memory block (see VLDTrackRealloc()).
+//
+//  - size (IN): Size, in bytes, of the resized memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VLDINLINE void VLDTrackReallocInline (VLD_TRACK_BUFFER *buffer, const void *mem, const void *newmem, size_t size)
+{
+    VLDTrackFlush(buffer);
+    VLDTrackRealloc(mem, newmem, size);
+}
 
 #ifdef __cplusplus
 }
@@ -93,5 +584,29 @@ __declspec(dllimport) void VLDEnable ();
 
 #define VLDEnable()
 #define VLDDisable()
+#define VLDGetHeapStats(stats, max) 0
+#define VLDGetLeaksCount() 0
+#define VLDGetSiteStats(stats, max) 0
+#define VLDGetStats(stats)
+#define VLDMarkCheckpoint() 0
+#define VLDReportAges() 0
+#define VLDReportLeaks() 0
+#define VLDReportOlderThan(age) 0
+#define VLDReportSince(checkpoint) 0
+#define VLDReportSites() 0
+#define VLDReportStats()
+#define VLDTrackAlloc(mem, size)
+#define VLDTrackAllocInline(buffer, mem, size)
+#define VLDTrackAllocInlineFrom(buffer, mem, size, caller)
+#define VLDTrackAllocs(mems, count, size)
+#define VLDTrackAllocsFrom(mems, callers, count, size)
+#define VLDTrackFlush(buffer)
+#define VLDTrackFree(mem)
+#define VLDTrackFreeInline(buffer, mem)
+#define VLDTrackFrees(mems, count)
+#define VLDTrackRealloc(mem, newmem, size)
+#define VLDTrackReallocInline(buffer, mem, newmem, size)
 
 #endif // _DEBUG
+
+#endif // VLDBUILD
@@ -21,7 +21,9 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <cstring>
 #define VLDBUILD     // Declares that we are building Visual Leak Detector.
+#include "utility.h" // Provides various utility functions.
 #include "vldint.h"  // Provides access to the Visual Leak Detector internals.
 #include "vldheap.h" // Provides internal new and delete operators.
 
@@ -66,3 +68,223 @@ extern "C" __declspec(dllexport) void VLDEnable ()
     tls->flags |= VLD_TLS_ENABLED;
     vld.m_status &= ~VLD_STATUS_NEVER_ENABLED;
 }
+
+extern "C" __declspec(dllexport) SIZE_T VLDGetHeapStats (VLD_HEAP_STATS *stats, SIZE_T max)
+{
+    SIZE_T          count;
+    VLD_HEAP_STATS *heapstats;
+
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return 0;
+    }
+
+    count = vld.getheapstats(&heapstats);
+    if (count != 0) {
+        if (max != 0) {
+            // Callers pass a NULL buffer to only query the number of heaps.
+            memcpy(stats, heapstats, ((count < max) ? count : max) * sizeof(VLD_HEAP_STATS));
+        }
+        delete [] heapstats;
+    }
+
+    return count;
+}
+
+extern "C" __declspec(dllexport) UINT VLDGetLeaksCount ()
+{
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return 0;
+    }
+
+    return (UINT)vld.getleakscount();
+}
+
+extern "C" __declspec(dllexport) SIZE_T VLDGetSiteStats (VLD_SITE_STATS *stats, SIZE_T max)
+{
+    SIZE_T          count;
+    VLD_SITE_STATS *sitestats;
+
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return 0;
+    }
+
+    count = vld.getsitestats(&sitestats);
+    if (count != 0) {
+        if (max != 0) {
+            // Callers pass a NULL buffer to only query the number of sites.
+            memcpy(stats, sitestats, ((count < max) ? count : max) * sizeof(VLD_SITE_STATS));
+        }
+        delete [] sitestats;
+    }
+
+    return count;
+}
+
+extern "C" __declspec(dllexport) void VLDGetStats (VLD_STATS *stats)
+{
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        memset(stats, 0x0, sizeof(VLD_STATS));
+        return;
+    }
+
+    vld.getstats(stats);
+}
+
+extern "C" __declspec(dllexport) SIZE_T VLDMarkCheckpoint ()
+{
+    SIZE_T checkpoint;
+
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return 0;
+    }
+
+    // The checkpoint is the serial number that will be assigned to the next
+    // allocated block.
+    enterlock(&vld.m_maplock);
+    checkpoint = readcounter(&vld.m_serialnumber);
+    leavelock(&vld.m_maplock);
+
+    return checkpoint;
+}
+
+extern "C" __declspec(dllexport) SIZE_T VLDReportAges ()
+{
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return 0;
+    }
+
+    return vld.reportages();
+}
+
+extern "C" __declspec(dllexport) UINT VLDReportLeaks ()
+{
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return 0;
+    }
+
+    return (UINT)vld.reportoutstanding(0, 0);
+}
+
+extern "C" __declspec(dllexport) UINT VLDReportOlderThan (SIZE_T age)
+{
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return 0;
+    }
+
+    return (UINT)vld.reportoutstanding(0, age);
+}
+
+extern "C" __declspec(dllexport) UINT VLDReportSince (SIZE_T checkpoint)
+{
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return 0;
+    }
+
+    return (UINT)vld.reportoutstanding(checkpoint, 0);
+}
+
+extern "C" __declspec(dllexport) SIZE_T VLDReportSites ()
+{
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return 0;
+    }
+
+    return vld.reportsites();
+}
+
+extern "C" __declspec(dllexport) void VLDReportStats ()
+{
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return;
+    }
+
+    vld.reportstats();
+}
+
+extern "C" __declspec(dllexport) void VLDTrackAlloc (LPCVOID mem, SIZE_T size)
+{
+    SIZE_T fp;
+
+    if ((vld.m_options & VLD_OPT_VLDOFF) || (mem == NULL)) {
+        // VLD has been turned off, or there is no block to track.
+        return;
+    }
+
+    // The block's call stack is traced from the caller of this function.
+    FRAMEPOINTER(fp);
+    vld.trackalloc(fp, mem, size);
+}
+
+extern "C" __declspec(dllexport) void VLDTrackAllocs (LPCVOID const *mems, SIZE_T count, SIZE_T size)
+{
+    SIZE_T fp;
+
+    if ((vld.m_options & VLD_OPT_VLDOFF) || (count == 0)) {
+        // VLD has been turned off, or there are no blocks to track.
+        return;
+    }
+
+    // The blocks' call stack is traced from the caller of this function.
+    FRAMEPOINTER(fp);
+    vld.trackallocs(fp, mems, count, size);
+}
+
+extern "C" __declspec(dllexport) void VLDTrackAllocsFrom (LPCVOID const *mems, LPCVOID const *callers, SIZE_T count,
+                                                          SIZE_T size)
+{
+    SIZE_T fp;
+
+    if ((vld.m_options & VLD_OPT_VLDOFF) || (count == 0)) {
+        // VLD has been turned off, or there are no blocks to track.
+        return;
+    }
+
+    // The blocks' call stacks are recorded by the callers, not traced.
+    FRAMEPOINTER(fp);
+    vld.trackallocsfrom(fp, mems, callers, count, size);
+}
+
+extern "C" __declspec(dllexport) void VLDTrackFree (LPCVOID mem)
+{
+    if ((vld.m_options & VLD_OPT_VLDOFF) || (mem == NULL)) {
+        // VLD has been turned off, or there is no block to untrack.
+        return;
+    }
+
+    vld.trackfree(mem);
+}
+
+extern "C" __declspec(dllexport) void VLDTrackFrees (LPCVOID const *mems, SIZE_T count)
+{
+    if ((vld.m_options & VLD_OPT_VLDOFF) || (count == 0)) {
+        // VLD has been turned off, or there are no blocks to untrack.
+        return;
+    }
+
+    vld.trackfrees(mems, count);
+}
+
+extern "C" __declspec(dllexport) void VLDTrackRealloc (LPCVOID mem, LPCVOID newmem, SIZE_T size)
+{
+    SIZE_T fp;
+
+    if (vld.m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return;
+    }
+
+    // The block's call stack is traced from the caller of this function.
+    FRAMEPOINTER(fp);
+    vld.trackrealloc(fp, mem, newmem, size);
+}
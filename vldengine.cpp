@@ -0,0 +1,2633 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - Tracking Engine
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#define VLDBUILD         // Declares that we are building Visual Leak Detector.
+#include "callstack.h"   // Provides a class for handling call stacks.
+#include "map.h"         // Provides a lightweight STL-like map template.
+#include "platform.h"    // Provides the platform services.
+#include "set.h"         // Provides a lightweight STL-like set template.
+#include "utility.h"     // Provides various utility functions.
+#include "vldheap.h"     // Provides internal new and delete operators.
+#include "vldint.h"      // Provides access to the Visual Leak Detector internals.
+
+#define BLOCKMAPRESERVE 64 // This should strike a balance between memory use and a desire to minimize heap hits.
+
+// The tracking engine is the portable part of the VisualLeakDetector class: the
+// block and heap maps, the stack depot, the statistics and the reports. It only
+// depends on the operating system through the platform services. The rest of
+// the class, which attaches VLD to the process, is in vld.cpp.
+
+// Imported global variables.
+extern vldblockheader_t *vldblocklist;
+extern HANDLE            vldheap;
+extern SIZE_T            vldheapblocks;
+extern SIZE_T            vldheapbytes;
+extern vldlock_t         vldheaplock;
+extern VisualLeakDetector vld;
+
+// Upper limits, in milliseconds, of the ranges of ages covered by each bucket of
+// the histograms of block ages (the last bucket has no upper limit), and the
+// labels by which the buckets are reported.
+static const ULONGLONG agelimits [VLD_AGE_BUCKETS - 1] = { 1000, 10000, 60000, 600000, 3600000, 86400000 };
+static const LPCWSTR   agelabels [VLD_AGE_BUCKETS] = { L"<1s", L"<10s", L"<1m", L"<10m", L"<1h", L"<1d", L">=1d" };
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Private Leak Detection Functions
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// checkbudget - Checks VLD's internal memory use against the configured budget.
+//   As the budget is approached, tracking is progressively degraded, so that
+//   VLD's memory use levels off instead of growing without bound: first call
+//   stacks are truncated, then only a sample of the blocks is tracked, and
+//   finally blocks are no longer tracked at all. Tracking is never restored,
+//   so that the leak report is consistently degraded. A warning is reported
+//   each time tracking is degraded.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::checkbudget ()
+{
+    LONG   current;
+    SIZE_T internalbytes;
+    LONG   level;
+
+    // The size of VLD's private heap is only updated while holding its lock,
+    // but it is read here without the lock.
+    internalbytes = readcounter(&vldheapbytes);
+
+    if (internalbytes >= m_maxinternalmemory) {
+        level = VLD_DEGRADE_COUNT;
+    }
+    else if (internalbytes >= m_maxinternalmemory / 8 * 7) {
+        level = VLD_DEGRADE_SAMPLE;
+    }
+    else if (internalbytes >= m_maxinternalmemory / 4 * 3) {
+        level = VLD_DEGRADE_TRUNCATE;
+    }
+    else {
+        return;
+    }
+
+    // Only the thread that actually raises the level reports it.
+    do {
+        current = readcounter(&m_degradation);
+        if (level <= current) {
+            return;
+        }
+    } while (InterlockedCompareExchange(&m_degradation, level, current) != current);
+    switch (level) {
+    case VLD_DEGRADE_TRUNCATE:
+        report(L"WARNING: Visual Leak Detector: Internal memory use is approaching its limit of %lu KB. Call\n"
+               L"  stacks are now truncated to %u frames.\n", m_maxinternalmemory / 1024,
+               VLD_DEGRADED_MAX_TRACE_FRAMES);
+        break;
+
+    case VLD_DEGRADE_SAMPLE:
+        report(L"WARNING: Visual Leak Detector: Internal memory use is nearing its limit of %lu KB. Only one\n"
+               L"  in every %u blocks is now tracked. Some leaks will not be reported.\n",
+               m_maxinternalmemory / 1024, VLD_DEGRADED_SAMPLE_INTERVAL);
+        break;
+
+    default:
+        report(L"WARNING: Visual Leak Detector: Internal memory use has reached its limit of %lu KB. Blocks\n"
+               L"  are no longer tracked; only the number of allocations from each call site is counted.\n",
+               m_maxinternalmemory / 1024);
+        break;
+    }
+}
+
+// acquireranges - Obtains one of the tables of ranges, so that the calling
+//   thread can search it without holding any lock. The table is not freed, even
+//   if it is superseded, until the thread calls "releaseranges". A thread may
+//   only search one table at a time.
+//
+//  - tls (IN): Pointer to the calling thread's thread local storage structure.
+//
+//  - table (IN): Pointer to the table to be searched.
+//
+//  Return Value:
+//
+//    Returns a pointer to the table (which may be NULL, if no ranges have been
+//    added to it yet).
+//
+const RangeTable* VisualLeakDetector::acquireranges (tls_t *tls, RangeTable *const *table)
+{
+    const RangeTable *ranges;
+
+    do {
+        // The table may be superseded, and found not to be in use, after it is
+        // read but before the thread says it is using it. In that case, it
+        // may already have been freed, so the new table is read instead.
+        ranges = acquirecounter(table);
+        orderedstore(&tls->ranges, ranges);
+    } while (orderedload(table) != ranges);
+
+    return ranges;
+}
+
+// addranges - Adds ranges of code to one of the tables of ranges, such as the
+//   ranges of code internal to the heap (e.g. the C runtime's allocation
+//   functions), whose frames are left out of call stacks when they are traced.
+//   Other threads may be searching the current table, so it is superseded by a
+//   new table rather than modified (see "setranges").
+//
+//  - table (IN/OUT): Pointer to the table to add the ranges to (which may be
+//      NULL, if no ranges have been added yet). Receives the new table.
+//
+//  - ranges (IN): Array of the ranges to be added.
+//
+//  - count (IN): Number of elements in the "ranges" array.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::addranges (RangeTable **table, const addressrange_t *ranges, SIZE_T count)
+{
+    if (count == 0) {
+        return;
+    }
+    enterlock(&m_moduleslock);
+    setranges(table, new RangeTable(*table, ranges, count));
+    leavelock(&m_moduleslock);
+}
+
+// countblock - Counts an allocation against its call site, without tracking the
+//   block. Once tracking has been degraded to counting (see "checkbudget"),
+//   this is all that is done for each allocation, so nothing is allocated: call
+//   stacks are truncated by then, so the call stack is traced into a CallStack
+//   on the stack, which has room for the truncated frames built in. Call sites
+//   that haven't been interned yet are no longer interned, so that the stack
+//   depot stops growing. They are all counted against a single untracked site
+//   instead, which is interned with an empty call stack.
+//
+//  - framepointer (IN): Frame pointer at the time the allocation first entered
+//      VLD's code.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::countblock (SIZE_T framepointer)
+{
+    CallStack     *callstack;
+    FastCallStack  faststack;
+    SafeCallStack  safestack;
+    stackinfo_t   *stack;
+    tls_t         *tls = gettls();
+
+    if (m_options & VLD_OPT_SAFE_STACK_WALK) {
+        callstack = &safestack;
+    }
+    else {
+        callstack = &faststack;
+    }
+    tracecallstack(framepointer, callstack);
+
+    enterlock(&m_maplock);
+    stack = findstack(callstack);
+    if (stack == NULL) {
+        callstack->clear();
+        stack = findstack(callstack);
+        if (stack == NULL) {
+            // This is the first allocation from a call site that isn't
+            // interned. Intern the untracked site.
+            stack = internstack(new FastCallStack);
+        }
+    }
+    stack->allocs++;
+    leavelock(&m_maplock);
+    addcounter(&tls->untracked, (SIZE_T)1);
+}
+
+// drainfrees - Unmaps the frees held back by every thread (see "unmapblock"),
+//   so that the block maps are up to date.
+//
+//   Note: The caller must hold the map lock.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::drainfrees ()
+{
+    TlsSet::Iterator tlsit;
+
+    enterlock(&m_tlslock);
+    for (tlsit = m_tlsset->begin(); tlsit != m_tlsset->end(); ++tlsit) {
+        flushfrees(*tlsit);
+    }
+    leavelock(&m_tlslock);
+}
+
+// enabled - Determines if memory leak detection is enabled for the current
+//   thread.
+//
+//  Return Value:
+//
+//    Returns true if Visual Leak Detector is enabled for the current thread.
+//    Otherwise, returns false.
+//
+BOOL VisualLeakDetector::enabled ()
+{
+    tls_t *tls = gettls();
+
+    if (!(m_status & VLD_STATUS_INSTALLED)) {
+        // Memory leak detection is not yet enabled because VLD is still
+        // initializing.
+        return FALSE;
+    }
+
+    if (!(tls->flags & VLD_TLS_DISABLED) && !(tls->flags & VLD_TLS_ENABLED)) {
+        // The enabled/disabled state for the current thread has not been 
+        // initialized yet. Use the default state.
+        if (m_options & VLD_OPT_START_DISABLED) {
+            tls->flags |= VLD_TLS_DISABLED;
+        }
+        else {
+            tls->flags |= VLD_TLS_ENABLED;
+        }
+    }
+
+    return ((tls->flags & VLD_TLS_ENABLED) != 0);
+}
+
+// eraseblocks - Unmaps a batch of freed blocks. The batch is sorted by heap and
+//   address first, so that each heap's block map is only looked up once, and
+//   its blocks are erased in order of address.
+//
+//   Note: The caller must hold the map lock.
+//
+//  - frees (IN/OUT): Array of the freed blocks. The array is sorted in place.
+//
+//  - count (IN): Number of elements in the "frees" array.
+//
+//  Return Value:
+//
+//    Returns the number of blocks unmapped. Blocks that weren't mapped, or
+//    that were mapped again after they were freed, are not unmapped.
+//
+SIZE_T VisualLeakDetector::eraseblocks (heldfree_t *frees, SIZE_T count)
+{
+    BlockMap::Iterator  blockit;
+    BlockMap           *blockmap = NULL;
+    SIZE_T              erased = 0;
+    HANDLE              heap = NULL;
+    heapinfo_t         *heapinfo = NULL;
+    HeapMap::Iterator   heapit;
+    SIZE_T              index;
+    blockinfo_t        *info;
+
+    if (count > 1) {
+        qsort(frees, count, sizeof(heldfree_t), compareheldfrees);
+    }
+    for (index = 0; index < count; index++) {
+        if ((index == 0) || (frees[index].heap != heap)) {
+            // Find this heap's block map.
+            heap = frees[index].heap;
+            heapit = m_heapmap->find(heap);
+            heapinfo = (heapit != m_heapmap->end()) ? (*heapit).second : NULL;
+            blockmap = (heapinfo != NULL) ? &heapinfo->blockmap : NULL;
+        }
+        if (heapinfo == NULL) {
+            // We don't have a block map for this heap. We must not have
+            // monitored this allocation (probably happened before VLD was
+            // initialized).
+            continue;
+        }
+
+        // Find this block in the block map.
+        blockit = blockmap->find(frees[index].address);
+        if (blockit == blockmap->end()) {
+            // This block is not in the block map. We must not have monitored
+            // this allocation (probably happened before VLD was initialized).
+            continue;
+        }
+        if ((*blockit).second->serialnumber >= frees[index].checkpoint) {
+            // Another block has since been allocated at the same address.
+            continue;
+        }
+
+        // Retire the blockinfo_t structure and erase it from the block map.
+        info = (*blockit).second;
+        unlinkblock(heapinfo, info);
+        retireblock(info);
+        blockmap->erase(blockit);
+        erased++;
+    }
+
+    return erased;
+}
+
+// excludedfunction - Applies the function rules (see the ExcludeFunctions and
+//   ForceIncludeFunctions options) to an allocation, once the module that
+//   initiated it has been looked up. The function rules take precedence over
+//   the module's exclusion. The functions matching the rules were resolved to
+//   ranges of code when their modules were loaded, so this only takes a binary
+//   search of each table, without any lock.
+//
+//  - returnaddress (IN): Return address of the call that initiated the
+//      allocation, which lies in the function that made it.
+//
+//  - excluded (IN): TRUE if the module that initiated the allocation is
+//      excluded from leak detection. Otherwise FALSE.
+//
+//  Return Value:
+//
+//    Returns TRUE if the allocation is excluded from leak detection. Otherwise
+//    returns FALSE.
+//
+BOOL VisualLeakDetector::excludedfunction (SIZE_T returnaddress, BOOL excluded)
+{
+    const RangeTable *ranges;
+    tls_t            *tls = gettls();
+
+    // Look up the call instruction, rather than the return address, which may
+    // be just beyond the end of the function.
+    if (excluded) {
+        ranges = acquireranges(tls, &m_forcedranges);
+        if ((ranges != NULL) && ranges->contains(returnaddress - 1)) {
+            excluded = FALSE;
+        }
+    }
+    else {
+        ranges = acquireranges(tls, &m_excludedranges);
+        if ((ranges != NULL) && ranges->contains(returnaddress - 1)) {
+            excluded = TRUE;
+        }
+    }
+    releaseranges(tls);
+
+    return excluded;
+}
+
+// flushfrees - Unmaps the frees a thread has held back (see "unmapblock"), that
+//   haven't been unmapped yet. Only the thread itself ever empties its buffer
+//   of held back frees (see "releasefrees"). Other threads may only flush it.
+//
+//   Note: The caller must hold the map lock.
+//
+//  - tls (IN): Pointer to the thread local storage structure of the thread
+//      whose held back frees are to be unmapped.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::flushfrees (tls_t *tls)
+{
+    SIZE_T count = acquirecounter(&tls->heldcount);
+
+    if (count > tls->heldflushed) {
+        addcounter(&tls->frees, eraseblocks(&tls->heldfrees[tls->heldflushed], count - tls->heldflushed));
+        tls->heldflushed = count;
+    }
+}
+
+// findstack - Looks up a call stack in the stack depot without interning it.
+//
+//   Note: The caller must hold the map lock.
+//
+//  - callstack (IN): The call stack to look up.
+//
+//  Return Value:
+//
+//    Returns a pointer to the information of the identical call stack that has
+//    already been interned, or NULL if there is none.
+//
+stackinfo_t* VisualLeakDetector::findstack (const CallStack *callstack)
+{
+    stackinfo_t        *stack;
+    StackMap::Iterator  stackit;
+
+    stackit = m_stackmap->find(callstack->hash());
+    if (stackit != m_stackmap->end()) {
+        for (stack = (*stackit).second; stack != NULL; stack = stack->next) {
+            if (*(stack->callstack) == *callstack) {
+                return stack;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// freesnapshot - Frees a snapshot of the block maps that was previously
+//   captured by "takesnapshot". Any retired block information that is no longer
+//   referenced by an outstanding snapshot is reclaimed.
+//
+//  - snapshot (IN): Pointer to the snapshot to be freed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::freesnapshot (snapshot_t *snapshot)
+{
+    SIZE_T         oldest;
+    retiredinfo_t *prev = NULL;
+    retiredinfo_t *reclaimed = NULL;
+    retiredinfo_t *retired;
+
+    enterlock(&m_maplock);
+    m_snapshotepochs->erase(snapshot->epoch);
+    if (m_snapshotepochs->size() == 0) {
+        // No more snapshots are outstanding. All retired block information can
+        // be reclaimed.
+        reclaimed = m_retiredlist;
+        m_retiredlist = NULL;
+    }
+    else {
+        // Block information retired before the oldest outstanding snapshot was
+        // captured can't be referenced by any snapshot. The retired list is
+        // ordered from newest to oldest, so the first such entry, and every
+        // entry following it, can be reclaimed.
+        oldest = *(m_snapshotepochs->begin());
+        for (retired = m_retiredlist; retired != NULL; retired = retired->next) {
+            if (retired->epoch < oldest) {
+                if (prev == NULL) {
+                    m_retiredlist = NULL;
+                }
+                else {
+                    prev->next = NULL;
+                }
+                reclaimed = retired;
+                break;
+            }
+            prev = retired;
+        }
+    }
+    leavelock(&m_maplock);
+
+    // Free the reclaimed block information after releasing the lock.
+    while (reclaimed != NULL) {
+        retired = reclaimed;
+        reclaimed = retired->next;
+        delete retired->info;
+        delete retired;
+    }
+    delete [] snapshot->entries;
+    snapshot->count = 0;
+    snapshot->entries = NULL;
+}
+
+// getheapstats - Obtains the statistics of every heap in the process. The
+//   statistics are copied while holding the map lock.
+//
+//  - stats (OUT): Receives a pointer to a newly allocated array containing the
+//      statistics. The caller is responsible for freeing the array. Receives
+//      NULL if no heaps have been mapped.
+//
+//  Return Value:
+//
+//    Returns the number of heaps (i.e. the number of elements in the array).
+//
+SIZE_T VisualLeakDetector::getheapstats (VLD_HEAP_STATS **stats)
+{
+    SIZE_T             count;
+    VLD_HEAP_STATS    *heapstats;
+    heapinfo_t        *heapinfo;
+    HeapMap::Iterator  heapit;
+
+    *stats = NULL;
+
+    enterlock(&m_maplock);
+    drainfrees();
+    count = m_heapmap->size();
+    if (count == 0) {
+        leavelock(&m_maplock);
+        return 0;
+    }
+    *stats = new VLD_HEAP_STATS [count];
+    heapstats = *stats;
+    for (heapit = m_heapmap->begin(); heapit != m_heapmap->end(); ++heapit) {
+        heapinfo = (*heapit).second;
+        heapstats->allocs = heapinfo->allocs;
+        heapstats->blocks = heapinfo->blockmap.size();
+        heapstats->bytes = heapinfo->bytes;
+        heapstats->frees = heapinfo->frees;
+        heapstats->heap = (*heapit).first;
+        heapstats->peakbytes = heapinfo->peakbytes;
+        heapstats++;
+    }
+    leavelock(&m_maplock);
+
+    return count;
+}
+
+// getleakscount - Counts the memory blocks that are currently outstanding,
+//   i.e. the number of blocks that would be reported as memory leaks if the
+//   program were to exit right now. This is a cheap summary; no call stacks
+//   are copied or symbolized.
+//
+//  Return Value:
+//
+//    Returns the number of outstanding memory blocks.
+//
+SIZE_T VisualLeakDetector::getleakscount ()
+{
+    LPCVOID             address;
+    BlockMap::Iterator  blockit;
+    BlockMap           *blockmap;
+    SIZE_T              count = 0;
+    heapinfo_t         *heapinfo;
+    HeapMap::Iterator   heapit;
+    SIZE_T              size;
+
+    enterlock(&m_maplock);
+    drainfrees();
+    for (heapit = m_heapmap->begin(); heapit != m_heapmap->end(); ++heapit) {
+        heapinfo = (*heapit).second;
+        blockmap = &heapinfo->blockmap;
+        if (!(heapinfo->flags & VLD_HEAP_CRT)) {
+            // None of this heap's blocks can be internal to the CRT, so every
+            // block in the block map counts.
+            count += blockmap->size();
+            continue;
+        }
+        for (blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
+            if (getuserblock(heapinfo, (*blockit).first, (*blockit).second->size, &address, &size)) {
+                count++;
+            }
+        }
+    }
+    leavelock(&m_maplock);
+
+    return count;
+}
+
+// getsitestats - Obtains the statistics of every call site from which blocks
+//   have been allocated. The statistics are copied while holding the map lock
+//   and are sorted after the lock has been released.
+//
+//  - stats (OUT): Receives a pointer to a newly allocated array containing the
+//      statistics, sorted by total size of outstanding blocks (largest first).
+//      The caller is responsible for freeing the array. Receives NULL if no
+//      blocks have been allocated.
+//
+//  Return Value:
+//
+//    Returns the number of call sites (i.e. the number of elements in the
+//    array).
+//
+SIZE_T VisualLeakDetector::getsitestats (VLD_SITE_STATS **stats)
+{
+    SIZE_T              count = 0;
+    VLD_SITE_STATS     *sitestats;
+    stackinfo_t        *stack;
+    StackMap::Iterator  stackit;
+
+    *stats = NULL;
+
+    enterlock(&m_maplock);
+    drainfrees();
+    for (stackit = m_stackmap->begin(); stackit != m_stackmap->end(); ++stackit) {
+        for (stack = (*stackit).second; stack != NULL; stack = stack->next) {
+            count++;
+        }
+    }
+    if (count == 0) {
+        leavelock(&m_maplock);
+        return 0;
+    }
+    *stats = new VLD_SITE_STATS [count];
+    sitestats = *stats;
+    for (stackit = m_stackmap->begin(); stackit != m_stackmap->end(); ++stackit) {
+        for (stack = (*stackit).second; stack != NULL; stack = stack->next) {
+            sitestats->address = (stack->callstack->size() != 0) ? (const void*)(*(stack->callstack))[0] : NULL;
+            sitestats->allocs = stack->allocs;
+            sitestats->bytes = stack->bytes;
+            sitestats->count = stack->count;
+            sitestats->frees = stack->frees;
+            sitestats->site = stack;
+            sitestats++;
+        }
+    }
+    leavelock(&m_maplock);
+
+    qsort(*stats, count, sizeof(VLD_SITE_STATS), comparesitestats);
+
+    return count;
+}
+
+// getstats - Obtains the statistics of the whole process. The counters kept by
+//   each thread are added up. Each thread's counters are only ever written by
+//   that thread, and TLS structures are not freed until VLD is destroyed, so
+//   the counters can be read without holding up the threads that own them.
+//   The other statistics are maintained under the locks that are already held
+//   while blocks are mapped and unmapped.
+//
+//  - stats (OUT): Pointer to the structure that receives the statistics.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::getstats (VLD_STATS *stats)
+{
+    ULONGLONG          elapsed;
+    ULONGLONG          frequency = m_perffrequency;
+    HeapMap::Iterator  heapit;
+    ULONGLONG          time = 0;
+    tls_t             *tls;
+    TlsSet::Iterator   tlsit;
+
+    memset(stats, 0x0, sizeof(VLD_STATS));
+
+    // Unmap the frees held back by every thread first, so that they are
+    // counted.
+    enterlock(&m_maplock);
+    drainfrees();
+    leavelock(&m_maplock);
+
+    enterlock(&m_tlslock);
+    for (tlsit = m_tlsset->begin(); tlsit != m_tlsset->end(); ++tlsit) {
+        tls = *tlsit;
+        stats->allocs += readcounter(&tls->allocs);
+        stats->frees += readcounter(&tls->frees);
+        stats->reallocs += readcounter(&tls->reallocs);
+        stats->stackwalks += readcounter(&tls->stackwalks);
+        stats->untracked += readcounter(&tls->untracked);
+        time += readcounter(&tls->time);
+    }
+    leavelock(&m_tlslock);
+
+    enterlock(&m_maplock);
+    for (heapit = m_heapmap->begin(); heapit != m_heapmap->end(); ++heapit) {
+        stats->blocks += (*heapit).second->blockmap.size();
+    }
+    stats->bytes = m_livebytes;
+    stats->heaps = m_heapmap->size();
+    stats->peakbytes = m_peakbytes;
+    leavelock(&m_maplock);
+
+    enterlock(&vldheaplock);
+    stats->internalblocks = vldheapblocks;
+    stats->internalbytes = readcounter(&vldheapbytes);
+    leavelock(&vldheaplock);
+
+    // Convert performance counter ticks to microseconds, without overflowing.
+    elapsed = getperfcounter() - m_starttime;
+    stats->elapsed = (elapsed / frequency) * 1000000 + ((elapsed % frequency) * 1000000) / frequency;
+    stats->time = (time / frequency) * 1000000 + ((time % frequency) * 1000000) / frequency;
+}
+
+// gettimestamp - Obtains a timestamp for the current time. The timestamp is the
+//   system tick count, extended to 64 bits so that it doesn't wrap around after
+//   49.7 days. The tick count is cheap to obtain, and its resolution (typically
+//   10 to 16 milliseconds) is plenty for telling long-lived blocks apart from
+//   short-lived ones.
+//
+//  Note: The caller must hold the map lock.
+//
+//  Return Value:
+//
+//    Returns the number of milliseconds elapsed since the system was started.
+//
+ULONGLONG VisualLeakDetector::gettimestamp ()
+{
+    DWORD tick = gettickcount();
+
+    if (tick < m_lasttick) {
+        // The tick count has wrapped around since the last timestamp.
+        m_tickwraps++;
+    }
+    m_lasttick = tick;
+
+    return ((ULONGLONG)m_tickwraps << 32) | tick;
+}
+
+// gettls - Obtains the thread local storage structure for the calling thread.
+//
+//  Return Value:
+//
+//    Returns a pointer to the thread local storage structure. (This function
+//    always succeeds).
+//
+tls_t* VisualLeakDetector::gettls ()
+{
+    tls_t *tls;
+    
+    // Get the pointer to this thread's thread local storage structure.
+    tls = (tls_t*)tlsgetvalue(m_tlsindex);
+
+    if (tls == NULL) {
+        // This thread's thread local storage structure has not been allocated.
+        tls = new tls_t;
+        tlssetvalue(m_tlsindex, tls);
+        tls->addrfp = 0x0;
+        tls->allocs = 0;
+        tls->flags = 0x0;
+        tls->frees = 0;
+        tls->heldcount = 0;
+        tls->heldflushed = 0;
+        tls->modules = NULL;
+        tls->ranges = NULL;
+        tls->reallocs = 0;
+        tls->replaystack = NULL;
+        tls->stackwalks = 0;
+        tls->threadid = currentthreadid();
+        tls->time = 0;
+        tls->tracebuffer = NULL;
+        tls->untracked = 0;
+
+        // Add this thread's TLS to the TlsSet.
+        enterlock(&m_tlslock);
+        m_tlsset->insert(tls);
+        leavelock(&m_tlslock);
+    }
+
+    return tls;
+}
+
+// getuserblock - Locates the user data portion of a mapped memory block. Blocks
+//   allocated from a CRT heap have a CRT memory block header prepended to them.
+//   The CRT header is more or less transparent to the user, so the information
+//   about the contained block will probably be more useful to the user.
+//
+//   Note: The caller must hold the map lock, to guarantee that the block is not
+//     freed while its header is being inspected.
+//
+//  - heapinfo (IN): Pointer to the information for the heap from which the
+//      block was allocated.
+//
+//  - block (IN): Pointer to the memory block, as mapped in the block map.
+//
+//  - size (IN): Size, in bytes, of the memory block, as mapped in the block
+//      map.
+//
+//  - address (OUT): Receives the address of the user data portion of the
+//      block.
+//
+//  - usersize (OUT): Receives the size, in bytes, of the user data portion of
+//      the block.
+//
+//  Return Value:
+//
+//    Returns FALSE if the block is used internally by the CRT, or is tagged to
+//    be ignored, in which case it should not be considered to be a memory leak.
+//    Otherwise returns TRUE.
+//
+BOOL VisualLeakDetector::getuserblock (const heapinfo_t *heapinfo, LPCVOID block, SIZE_T size, LPCVOID *address,
+                                       SIZE_T *usersize)
+{
+    *address = block;
+    *usersize = size;
+    if (heapinfo->flags & VLD_HEAP_CRT) {
+        // This block is allocated to a CRT heap, so the block has a CRT
+        // memory block header prepended to it. Blocks allocated through the
+        // debug CRT's patched functions were already classified when they were
+        // allocated (see "__malloc_dbg"), but the CRT also allocates blocks
+        // internally, without going through any import.
+        return getcrtuserblock(block, address, usersize);
+    }
+
+    return TRUE;
+}
+
+// insertblock - Inserts a newly allocated block's information into its heap's
+//   block map, and links it at the end of the heap's list of blocks.
+//
+//   Note: The caller must hold the map lock.
+//
+//  - heapinfo (IN): Pointer to the information for the heap from which the
+//      block was allocated.
+//
+//  - info (IN): Pointer to the block's information.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::insertblock (heapinfo_t *heapinfo, blockinfo_t *info)
+{
+    BlockMap::Iterator  blockit;
+    BlockMap           *blockmap = &heapinfo->blockmap;
+
+    blockit = blockmap->insert(info->address, info);
+    if (blockit == blockmap->end()) {
+        // A block with this address has already been allocated. Another
+        // thread may have freed it, and held back the free.
+        drainfrees();
+        blockit = blockmap->insert(info->address, info);
+    }
+    if (blockit == blockmap->end()) {
+        // The previously allocated block must have been freed (probably by
+        // some mechanism unknown to VLD), or the heap wouldn't have allocated
+        // it again. Replace the previously allocated info with the new info.
+        blockit = blockmap->find(info->address);
+        unlinkblock(heapinfo, (*blockit).second);
+        retireblock((*blockit).second);
+        blockmap->erase(blockit);
+        blockmap->insert(info->address, info);
+    }
+    linkblock(heapinfo, info);
+}
+
+// internstack - Interns a call stack in the stack depot. If an identical call
+//   stack has already been interned, the existing one is used instead.
+//
+//   Note: The caller must hold the map lock.
+//
+//  - callstack (IN): The call stack to intern. If an identical call stack has
+//      not already been interned, the stack depot takes ownership of it.
+//      Otherwise, the caller remains responsible for freeing it.
+//
+//  Return Value:
+//
+//    Returns a pointer to the interned call stack's information. If the
+//    "callstack" member of the returned structure differs from the specified
+//    call stack, then the caller must free the specified call stack.
+//
+stackinfo_t* VisualLeakDetector::internstack (CallStack *callstack)
+{
+    SIZE_T              hash;
+    stackinfo_t        *stack;
+    StackMap::Iterator  stackit;
+
+    stack = findstack(callstack);
+    if (stack != NULL) {
+        // This call stack has already been interned.
+        return stack;
+    }
+
+    // This is the first block allocated from this call stack.
+    hash = callstack->hash();
+    stackit = m_stackmap->find(hash);
+    stack = new stackinfo_t;
+    stack->allocs = 0;
+    stack->bytes = 0;
+    stack->callstack = callstack;
+    stack->count = 0;
+    stack->frees = 0;
+    stack->growth = 0;
+    stack->next = NULL;
+    stack->reportedcount = 0;
+    stack->samplebytes = 0;
+    stack->samplecount = 0;
+    stack->suppression = VLD_SUPPRESSION_UNCHECKED;
+    stack->traceid = 0;
+    if (m_tracewriter != NULL) {
+        // Write the call stack to the trace file, so that events can refer to
+        // it by ID.
+        m_tracestacks++;
+        stack->traceid = m_tracestacks;
+        m_tracewriter->writestack(stack->traceid, callstack);
+    }
+    if (stackit != m_stackmap->end()) {
+        // Another call stack has the same hash value. Chain this one after it.
+        stack->next = (*stackit).second->next;
+        (*stackit).second->next = stack;
+    }
+    else {
+        m_stackmap->insert(hash, stack);
+    }
+
+    return stack;
+}
+
+// linkblock - Links a block's information at the end of its heap's list of
+//   blocks, which is kept in order of serial number. The block is also
+//   accounted for in its call site's and its heap's statistics.
+//
+//   Note: The caller must hold the map lock.
+//
+//  - heapinfo (IN): Pointer to the information for the heap from which the
+//      block was allocated.
+//
+//  - info (IN): Pointer to the block's information.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::linkblock (heapinfo_t *heapinfo, blockinfo_t *info)
+{
+    // Account for the block in its call site's statistics.
+    info->stack->allocs++;
+    info->stack->bytes += info->size;
+    info->stack->count++;
+
+    // Account for the block in its heap's statistics.
+    heapinfo->allocs++;
+    heapinfo->bytes += info->size;
+    if (heapinfo->bytes > heapinfo->peakbytes) {
+        heapinfo->peakbytes = heapinfo->bytes;
+    }
+    m_livebytes += info->size;
+    if (m_livebytes > m_peakbytes) {
+        m_peakbytes = m_livebytes;
+    }
+
+    // Let the block's free be looked up in the block map.
+    m_blockfilter.insert(info->address);
+
+    info->next = NULL;
+    info->prev = heapinfo->newest;
+    if (heapinfo->newest != NULL) {
+        heapinfo->newest->next = info;
+    }
+    else {
+        heapinfo->oldest = info;
+    }
+    heapinfo->newest = info;
+}
+
+// mapblock - Tracks memory allocations. Information about allocated blocks is
+//   collected and then the block is mapped to this information.
+//
+//  - heap (IN): Handle to the heap from which the block has been allocated.
+//
+//  - mem (IN): Pointer to the memory block being allocated.
+//
+//  - size (IN): Size, in bytes, of the memory block being allocated.
+//
+//  - framepointer (IN): Framepointer at the time this allocation first entered
+//      VLD's code. This is used from determining the starting point for the
+//      stack trace.
+//
+//  - crtalloc (IN): Should be set to TRUE if this allocation is a CRT memory
+//      block. Otherwise should be FALSE.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::mapblock (HANDLE heap, LPCVOID mem, SIZE_T size, SIZE_T framepointer, BOOL crtalloc)
+{
+    blockinfo_t        *blockinfo;
+    CallStack          *callstack;
+    heapinfo_t         *heapinfo;
+    HeapMap::Iterator   heapit;
+    tls_t              *tls = gettls();
+
+    addcounter(&tls->allocs, (SIZE_T)1);
+    if (m_maxinternalmemory != 0) {
+        checkbudget();
+        if (readcounter(&m_degradation) == VLD_DEGRADE_COUNT) {
+            // Don't track the block. Just count the allocation against its
+            // call site.
+            countblock(framepointer);
+            return;
+        }
+        if ((readcounter(&m_degradation) == VLD_DEGRADE_SAMPLE) &&
+            (((ULONG)InterlockedIncrement(&m_sampleallocs) % VLD_DEGRADED_SAMPLE_INTERVAL) != 0)) {
+            // Only a sample of the blocks is tracked. This isn't one of them.
+            // The allocations of all threads are counted together, so that
+            // threads that rarely allocate are sampled too.
+            addcounter(&tls->untracked, (SIZE_T)1);
+            return;
+        }
+    }
+
+    // Record the block's information.
+    blockinfo = new blockinfo_t;
+    blockinfo->address = mem;
+    blockinfo->size = size;
+    callstack = tracecallstack(framepointer);
+
+    // Insert the block's information into the block map. The serial number is
+    // assigned while holding the lock, so that each heap's list of blocks stays
+    // in order of serial number. The frees this thread has held back are
+    // unmapped first, while the lock is held anyway.
+    enterlock(&m_maplock);
+    releasefrees(tls);
+    blockinfo->serialnumber = m_serialnumber;
+    addcounter(&m_serialnumber, (SIZE_T)1);
+    blockinfo->stack = internstack(callstack);
+    blockinfo->timestamp = gettimestamp();
+    heapit = m_heapmap->find(heap);
+    if (heapit == m_heapmap->end()) {
+        // We haven't mapped this heap to a block map yet. Do it now.
+        mapheap(heap);
+        heapit = m_heapmap->find(heap);
+        assert(heapit != m_heapmap->end());
+    }
+    heapinfo = (*heapit).second;
+    if (crtalloc == TRUE) {
+        // The heap that this block was allocated from is a CRT heap.
+        heapinfo->flags |= VLD_HEAP_CRT;
+    }
+    insertblock(heapinfo, blockinfo);
+    leavelock(&m_maplock);
+
+    traceevent(tls, TRACE_EVENT_ALLOC | (crtalloc ? TRACE_EVENT_CRT : 0x0), heap, mem, size, blockinfo->stack);
+    if (blockinfo->stack->callstack != callstack) {
+        // An identical call stack was already interned. This one is redundant.
+        delete callstack;
+    }
+}
+
+// mapblocks - Tracks a batch of memory allocations made from the same call
+//   site, such as the blocks a memory pool carves out of a newly allocated
+//   chunk. The call stack is traced only once for the whole batch, and the map
+//   lock is acquired only once, so mapping the batch costs much less than
+//   mapping each block individually.
+//
+//  - heap (IN): Handle to the heap from which the blocks have been allocated.
+//
+//  - mems (IN): Array of pointers to the memory blocks being allocated.
+//
+//  - count (IN): Number of elements in the "mems" array.
+//
+//  - size (IN): Size, in bytes, of each memory block.
+//
+//  - framepointer (IN): Framepointer at the time these allocations first
+//      entered VLD's code. This is used from determining the starting point for
+//      the stack trace.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::mapblocks (HANDLE heap, LPCVOID const *mems, SIZE_T count, SIZE_T size, SIZE_T framepointer)
+{
+    CallStack          *callstack;
+    heapinfo_t         *heapinfo;
+    HeapMap::Iterator   heapit;
+    SIZE_T              index;
+    blockinfo_t       **infos;
+    stackinfo_t        *stack;
+    ULONGLONG           timestamp;
+    tls_t              *tls = gettls();
+
+    if (count == 0) {
+        return;
+    }
+    if (m_maxinternalmemory != 0) {
+        checkbudget();
+        if (readcounter(&m_degradation) >= VLD_DEGRADE_SAMPLE) {
+            // Only some of the blocks, if any, are tracked. Leave it to
+            // "mapblock" to decide which ones.
+            for (index = 0; index < count; index++) {
+                mapblock(heap, mems[index], size, framepointer, FALSE);
+            }
+            return;
+        }
+    }
+    addcounter(&tls->allocs, count);
+
+    // Record the blocks' information, and trace the call stack they share,
+    // before acquiring the map lock.
+    infos = new blockinfo_t* [count];
+    for (index = 0; index < count; index++) {
+        infos[index] = new blockinfo_t;
+        infos[index]->address = mems[index];
+        infos[index]->size = size;
+    }
+    callstack = tracecallstack(framepointer);
+
+    enterlock(&m_maplock);
+    releasefrees(tls);
+    stack = internstack(callstack);
+    heapit = m_heapmap->find(heap);
+    if (heapit == m_heapmap->end()) {
+        // We haven't mapped this heap to a block map yet. Do it now.
+        mapheap(heap);
+        heapit = m_heapmap->find(heap);
+        assert(heapit != m_heapmap->end());
+    }
+    heapinfo = (*heapit).second;
+    timestamp = gettimestamp();
+    for (index = 0; index < count; index++) {
+        infos[index]->serialnumber = m_serialnumber;
+        addcounter(&m_serialnumber, (SIZE_T)1);
+        infos[index]->stack = stack;
+        infos[index]->timestamp = timestamp;
+        insertblock(heapinfo, infos[index]);
+    }
+    leavelock(&m_maplock);
+
+    for (index = 0; index < count; index++) {
+        traceevent(tls, TRACE_EVENT_ALLOC, heap, mems[index], size, stack);
+    }
+
+    if (stack->callstack != callstack) {
+        // An identical call stack was already interned. This one is redundant.
+        delete callstack;
+    }
+    delete [] infos;
+}
+
+// mapblocksfrom - Tracks a batch of memory allocations whose call stacks can no
+//   longer be traced, such as the blocks a custom allocator collected in a
+//   buffer before handing them to VLD. Each block's call stack consists of a
+//   single frame: the address its caller was returned to. The blocks that were
+//   allocated in a row by the same caller are mapped together (see
+//   "mapblocks").
+//
+//  - heap (IN): Handle to the heap from which the blocks have been allocated.
+//
+//  - mems (IN): Array of pointers to the memory blocks being allocated.
+//
+//  - callers (IN): Array of the addresses the blocks' callers were returned
+//      to, one for each element of the "mems" array.
+//
+//  - count (IN): Number of elements in the "mems" and "callers" arrays.
+//
+//  - size (IN): Size, in bytes, of each memory block.
+//
+//  - framepointer (IN): Framepointer at the time these allocations first
+//      entered VLD's code.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::mapblocksfrom (HANDLE heap, LPCVOID const *mems, LPCVOID const *callers, SIZE_T count,
+                                        SIZE_T size, SIZE_T framepointer)
+{
+    FastCallStack    callstack;
+    SIZE_T           first;
+    SIZE_T           last;
+    const CallStack *replaystack;
+    tls_t           *tls = gettls();
+
+    // The call stack is handed to "tracecallstack" as if the blocks were being
+    // replayed from a trace, so that it is recorded in place of a stack trace
+    // however the blocks end up being tracked.
+    replaystack = tls->replaystack;
+    for (first = 0; first < count; first = last) {
+        last = first + 1;
+        while ((last < count) && (callers[last] == callers[first])) {
+            last++;
+        }
+        callstack.clear();
+        callstack.push_back((SIZE_T)callers[first]);
+        tls->replaystack = &callstack;
+        mapblocks(heap, &mems[first], last - first, size, framepointer);
+    }
+    tls->replaystack = replaystack;
+}
+
+// mapheap - Tracks heap creation. Creates a block map for tracking individual
+//   allocations from the newly created heap and then maps the heap to this
+//   block map.
+//
+//  - heap (IN): Handle to the newly created heap.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::mapheap (HANDLE heap)
+{
+    heapinfo_t        *heapinfo;
+    HeapMap::Iterator  heapit;
+
+    // Create a new block map for this heap and insert it into the heap map.
+    heapinfo = new heapinfo_t;
+    heapinfo->allocs = 0;
+    heapinfo->blockmap.reserve(BLOCKMAPRESERVE);
+    heapinfo->bytes = 0;
+    heapinfo->flags = 0x0;
+    heapinfo->frees = 0;
+    heapinfo->newest = NULL;
+    heapinfo->oldest = NULL;
+    heapinfo->peakbytes = 0;
+    enterlock(&m_maplock);
+    heapit = m_heapmap->insert(heap, heapinfo);
+    if (heapit == m_heapmap->end()) {
+        // Somehow this heap has been created twice without being destroyed,
+        // or at least it was destroyed without VLD's knowledge. Unmap the heap
+        // from the existing heapinfo, and remap it to the new one.
+        report(L"WARNING: Visual Leak Detector detected a duplicate heap (" ADDRESSFORMAT L").\n", heap);
+        heapit = m_heapmap->find(heap);
+        unmapheap((*heapit).first);
+        m_heapmap->insert(heap, heapinfo);
+    }
+    leavelock(&m_maplock);
+}
+
+// pruneranges - Removes the ranges of code of the modules that have been
+//   unloaded from one of the tables of ranges, so that the code of modules
+//   later loaded at the same addresses isn't mistaken for the functions that
+//   were there before.
+//
+//  - table (IN/OUT): Pointer to the table to be pruned. Receives the new table,
+//      if any ranges were removed.
+//
+//  - unloaded (IN): The modules that have been unloaded.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::pruneranges (RangeTable **table, const ModuleSet *unloaded)
+{
+    SIZE_T          count = 0;
+    SIZE_T          index;
+    moduleinfo_t    moduleinfo;
+    addressrange_t *ranges;
+
+    enterlock(&m_moduleslock);
+    if (*table == NULL) {
+        leavelock(&m_moduleslock);
+        return;
+    }
+    ranges = new addressrange_t [(*table)->size()];
+    for (index = 0; index < (*table)->size(); index++) {
+        moduleinfo.addrhigh = (**table)[index].low;
+        moduleinfo.addrlow = (**table)[index].low;
+        if (unloaded->find(moduleinfo) == unloaded->end()) {
+            // The module is still loaded.
+            ranges[count++] = (**table)[index];
+        }
+    }
+    if (count != (*table)->size()) {
+        setranges(table, (count != 0) ? new RangeTable(NULL, ranges, count) : NULL);
+    }
+    leavelock(&m_moduleslock);
+    delete [] ranges;
+}
+
+// releasefrees - Unmaps the frees the calling thread has held back (see
+//   "unmapblock"), and empties its buffer of held back frees.
+//
+//   Note: The caller must hold the map lock.
+//
+//  - tls (IN): Pointer to the calling thread's thread local storage structure.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::releasefrees (tls_t *tls)
+{
+    if (tls->heldcount != 0) {
+        flushfrees(tls);
+        tls->heldflushed = 0;
+        publishcounter(&tls->heldcount, (SIZE_T)0);
+    }
+}
+
+// releaseranges - Tells that the calling thread is done searching the table of
+//   ranges it obtained from "acquireranges", which may then be freed.
+//
+//  - tls (IN): Pointer to the calling thread's thread local storage structure.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::releaseranges (tls_t *tls)
+{
+    publishcounter(&tls->ranges, (const RangeTable*)NULL);
+}
+
+// remapblock - Tracks reallocations. Unmaps a block from its previously
+//   collected information and remaps it to updated information.
+//
+//  Note: If the block itself remains at the same address, then the block's
+//   information can simply be updated rather than having to actually erase and
+//   reinsert the block.
+//
+//  - heap (IN): Handle to the heap from which the memory is being reallocated.
+//
+//  - mem (IN): Pointer to the memory block being reallocated.
+//
+//  - newmem (IN): Pointer to the memory block being returned to the caller
+//      that requested the reallocation. This pointer may or may not be the same
+//      as the original memory block (as pointed to by "mem").
+//
+//  - size (IN): Size, in bytes, of the new memory block.
+//
+//  - framepointer (IN): The frame pointer at which this reallocation entered
+//      VLD's code. Used for determining the starting point of the stack trace.
+//
+//  - crtalloc (IN): Should be set to TRUE if this reallocation is for a CRT
+//      memory block. Otherwise should be set to FALSE.
+//
+//  - checkpoint (IN): The serial number to be assigned to the next allocated
+//      block, as of just before the block was reallocated (see "unmapblock").
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::remapblock (HANDLE heap, LPCVOID mem, LPCVOID newmem, SIZE_T size, SIZE_T framepointer,
+                                     BOOL crtalloc, SIZE_T checkpoint)
+{
+    BlockMap::Iterator   blockit;
+    BlockMap            *blockmap;
+    CallStack           *callstack;
+    heapinfo_t          *heapinfo;
+    HeapMap::Iterator    heapit;
+    blockinfo_t         *info;
+    blockinfo_t         *newinfo;
+    tls_t               *tls = gettls();
+
+    addcounter(&tls->reallocs, (SIZE_T)1);
+    if (newmem != mem) {
+        // The block was not reallocated in-place. Instead the old block was
+        // freed and a new block allocated to satisfy the new size.
+        unmapblock(heap, mem, checkpoint);
+        mapblock(heap, newmem, size, framepointer, crtalloc);
+        return;
+    }
+
+    // The block was reallocated in-place. Trace the new call stack before
+    // acquiring the map lock, so that the lock is only held briefly.
+    newinfo = new blockinfo_t;
+    newinfo->address = mem;
+    newinfo->size = size;
+    callstack = tracecallstack(framepointer);
+
+    // Find the existing blockinfo_t entry in the block map and update it with
+    // the new callstack and size.
+    enterlock(&m_maplock);
+    releasefrees(tls);
+    heapit = m_heapmap->find(heap);
+    if (heapit == m_heapmap->end()) {
+        // We haven't mapped this heap to a block map yet. Obviously the
+        // block has also not been mapped to a blockinfo_t entry yet either,
+        // so treat this reallocation as a brand-new allocation (this will
+        // also map the heap to a new block map).
+        leavelock(&m_maplock);
+        delete callstack;
+        delete newinfo;
+        mapblock(heap, newmem, size, framepointer, crtalloc);
+        return;
+    }
+
+    // Find the block's blockinfo_t structure so that we can update it.
+    blockmap = &(*heapit).second->blockmap;
+    blockit = blockmap->find(mem);
+    if (blockit == blockmap->end()) {
+        // The block hasn't been mapped to a blockinfo_t entry yet.
+        // Treat this reallocation as a new allocation.
+        leavelock(&m_maplock);
+        delete callstack;
+        delete newinfo;
+        mapblock(heap, newmem, size, framepointer, crtalloc);
+        return;
+    }
+
+    // Found the blockinfo_t entry for this block. The existing entry may be
+    // referenced by outstanding snapshots, so it must not be modified. Replace
+    // it with the new entry (which keeps the block's serial number and time of
+    // allocation, and its place in the heap's list of blocks) and retire the
+    // existing one.
+    heapinfo = (*heapit).second;
+    info = (*blockit).second;
+    newinfo->serialnumber = info->serialnumber;
+    newinfo->stack = internstack(callstack);
+    newinfo->timestamp = info->timestamp;
+    // As far as the call site statistics are concerned, the existing block
+    // was freed and the new block was allocated.
+    info->stack->bytes -= info->size;
+    info->stack->count--;
+    info->stack->frees++;
+    newinfo->stack->allocs++;
+    newinfo->stack->bytes += newinfo->size;
+    newinfo->stack->count++;
+    // The heap's statistics only see the block change size.
+    heapinfo->bytes += newinfo->size - info->size;
+    if (heapinfo->bytes > heapinfo->peakbytes) {
+        heapinfo->peakbytes = heapinfo->bytes;
+    }
+    m_livebytes += newinfo->size - info->size;
+    if (m_livebytes > m_peakbytes) {
+        m_peakbytes = m_livebytes;
+    }
+    newinfo->next = info->next;
+    newinfo->prev = info->prev;
+    if (info->next != NULL) {
+        info->next->prev = newinfo;
+    }
+    else {
+        heapinfo->newest = newinfo;
+    }
+    if (info->prev != NULL) {
+        info->prev->next = newinfo;
+    }
+    else {
+        heapinfo->oldest = newinfo;
+    }
+    blockmap->erase(blockit);
+    blockmap->insert(mem, newinfo);
+    retireblock(info);
+    if (crtalloc) {
+        // The heap that this block was allocated from is a CRT heap.
+        heapinfo->flags |= VLD_HEAP_CRT;
+    }
+    leavelock(&m_maplock);
+
+    traceevent(tls, TRACE_EVENT_REALLOC | (crtalloc ? TRACE_EVENT_CRT : 0x0), heap, mem, size, newinfo->stack);
+    if (newinfo->stack->callstack != callstack) {
+        // An identical call stack was already interned. This one is redundant.
+        delete callstack;
+    }
+}
+
+// reportconfig - Generates a brief report summarizing Visual Leak Detector's
+//   configuration, as loaded from the vld.ini file.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::reportconfig ()
+{
+    if (m_options & VLD_OPT_AGGREGATE_DUPLICATES) {
+        report(L"    Aggregating duplicate leaks.\n");
+    }
+    if (m_options & VLD_OPT_CLASSIFY_LEAKS) {
+        report(L"    Classifying leaks by scanning memory for references to them.\n");
+    }
+    if (wcslen(m_excludedfunctionlist) != 0) {
+        report(L"    Excluding allocations by these functions from leak detection: %s\n", m_excludedfunctionlist);
+    }
+    if (wcslen(m_forcedfunctionlist) != 0) {
+        report(L"    Forcing inclusion of allocations by these functions in leak detection: %s\n",
+               m_forcedfunctionlist);
+    }
+    if (wcslen(m_forcedmodulelist) != 0) {
+        report(L"    Forcing inclusion of these modules in leak detection: %s\n", m_forcedmodulelist);
+    }
+    if (m_maxdatadump != VLD_DEFAULT_MAX_DATA_DUMP) {
+        if (m_maxdatadump == 0) {
+            report(L"    Suppressing data dumps.\n");
+        }
+        else {
+            report(L"    Limiting data dumps to %lu bytes.\n", m_maxdatadump);
+        }
+    }
+    if (m_maxinternalmemory != 0) {
+        report(L"    Limiting internal memory use to %lu KB.\n", m_maxinternalmemory / 1024);
+    }
+    if (m_maxtraceframes != VLD_DEFAULT_MAX_TRACE_FRAMES) {
+        report(L"    Limiting stack traces to %u frames.\n", m_maxtraceframes);
+    }
+    if (m_monitorinterval != 0) {
+        report(L"    Monitoring leak growth every %u ms, flagging growth over %u consecutive intervals.\n",
+               m_monitorinterval, m_monitorgrowth);
+        if (m_options & VLD_OPT_MONITOR_STATS) {
+            report(L"    Reporting statistics every %u ms.\n", m_monitorinterval);
+        }
+    }
+    if (m_options & VLD_OPT_UNICODE_REPORT) {
+        report(L"    Generating a Unicode (UTF-16) encoded report.\n");
+    }
+    if (m_options & VLD_OPT_REPORT_TO_FILE) {
+        if (m_options & VLD_OPT_REPORT_TO_DEBUGGER) {
+            report(L"    Outputting the report to the debugger and to %s\n", m_reportfilepath);
+        }
+        else {
+            report(L"    Outputting the report to %s\n", m_reportfilepath);
+        }
+    }
+    if (m_options & VLD_OPT_SLOW_DEBUGGER_DUMP) {
+        report(L"    Outputting the report to the debugger at a slower rate.\n");
+    }
+    if (m_options & VLD_OPT_REPORT_SITES) {
+        report(L"    Reporting outstanding memory by call site.\n");
+    }
+    if (m_options & VLD_OPT_SAFE_STACK_WALK) {
+        report(L"    Using the \"safe\" (but slow) stack walking method.\n");
+    }
+    if (m_options & VLD_OPT_SELF_TEST) {
+        report(L"    Perfoming a memory leak self-test.\n");
+    }
+    if (m_options & VLD_OPT_START_DISABLED) {
+        report(L"    Starting with memory leak detection disabled.\n");
+    }
+    if (m_suppressions != NULL) {
+        report(L"    Suppressing leaks that match the %lu signatures in %s\n", m_suppressions->size(),
+               m_suppressionfilepath);
+    }
+    if (m_options & VLD_OPT_TRACE_INTERNAL_FRAMES) {
+        report(L"    Including heap and VLD internal frames in stack traces.\n");
+    }
+    if (m_tracewriter != NULL) {
+        report(L"    Recording a trace of allocations and frees in %s\n", m_tracefilepath);
+    }
+}
+
+// reportgrowth - Samples the statistics of every call site and reports the
+//   call sites whose number of outstanding blocks has grown over the configured
+//   number of consecutive monitor intervals. Each report is incremental: it
+//   shows how much the call site has grown since it was last reported. Called
+//   once per interval by the leak growth monitor thread.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::reportgrowth ()
+{
+    SIZE_T               count = 0;
+    stackinfo_t        **flagged;
+    SIZE_T               index;
+    stackinfo_t         *stack;
+    StackMap::Iterator   stackit;
+    SIZE_T               total = 0;
+
+    // Sample the call site statistics. Only the monitor thread uses the sample
+    // fields, and interned call stacks are never freed, so the flagged call
+    // sites can be reported after the lock has been released.
+    enterlock(&m_maplock);
+    drainfrees();
+    for (stackit = m_stackmap->begin(); stackit != m_stackmap->end(); ++stackit) {
+        for (stack = (*stackit).second; stack != NULL; stack = stack->next) {
+            total++;
+        }
+    }
+    if (total == 0) {
+        leavelock(&m_maplock);
+        return;
+    }
+    flagged = new stackinfo_t* [total];
+    for (stackit = m_stackmap->begin(); stackit != m_stackmap->end(); ++stackit) {
+        for (stack = (*stackit).second; stack != NULL; stack = stack->next) {
+            if (stack->count > stack->samplecount) {
+                stack->growth++;
+            }
+            else {
+                // The call site didn't grow. Start over.
+                stack->growth = 0;
+                stack->reportedcount = stack->count;
+            }
+            stack->samplebytes = stack->bytes;
+            stack->samplecount = stack->count;
+            if ((stack->growth >= m_monitorgrowth) && (stack->samplecount > stack->reportedcount)) {
+                flagged[count++] = stack;
+            }
+        }
+    }
+    leavelock(&m_maplock);
+
+    for (index = 0; index < count; index++) {
+        stack = flagged[index];
+        report(L"Visual Leak Detector: Outstanding blocks have grown over %u consecutive intervals at this call site.\n",
+               stack->growth);
+        report(L"---------- %lu blocks (%lu new) totalling %lu bytes ----------\n", stack->samplecount,
+               stack->samplecount - stack->reportedcount, stack->samplebytes);
+        report(L"  Call Stack:\n");
+        stack->callstack->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES);
+        report(L"\n");
+        stack->reportedcount = stack->samplecount;
+    }
+    delete [] flagged;
+}
+
+// reportleaks - Generates a memory leak report for the specified heap.
+//
+//   Note: The contents of the leaked blocks are dumped after the map lock has
+//     been released. This is only safe because the report is generated either
+//     when the heap is being destroyed, or when the process is exiting and all
+//     other threads have terminated, so no leaked block can be freed while its
+//     contents are being dumped.
+//
+//  - heap (IN): Handle to the heap for which to generate a memory leak
+//      report. If NULL, a single report is generated for all heaps.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::reportleaks (HANDLE heap)
+{
+    SIZE_T     index;
+    SIZE_T     leaks = 0;
+    snapshot_t snapshot;
+
+    if ((heap == NULL) && (m_options & VLD_OPT_CLASSIFY_LEAKS)) {
+        // Classifying the blocks requires scanning all of them, so it's only
+        // done for the final report of all heaps. Every block in a heap that
+        // is being destroyed is lost anyway. The process is exiting, so the
+        // scan can't be done in parallel: no new threads can be started.
+        takeclassifiedsnapshot(&snapshot, FALSE);
+    }
+    else {
+        takesnapshot(&snapshot, heap, 0);
+    }
+    for (index = 0; index < snapshot.count; index++) {
+        if (!(snapshot.entries[index].flags & VLD_SNAPSHOT_REACHABLE) &&
+            !suppressedstack(snapshot.entries[index].info->stack)) {
+            leaks++;
+        }
+    }
+    if ((leaks != 0) && (m_leaksfound == 0)) {
+        report(L"WARNING: Visual Leak Detector detected memory leaks!\n");
+    }
+    m_leaksfound += reportsnapshot(&snapshot, TRUE);
+    freesnapshot(&snapshot);
+}
+
+// reportoutstanding - Generates a report of memory blocks that are currently
+//   outstanding, while the program is still running. The block maps are locked
+//   only for as long as it takes to capture a snapshot of them. The report is
+//   then generated from the snapshot after the lock has been released, so other
+//   threads are free to allocate and free memory while the report is being
+//   symbolized and formatted.
+//
+//   If leaks are being classified, the lock is instead held until every block
+//   has been scanned, and other threads are briefly suspended. The scan is
+//   done in parallel, by one thread per processor.
+//
+//  - since (IN): Only blocks with serial numbers greater than or equal to this
+//      checkpoint (i.e. blocks allocated after the checkpoint was marked) are
+//      reported. If zero, all outstanding blocks are reported.
+//
+//  - minage (IN): Only blocks that have been outstanding for at least this
+//      many milliseconds are reported. If zero, blocks are reported regardless
+//      of their age.
+//
+//  Return Value:
+//
+//    Returns the number of outstanding memory blocks that were reported.
+//
+SIZE_T VisualLeakDetector::reportoutstanding (SIZE_T since, SIZE_T minage)
+{
+    SIZE_T       count = 0;
+    SIZE_T       index;
+    blockinfo_t *info;
+    SIZE_T       leaks;
+    ULONGLONG    now;
+    snapshot_t   snapshot;
+
+    if (m_options & VLD_OPT_CLASSIFY_LEAKS) {
+        // Blocks allocated since the checkpoint may only be referenced from
+        // older blocks, so all blocks must be classified. Then only those
+        // allocated since the checkpoint are kept.
+        takeclassifiedsnapshot(&snapshot, TRUE);
+    }
+    else {
+        takesnapshot(&snapshot, NULL, since);
+    }
+    enterlock(&m_maplock);
+    now = gettimestamp();
+    leavelock(&m_maplock);
+    for (index = 0; index < snapshot.count; index++) {
+        info = snapshot.entries[index].info;
+        if ((info->serialnumber >= since) && ((now - info->timestamp) >= minage)) {
+            snapshot.entries[count++] = snapshot.entries[index];
+        }
+    }
+    snapshot.count = count;
+    if (minage != 0) {
+        report(L"Visual Leak Detector: Reporting memory blocks outstanding for at least %lu milliseconds.\n", minage);
+    }
+    else if (since == 0) {
+        report(L"Visual Leak Detector: Reporting memory blocks outstanding at runtime.\n");
+    }
+    else {
+        report(L"Visual Leak Detector: Reporting memory blocks allocated since checkpoint %lu and still outstanding.\n",
+               since);
+    }
+    leaks = reportsnapshot(&snapshot, FALSE);
+    freesnapshot(&snapshot);
+
+    // Show a summary.
+    if (leaks == 0) {
+        report(L"No memory leaks detected so far.\n");
+    }
+    else {
+        report(L"Visual Leak Detector found %lu outstanding memory block", leaks);
+        report((leaks > 1) ? L"s.\n" : L".\n");
+    }
+
+    return leaks;
+}
+
+// reportages - Generates a report of the ages of the blocks outstanding at each
+//   call site from which blocks have been allocated. The blocks of each call
+//   site are tallied in a histogram of ages. Call sites whose oldest blocks
+//   have been outstanding the longest are reported first. Call sites that keep
+//   accumulating old blocks are likely to be leaking slowly, whereas call sites
+//   whose blocks are all young are likely to be caches or working sets.
+//
+//  Return Value:
+//
+//    Returns the number of call sites reported.
+//
+SIZE_T VisualLeakDetector::reportages ()
+{
+    ULONGLONG        age;
+    siteages_t      *ages = NULL;
+    SIZE_T           bucket;
+    SIZE_T           bytes = 0;
+    snapshotentry_t *entry;
+    SIZE_T           index;
+    ULONGLONG        now;
+    siteages_t      *site = NULL;
+    SIZE_T           sites = 0;
+    snapshot_t       snapshot;
+
+    takesnapshot(&snapshot, NULL, 0);
+    enterlock(&m_maplock);
+    now = gettimestamp();
+    leavelock(&m_maplock);
+
+    // Group the blocks by call site, then tally each call site's blocks.
+    if (snapshot.count != 0) {
+        qsort(snapshot.entries, snapshot.count, sizeof(snapshotentry_t), compareentrysites);
+        ages = new siteages_t [snapshot.count];
+    }
+    for (index = 0; index < snapshot.count; index++) {
+        entry = &snapshot.entries[index];
+        if ((site == NULL) || (site->stack != entry->info->stack)) {
+            site = &ages[sites++];
+            memset(site, 0x0, sizeof(siteages_t));
+            site->stack = entry->info->stack;
+        }
+        age = now - entry->info->timestamp;
+        bucket = 0;
+        while ((bucket < VLD_AGE_BUCKETS - 1) && (age >= agelimits[bucket])) {
+            bucket++;
+        }
+        site->bytes += entry->size;
+        site->count++;
+        site->histogram[bucket]++;
+        if (age > site->oldest) {
+            site->oldest = age;
+        }
+    }
+    freesnapshot(&snapshot);
+    qsort(ages, sites, sizeof(siteages_t), comparesiteages);
+
+    report(L"Visual Leak Detector: Reporting the ages of outstanding memory blocks by call site.\n");
+    for (index = 0; index < sites; index++) {
+        site = &ages[index];
+        bytes += site->bytes;
+        report(L"---------- %lu blocks totalling %lu bytes (oldest outstanding for %lu seconds) ----------\n",
+               site->count, site->bytes, (ULONG)(site->oldest / 1000));
+        report(L"  Ages:");
+        for (bucket = 0; bucket < VLD_AGE_BUCKETS; bucket++) {
+            report(L" %s: %lu", agelabels[bucket], site->histogram[bucket]);
+        }
+        report(L"\n");
+        report(L"  Call Stack:\n");
+        site->stack->callstack->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES);
+        report(L"\n");
+    }
+    delete [] ages;
+
+    // Show a summary.
+    report(L"%lu bytes outstanding at %lu call sites.\n", bytes, sites);
+
+    return sites;
+}
+
+// reportsites - Generates a report of the memory outstanding at each call site
+//   from which blocks have been allocated, largest first. Call sites without
+//   any outstanding blocks are not reported.
+//
+//  Return Value:
+//
+//    Returns the number of call sites reported.
+//
+SIZE_T VisualLeakDetector::reportsites ()
+{
+    SIZE_T          bytes = 0;
+    SIZE_T          count;
+    SIZE_T          index;
+    SIZE_T          sites = 0;
+    VLD_SITE_STATS *stats;
+
+    count = getsitestats(&stats);
+    report(L"Visual Leak Detector: Reporting outstanding memory by call site.\n");
+    for (index = 0; (index < count) && (stats[index].count != 0); index++) {
+        sites++;
+        bytes += stats[index].bytes;
+        report(L"---------- %lu blocks totalling %lu bytes (%lu allocated, %lu freed) ----------\n",
+               stats[index].count, stats[index].bytes, stats[index].allocs, stats[index].frees);
+        report(L"  Call Stack:\n");
+        ((stackinfo_t*)stats[index].site)->callstack->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES);
+        report(L"\n");
+    }
+    delete [] stats;
+
+    // Show a summary.
+    report(L"%lu bytes outstanding at %lu of %lu call sites.\n", bytes, sites, count);
+
+    return sites;
+}
+
+// reportsnapshot - Generates a memory leak report for the blocks contained in
+//   a snapshot of the block maps. Leaks whose call stacks match a suppression
+//   are left out before anything about them is symbolized or formatted, so the
+//   cost of the report depends only on the leaks that are actually reported.
+//
+//  - snapshot (IN): Pointer to the snapshot to report. If duplicate leaks are
+//      being aggregated, entries that duplicate earlier entries are flagged as
+//      such. If the snapshot has been classified, blocks that are still
+//      reachable are not reported.
+//
+//  - dumpdata (IN): If TRUE, the contents of each block are dumped. This must
+//      only be set if none of the blocks in the snapshot can possibly have been
+//      freed since the snapshot was captured.
+//
+//  Return Value:
+//
+//    Returns the number of memory leaks reported.
+//
+SIZE_T VisualLeakDetector::reportsnapshot (snapshot_t *snapshot, BOOL dumpdata)
+{
+    LPCWSTR          classification;
+    SIZE_T           definite = 0;
+    SIZE_T           duplicates;
+    snapshotentry_t *entry;
+    SIZE_T           index;
+    SIZE_T           indirect = 0;
+    SIZE_T           leaks = 0;
+    snapshotentry_t *other;
+    SIZE_T           otherindex;
+    SIZE_T           reachable = 0;
+    SIZE_T           suppressed = 0;
+
+    for (index = 0; index < snapshot->count; index++) {
+        entry = &snapshot->entries[index];
+        if (!(entry->flags & VLD_SNAPSHOT_REACHABLE) && suppressedstack(entry->info->stack)) {
+            // This is a known leak. Duplicates of reported leaks share their
+            // call stack, so they are never suppressed.
+            suppressed++;
+            continue;
+        }
+        if (entry->flags & VLD_SNAPSHOT_DEFINITE) {
+            definite++;
+            classification = L" (definitely lost)";
+        }
+        else if (entry->flags & VLD_SNAPSHOT_INDIRECT) {
+            indirect++;
+            classification = L" (indirectly lost)";
+        }
+        else if (entry->flags & VLD_SNAPSHOT_REACHABLE) {
+            // The program still references this block, so it isn't a leak
+            // (yet).
+            reachable++;
+            continue;
+        }
+        else {
+            classification = L"";
+        }
+        if (entry->flags & VLD_SNAPSHOT_DUPLICATE) {
+            // This leak has already been aggregated with an earlier one.
+            continue;
+        }
+        leaks++;
+        report(L"---------- Block %ld at " ADDRESSFORMAT L": %lu bytes%s ----------\n", entry->info->serialnumber,
+               entry->address, (ULONG)entry->size, classification);
+        if (m_options & VLD_OPT_AGGREGATE_DUPLICATES) {
+            // Aggregate all other leaks which are duplicates of this one
+            // under this same heading, to cut down on clutter.
+            duplicates = 0;
+            for (otherindex = index + 1; otherindex < snapshot->count; otherindex++) {
+                other = &snapshot->entries[otherindex];
+                if (!(other->flags & VLD_SNAPSHOT_DUPLICATE) && (other->size == entry->size) &&
+                    (other->info->stack == entry->info->stack) &&
+                    ((other->flags & VLD_SNAPSHOT_CLASSIFICATION) == (entry->flags & VLD_SNAPSHOT_CLASSIFICATION))) {
+                    other->flags |= VLD_SNAPSHOT_DUPLICATE;
+                    duplicates++;
+                }
+            }
+            if (duplicates) {
+                report(L"A total of %lu leaks match this size and call stack. Showing only the first one.\n",
+                       duplicates + 1);
+                leaks += duplicates;
+            }
+        }
+        // Dump the call stack.
+        report(L"  Call Stack:\n");
+        entry->info->stack->callstack->dump(m_options & VLD_OPT_TRACE_INTERNAL_FRAMES);
+        // Dump the data in the user data section of the memory block.
+        if (dumpdata && (m_maxdatadump != 0)) {
+            report(L"  Data:\n");
+            if (m_options & VLD_OPT_UNICODE_REPORT) {
+                dumpmemoryw(entry->address, (m_maxdatadump < entry->size) ? m_maxdatadump : entry->size);
+            }
+            else {
+                dumpmemorya(entry->address, (m_maxdatadump < entry->size) ? m_maxdatadump : entry->size);
+            }
+        }
+        report(L"\n");
+    }
+
+    if (definite + indirect + reachable != 0) {
+        report(L"Of the blocks scanned, %lu were definitely lost, %lu indirectly lost and %lu still reachable"
+               L" (not reported).\n", definite, indirect, reachable);
+    }
+    if (suppressed != 0) {
+        report(L"%lu leaks matched the suppressions (not reported).\n", suppressed);
+    }
+
+    return leaks;
+}
+
+// reportstats - Generates a report of the statistics of the whole process and
+//   of each heap.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::reportstats ()
+{
+    SIZE_T          count;
+    VLD_HEAP_STATS *heapstats;
+    SIZE_T          index;
+    VLD_STATS       stats;
+
+    getstats(&stats);
+    count = getheapstats(&heapstats);
+
+    report(L"Visual Leak Detector: Statistics after %lu seconds:\n", (ULONG)(stats.elapsed / 1000000));
+    report(L"    %lu blocks allocated (%lu per second), %lu freed and %lu reallocated.\n", stats.allocs,
+           (stats.elapsed != 0) ? (ULONG)(((ULONGLONG)stats.allocs * 1000000) / stats.elapsed) : 0,
+           stats.frees, stats.reallocs);
+    report(L"    %lu blocks totalling %lu bytes outstanding in %lu heaps (peak of %lu bytes).\n", stats.blocks,
+           stats.bytes, stats.heaps, stats.peakbytes);
+    for (index = 0; index < count; index++) {
+        report(L"    %s " ADDRESSFORMAT L": %lu blocks totalling %lu bytes outstanding (peak of %lu bytes), %lu"
+               L" allocated and %lu freed.\n", (heapstats[index].heap == VIRTUALHEAP) ? L"Virtual heap" : L"Heap",
+               heapstats[index].heap, heapstats[index].blocks, heapstats[index].bytes, heapstats[index].peakbytes,
+               heapstats[index].allocs, heapstats[index].frees);
+    }
+    // The tracking time is summed over all threads, so it can exceed the
+    // elapsed time when several threads allocate at once.
+    report(L"    Overhead: %lu bytes in %lu internal blocks, %lu stack traces and %lu ms of thread time spent tracking"
+           L" (%lu%% of the elapsed time, summed over all threads).\n", stats.internalbytes, stats.internalblocks,
+           stats.stackwalks, (ULONG)(stats.time / 1000),
+           (stats.elapsed != 0) ? (ULONG)((stats.time * 100) / stats.elapsed) : 0);
+    if (stats.untracked != 0) {
+        report(L"    %lu blocks were not tracked, to stay within the internal memory limit of %lu KB.\n",
+               stats.untracked, m_maxinternalmemory / 1024);
+    }
+    delete [] heapstats;
+}
+
+// retireblock - Disposes of block information that has been unmapped from the
+//   block maps. If any snapshots are outstanding, they might still reference
+//   the block information, so it is retired until they have all been freed.
+//   Otherwise it is freed immediately.
+//
+//   Note: The caller must hold the map lock.
+//
+//  - info (IN): Pointer to the block information to be disposed of.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::retireblock (blockinfo_t *info)
+{
+    retiredinfo_t *retired;
+
+    if (m_snapshotepochs->size() == 0) {
+        // No snapshots are outstanding. Nothing can reference this block
+        // information.
+        delete info;
+        return;
+    }
+
+    retired = new retiredinfo_t;
+    retired->epoch = m_epoch;
+    retired->info = info;
+    retired->next = m_retiredlist;
+    m_retiredlist = retired;
+}
+
+// setranges - Replaces one of the tables of ranges. Other threads may still be
+//   searching the table being replaced, so it is retired, rather than freed,
+//   until none of them is (see "acquireranges"). Tables retired earlier that no
+//   thread is searching anymore are freed.
+//
+//   Note: The caller must hold the modules lock.
+//
+//  - table (IN/OUT): Pointer to the table to be replaced. Receives the new
+//      table.
+//
+//  - newtable (IN): Pointer to the new table (which may be NULL).
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::setranges (RangeTable **table, RangeTable *newtable)
+{
+    RangeTableSet           inuse;
+    const RangeTable       *ranges;
+    RangeTableSet::Iterator retiredit;
+    RangeTableSet          *stillretired;
+    TlsSet::Iterator        tlsit;
+
+    if (*table != NULL) {
+        m_retiredranges->insert(*table);
+    }
+    orderedstore(table, newtable);
+
+    // Any thread that starts searching a table from now on finds the new
+    // table. Find the tables that threads may have started searching before.
+    enterlock(&m_tlslock);
+    for (tlsit = m_tlsset->begin(); tlsit != m_tlsset->end(); ++tlsit) {
+        ranges = orderedload(&(*tlsit)->ranges);
+        if (ranges != NULL) {
+            inuse.insert(ranges);
+        }
+    }
+    leavelock(&m_tlslock);
+
+    stillretired = new RangeTableSet;
+    for (retiredit = m_retiredranges->begin(); retiredit != m_retiredranges->end(); ++retiredit) {
+        if (inuse.find(*retiredit) != inuse.end()) {
+            stillretired->insert(*retiredit);
+        }
+        else {
+            delete *retiredit;
+        }
+    }
+    delete m_retiredranges;
+    m_retiredranges = stillretired;
+}
+
+// suppressedstack - Determines whether leaks allocated from a call stack are
+//   suppressed. The call stack is matched against the suppressions only the
+//   first time. The outcome is kept with the interned call stack, so that
+//   checking any other leak allocated from it costs next to nothing.
+//
+//  - stack (IN): Pointer to the interned call stack's information.
+//
+//  Return Value:
+//
+//    Returns TRUE if the call stack matches a suppression. Otherwise returns
+//    FALSE.
+//
+BOOL VisualLeakDetector::suppressedstack (stackinfo_t *stack)
+{
+    UINT32 suppression;
+
+    if (m_suppressions == NULL) {
+        return FALSE;
+    }
+
+    // Reports may be generated by several threads at once. They may all match
+    // the call stack, but they always come to the same outcome.
+    suppression = acquirecounter(&stack->suppression);
+    if (suppression == VLD_SUPPRESSION_UNCHECKED) {
+        suppression = m_suppressions->match(stack->callstack) ? VLD_SUPPRESSION_MATCHED : VLD_SUPPRESSION_NONE;
+        publishcounter(&stack->suppression, suppression);
+    }
+
+    return (suppression == VLD_SUPPRESSION_MATCHED) ? TRUE : FALSE;
+}
+
+// takesnapshot - Captures a snapshot of the memory blocks that are currently
+//   outstanding. The map lock is held only while the snapshot is being
+//   captured, which amounts to recording a reference to each block's
+//   information. The block information is immutable and won't be freed until
+//   the snapshot is freed, so nothing needs to be copied. Blocks used
+//   internally by the CRT are not included in the snapshot.
+//
+//   Each heap's blocks are found by walking backwards from the end of the
+//   heap's list of blocks, so the cost of capturing only recently allocated
+//   blocks is proportional to the number of such blocks, regardless of how
+//   many older blocks are outstanding.
+//
+//  - snapshot (OUT): Pointer to a snapshot structure to receive the snapshot.
+//      The snapshot must be freed by calling "freesnapshot".
+//
+//  - heap (IN): Handle to the heap whose blocks are to be captured. If NULL,
+//      the blocks of all heaps are captured.
+//
+//  - since (IN): Only blocks with serial numbers greater than or equal to this
+//      value are captured.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::takesnapshot (snapshot_t *snapshot, HANDLE heap, SIZE_T since)
+{
+    LPCVOID              address;
+    SIZE_T               capacity = 0;
+    snapshotentry_t     *entry;
+    blockinfo_t         *first;
+    heapinfo_t          *heapinfo;
+    HeapMap::Iterator    heapit;
+    blockinfo_t         *info;
+    SIZE_T               size;
+
+    snapshot->count = 0;
+    snapshot->entries = NULL;
+
+    enterlock(&m_maplock);
+    drainfrees();
+    snapshot->epoch = ++m_epoch;
+    m_snapshotepochs->insert(snapshot->epoch);
+    for (heapit = m_heapmap->begin(); heapit != m_heapmap->end(); ++heapit) {
+        if ((heap != NULL) && ((*heapit).first != heap)) {
+            continue;
+        }
+        heapinfo = (*heapit).second;
+        for (info = heapinfo->newest; (info != NULL) && (info->serialnumber >= since); info = info->prev) {
+            capacity++;
+        }
+    }
+    if (capacity == 0) {
+        // Nothing is allocated. Nothing to capture.
+        leavelock(&m_maplock);
+        return;
+    }
+    snapshot->entries = new snapshotentry_t [capacity];
+    for (heapit = m_heapmap->begin(); heapit != m_heapmap->end(); ++heapit) {
+        if ((heap != NULL) && ((*heapit).first != heap)) {
+            continue;
+        }
+        // Find the heap's first block allocated since the specified serial
+        // number, then capture the blocks in order of allocation.
+        heapinfo = (*heapit).second;
+        first = NULL;
+        for (info = heapinfo->newest; (info != NULL) && (info->serialnumber >= since); info = info->prev) {
+            first = info;
+        }
+        for (info = first; info != NULL; info = info->next) {
+            if (!getuserblock(heapinfo, info->address, info->size, &address, &size)) {
+                // This block is marked as being used internally by the CRT.
+                // The CRT will free the block after VLD is destroyed.
+                continue;
+            }
+            entry = &snapshot->entries[snapshot->count++];
+            entry->address = address;
+            entry->flags = 0x0;
+            entry->info = info;
+            entry->size = size;
+        }
+    }
+    leavelock(&m_maplock);
+}
+
+// tracecallstack - Obtains a stack trace for the current allocation, using the
+//   configured stack walking method.
+//
+//  - framepointer (IN): Frame pointer at the time the allocation first entered
+//      VLD's code. The stack trace begins at this frame, unless internal frames
+//      are being traced.
+//
+//  Return Value:
+//
+//    Returns a pointer to a newly allocated CallStack containing the stack
+//    trace. The caller is responsible for freeing the CallStack.
+//
+CallStack* VisualLeakDetector::tracecallstack (SIZE_T framepointer)
+{
+    CallStack *callstack;
+
+    if (m_options & VLD_OPT_SAFE_STACK_WALK) {
+        callstack = new SafeCallStack;
+    }
+    else {
+        callstack = new FastCallStack;
+    }
+    tracecallstack(framepointer, callstack);
+
+    return callstack;
+}
+
+// tracecallstack - Obtains a stack trace for the current allocation into an
+//   existing, empty CallStack, using the configured stack walking method.
+//
+//  - framepointer (IN): Frame pointer at the time the allocation first entered
+//      VLD's code. The stack trace begins at this frame, unless internal frames
+//      are being traced.
+//
+//  - callstack (OUT): Pointer to the CallStack to receive the stack trace.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::tracecallstack (SIZE_T framepointer, CallStack *callstack)
+{
+    UINT32 frame;
+    UINT32 maxframes = m_maxtraceframes;
+    tls_t *tls = gettls();
+
+    addcounter(&tls->stackwalks, (SIZE_T)1);
+    if ((readcounter(&m_degradation) != VLD_DEGRADE_NONE) && (maxframes > VLD_DEGRADED_MAX_TRACE_FRAMES)) {
+        // Call stacks are truncated to stay within the internal memory budget.
+        maxframes = VLD_DEGRADED_MAX_TRACE_FRAMES;
+    }
+    if (tls->replaystack != NULL) {
+        // The allocation is being replayed from a trace (see TraceReplayer), or
+        // was made some time ago (see "mapblocksfrom"). Its call stack was
+        // recorded at the time.
+        for (frame = 0; frame < tls->replaystack->size(); frame++) {
+            callstack->push_back((*tls->replaystack)[frame]);
+        }
+    }
+    else if (m_options & VLD_OPT_TRACE_INTERNAL_FRAMES) {
+        // Passing NULL for the frame pointer argument will force the stack
+        // trace to begin at the current frame.
+        callstack->getstacktrace(maxframes, NULL, NULL);
+    }
+    else {
+        // Start the stack trace at the call that first entered VLD's code, and
+        // leave out the frames internal to the heap.
+        callstack->getstacktrace(maxframes, (SIZE_T*)framepointer, acquireranges(tls, &m_internalranges));
+        releaseranges(tls);
+    }
+}
+
+// traceevent - Records an event in the trace file, if tracing is enabled.
+//
+//  - tls (IN): Pointer to the calling thread's thread local storage structure.
+//
+//  - type (IN): Type of the event (see traceevent_t).
+//
+//  - heap (IN): Handle to the heap the block belongs to.
+//
+//  - mem (IN): Pointer to the memory block.
+//
+//  - size (IN): Size, in bytes, of the memory block.
+//
+//  - stack (IN): Pointer to the interned call stack the block was allocated
+//      from, or NULL if the event is not an allocation.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::traceevent (tls_t *tls, UINT32 type, HANDLE heap, LPCVOID mem, SIZE_T size,
+                                     const stackinfo_t *stack)
+{
+    if (m_tracewriter != NULL) {
+        m_tracewriter->record(&tls->tracebuffer, type, heap, mem, size, (stack != NULL) ? stack->traceid : 0);
+    }
+}
+
+// unlinkblock - Unlinks a block's information from its heap's list of blocks.
+//   The block is also removed from its call site's statistics.
+//
+//   Note: The caller must hold the map lock.
+//
+//  - heapinfo (IN): Pointer to the information for the heap from which the
+//      block was allocated.
+//
+//  - info (IN): Pointer to the block's information.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::unlinkblock (heapinfo_t *heapinfo, blockinfo_t *info)
+{
+    info->stack->bytes -= info->size;
+    info->stack->count--;
+    info->stack->frees++;
+    heapinfo->bytes -= info->size;
+    heapinfo->frees++;
+    m_livebytes -= info->size;
+    m_blockfilter.remove(info->address);
+
+    if (info->next != NULL) {
+        info->next->prev = info->prev;
+    }
+    else {
+        heapinfo->newest = info->prev;
+    }
+    if (info->prev != NULL) {
+        info->prev->next = info->next;
+    }
+    else {
+        heapinfo->oldest = info->next;
+    }
+}
+
+// unmapblock - Tracks memory blocks that are freed. Unmaps the specified block
+//   from the block's information, relinquishing internally allocated resources.
+//
+//   Frees are held back, so that the frees a thread makes in a row can be
+//   unmapped in a batch, acquiring the map lock only once (see "releasefrees").
+//   By the time they are unmapped, another thread may have allocated a new
+//   block at the same address, so each free records the serial number to be
+//   assigned to the next allocated block as its checkpoint (see the other
+//   "unmapblock"). Frees of blocks that the block filter shows were never
+//   mapped are neither held back nor looked up.
+//
+//  - heap (IN): Handle to the heap to which this block is being freed.
+//
+//  - mem (IN): Pointer to the memory block being freed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::unmapblock (HANDLE heap, LPCVOID mem)
+{
+    heldfree_t *held;
+    tls_t      *tls = gettls();
+
+    if (mem == NULL) {
+        return;
+    }
+    traceevent(tls, TRACE_EVENT_FREE, heap, mem, 0, NULL);
+    if (!m_blockfilter.maycontain(mem)) {
+        // This block was never mapped (it was probably allocated before VLD
+        // was initialized, from an excluded module, or while VLD was disabled).
+        return;
+    }
+    if (tls->heldcount == VLD_HELD_FREES) {
+        // The batch is full.
+        enterlock(&m_maplock);
+        releasefrees(tls);
+        leavelock(&m_maplock);
+    }
+
+    // Other threads may flush the held back frees at any time, so the free
+    // must be recorded before it is published.
+    held = &tls->heldfrees[tls->heldcount];
+    held->address = mem;
+    held->checkpoint = readcounter(&m_serialnumber);
+    held->heap = heap;
+    publishcounter(&tls->heldcount, tls->heldcount + 1);
+}
+
+// unmapblock - Tracks memory blocks that have been freed by a reallocation.
+//   Unlike a block that is about to be freed, such a block has already been
+//   returned to the heap by the time it is unmapped. Meanwhile, another thread
+//   may have allocated a new block at the same address, and mapped it in place
+//   of the freed one. So the block is only unmapped if it was allocated before
+//   the reallocation took place.
+//
+//  - heap (IN): Handle to the heap to which this block has been freed.
+//
+//  - mem (IN): Pointer to the memory block that has been freed.
+//
+//  - checkpoint (IN): The serial number to be assigned to the next allocated
+//      block, as of just before the block was reallocated. Only a block with
+//      an older serial number is unmapped.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::unmapblock (HANDLE heap, LPCVOID mem, SIZE_T checkpoint)
+{
+    heldfree_t  block;
+    tls_t      *tls = gettls();
+
+    if (mem == NULL) {
+        // Reallocating NULL only allocates a block.
+        return;
+    }
+    traceevent(tls, TRACE_EVENT_FREE, heap, mem, 0, NULL);
+    if (!m_blockfilter.maycontain(mem)) {
+        // This block was never mapped.
+        return;
+    }
+    block.address = mem;
+    block.checkpoint = checkpoint;
+    block.heap = heap;
+    enterlock(&m_maplock);
+    addcounter(&tls->frees, eraseblocks(&block, 1));
+    leavelock(&m_maplock);
+}
+
+// unmapblocks - Tracks a batch of memory blocks that are freed at once, such
+//   as the blocks of a memory pool that is being reset. The map lock is only
+//   acquired once for the whole batch.
+//
+//  - heap (IN): Handle to the heap to which the blocks are being freed.
+//
+//  - mems (IN): Array of pointers to the memory blocks being freed.
+//
+//  - count (IN): Number of elements in the "mems" array.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::unmapblocks (HANDLE heap, LPCVOID const *mems, SIZE_T count)
+{
+    heldfree_t *frees;
+    SIZE_T      index;
+    SIZE_T      mapped = 0;
+    tls_t      *tls = gettls();
+
+    if (count == 0) {
+        return;
+    }
+    frees = new heldfree_t [count];
+    for (index = 0; index < count; index++) {
+        if (mems[index] == NULL) {
+            // Freeing NULL does nothing.
+            continue;
+        }
+        traceevent(tls, TRACE_EVENT_FREE, heap, mems[index], 0, NULL);
+        if (!m_blockfilter.maycontain(mems[index])) {
+            // This block was never mapped.
+            continue;
+        }
+        frees[mapped].address = mems[index];
+        frees[mapped].checkpoint = (SIZE_T)-1;
+        frees[mapped].heap = heap;
+        mapped++;
+    }
+    if (mapped != 0) {
+        enterlock(&m_maplock);
+        addcounter(&tls->frees, eraseblocks(frees, mapped));
+        leavelock(&m_maplock);
+    }
+    delete [] frees;
+}
+
+// unmapheap - Tracks heap destruction. Unmaps the specified heap from its block
+//   map. The block map is cleared and deleted, relinquishing internally
+//   allocated resources.
+//
+//  - heap (IN): Handle to the heap which is being destroyed.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::unmapheap (HANDLE heap)
+{
+    BlockMap::Iterator  blockit;
+    BlockMap           *blockmap;
+    heapinfo_t         *heapinfo;
+    HeapMap::Iterator   heapit;
+
+    traceevent(gettls(), TRACE_EVENT_HEAPDESTROY, heap, NULL, 0, NULL);
+
+    // Find this heap's block map, once the frees of its blocks that threads
+    // have held back have been unmapped.
+    enterlock(&m_maplock);
+    drainfrees();
+    heapit = m_heapmap->find(heap);
+    if (heapit == m_heapmap->end()) {
+        // This heap hasn't been mapped. We must not have monitored this heap's
+        // creation (probably happened before VLD was initialized).
+        leavelock(&m_maplock);
+        return;
+    }
+
+    // Retire all of the blockinfo_t structures stored in the block map.
+    heapinfo = (*heapit).second;
+    blockmap = &heapinfo->blockmap;
+    for (blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
+        unlinkblock(heapinfo, (*blockit).second);
+        retireblock((*blockit).second);
+    }
+    delete heapinfo;
+
+    // Remove this heap's block map from the heap map.
+    m_heapmap->erase(heapit);
+    leavelock(&m_maplock);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Static Leak Detection Functions (Callbacks)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// compareentrysites - Comparison function for sorting snapshot entries with
+//   qsort so that the entries of blocks allocated from the same call site are
+//   next to each other.
+//
+//  - first (IN): Pointer to the first snapshotentry_t structure to compare.
+//
+//  - second (IN): Pointer to the second snapshotentry_t structure to compare.
+//
+//  Return Value:
+//
+//    Returns a negative value if the first entry's interned call stack is at
+//    a lower address than the second entry's, a positive value if it is at a
+//    higher address, or zero if both entries have the same call stack.
+//
+int VisualLeakDetector::compareentrysites (const void *first, const void *second)
+{
+    SIZE_T firststack = (SIZE_T)((const snapshotentry_t*)first)->info->stack;
+    SIZE_T secondstack = (SIZE_T)((const snapshotentry_t*)second)->info->stack;
+
+    if (firststack < secondstack) {
+        return -1;
+    }
+    if (firststack > secondstack) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// compareheldfrees - Comparison function for sorting held back frees with qsort
+//   by heap and address.
+//
+//  - first (IN): Pointer to the first heldfree_t structure to compare.
+//
+//  - second (IN): Pointer to the second heldfree_t structure to compare.
+//
+//  Return Value:
+//
+//    Returns a negative value if the first free is ordered before the second
+//    one, a positive value if it is ordered after it, or zero if both frees
+//    are of the same block.
+//
+int VisualLeakDetector::compareheldfrees (const void *first, const void *second)
+{
+    const heldfree_t *firstfree = (const heldfree_t*)first;
+    const heldfree_t *secondfree = (const heldfree_t*)second;
+
+    if (firstfree->heap != secondfree->heap) {
+        return ((SIZE_T)firstfree->heap < (SIZE_T)secondfree->heap) ? -1 : 1;
+    }
+    if (firstfree->address != secondfree->address) {
+        return ((SIZE_T)firstfree->address < (SIZE_T)secondfree->address) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// comparesiteages - Comparison function for sorting the ages of call sites'
+//   blocks with qsort. Call sites with older blocks sort first.
+//
+//  - first (IN): Pointer to the first siteages_t structure to compare.
+//
+//  - second (IN): Pointer to the second siteages_t structure to compare.
+//
+//  Return Value:
+//
+//    Returns a negative value if the first call site's oldest block is older
+//    than the second's, a positive value if it is younger, or zero if they are
+//    the same age.
+//
+int VisualLeakDetector::comparesiteages (const void *first, const void *second)
+{
+    const siteages_t *firstages = (const siteages_t*)first;
+    const siteages_t *secondages = (const siteages_t*)second;
+
+    if (firstages->oldest > secondages->oldest) {
+        return -1;
+    }
+    if (firstages->oldest < secondages->oldest) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// comparesitestats - Comparison function for sorting call site statistics with
+//   qsort. Call sites with more outstanding memory sort first. Ties are broken
+//   on the number of outstanding blocks, so that sites whose outstanding blocks
+//   are all empty still sort ahead of sites whose blocks have all been freed.
+//
+//  - first (IN): Pointer to the first VLD_SITE_STATS structure to compare.
+//
+//  - second (IN): Pointer to the second VLD_SITE_STATS structure to compare.
+//
+//  Return Value:
+//
+//    Returns a negative value if the first call site sorts before the second,
+//    a positive value if it sorts after it, or zero if they have the same
+//    amount of outstanding memory in the same number of blocks.
+//
+int VisualLeakDetector::comparesitestats (const void *first, const void *second)
+{
+    const VLD_SITE_STATS *firststats = (const VLD_SITE_STATS*)first;
+    const VLD_SITE_STATS *secondstats = (const VLD_SITE_STATS*)second;
+
+    if (firststats->bytes > secondstats->bytes) {
+        return -1;
+    }
+    if (firststats->bytes < secondstats->bytes) {
+        return 1;
+    }
+    if (firststats->count > secondstats->count) {
+        return -1;
+    }
+    if (firststats->count < secondstats->count) {
+        return 1;
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -22,15 +22,18 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include <cassert>
-#define VLDBUILD     // Declares that we are building Visual Leak Detector.
-#include "ntapi.h"   // Provides access to NT APIs.
-#include "vldheap.h" // Provides access to VLD's internal heap data structures.
-#undef new           // Do not map "new" to VLD's new operator in this file
+#include <cstdlib>
+#define VLDBUILD      // Declares that we are building Visual Leak Detector.
+#include "platform.h" // Provides the platform services, including private heaps.
+#include "vldheap.h"  // Provides access to VLD's internal heap data structures.
+#undef new            // Do not map "new" to VLD's new operator in this file
 
 // Global variables.
 vldblockheader_t *vldblocklist = NULL; // List of internally allocated blocks on VLD's private heap.
 HANDLE            vldheap;             // VLD's private heap.
-CRITICAL_SECTION  vldheaplock;         // Serializes access to VLD's private heap.
+SIZE_T            vldheapblocks = 0;   // Number of internally allocated blocks on VLD's private heap.
+SIZE_T            vldheapbytes = 0;    // Total size of the internally allocated blocks on VLD's private heap.
+vldlock_t         vldheaplock;         // Serializes access to VLD's private heap.
 
 // Local helper functions.
 static inline void vlddelete (void *block);
@@ -144,8 +147,22 @@ void vlddelete (void *block)
     BOOL              freed;
     vldblockheader_t *header = VLDBLOCKHEADER((LPVOID)block);
 
+    if (block == NULL) {
+        return;
+    }
+#ifndef _WIN32
+    if (!heapcontains(vldheap, block)) {
+        // Unlike on Windows, where these delete operators only replace the
+        // ones used within vld.dll, on ELF systems they replace the delete
+        // operators of the whole process. Blocks that weren't allocated from
+        // VLD's private heap came from the C runtime's heap.
+        free(block);
+        return;
+    }
+#endif // _WIN32
+
     // Unlink the block from the block list.
-    EnterCriticalSection(&vldheaplock);
+    enterlock(&vldheaplock);
     if (header->prev) {
         header->prev->next = header->next;
     }
@@ -156,11 +173,14 @@ void vlddelete (void *block)
     if (header->next) {
         header->next->prev = header->prev;
     }
-    LeaveCriticalSection(&vldheaplock);
+    vldheapblocks--;
+    addcounter(&vldheapbytes, (SIZE_T)0 - header->size);
+    leavelock(&vldheaplock);
 
     // Free the block.
-    freed = RtlFreeHeap(vldheap, 0x0, header);
+    freed = heapfree(vldheap, header);
     assert(freed != FALSE);
+    (void)freed; // Only checked in debug builds.
 }
 
 // vldnew - Local helper function that actually allocates memory from VLD's
@@ -183,7 +203,7 @@ void vlddelete (void *block)
 //
 void* vldnew (size_t size, const char *file, int line)
 {
-    vldblockheader_t *header = (vldblockheader_t*)RtlAllocateHeap(vldheap, 0x0, size + sizeof(vldblockheader_t));
+    vldblockheader_t *header = (vldblockheader_t*)heapalloc(vldheap, size + sizeof(vldblockheader_t));
     static SIZE_T     serialnumber = 0;
 
     if (header == NULL) {
@@ -194,18 +214,21 @@ void* vldnew (size_t size, const char *file, int line)
     // Fill in the block's header information.
     header->file         = file;
     header->line         = line;
-    header->serialnumber = serialnumber++;
     header->size         = size;
 
-    // Link the block into the block list.
-    EnterCriticalSection(&vldheaplock);
+    // Link the block into the block list. The serial number is assigned while
+    // holding the lock, so that no two blocks get the same one.
+    enterlock(&vldheaplock);
+    header->serialnumber = serialnumber++;
     header->next         = vldblocklist;
     if (header->next != NULL) {
         header->next->prev = header;
     }
     header->prev         = NULL;
     vldblocklist         = header;
-    LeaveCriticalSection(&vldheaplock);
+    vldheapblocks++;
+    addcounter(&vldheapbytes, size);
+    leavelock(&vldheaplock);
 
     // Return a pointer to the beginning of the data section of the block.
     return (void*)VLDBLOCKDATA(header);
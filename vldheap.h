@@ -29,7 +29,7 @@
 Applications should never include this header."
 #endif
 
-#include <windows.h>
+#include "platform.h" // Provides the platform services and, on POSIX systems, the Win32 types.
 
 #define GAPSIZE 4
 
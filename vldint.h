@@ -30,12 +30,19 @@ Applications should never include this header."
 #endif
 
 #include <cstdio>
-#include <windows.h>
-#include "callstack.h" // Provides a custom class for handling call stacks.
-#include "map.h"       // Provides a custom STL-like map template.
-#include "ntapi.h"     // Provides access to NT APIs.
-#include "set.h"       // Provides a custom STL-like set template.
-#include "utility.h"   // Provides miscellaneous utility functions.
+#include "platform.h"      // Provides the platform services.
+#include "addressfilter.h" // Provides a filter of the addresses of the mapped blocks.
+#include "callstack.h"     // Provides a custom class for handling call stacks.
+#include "map.h"           // Provides a custom STL-like map template.
+#include "rangetable.h"    // Provides tables of address ranges.
+#ifdef _WIN32
+#include "ntapi.h"         // Provides access to NT APIs.
+#endif // _WIN32
+#include "set.h"           // Provides a custom STL-like set template.
+#include "suppressions.h"  // Provides the list of suppressed leak signatures.
+#include "trace.h"         // Provides the trace file writer.
+#include "utility.h"       // Provides miscellaneous utility functions.
+#include "vld.h"           // Provides the public Visual Leak Detector types.
 
 #define MAXMODULELISTLENGTH 512     // Maximum module list length, in characters.
 #define SELFTESTTEXTA       "Memory Leak Self-Test"
@@ -46,7 +53,26 @@ Applications should never include this header."
 // The Visual Leak Detector APIs.
 extern "C" __declspec(dllexport) void VLDDisable ();
 extern "C" __declspec(dllexport) void VLDEnable ();
+extern "C" __declspec(dllexport) SIZE_T VLDGetHeapStats (VLD_HEAP_STATS *stats, SIZE_T max);
+extern "C" __declspec(dllexport) UINT VLDGetLeaksCount ();
+extern "C" __declspec(dllexport) SIZE_T VLDGetSiteStats (VLD_SITE_STATS *stats, SIZE_T max);
+extern "C" __declspec(dllexport) void VLDGetStats (VLD_STATS *stats);
+extern "C" __declspec(dllexport) SIZE_T VLDMarkCheckpoint ();
+extern "C" __declspec(dllexport) SIZE_T VLDReportAges ();
+extern "C" __declspec(dllexport) UINT VLDReportLeaks ();
+extern "C" __declspec(dllexport) UINT VLDReportOlderThan (SIZE_T age);
+extern "C" __declspec(dllexport) UINT VLDReportSince (SIZE_T checkpoint);
+extern "C" __declspec(dllexport) SIZE_T VLDReportSites ();
+extern "C" __declspec(dllexport) void VLDReportStats ();
+extern "C" __declspec(dllexport) void VLDTrackAlloc (LPCVOID mem, SIZE_T size);
+extern "C" __declspec(dllexport) void VLDTrackAllocs (LPCVOID const *mems, SIZE_T count, SIZE_T size);
+extern "C" __declspec(dllexport) void VLDTrackAllocsFrom (LPCVOID const *mems, LPCVOID const *callers, SIZE_T count,
+                                                          SIZE_T size);
+extern "C" __declspec(dllexport) void VLDTrackFree (LPCVOID mem);
+extern "C" __declspec(dllexport) void VLDTrackFrees (LPCVOID const *mems, SIZE_T count);
+extern "C" __declspec(dllexport) void VLDTrackRealloc (LPCVOID mem, LPCVOID newmem, SIZE_T size);
 
+#ifdef _WIN32
 // Function pointer types for explicit dynamic linking with functions listed in
 // the import patch table.
 typedef void* (__cdecl *_calloc_dbg_t) (size_t, size_t, int, const char*, int);
@@ -61,15 +87,60 @@ typedef void* (__cdecl *new_t) (size_t);
 typedef void* (__cdecl *new_dbg_crt_t) (size_t, int, const char *, int);
 typedef void* (__cdecl *new_dbg_mfc_t) (size_t, const char *, int);
 typedef void* (__cdecl *realloc_t) (void *, size_t);
+#else
+// Function pointer types for explicit dynamic linking with the C runtime's
+// allocation functions, which are interposed by vldposix.cpp.
+typedef void* (*calloc_t) (size_t, size_t);
+typedef int   (*dlclose_t) (void *);
+typedef void  (*free_t) (void *);
+typedef void* (*malloc_t) (size_t);
+typedef int   (*posix_memalign_t) (void **, size_t, size_t);
+typedef void* (*realloc_t) (void *, size_t);
+#endif // _WIN32
+
+// Every distinct call stack from which blocks are allocated is interned in the
+// stack depot, so that blocks allocated from the same call site share a single
+// copy of the call stack. Interned call stacks are never freed until VLD is
+// destroyed, so they may be referenced without holding the map lock. Live and
+// cumulative statistics for each call site are kept along with its call stack.
+// They are updated as blocks are mapped and unmapped, so that they can be
+// queried (and sampled by the leak growth monitor) without scanning the block
+// maps.
+typedef struct stackinfo_s {
+    SIZE_T              allocs;        // Cumulative number of blocks allocated from this call site.
+    SIZE_T              bytes;         // Total size of the outstanding blocks allocated from this call site.
+    CallStack          *callstack;     // The interned call stack.
+    SIZE_T              count;         // Number of outstanding blocks allocated from this call site.
+    SIZE_T              frees;         // Cumulative number of blocks allocated from this call site that were freed.
+    UINT32              growth;        // Number of consecutive monitor intervals over which the count has grown.
+    struct stackinfo_s *next;          // Next interned call stack with the same hash value.
+    SIZE_T              reportedcount; // Count at which growth was last reported (or at which the count last shrank).
+    SIZE_T              samplebytes;   // Total size of the outstanding blocks as of the most recent monitor interval.
+    SIZE_T              samplecount;   // Number of outstanding blocks as of the most recent monitor interval.
+    UINT32              suppression;   // Whether the call stack matches a suppression (see "suppressedstack"):
+#define VLD_SUPPRESSION_UNCHECKED 0x0  //   The call stack hasn't been matched against the suppressions yet.
+#define VLD_SUPPRESSION_NONE      0x1  //   The call stack doesn't match any suppression. Its leaks are reported.
+#define VLD_SUPPRESSION_MATCHED   0x2  //   The call stack matches a suppression. Its leaks are not reported.
+    UINT32              traceid;       // ID by which events in the trace file refer to the call stack (zero if not traced).
+} stackinfo_t;
+
+// The stack depot is a StackMap, which maps call stack hash values to lists
+// of interned call stacks.
+typedef Map<SIZE_T, stackinfo_t*> StackMap;
 
 // Data is collected for every block allocated from any heap in the process.
 // The data is stored in this structure and these structures are stored in
 // a BlockMap which maps each of these structures to its corresponding memory
-// block.
+// block. The structures for each heap are also linked together, in order of
+// serial number, so that recently allocated blocks can be found quickly.
 typedef struct blockinfo_s {
-    CallStack *callstack;
-    SIZE_T     serialnumber;
-    SIZE_T     size;
+    LPCVOID             address;      // Address of the memory block.
+    struct blockinfo_s *next;         // Next (more recently allocated) block from the same heap.
+    struct blockinfo_s *prev;         // Previous (less recently allocated) block from the same heap.
+    SIZE_T              serialnumber; // The block's serial number, in order of allocation.
+    SIZE_T              size;         // Size of the memory block.
+    stackinfo_t        *stack;        // Interned call stack at the time the block was allocated.
+    ULONGLONG           timestamp;    // Time, in milliseconds, at which the block was allocated (see gettimestamp).
 } blockinfo_t;
 
 // BlockMaps map memory blocks (via their addresses) to blockinfo_t structures.
@@ -79,14 +150,77 @@ typedef Map<LPCVOID, blockinfo_t*> BlockMap;
 // this is used for mapping heaps to all of the blocks allocated from those
 // heaps.
 typedef struct heapinfo_s {
-    BlockMap blockmap;   // Map of all blocks allocated from this heap.
-    UINT32   flags;      // Heap status flags:
-#define VLD_HEAP_CRT 0x1 //   If set, this heap is a CRT heap (i.e. the CRT uses it for new/malloc).
+    SIZE_T       allocs;    // Cumulative number of blocks allocated from this heap.
+    BlockMap     blockmap;  // Map of all blocks allocated from this heap.
+    SIZE_T       bytes;     // Total size of this heap's outstanding blocks.
+    UINT32       flags;     // Heap status flags:
+#define VLD_HEAP_CRT 0x1    //   If set, this heap is a CRT heap (i.e. the CRT uses it for new/malloc).
+    SIZE_T       frees;     // Cumulative number of this heap's blocks that have been freed.
+    blockinfo_t *newest;    // Most recently allocated block from this heap.
+    blockinfo_t *oldest;    // Least recently allocated block from this heap.
+    SIZE_T       peakbytes; // Largest total size this heap's outstanding blocks have ever reached.
 } heapinfo_t;
 
 // HeapMaps map heaps (via their handles) to BlockMaps.
 typedef Map<HANDLE, heapinfo_t*> HeapMap;
 
+// Custom allocators (e.g. memory pools) report the blocks they hand out through
+// the VLDTrack APIs. Those blocks are mapped to a virtual heap, whose handle is
+// the address of the global VisualLeakDetector object, so that it can never be
+// mistaken for a real heap.
+#define VIRTUALHEAP ((HANDLE)&vld)
+
+// Leak reports are built from a snapshot of the block maps. The snapshot is
+// captured while holding the map lock, but it is formatted and symbolized after
+// the lock has been released so that other threads can continue to allocate
+// and free memory in the meantime. Each snapshot is stamped with an epoch.
+// While any snapshot is outstanding, blockinfo_t structures are never modified
+// in place (except for their list links, which are only accessed while holding
+// the map lock), and those that are unmapped are retired rather than freed, so
+// the snapshot can simply reference them instead of copying them.
+typedef struct snapshotentry_s {
+    LPCVOID      address;          // Address of the user data portion of the block.
+    UINT32       flags;            // Snapshot entry flags:
+#define VLD_SNAPSHOT_DUPLICATE 0x1 //   If set, this entry duplicates an earlier entry and is not reported separately.
+#define VLD_SNAPSHOT_DEFINITE  0x2 //   If set, the block was classified as definitely lost (nothing references it).
+#define VLD_SNAPSHOT_INDIRECT  0x4 //   If set, the block was classified as indirectly lost (only lost blocks reference it).
+#define VLD_SNAPSHOT_REACHABLE 0x8 //   If set, the block was classified as still reachable (it is not reported as a leak).
+#define VLD_SNAPSHOT_CLASSIFICATION (VLD_SNAPSHOT_DEFINITE | VLD_SNAPSHOT_INDIRECT | VLD_SNAPSHOT_REACHABLE)
+    blockinfo_t *info;             // The block's information, kept alive until the snapshot is freed.
+    SIZE_T       size;             // Size of the user data portion of the block.
+} snapshotentry_t;
+
+// Snapshots are simply arrays of snapshot entries.
+typedef struct snapshot_s {
+    SIZE_T           count;   // Number of entries in the snapshot.
+    snapshotentry_t *entries; // Array of snapshot entries.
+    SIZE_T           epoch;   // Epoch at which the snapshot was captured.
+} snapshot_t;
+
+// The outstanding blocks allocated from each call site are tallied by age in a
+// histogram. Each bucket of the histogram covers a range of ages roughly ten
+// times as long as the previous one (see agelimits in vldengine.cpp).
+#define VLD_AGE_BUCKETS 7 // Number of buckets in each histogram of block ages.
+typedef struct siteages_s {
+    SIZE_T       bytes;                       // Total size of the call site's outstanding blocks.
+    SIZE_T       count;                       // Number of the call site's outstanding blocks.
+    SIZE_T       histogram [VLD_AGE_BUCKETS]; // Number of the call site's outstanding blocks in each range of ages.
+    ULONGLONG    oldest;                      // Age, in milliseconds, of the call site's oldest outstanding block.
+    stackinfo_t *stack;                       // The call site's interned call stack.
+} siteages_t;
+
+// The EpochSet keeps track of the epochs of all outstanding snapshots.
+typedef Set<SIZE_T> EpochSet;
+
+// blockinfo_t structures that are unmapped while snapshots are outstanding are
+// kept on a list of retired block information until every snapshot that might
+// reference them has been freed.
+typedef struct retiredinfo_s {
+    SIZE_T                epoch; // Epoch at which the block information was retired.
+    blockinfo_t          *info;  // The retired block information.
+    struct retiredinfo_s *next;  // Next (i.e. previously retired) entry in the list.
+} retiredinfo_t;
+
 // This structure stores information, primarily the virtual address range, about
 // a given module and can be used with the Set template because it supports the
 // '<' operator (sorts by virtual address range).
@@ -113,23 +247,62 @@ typedef struct moduleinfo_s {
 // ModuleSets store information about modules loaded in the process.
 typedef Set<moduleinfo_t> ModuleSet;
 
+// Frees are not unmapped one at a time. Instead, each thread holds back the
+// frees it makes in a row, and unmaps them in a batch (sorted by heap and
+// address), acquiring the map lock only once. The held back frees are unmapped
+// as soon as the thread next maps a block, or the batch is full, or another
+// thread needs the block maps to be up to date (to count or report the
+// outstanding blocks).
+#define VLD_HELD_FREES 64 // Maximum number of frees a thread holds back.
+typedef struct heldfree_s {
+    LPCVOID address;    // Address of the freed block.
+    SIZE_T  checkpoint; // Serial number to be assigned to the next allocated block, as of when the block was freed.
+    HANDLE  heap;       // Handle to the heap to which the block was freed.
+} heldfree_t;
+
 // Thread local storage structure. Every thread in the process gets its own copy
 // of this structure. Thread specific information, such as the current leak
 // detection status (enabled or disabled) and the address that initiated the
-// current allocation is stored here.
+// current allocation is stored here. Each thread also keeps its own statistics
+// counters, which only it ever writes, so that they can be updated without
+// locking. The counters of all threads are added up when they are read.
 typedef struct tls_s {
-    SIZE_T addrfp;           // Frame pointer at the first call that entered VLD's code for the current allocation.
-    UINT32 flags;            // Thread-local status flags:
-#define VLD_TLS_CRTALLOC 0x1 //   If set, the current allocation is a CRT allocation.
-#define VLD_TLS_DISABLED 0x2 //   If set, memory leak detection is disabled for the current thread.
-#define VLD_TLS_ENABLED  0x4 //   If set, memory leak detection is enabled for the current thread.
-    DWORD  threadid;         // Thread ID of the thread that owns this TLS structure.
+    SIZE_T           addrfp;      // Frame pointer at the first call that entered VLD's code for the current allocation.
+    SIZE_T           allocs;      // Number of blocks mapped by this thread.
+    UINT32           flags;       // Thread-local status flags:
+#define VLD_TLS_CRTALLOC    0x1     //   If set, the current allocation is a CRT allocation.
+#define VLD_TLS_DISABLED    0x2     //   If set, memory leak detection is disabled for the current thread.
+#define VLD_TLS_ENABLED     0x4     //   If set, memory leak detection is enabled for the current thread.
+#define VLD_TLS_CRTINTERNAL 0x8     //   If set, the current allocation is a CRT block that is never reported (see "iscrtuserblock").
+    SIZE_T           frees;       // Number of blocks unmapped by this thread (only updated while holding the map lock).
+    SIZE_T           heldcount;   // Number of entries in "heldfrees" (published by this thread with "publishcounter").
+    SIZE_T           heldflushed; // Number of entries in "heldfrees" already unmapped (only accessed while holding the map lock).
+    heldfree_t       heldfrees [VLD_HELD_FREES]; // The frees this thread has held back.
+    const ModuleSet *modules;     // Set of loaded modules this thread is searching, which must not be freed (see "acquiremodules").
+    const RangeTable *ranges;     // Table of ranges this thread is searching, which must not be freed (see "acquireranges").
+    SIZE_T           reallocs;    // Number of blocks remapped by this thread.
+    const CallStack *replaystack; // If not NULL, the call stack recorded for the allocation being mapped, not traced.
+    SIZE_T           stackwalks;  // Number of call stacks traced by this thread.
+    DWORD            threadid;    // Thread ID of the thread that owns this TLS structure.
+    ULONGLONG        time;        // Time, in performance counter ticks, this thread has spent tracking allocations and frees.
+    tracebuffer_t   *tracebuffer; // Buffer in which this thread records events for the trace file (see TraceWriter).
+    SIZE_T           untracked;   // Number of blocks allocated by this thread that were not tracked, to stay within budget.
 } tls_t;
 
 // The TlsSet allows VLD to keep track of all thread local storage structures
 // allocated in the process.
 typedef Set<tls_t*> TlsSet;
 
+// Tables of ranges that have been superseded are kept in a RangeTableSet until
+// no thread is searching them anymore (see "setranges").
+typedef Set<const RangeTable*> RangeTableSet;
+
+#ifndef _WIN32
+// Sets of loaded modules that have been superseded are kept in a ModuleSetSet
+// until no thread is searching them anymore (see "setmodules").
+typedef Set<const ModuleSet*> ModuleSetSet;
+#endif // _WIN32
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // The VisualLeakDetector Class
@@ -156,12 +329,22 @@ typedef Set<tls_t*> TlsSet;
 //   memory leaks. However, this implementation of IMalloc is actually just a
 //   thin wrapper around the system's implementation of IMalloc.
 //
-class VisualLeakDetector : public IMalloc
+//   Only the tracking engine (see vldengine.cpp) is portable. On POSIX systems
+//   the Win32 specific parts below are left out. Instead of patching IATs, VLD
+//   is linked with, or preloaded into, the process and interposes the C
+//   runtime's allocation functions (see vldposix.cpp).
+//
+class VisualLeakDetector
+#ifdef _WIN32
+    : public IMalloc
+#endif // _WIN32
 {
 public:
     VisualLeakDetector();
     ~VisualLeakDetector();
 
+#ifdef _WIN32
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public CRT and MFC Common Handlers
 //
@@ -196,28 +379,148 @@ public:
     HRESULT __stdcall QueryInterface (REFIID iid, LPVOID *object);
     LPVOID  __stdcall Realloc (LPVOID mem, ULONG size);
     ULONG   __stdcall Release ();
+#else
+
+////////////////////////////////////////////////////////////////////////////////
+// Public POSIX Allocation Handlers
+//
+// The C runtime's allocation functions, and the global new operators, are
+// interposed by vldposix.cpp. The interposed functions are routed to these
+// handlers, which call the real allocation functions and then map, unmap or
+// remap the blocks. dlclose is interposed too, so that the set of loaded
+// modules can be updated when modules are unloaded.
+////////////////////////////////////////////////////////////////////////////////
+    void* _calloc (calloc_t pcalloc, SIZE_T fp, size_t num, size_t size);
+    int   _dlclose (dlclose_t pdlclose, void *handle);
+    void  _free (free_t pfree, void *mem);
+    void* _malloc (malloc_t pmalloc, SIZE_T fp, size_t size);
+    int   _posix_memalign (posix_memalign_t pposix_memalign, SIZE_T fp, void **mem, size_t alignment, size_t size);
+    void* _realloc (realloc_t prealloc, SIZE_T fp, void *mem, size_t size);
+#endif // _WIN32
+
+////////////////////////////////////////////////////////////////////////////////
+// Public Custom Allocator Handlers
+//
+// Custom allocators report the blocks they hand out and take back through the
+// VLDTrack APIs, which are routed to these handlers. The handlers map, unmap or
+// remap the blocks in the virtual heap (see VIRTUALHEAP).
+////////////////////////////////////////////////////////////////////////////////
+    VOID trackalloc (SIZE_T fp, LPCVOID mem, SIZE_T size);
+    VOID trackallocs (SIZE_T fp, LPCVOID const *mems, SIZE_T count, SIZE_T size);
+    VOID trackallocsfrom (SIZE_T fp, LPCVOID const *mems, LPCVOID const *callers, SIZE_T count, SIZE_T size);
+    VOID trackfree (LPCVOID mem);
+    VOID trackfrees (LPCVOID const *mems, SIZE_T count);
+    VOID trackrealloc (SIZE_T fp, LPCVOID mem, LPCVOID newmem, SIZE_T size);
 
 private:
 ////////////////////////////////////////////////////////////////////////////////
 // Private leak detection functions - see each function definition for details.
 ////////////////////////////////////////////////////////////////////////////////
+#ifndef _WIN32
+    const ModuleSet* acquiremodules (tls_t *tls);
+#endif // _WIN32
+    const RangeTable* acquireranges (tls_t *tls, RangeTable *const *table);
+    VOID   addranges (RangeTable **table, const addressrange_t *ranges, SIZE_T count);
     VOID   attachtoloadedmodules (ModuleSet *newmodules);
     LPWSTR buildsymbolsearchpath ();
+    VOID   checkbudget ();
     VOID   configure ();
+    VOID   countblock (SIZE_T framepointer);
+    VOID   drainfrees ();
     BOOL   enabled ();
-    SIZE_T eraseduplicates (const BlockMap::Iterator &element);
+    SIZE_T eraseblocks (heldfree_t *frees, SIZE_T count);
+#ifndef _WIN32
+    BOOL   enterhandler ();
+    BOOL   excludedcaller (SIZE_T framepointer);
+#endif // _WIN32
+    BOOL   excludedfunction (SIZE_T returnaddress, BOOL excluded);
+#ifndef _WIN32
+    BOOL   findcaller (tls_t *tls, SIZE_T returnaddress, BOOL *excluded);
+#endif // _WIN32
+    stackinfo_t* findstack (const CallStack *callstack);
+    VOID   flushfrees (tls_t *tls);
+    VOID   freesnapshot (snapshot_t *snapshot);
+    SIZE_T getheapstats (VLD_HEAP_STATS **stats);
+    SIZE_T getleakscount ();
+    SIZE_T getsitestats (VLD_SITE_STATS **stats);
+    VOID   getstats (VLD_STATS *stats);
+    ULONGLONG gettimestamp ();
     tls_t* gettls ();
+    BOOL   getuserblock (const heapinfo_t *heapinfo, LPCVOID block, SIZE_T size, LPCVOID *address, SIZE_T *usersize);
+    VOID   insertblock (heapinfo_t *heapinfo, blockinfo_t *info);
+    stackinfo_t* internstack (CallStack *callstack);
+#ifndef _WIN32
+    VOID   leavehandler (ULONGLONG start);
+#endif // _WIN32
+    VOID   linkblock (heapinfo_t *heapinfo, blockinfo_t *info);
     VOID   mapblock (HANDLE heap, LPCVOID mem, SIZE_T size, SIZE_T framepointer, BOOL crtalloc);
+    VOID   mapblocks (HANDLE heap, LPCVOID const *mems, SIZE_T count, SIZE_T size, SIZE_T framepointer);
+    VOID   mapblocksfrom (HANDLE heap, LPCVOID const *mems, LPCVOID const *callers, SIZE_T count, SIZE_T size,
+                          SIZE_T framepointer);
     VOID   mapheap (HANDLE heap);
-    VOID   remapblock (HANDLE heap, LPCVOID mem, LPCVOID newmem, SIZE_T size, SIZE_T framepointer, BOOL crtalloc);
+    VOID   pruneranges (RangeTable **table, const ModuleSet *unloaded);
+#ifndef _WIN32
+    BOOL   refreshmodules (BOOL wait);
+#endif // _WIN32
+#ifdef _WIN32
+    VOID   resolvefunctionranges (DWORD64 modulebase, LPCWSTR patterns, RangeTable **table);
+    VOID   resolveinternalranges (DWORD64 modulebase);
+#else
+    VOID   resolvefunctionranges (SIZE_T moduleaddress, LPCWSTR patterns, RangeTable **table);
+    VOID   resolveinternalranges ();
+#endif // _WIN32
+    VOID   releasefrees (tls_t *tls);
+#ifndef _WIN32
+    VOID   releasemodules (tls_t *tls);
+#endif // _WIN32
+    VOID   releaseranges (tls_t *tls);
+    VOID   remapblock (HANDLE heap, LPCVOID mem, LPCVOID newmem, SIZE_T size, SIZE_T framepointer, BOOL crtalloc,
+                       SIZE_T checkpoint);
+    SIZE_T reportages ();
     VOID   reportconfig ();
+    VOID   reportgrowth ();
     VOID   reportleaks (HANDLE heap);
+    SIZE_T reportoutstanding (SIZE_T since, SIZE_T minage);
+    SIZE_T reportsites ();
+    SIZE_T reportsnapshot (snapshot_t *snapshot, BOOL dumpdata);
+    VOID   reportstats ();
+    VOID   retireblock (blockinfo_t *info);
+#ifndef _WIN32
+    VOID   setmodules (ModuleSet *newmodules);
+#endif // _WIN32
+    VOID   setranges (RangeTable **table, RangeTable *newtable);
+    BOOL   suppressedstack (stackinfo_t *stack);
+    VOID   takeclassifiedsnapshot (snapshot_t *snapshot, BOOL parallel);
+    VOID   takesnapshot (snapshot_t *snapshot, HANDLE heap, SIZE_T since);
+    CallStack* tracecallstack (SIZE_T framepointer);
+    VOID   tracecallstack (SIZE_T framepointer, CallStack *callstack);
+    VOID   traceevent (tls_t *tls, UINT32 type, HANDLE heap, LPCVOID mem, SIZE_T size, const stackinfo_t *stack);
+    VOID   unlinkblock (heapinfo_t *heapinfo, blockinfo_t *info);
     VOID   unmapblock (HANDLE heap, LPCVOID mem);
+    VOID   unmapblock (HANDLE heap, LPCVOID mem, SIZE_T checkpoint);
+    VOID   unmapblocks (HANDLE heap, LPCVOID const *mems, SIZE_T count);
     VOID   unmapheap (HANDLE heap);
 
     // Static functions (callbacks)
+#ifdef _WIN32
+    static BOOL __stdcall addfunctionline (PSRCCODEINFOW lineinfo, PVOID context);
+    static BOOL __stdcall addfunctionsymbol (PSYMBOL_INFOW symbolinfo, ULONG symbolsize, PVOID context);
     static BOOL __stdcall addloadedmodule (PCWSTR modulepath, DWORD64 modulebase, ULONG modulesize, PVOID context);
+#endif // _WIN32
+    static int __cdecl compareentrysites (const void *first, const void *second);
+    static int __cdecl compareheldfrees (const void *first, const void *second);
+    static int __cdecl comparesiteages (const void *first, const void *second);
+    static int __cdecl comparesitestats (const void *first, const void *second);
+#ifndef _WIN32
+    static int addloadedmodule (struct dl_phdr_info *info, size_t size, void *context);
+    static VOID forkchild ();
+    static VOID forkprepare ();
+    static VOID forkrelease ();
+    static VOID threadexit (LPVOID value);
+#endif // _WIN32
+#ifdef _WIN32
     static BOOL __stdcall detachfrommodule (PCWSTR modulepath, DWORD64 modulebase, ULONG modulesize, PVOID context);
+    static DWORD __stdcall monitorthread (LPVOID context);
 
 ////////////////////////////////////////////////////////////////////////////////
 // IAT replacement functions - see each function definition for details.
@@ -240,53 +543,145 @@ private:
     static HRESULT __stdcall _CoGetMalloc (DWORD context, LPMALLOC *imalloc);
     static LPVOID  __stdcall _CoTaskMemAlloc (ULONG size);
     static LPVOID  __stdcall _CoTaskMemRealloc (LPVOID mem, ULONG size);
+#endif // _WIN32
 
 ////////////////////////////////////////////////////////////////////////////////
 // Private data
 ////////////////////////////////////////////////////////////////////////////////
+    AddressFilter        m_blockfilter;       // Addresses of all mapped blocks, so that frees of untracked blocks can skip the map lock.
+    volatile LONG        m_degradation;       // How far tracking has been degraded to stay within the internal memory budget:
+#define VLD_DEGRADE_NONE     0x0              //   Tracking is not degraded.
+#define VLD_DEGRADE_TRUNCATE 0x1              //   Call stacks are truncated.
+#define VLD_DEGRADE_SAMPLE   0x2              //   Call stacks are truncated, and only a sample of the blocks is tracked.
+#define VLD_DEGRADE_COUNT    0x3              //   Blocks are not tracked. Only allocations per call site are counted.
+    SIZE_T               m_epoch;             // Epoch of the most recently captured snapshot.
+    WCHAR                m_excludedfunctionlist [MAXMODULELISTLENGTH]; // Patterns of the functions whose allocations are excluded.
+    RangeTable          *m_excludedranges;    // Code of the functions matching the excluded patterns.
+#ifndef _WIN32
+    volatile LONG        m_handlers;          // Number of threads currently inside the POSIX allocation handlers.
+#endif // _WIN32
+    WCHAR                m_forcedfunctionlist [MAXMODULELISTLENGTH]; // Patterns of the functions whose allocations are forcefully included.
     WCHAR                m_forcedmodulelist [MAXMODULELISTLENGTH]; // List of modules to be forcefully included in leak detection.
+    RangeTable          *m_forcedranges;      // Code of the functions matching the forcefully included patterns.
     HeapMap             *m_heapmap;           // Map of all active heaps in the process.
+#ifdef _WIN32
     IMalloc             *m_imalloc;           // Pointer to the system implementation of IMalloc.
+#endif // _WIN32
+    RangeTable          *m_internalranges;    // Ranges of code internal to the heap, whose frames are left out of call stacks.
+    DWORD                m_lasttick;          // Tick count at which the most recent timestamp was taken.
     SIZE_T               m_leaksfound;        // Total number of leaks found.
+    SIZE_T               m_livebytes;         // Total size of all outstanding blocks.
     ModuleSet           *m_loadedmodules;     // Contains information about all modules loaded in the process.
-    CRITICAL_SECTION     m_loaderlock;        // Serializes the attachment of newly loaded modules.
-    CRITICAL_SECTION     m_maplock;           // Serializes access to the heap and block maps.
+    vldlock_t            m_loaderlock;        // Serializes the attachment of newly loaded modules.
+    vldlock_t            m_maplock;           // Serializes access to the heap and block maps.
     SIZE_T               m_maxdatadump;       // Maximum number of user-data bytes to dump for each leaked block.
+    SIZE_T               m_maxinternalmemory; // Maximum number of bytes VLD may use internally (zero if unlimited).
     UINT32               m_maxtraceframes;    // Maximum number of frames per stack trace for each leaked block.
-    CRITICAL_SECTION     m_moduleslock;       // Protects accesses to the "loaded modules" ModuleSet.
+#ifndef _WIN32
+    SIZE_T               m_moduleloads;       // Number of modules the dynamic linker had loaded when the ModuleSet was last refreshed.
+#endif // _WIN32
+    vldlock_t            m_moduleslock;       // Protects accesses to the "loaded modules" ModuleSet.
+#ifndef _WIN32
+    SIZE_T               m_moduleunloads;     // Number of modules the dynamic linker had unloaded when the ModuleSet was last refreshed.
+#endif // _WIN32
+    UINT32               m_monitorgrowth;     // Number of consecutive intervals of growth after which a call site is flagged.
+    UINT32               m_monitorinterval;   // Leak growth monitor sampling interval, in milliseconds (zero if disabled).
+    HANDLE               m_monitorstop;       // Event signaled to stop the leak growth monitor.
+    HANDLE               m_monitorstopped;    // Event signaled by the leak growth monitor once it has stopped.
+    HANDLE               m_monitorthread;     // Leak growth monitor thread.
     UINT32               m_options;           // Configuration options:
-#define VLD_OPT_AGGREGATE_DUPLICATES    0x1   //   If set, aggregate duplicate leaks in the leak report.
-#define VLD_OPT_MODULE_LIST_INCLUDE     0x2   //   If set, modules in the module list are included, all others are excluded.
-#define VLD_OPT_REPORT_TO_DEBUGGER      0x4   //   If set, the memory leak report is sent to the debugger.
-#define VLD_OPT_REPORT_TO_FILE          0x8   //   If set, the memory leak report is sent to a file.
-#define VLD_OPT_SAFE_STACK_WALK         0x10  //   If set, the stack is walked using the "safe" method (StackWalk64).
-#define VLD_OPT_SELF_TEST               0x20  //   If set, peform a self-test to verify memory leak self-checking.
-#define VLD_OPT_SLOW_DEBUGGER_DUMP      0x40  //   If set, inserts a slight delay between sending output to the debugger.
-#define VLD_OPT_START_DISABLED          0x80  //   If set, memory leak detection will initially disabled.
-#define VLD_OPT_TRACE_INTERNAL_FRAMES   0x100 //   If set, include useless frames (e.g. internal to VLD) in call stacks.
-#define VLD_OPT_UNICODE_REPORT          0x200 //   If set, the leak report will be encoded UTF-16 instead of ASCII.
-#define VLD_OPT_VLDOFF                  0x400 //   If set, VLD will be completely deactivated. It will not attach to any modules.
+#define VLD_OPT_AGGREGATE_DUPLICATES    0x1    //   If set, aggregate duplicate leaks in the leak report.
+#define VLD_OPT_MODULE_LIST_INCLUDE     0x2    //   If set, modules in the module list are included, all others are excluded.
+#define VLD_OPT_REPORT_TO_DEBUGGER      0x4    //   If set, the memory leak report is sent to the debugger.
+#define VLD_OPT_REPORT_TO_FILE          0x8    //   If set, the memory leak report is sent to a file.
+#define VLD_OPT_SAFE_STACK_WALK         0x10   //   If set, the stack is walked using the "safe" method (StackWalk64).
+#define VLD_OPT_SELF_TEST               0x20   //   If set, peform a self-test to verify memory leak self-checking.
+#define VLD_OPT_SLOW_DEBUGGER_DUMP      0x40   //   If set, inserts a slight delay between sending output to the debugger.
+#define VLD_OPT_START_DISABLED          0x80   //   If set, memory leak detection will initially disabled.
+#define VLD_OPT_TRACE_INTERNAL_FRAMES   0x100  //   If set, include useless frames (e.g. internal to VLD) in call stacks.
+#define VLD_OPT_UNICODE_REPORT          0x200  //   If set, the leak report will be encoded UTF-16 instead of ASCII.
+#define VLD_OPT_VLDOFF                  0x400  //   If set, VLD will be completely deactivated. It will not attach to any modules.
+#define VLD_OPT_REPORT_SITES            0x800  //   If set, outstanding memory per call site is reported at exit.
+#define VLD_OPT_CLASSIFY_LEAKS          0x1000 //   If set, leaks are classified by scanning memory for references to them.
+#define VLD_OPT_MONITOR_STATS           0x2000 //   If set, the leak growth monitor also reports statistics every interval.
+#ifdef _WIN32
     static patchentry_t  m_patchtable [];     // Table of imports patched for attaching VLD to other modules.
+#endif // _WIN32
+    SIZE_T               m_peakbytes;         // Largest total size all outstanding blocks have ever reached.
+    ULONGLONG            m_perffrequency;     // Frequency of the performance counter, in ticks per second.
+#ifndef _WIN32
+    volatile LONG        m_refreshing;        // Set while a thread is refreshing the "loaded modules" ModuleSet.
+#endif // _WIN32
     FILE                *m_reportfile;        // File where the memory leak report may be sent to.
     WCHAR                m_reportfilepath [MAX_PATH]; // Full path and name of file to send memory leak report to.
+    retiredinfo_t       *m_retiredlist;       // List of block information retired while snapshots are outstanding.
+#ifndef _WIN32
+    ModuleSetSet        *m_retiredmodules;    // Superseded sets of loaded modules that threads may still be searching.
+#endif // _WIN32
+    RangeTableSet       *m_retiredranges;     // Superseded tables of ranges that threads may still be searching.
+    volatile LONG        m_sampleallocs;      // Number of allocations made by all threads while only a sample of the blocks is tracked.
     const char          *m_selftestfile;      // Filename where the memory leak self-test block is leaked.
     int                  m_selftestline;      // Line number where the memory leak self-test block is leaked.
+    SIZE_T               m_serialnumber;      // Serial number to be assigned to the next allocated block.
+    EpochSet            *m_snapshotepochs;    // Epochs of all outstanding snapshots.
+    StackMap            *m_stackmap;          // The stack depot: all call stacks from which blocks have been allocated.
+    ULONGLONG            m_starttime;         // Value of the performance counter when VLD was initialized.
     UINT32               m_status;            // Status flags:
 #define VLD_STATUS_DBGHELPLINKED        0x1   //   If set, the explicit dynamic link to the Debug Help Library succeeded.
 #define VLD_STATUS_INSTALLED            0x2   //   If set, VLD was successfully installed.
 #define VLD_STATUS_NEVER_ENABLED        0x4   //   If set, VLD started disabled, and has not yet been manually enabled.
 #define VLD_STATUS_FORCE_REPORT_TO_FILE 0x8   //   If set, the leak report is being forced to a file.
-    DWORD                m_tlsindex;          // Thread-local storage index.
-    CRITICAL_SECTION     m_tlslock;           // Protects accesses to the Set of TLS structures.
+    WCHAR                m_suppressionfilepath [MAX_PATH]; // Full path and name of the suppression file (empty if none).
+    SuppressionList     *m_suppressions;      // Signatures of the leaks left out of leak reports (NULL if none).
+    DWORD                m_tickwraps;         // Number of times the tick count has wrapped around to zero.
+    vldtls_t             m_tlsindex;          // Thread-local storage index.
+    vldlock_t            m_tlslock;           // Protects accesses to the Set of TLS structures.
     TlsSet              *m_tlsset;            // Set of all all thread-local storage structres for the process.
+    WCHAR                m_tracefilepath [MAX_PATH]; // Full path and name of the file to record a trace in (empty if not tracing).
+    UINT32               m_tracestacks;       // Number of call stacks that have been written to the trace file.
+    TraceWriter         *m_tracewriter;       // Writes the trace file (NULL if not tracing).
+#ifndef _WIN32
+    RangeTable          *m_unknowncallers;    // Return addresses found in no loaded module (e.g. in code generated at run time).
+#endif // _WIN32
     HMODULE              m_vldbase;           // Visual Leak Detector's own module handle (base address).
 
     // The Visual Leak Detector APIs are our friends.
     friend __declspec(dllexport) void VLDDisable ();
     friend __declspec(dllexport) void VLDEnable ();
+    friend __declspec(dllexport) SIZE_T VLDGetHeapStats (VLD_HEAP_STATS *stats, SIZE_T max);
+    friend __declspec(dllexport) UINT VLDGetLeaksCount ();
+    friend __declspec(dllexport) SIZE_T VLDGetSiteStats (VLD_SITE_STATS *stats, SIZE_T max);
+    friend __declspec(dllexport) void VLDGetStats (VLD_STATS *stats);
+    friend __declspec(dllexport) SIZE_T VLDMarkCheckpoint ();
+    friend __declspec(dllexport) SIZE_T VLDReportAges ();
+    friend __declspec(dllexport) UINT VLDReportLeaks ();
+    friend __declspec(dllexport) UINT VLDReportOlderThan (SIZE_T age);
+    friend __declspec(dllexport) UINT VLDReportSince (SIZE_T checkpoint);
+    friend __declspec(dllexport) SIZE_T VLDReportSites ();
+    friend __declspec(dllexport) void VLDReportStats ();
+    friend __declspec(dllexport) void VLDTrackAlloc (LPCVOID mem, SIZE_T size);
+    friend __declspec(dllexport) void VLDTrackAllocs (LPCVOID const *mems, SIZE_T count, SIZE_T size);
+    friend __declspec(dllexport) void VLDTrackAllocsFrom (LPCVOID const *mems, LPCVOID const *callers, SIZE_T count,
+                                                          SIZE_T size);
+    friend __declspec(dllexport) void VLDTrackFree (LPCVOID mem);
+    friend __declspec(dllexport) void VLDTrackFrees (LPCVOID const *mems, SIZE_T count);
+    friend __declspec(dllexport) void VLDTrackRealloc (LPCVOID mem, LPCVOID newmem, SIZE_T size);
+
+    // The trace replay tool drives the tracking engine directly.
+    friend class TraceReplayer;
 };
 
 // Configuration option default values
 #define VLD_DEFAULT_MAX_DATA_DUMP    256
 #define VLD_DEFAULT_MAX_TRACE_FRAMES 64
+#define VLD_DEFAULT_MONITOR_GROWTH   5
+#ifdef _WIN32
 #define VLD_DEFAULT_REPORT_FILE_NAME L".\\memory_leak_report.txt"
+#else
+#define VLD_DEFAULT_REPORT_FILE_NAME L"./memory_leak_report.txt"
+#endif // _WIN32
+
+// Limits applied when tracking is degraded to stay within the internal memory
+// budget.
+#define VLD_DEGRADED_MAX_TRACE_FRAMES 8  // Maximum number of frames per stack trace once call stacks are truncated.
+#define VLD_DEGRADED_SAMPLE_INTERVAL  16 // One in this many blocks is tracked once tracking is sampled.
@@ -0,0 +1,2403 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Visual Leak Detector - POSIX Backend
+//  Copyright (c) 2005-2009 Dan Moulding
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2.1 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+//
+//  See COPYING.txt for the full terms of the GNU Lesser General Public License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+#include <dlfcn.h>
+#include <link.h>
+#include <new>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VLDBUILD         // Declares that we are building Visual Leak Detector.
+#include "callstack.h"   // Provides a class for handling call stacks.
+#include "map.h"         // Provides a lightweight STL-like map template.
+#include "platform.h"    // Provides the platform services.
+#include "set.h"         // Provides a lightweight STL-like set template.
+#include "symbolizer.h"  // Provides symbol handling services.
+#include "utility.h"     // Provides various utility functions.
+#include "vldheap.h"     // Provides internal new and delete operators.
+#include "vldint.h"      // Provides access to the Visual Leak Detector internals.
+
+#define BOOTSTRAPSIZE     0x2000 // Size, in bytes, of the buffer that satisfies allocations made while linking to the real allocator.
+#define HEAPMAPRESERVE    2      // Usually there won't be more than a few heaps in the process, so this should be small.
+#define INTERNALCOUNT     (sizeof(internalfunctions) / sizeof(internalfunctions[0]))
+#define MAXINILINELENGTH  1024   // Maximum length, in characters, of a line in the vld.ini file.
+#define MAXMODULENAME     (NAME_MAX + 1)
+#define MAXPATTERNLENGTH  256    // Maximum length, in characters, of a function or source file pattern.
+#define MAXPATTERNS       32     // Maximum number of patterns in each list of function rules.
+#define MODULESETRESERVE  16     // There are likely to be several modules loaded in the process.
+
+#ifndef __THROW
+#define __THROW
+#endif // __THROW
+
+// Mangled name of size_t, used to build the mangled names of the new operators.
+#if __SIZEOF_SIZE_T__ == __SIZEOF_LONG__
+#define MANGLEDSIZE "m"
+#else
+#define MANGLEDSIZE "j"
+#endif // __SIZEOF_SIZE_T__
+
+// On POSIX systems, VLD doesn't patch anything. The C runtime's allocation
+// functions, and the global new operators, are simply defined here. Because
+// VLD is either linked with the program or preloaded into it (with
+// LD_PRELOAD), the dynamic linker resolves every module's references to these
+// functions, including the C runtime's own, to VLD's definitions. Each
+// definition calls the real allocation function (the next definition in the
+// dynamic linker's search order) and has VLD map, unmap or remap the block.
+//
+// The interposed functions are called from anywhere at any time: before VLD has
+// been constructed, after it has been destroyed, while the real allocation
+// functions are still being looked up, and by the C runtime while VLD itself is
+// tracking an allocation (e.g. while the call stack is being traced). Only the
+// calls made while VLD is installed, and not already busy tracking another
+// allocation on the same thread, are tracked. All others are passed straight
+// through to the real allocation functions.
+
+// Global variables.
+// The one and only VisualLeakDetector object instance. It is constructed before
+// any of the other static objects in the process (except for the Symbolizer,
+// which it uses), and therefore destroyed after all of them, so that it can see
+// all of their allocations and frees.
+__attribute__((init_priority(102))) VisualLeakDetector vld;
+
+// Imported global variables.
+extern vldblockheader_t *vldblocklist;
+extern HANDLE            vldheap;
+extern vldlock_t         vldheaplock;
+
+// All blocks allocated by the interposed allocation functions come from the C
+// runtime's heap. There are no heap handles on POSIX systems, so the heap is
+// identified by the address of a variable instead.
+static BYTE crtheap;
+#define CRTHEAP ((HANDLE)&crtheap)
+
+// The real allocation functions.
+static calloc_t         pcalloc = NULL;
+static dlclose_t        pdlclose = NULL;
+static free_t           pfree = NULL;
+static volatile BOOL    linked = FALSE;
+static malloc_t         pmalloc = NULL;
+static posix_memalign_t pposix_memalign = NULL;
+static realloc_t        prealloc = NULL;
+
+// Memory allocated while linking to the real allocation functions is carved out
+// of the bootstrap buffer. It is never freed.
+static BYTE   bootstrap [BOOTSTRAPSIZE] __attribute__((aligned(16)));
+static SIZE_T bootstrapused = 0;
+
+// System libraries, which are excluded from leak detection unless they are
+// forcefully included. Modules whose names begin with any of these are system
+// libraries.
+static const LPCSTR systemmodules [] = {
+    "ld-", "libc.", "libc-", "libdl.", "libdl-", "libgcc_s.", "libm.", "libm-", "libpthread.", "libpthread-",
+    "librt.", "librt-", "libstdc++."
+};
+
+// Allocation functions internal to the heap, which VLD doesn't interpose itself.
+// Their frames are left out of call stacks, so that the first frame of a block's
+// call stack is where the program allocated it (e.g. the call to the aligned new
+// operator rather than the call from it to aligned_alloc).
+static const LPCSTR internalfunctions [] = {
+    "_Zna" MANGLEDSIZE "RKSt9nothrow_t", "_Zna" MANGLEDSIZE "St11align_val_t",
+    "_Zna" MANGLEDSIZE "St11align_val_tRKSt9nothrow_t", "_Zna" MANGLEDSIZE, "_Znw" MANGLEDSIZE "RKSt9nothrow_t",
+    "_Znw" MANGLEDSIZE "St11align_val_t", "_Znw" MANGLEDSIZE "St11align_val_tRKSt9nothrow_t", "_Znw" MANGLEDSIZE,
+    "pvalloc", "reallocarray", "valloc"
+};
+
+// Context passed to addmatchingfunction while the function rules are being
+// resolved for a module.
+typedef struct functionrules_s {
+    SIZE_T    count;                                    // Number of patterns.
+    CHAR      patterns [MAXPATTERNS][MAXPATTERNLENGTH]; // Patterns of function names or (if they contain a "/") source files.
+    RangeList ranges;                                   // Ranges of the functions matching any of the patterns.
+} functionrules_t;
+
+// Context passed to addloadedmodule while the set of loaded modules is being
+// refreshed.
+typedef struct modulerefresh_s {
+    ModuleSet *newmodules; // The new set of loaded modules, being built.
+    ModuleSet *oldmodules; // The current set of loaded modules.
+} modulerefresh_t;
+
+// Thread local variables. The initial-exec model guarantees that accessing
+// them never allocates memory.
+static __thread BOOL busy __attribute__((tls_model("initial-exec"))) = FALSE;    // Set while the thread is inside VLD's allocation handlers.
+static __thread BOOL linking __attribute__((tls_model("initial-exec"))) = FALSE; // Set while the thread is linking to the real allocation functions.
+
+// Local helper functions.
+static VOID addmatchingfunction (LPCSTR functionname, LPCSTR filename, SIZE_T low, SIZE_T high, LPVOID context);
+static LPVOID bootstrapalloc (SIZE_T size);
+static int countmodules (struct dl_phdr_info *info, size_t size, void *context);
+static UINT getprofileint (LPCWSTR section, LPCWSTR key, UINT defaultvalue, LPCSTR inipath);
+static VOID getprofilestring (LPCWSTR section, LPCWSTR key, LPCWSTR defaultvalue, LPWSTR buffer, SIZE_T size,
+                              LPCSTR inipath);
+static inline BOOL isbootstrap (LPCVOID mem);
+static BOOL linkallocator ();
+static VOID tracemodule (const Symbolizer::moduleinfo_t *moduleinfo, LPVOID context);
+static LPWSTR trimspace (LPWSTR string);
+
+// addmatchingfunction - Callback function for Symbolizer::enumfunctions. Adds
+//   the range of a function to the ranges being collected, if the function's
+//   name, or its source file, matches any of the patterns of a list of function
+//   rules.
+//
+//  - functionname (IN): The function's name.
+//
+//  - filename (IN): Path of the function's source file (NULL if unknown).
+//
+//  - low (IN): Address of the function's first byte.
+//
+//  - high (IN): Address just beyond the end of the function.
+//
+//  - context (IN): Pointer to the functionrules_t collecting the ranges.
+//
+//  Return Value:
+//
+//    None.
+//
+static VOID addmatchingfunction (LPCSTR functionname, LPCSTR filename, SIZE_T low, SIZE_T high, LPVOID context)
+{
+    SIZE_T           index;
+    LPCSTR           pattern;
+    functionrules_t *rules = (functionrules_t*)context;
+
+    for (index = 0; index < rules->count; index++) {
+        pattern = rules->patterns[index];
+        if ((strchr(pattern, '/') != NULL) ? ((filename != NULL) && matchpattern(pattern, filename)) :
+            matchpattern(pattern, functionname)) {
+            rules->ranges.add(low, high);
+            return;
+        }
+    }
+}
+
+// bootstrapalloc - Allocates a memory block from the bootstrap buffer. The
+//   size of each block is stored just before it, so that it can be reallocated.
+//
+//  - size (IN): Size, in bytes, of the block to allocate.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated (zeroed) block, or NULL if the
+//    bootstrap buffer is exhausted.
+//
+LPVOID bootstrapalloc (SIZE_T size)
+{
+    SIZE_T offset;
+    SIZE_T total = ((size + 15) & ~(SIZE_T)15) + 16;
+
+    offset = __sync_fetch_and_add(&bootstrapused, total);
+    if ((offset + total > BOOTSTRAPSIZE) || (total < size)) {
+        return NULL;
+    }
+    *(SIZE_T*)(bootstrap + offset) = size;
+
+    return bootstrap + offset + 16;
+}
+
+// countmodules - Callback function for dl_iterate_phdr. Obtains the number of
+//   modules that the dynamic linker has loaded and unloaded so far. These only
+//   change when modules are loaded or unloaded, so they tell whether the set of
+//   loaded modules needs to be refreshed.
+//
+//  - info (IN): Information about the first module, including the counters.
+//
+//  - size (IN): Size, in bytes, of the information.
+//
+//  - context (IN/OUT): Pointer to an array of two SIZE_Ts, receiving the number
+//      of modules loaded and unloaded.
+//
+//  Return Value:
+//
+//    Always returns non-zero, so that the enumeration stops at the first
+//    module.
+//
+int countmodules (struct dl_phdr_info *info, size_t, void *context)
+{
+    SIZE_T *counts = (SIZE_T*)context;
+
+    counts[0] = (SIZE_T)info->dlpi_adds;
+    counts[1] = (SIZE_T)info->dlpi_subs;
+
+    return 1;
+}
+
+// getprofileint - Reads an integer value from an ini file (see
+//   "getprofilestring").
+//
+//  - section (IN): Name of the section containing the value.
+//
+//  - key (IN): Name of the value.
+//
+//  - defaultvalue (IN): Value to return if the value is missing or blank.
+//
+//  - inipath (IN): Path of the ini file.
+//
+//  Return Value:
+//
+//    Returns the value read from the ini file, or the default value.
+//
+UINT getprofileint (LPCWSTR section, LPCWSTR key, UINT defaultvalue, LPCSTR inipath)
+{
+#define ISIZE 16
+    WCHAR buffer [ISIZE];
+
+    getprofilestring(section, key, L"", buffer, ISIZE, inipath);
+    if (buffer[0] == L'\0') {
+        return defaultvalue;
+    }
+
+    return (UINT)wcstoul(buffer, NULL, 10);
+}
+
+// getprofilestring - Reads a string value from an ini file, much like
+//   GetPrivateProfileString does on Windows. Lines beginning with a semicolon
+//   are comments. Section and value names are not case sensitive.
+//
+//  - section (IN): Name of the section containing the value.
+//
+//  - key (IN): Name of the value.
+//
+//  - defaultvalue (IN): Value to return if the value (or the ini file) is
+//      missing.
+//
+//  - buffer (OUT): Buffer that receives the value.
+//
+//  - size (IN): Size, in characters, of the buffer.
+//
+//  - inipath (IN): Path of the ini file.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID getprofilestring (LPCWSTR section, LPCWSTR key, LPCWSTR defaultvalue, LPWSTR buffer, SIZE_T size,
+                       LPCSTR inipath)
+{
+    LPWSTR end;
+    FILE  *file;
+    BOOL   insection = FALSE;
+    CHAR   line [MAXINILINELENGTH];
+    WCHAR  linew [MAXINILINELENGTH];
+    LPWSTR name;
+    LPWSTR value;
+
+    wcsncpy_s(buffer, size, defaultvalue, _TRUNCATE);
+    file = fopen(inipath, "r");
+    if (file == NULL) {
+        return;
+    }
+    while (fgets(line, MAXINILINELENGTH, file) != NULL) {
+        if (mbstowcs(linew, line, MAXINILINELENGTH) == (size_t)-1) {
+            continue;
+        }
+        linew[MAXINILINELENGTH - 1] = L'\0';
+        name = trimspace(linew);
+        if (*name == L'[') {
+            // Start of a new section.
+            end = wcschr(name, L']');
+            if (end != NULL) {
+                *end = L'\0';
+            }
+            insection = (_wcsicmp(name + 1, section) == 0);
+            continue;
+        }
+        if (!insection || (*name == L';')) {
+            continue;
+        }
+        value = wcschr(name, L'=');
+        if (value == NULL) {
+            continue;
+        }
+        *value++ = L'\0';
+        if (_wcsicmp(trimspace(name), key) == 0) {
+            wcsncpy_s(buffer, size, trimspace(value), _TRUNCATE);
+            break;
+        }
+    }
+    fclose(file);
+}
+
+// isbootstrap - Determines whether a memory block was allocated from the
+//   bootstrap buffer.
+//
+//  - mem (IN): Pointer to the memory block.
+//
+//  Return Value:
+//
+//    Returns TRUE if the block was allocated from the bootstrap buffer.
+//    Otherwise returns FALSE.
+//
+BOOL isbootstrap (LPCVOID mem)
+{
+    return (((PBYTE)mem >= bootstrap) && ((PBYTE)mem < bootstrap + BOOTSTRAPSIZE));
+}
+
+// linkallocator - Links to the real allocation functions, if that hasn't been
+//   done already. Looking them up can itself allocate memory (the dynamic
+//   linker allocates memory for its error messages). Those allocations must be
+//   satisfied from the bootstrap buffer.
+//
+//  Return Value:
+//
+//    Returns TRUE if the real allocation functions are linked. Returns FALSE
+//    if the calling thread is in the middle of linking them.
+//
+BOOL linkallocator ()
+{
+    if (linked) {
+        return TRUE;
+    }
+    if (linking) {
+        return FALSE;
+    }
+
+    linking = TRUE;
+    pcalloc = (calloc_t)dlsym(RTLD_NEXT, "calloc");
+    pfree = (free_t)dlsym(RTLD_NEXT, "free");
+    pmalloc = (malloc_t)dlsym(RTLD_NEXT, "malloc");
+    pposix_memalign = (posix_memalign_t)dlsym(RTLD_NEXT, "posix_memalign");
+    prealloc = (realloc_t)dlsym(RTLD_NEXT, "realloc");
+    linking = FALSE;
+    if ((pcalloc == NULL) || (pfree == NULL) || (pmalloc == NULL) || (pposix_memalign == NULL) ||
+        (prealloc == NULL)) {
+        debugoutputa("ERROR: Visual Leak Detector: Could not find the C runtime's allocation functions.\n");
+        abort();
+    }
+    __sync_synchronize();
+    linked = TRUE;
+
+    return TRUE;
+}
+
+// tracemodule - Callback function for Symbolizer::enummodules. Describes a
+//   loaded module in the trace file, so that call stacks can be symbolized
+//   when the trace is analyzed offline.
+//
+//  - moduleinfo (IN): Describes the module.
+//
+//  - context (IN): Pointer to the TraceWriter.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID tracemodule (const Symbolizer::moduleinfo_t *moduleinfo, LPVOID context)
+{
+    TraceWriter *tracewriter = (TraceWriter*)context;
+
+    tracewriter->writemodule(moduleinfo->low, moduleinfo->high, moduleinfo->bias, moduleinfo->buildid,
+                             moduleinfo->buildidsize, moduleinfo->path);
+}
+
+// trimspace - Removes leading and trailing white space from a string.
+//
+//  - string (IN/OUT): The string to trim. Trailing white space is removed in
+//      place.
+//
+//  Return Value:
+//
+//    Returns a pointer to the first character of the string that is not white
+//    space.
+//
+LPWSTR trimspace (LPWSTR string)
+{
+    SIZE_T length;
+
+    while (iswspace(*string)) {
+        string++;
+    }
+    length = wcslen(string);
+    while ((length > 0) && iswspace(string[length - 1])) {
+        string[--length] = L'\0';
+    }
+
+    return string;
+}
+
+// Constructor - Initializes private data, loads configuration options, and
+//   takes note of all modules loaded into the current process, so that
+//   allocations can be attributed to them.
+//
+VisualLeakDetector::VisualLeakDetector ()
+{
+    WCHAR      bom = BOM; // Unicode byte-order mark.
+    size_t     count;
+    Dl_info    dlinfo;
+    CHAR       filename [MAX_PATH];
+
+    // Initialize configuration options and related private data.
+    wmemset(m_excludedfunctionlist, L'\0', MAXMODULELISTLENGTH);
+    wmemset(m_forcedfunctionlist, L'\0', MAXMODULELISTLENGTH);
+    wmemset(m_forcedmodulelist, L'\0', MAXMODULELISTLENGTH);
+    m_maxdatadump    = 0xffffffff;
+    m_maxtraceframes = 0xffffffff;
+    m_options        = 0x0;
+    m_reportfile     = NULL;
+    wcsncpy_s(m_reportfilepath, MAX_PATH, VLD_DEFAULT_REPORT_FILE_NAME, _TRUNCATE);
+    m_status         = 0x0;
+    m_suppressionfilepath[0] = L'\0';
+    m_tracefilepath[0] = L'\0';
+    m_tracewriter    = NULL;
+
+    // Load configuration options.
+    configure();
+    if (m_options & VLD_OPT_VLDOFF) {
+        report(L"Visual Leak Detector is turned off.\n");
+        return;
+    }
+
+    // Initialize global variables.
+    vldheap           = heapcreate();
+    initlock(&vldheaplock);
+
+    // Initialize remaining private data.
+    m_degradation     = VLD_DEGRADE_NONE;
+    m_epoch           = 0;
+    m_excludedranges  = NULL;
+    m_forcedranges    = NULL;
+    m_handlers        = 0;
+    m_heapmap         = new HeapMap;
+    m_heapmap->reserve(HEAPMAPRESERVE);
+    m_internalranges  = NULL;
+    m_lasttick        = gettickcount();
+    m_leaksfound      = 0;
+    m_livebytes       = 0;
+    m_loadedmodules   = new ModuleSet;
+    m_loadedmodules->reserve(MODULESETRESERVE);
+    initlock(&m_loaderlock);
+    initlock(&m_maplock);
+    m_moduleloads     = (SIZE_T)-1;
+    initlock(&m_moduleslock);
+    m_moduleunloads   = (SIZE_T)-1;
+    m_monitorstop     = NULL;
+    m_monitorstopped  = NULL;
+    m_monitorthread   = NULL;
+    m_peakbytes       = 0;
+    m_perffrequency   = getperffrequency();
+    m_refreshing      = 0;
+    m_retiredlist     = NULL;
+    m_retiredmodules  = new ModuleSetSet;
+    m_retiredranges   = new RangeTableSet;
+    m_sampleallocs    = 0;
+    m_selftestfile    = __FILE__;
+    m_selftestline    = 0;
+    m_serialnumber    = 0;
+    m_snapshotepochs  = new EpochSet;
+    m_stackmap        = new StackMap;
+    m_starttime       = getperfcounter();
+    m_suppressions    = NULL;
+    m_tickwraps       = 0;
+    initlock(&m_tlslock);
+    m_tlsset          = new TlsSet;
+    m_tracestacks     = 0;
+    m_unknowncallers  = NULL;
+    m_vldbase         = (dladdr(&vld, &dlinfo) != 0) ? dlinfo.dli_fbase : NULL;
+
+    if (m_options & VLD_OPT_SELF_TEST) {
+        // Self-test mode has been enabled. Intentionally leak a small amount of
+        // memory so that memory leak self-checking can be verified.
+        if (m_options & VLD_OPT_UNICODE_REPORT) {
+            wcsncpy_s(new WCHAR [wcslen(SELFTESTTEXTW) + 1], wcslen(SELFTESTTEXTW) + 1, SELFTESTTEXTW, _TRUNCATE);
+            m_selftestline = __LINE__ - 1;
+        }
+        else {
+            strncpy(new CHAR [strlen(SELFTESTTEXTA) + 1], SELFTESTTEXTA, strlen(SELFTESTTEXTA) + 1);
+            m_selftestline = __LINE__ - 1;
+        }
+    }
+    if (m_options & VLD_OPT_START_DISABLED) {
+        // Memory leak detection will initially be disabled.
+        m_status |= VLD_STATUS_NEVER_ENABLED;
+    }
+    if (m_options & VLD_OPT_REPORT_TO_FILE) {
+        // Reporting to file enabled.
+        wcstombs_s(&count, filename, MAX_PATH, m_reportfilepath, _TRUNCATE);
+        if (m_options & VLD_OPT_UNICODE_REPORT) {
+            // Unicode data encoding has been enabled. Write the byte-order
+            // mark before anything else gets written to the file.
+            m_reportfile = fopen(filename, "wb");
+            if (m_reportfile != NULL) {
+                fwrite(&bom, sizeof(WCHAR), 1, m_reportfile);
+                setreportencoding(unicode);
+            }
+        }
+        else {
+            m_reportfile = fopen(filename, "w");
+            if (m_reportfile != NULL) {
+                setreportencoding(ascii);
+            }
+        }
+        if (m_reportfile == NULL) {
+            report(L"WARNING: Visual Leak Detector: Couldn't open report file for writing: %s\n"
+                   L"  The report will be sent to the debugger instead.\n", m_reportfilepath);
+        }
+        else {
+            // Set the "report" function to write to the file.
+            setreportfile(m_reportfile, m_options & VLD_OPT_REPORT_TO_DEBUGGER);
+        }
+    }
+    if (m_options & VLD_OPT_SLOW_DEBUGGER_DUMP) {
+        // Insert a slight delay between messages sent to the debugger for
+        // output.
+        insertreportdelay();
+    }
+
+    if (!tlsalloc(&m_tlsindex, threadexit)) {
+        report(L"ERROR: Visual Leak Detector could not be installed because thread local"
+               L"  storage could not be allocated.");
+        return;
+    }
+
+    // Take note of every module loaded in the process. System libraries are
+    // excluded from leak detection.
+    refreshmodules(TRUE);
+    resolveinternalranges();
+
+    if (wcslen(m_suppressionfilepath) != 0) {
+        // Leaks that match the signatures in the suppression file are left
+        // out of leak reports.
+        m_suppressions = new SuppressionList;
+        if (!m_suppressions->load(m_suppressionfilepath)) {
+            report(L"WARNING: Visual Leak Detector: Couldn't open suppression file for reading: %s\n",
+                   m_suppressionfilepath);
+            delete m_suppressions;
+            m_suppressions = NULL;
+        }
+    }
+
+    if (wcslen(m_tracefilepath) != 0) {
+        // Tracing has been enabled. Every block mapped, unmapped or remapped
+        // from now on is recorded in the trace file.
+        m_tracewriter = new TraceWriter;
+        if (!m_tracewriter->open(m_tracefilepath, VIRTUALHEAP)) {
+            report(L"WARNING: Visual Leak Detector: Couldn't open trace file for writing: %s\n", m_tracefilepath);
+            delete m_tracewriter;
+            m_tracewriter = NULL;
+        }
+        else {
+            Symbolizer::enummodules(tracemodule, m_tracewriter);
+        }
+    }
+
+    // Keep VLD's locks consistent across calls to fork.
+    pthread_atfork(forkprepare, forkrelease, forkchild);
+    m_status |= VLD_STATUS_INSTALLED;
+
+    report(L"Visual Leak Detector Version " VLDVERSION L" installed.\n");
+    if (m_status & VLD_STATUS_FORCE_REPORT_TO_FILE) {
+        // The report is being forced to a file. Let the human know why.
+        report(L"NOTE: Visual Leak Detector: Unicode-encoded reporting has been enabled, but the\n"
+               L"  debugger is the only selected report destination. The debugger cannot display\n"
+               L"  Unicode characters, so the report will also be sent to a file. If no file has\n"
+               L"  been specified, the default file name is \"" VLD_DEFAULT_REPORT_FILE_NAME L"\".\n");
+
+    }
+    reportconfig();
+}
+
+// Destructor - Stops tracking allocations, frees internally allocated
+//   resources, and generates the memory leak report.
+//
+//   The interposed allocation functions can still be called after VLD has been
+//   destroyed (by static destructors that run later, and by other threads that
+//   are still running). Those calls aren't tracked, but the global delete
+//   operators still need the private heap to tell VLD's own blocks apart from
+//   all others, and the fork handlers still need VLD's locks. So the private
+//   heap and the locks are left in place.
+//
+VisualLeakDetector::~VisualLeakDetector ()
+{
+    BlockMap::Iterator   blockit;
+    BlockMap            *blockmap;
+    HeapMap::Iterator    heapit;
+    vldblockheader_t    *header;
+    SIZE_T               internalleaks = 0;
+    const char          *leakfile = NULL;
+    WCHAR                leakfilew [MAX_PATH];
+    int                  leakline = 0;
+    ModuleSet::Iterator  moduleit;
+    ModuleSetSet::Iterator modulesetit;
+    stackinfo_t         *nextstack;
+    RangeTableSet::Iterator rangeit;
+    retiredinfo_t       *retired;
+    stackinfo_t         *stack;
+    StackMap::Iterator   stackit;
+    TlsSet::Iterator     tlsit;
+
+    if (m_options & VLD_OPT_VLDOFF) {
+        // VLD has been turned off.
+        return;
+    }
+
+    if (m_status & VLD_STATUS_INSTALLED) {
+        // Stop tracking allocations, and wait for any other threads that are
+        // still tracking an allocation to finish. See "enterhandler".
+        m_status &= ~VLD_STATUS_INSTALLED;
+        __sync_synchronize();
+        while (m_handlers != 0) {
+            delay(1);
+        }
+
+        if (m_tracewriter != NULL) {
+            // Write out the rest of the trace.
+            m_tracewriter->close();
+            delete m_tracewriter;
+            m_tracewriter = NULL;
+        }
+
+        if (m_status & VLD_STATUS_NEVER_ENABLED) {
+            // Visual Leak Detector started with leak detection disabled and
+            // it was never enabled at runtime. A lot of good that does.
+            report(L"WARNING: Visual Leak Detector: Memory leak detection was never enabled.\n");
+        }
+        else {
+            // Generate a memory leak report for all heaps in the process,
+            // headed by the statistics.
+            reportstats();
+            reportleaks(NULL);
+
+            // Show a summary.
+            if (m_leaksfound == 0) {
+                report(L"No memory leaks detected.\n");
+            }
+            else {
+                report(L"Visual Leak Detector detected %lu memory leak", m_leaksfound);
+                report((m_leaksfound > 1) ? L"s.\n" : L".\n");
+            }
+            if (readcounter(&m_degradation) >= VLD_DEGRADE_SAMPLE) {
+                report(L"NOTE: Visual Leak Detector: Not every block was tracked, to stay within the internal memory\n"
+                       L"  limit. Some memory leaks may not have been detected.\n");
+            }
+
+            if (m_options & VLD_OPT_REPORT_SITES) {
+                // Also show where the outstanding memory was allocated from,
+                // by call site.
+                reportsites();
+            }
+        }
+
+        // Free internally allocated resources used by the heapmap and blockmap.
+        for (heapit = m_heapmap->begin(); heapit != m_heapmap->end(); ++heapit) {
+            blockmap = &(*heapit).second->blockmap;
+            for (blockit = blockmap->begin(); blockit != blockmap->end(); ++blockit) {
+                delete (*blockit).second;
+            }
+            delete (*heapit).second;
+        }
+        delete m_heapmap;
+
+        // Free any block information still waiting to be reclaimed. All
+        // snapshots have been freed by now, so nothing references it anymore.
+        while (m_retiredlist != NULL) {
+            retired = m_retiredlist;
+            m_retiredlist = retired->next;
+            delete retired->info;
+            delete retired;
+        }
+        delete m_snapshotepochs;
+
+        // Free internally allocated resources used by the stack depot.
+        for (stackit = m_stackmap->begin(); stackit != m_stackmap->end(); ++stackit) {
+            stack = (*stackit).second;
+            while (stack != NULL) {
+                nextstack = stack->next;
+                delete stack->callstack;
+                delete stack;
+                stack = nextstack;
+            }
+        }
+        delete m_stackmap;
+
+        // Free internally allocated resources used by the loaded module set.
+        for (moduleit = m_loadedmodules->begin(); moduleit != m_loadedmodules->end(); ++moduleit) {
+            delete (*moduleit).name;
+            delete (*moduleit).path;
+        }
+        delete m_loadedmodules;
+        delete m_excludedranges;
+        delete m_forcedranges;
+        delete m_internalranges;
+        for (modulesetit = m_retiredmodules->begin(); modulesetit != m_retiredmodules->end(); ++modulesetit) {
+            delete *modulesetit;
+        }
+        delete m_retiredmodules;
+        for (rangeit = m_retiredranges->begin(); rangeit != m_retiredranges->end(); ++rangeit) {
+            delete *rangeit;
+        }
+        delete m_retiredranges;
+        delete m_suppressions;
+        delete m_unknowncallers;
+
+        // Free internally allocated resources used for thread local storage.
+        // Other threads may still be running, so the index itself is not
+        // freed. The threads will find that VLD is no longer installed before
+        // they look up their thread local storage.
+        for (tlsit = m_tlsset->begin(); tlsit != m_tlsset->end(); ++tlsit) {
+            delete *tlsit;
+        }
+        delete m_tlsset;
+
+        // Free resources used by the symbolizer.
+        symbolizer.cleanup();
+
+        // Do a memory leak self-check.
+        header = vldblocklist;
+        while (header) {
+            // Doh! VLD still has an internally allocated block!
+            // This won't ever actually happen, right guys?... guys?
+            internalleaks++;
+            leakfile = header->file;
+            leakline = header->line;
+            mbstowcs(leakfilew, leakfile, MAX_PATH);
+            leakfilew[MAX_PATH - 1] = L'\0';
+            report(L"ERROR: Visual Leak Detector: Detected a memory leak internal to Visual Leak Detector!!\n");
+            report(L"---------- Block %ld at " ADDRESSFORMAT L": %lu bytes ----------\n", header->serialnumber,
+                   VLDBLOCKDATA(header), header->size);
+            report(L"  Call Stack:\n");
+            report(L"    %s (%d): Full call stack not available.\n", leakfilew, leakline);
+            if (m_maxdatadump != 0) {
+                report(L"  Data:\n");
+                if (m_options & VLD_OPT_UNICODE_REPORT) {
+                    dumpmemoryw(VLDBLOCKDATA(header), (m_maxdatadump < header->size) ? m_maxdatadump : header->size);
+                }
+                else {
+                    dumpmemorya(VLDBLOCKDATA(header), (m_maxdatadump < header->size) ? m_maxdatadump : header->size);
+                }
+            }
+            report(L"\n");
+            header = header->next;
+        }
+        if (m_options & VLD_OPT_SELF_TEST) {
+            if ((internalleaks == 1) && (strcmp(leakfile, m_selftestfile) == 0) && (leakline == m_selftestline)) {
+                report(L"Visual Leak Detector passed the memory leak self-test.\n");
+            }
+            else {
+                report(L"ERROR: Visual Leak Detector: Failed the memory leak self-test.\n");
+            }
+        }
+
+        report(L"Visual Leak Detector is now exiting.\n");
+    }
+    else {
+        // VLD failed to load properly.
+        delete m_excludedranges;
+        delete m_forcedranges;
+        delete m_heapmap;
+        delete m_internalranges;
+        for (modulesetit = m_retiredmodules->begin(); modulesetit != m_retiredmodules->end(); ++modulesetit) {
+            delete *modulesetit;
+        }
+        delete m_retiredmodules;
+        for (rangeit = m_retiredranges->begin(); rangeit != m_retiredranges->end(); ++rangeit) {
+            delete *rangeit;
+        }
+        delete m_retiredranges;
+        delete m_snapshotepochs;
+        delete m_stackmap;
+        delete m_suppressions;
+        delete m_tlsset;
+        delete m_unknowncallers;
+    }
+
+    if (m_reportfile != NULL) {
+        setreportfile(NULL, FALSE);
+        fclose(m_reportfile);
+        m_reportfile = NULL;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Private Leak Detection Functions
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// acquiremodules - Obtains the set of loaded modules, so that the calling thread
+//   can search it without holding any lock. The set is never modified once it
+//   is in use, and it is not freed, even if it is superseded, until the thread
+//   calls "releasemodules".
+//
+//  - tls (IN): Pointer to the calling thread's thread local storage structure.
+//
+//  Return Value:
+//
+//    Returns a pointer to the set of loaded modules.
+//
+const ModuleSet* VisualLeakDetector::acquiremodules (tls_t *tls)
+{
+    const ModuleSet *modules;
+
+    do {
+        // The set may be superseded, and found not to be in use, after it is
+        // read but before the thread says it is using it. In that case, it
+        // may already have been freed, so the new set is read instead.
+        modules = acquirecounter(&m_loadedmodules);
+        orderedstore(&tls->modules, modules);
+    } while (orderedload(&m_loadedmodules) != modules);
+
+    return modules;
+}
+
+// configure - Configures VLD using values read from the vld.ini file. The file
+//   is looked for in the working directory first. Otherwise its location is
+//   taken from the VLD_INI environment variable. As a last resort, it is looked
+//   for in the system configuration directory.
+//
+//   The leak growth monitor and leak classification are not available on
+//   POSIX systems, so their options are ignored. The symbol cache is only used
+//   on POSIX systems.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::configure ()
+{
+#define BSIZE 64
+    WCHAR       buffer [BSIZE];
+    CHAR        directory [MAX_PATH];
+    LPCSTR      environment;
+    WCHAR       filename [MAX_PATH];
+    CHAR        inipath [MAX_PATH];
+    struct stat s;
+
+    if (stat("./vld.ini", &s) == 0) {
+        // Found a copy of vld.ini in the working directory. Use it.
+        strncpy(inipath, "./vld.ini", MAX_PATH);
+    }
+    else {
+        // Get the location of the vld.ini file from the environment.
+        environment = getenv("VLD_INI");
+        if ((environment != NULL) && (stat(environment, &s) == 0)) {
+            strncpy(inipath, environment, MAX_PATH);
+            inipath[MAX_PATH - 1] = '\0';
+        }
+        else {
+            // The location of vld.ini could not be read from the environment.
+            // As a last resort, look in the system configuration directory.
+            strncpy(inipath, "/etc/vld.ini", MAX_PATH);
+        }
+    }
+
+    // Read the boolean options.
+    getprofilestring(L"Options", L"VLD", L"on", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == FALSE) {
+        m_options |= VLD_OPT_VLDOFF;
+        return;
+    }
+
+    getprofilestring(L"Options", L"AggregateDuplicates", L"", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == TRUE) {
+        m_options |= VLD_OPT_AGGREGATE_DUPLICATES;
+    }
+
+    getprofilestring(L"Options", L"ReportSites", L"", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == TRUE) {
+        m_options |= VLD_OPT_REPORT_SITES;
+    }
+
+    getprofilestring(L"Options", L"SelfTest", L"", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == TRUE) {
+        m_options |= VLD_OPT_SELF_TEST;
+    }
+
+    getprofilestring(L"Options", L"SlowDebuggerDump", L"", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == TRUE) {
+        m_options |= VLD_OPT_SLOW_DEBUGGER_DUMP;
+    }
+
+    getprofilestring(L"Options", L"StartDisabled", L"", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == TRUE) {
+        m_options |= VLD_OPT_START_DISABLED;
+    }
+
+    getprofilestring(L"Options", L"TraceInternalFrames", L"", buffer, BSIZE, inipath);
+    if (strtobool(buffer) == TRUE) {
+        m_options |= VLD_OPT_TRACE_INTERNAL_FRAMES;
+    }
+
+    // Read the integer configuration options.
+    m_maxdatadump = getprofileint(L"Options", L"MaxDataDump", VLD_DEFAULT_MAX_DATA_DUMP, inipath);
+    m_maxinternalmemory = (SIZE_T)getprofileint(L"Options", L"MaxInternalMemory", 0, inipath) * 1024;
+    m_maxtraceframes = getprofileint(L"Options", L"MaxTraceFrames", VLD_DEFAULT_MAX_TRACE_FRAMES, inipath);
+    if (m_maxtraceframes < 1) {
+        m_maxtraceframes = VLD_DEFAULT_MAX_TRACE_FRAMES;
+    }
+    m_monitorinterval = 0;
+    m_monitorgrowth = VLD_DEFAULT_MONITOR_GROWTH;
+
+    // Read the force-include module list.
+    getprofilestring(L"Options", L"ForceIncludeModules", L"", m_forcedmodulelist, MAXMODULELISTLENGTH, inipath);
+
+    // Read the function rules.
+    getprofilestring(L"Options", L"ExcludeFunctions", L"", m_excludedfunctionlist, MAXMODULELISTLENGTH, inipath);
+    getprofilestring(L"Options", L"ForceIncludeFunctions", L"", m_forcedfunctionlist, MAXMODULELISTLENGTH, inipath);
+
+    // Read the report destination (debugger, file, or both).
+    getprofilestring(L"Options", L"ReportFile", L"", filename, MAX_PATH, inipath);
+    if (wcslen(filename) == 0) {
+        wcsncpy_s(filename, MAX_PATH, VLD_DEFAULT_REPORT_FILE_NAME, _TRUNCATE);
+    }
+    if ((filename[0] != L'/') && (getcwd(directory, MAX_PATH) != NULL)) {
+        // Relative paths are relative to the working directory.
+        mbstowcs(m_reportfilepath, directory, MAX_PATH);
+        m_reportfilepath[MAX_PATH - 1] = L'\0';
+        wcsncat_s(m_reportfilepath, MAX_PATH, L"/", _TRUNCATE);
+        wcsncat_s(m_reportfilepath, MAX_PATH, (wcsncmp(filename, L"./", 2) == 0) ? filename + 2 : filename, _TRUNCATE);
+    }
+    else {
+        wcsncpy_s(m_reportfilepath, MAX_PATH, filename, _TRUNCATE);
+    }
+    getprofilestring(L"Options", L"ReportTo", L"", buffer, BSIZE, inipath);
+    if (_wcsicmp(buffer, L"both") == 0) {
+        m_options |= (VLD_OPT_REPORT_TO_DEBUGGER | VLD_OPT_REPORT_TO_FILE);
+    }
+    else if (_wcsicmp(buffer, L"file") == 0) {
+        m_options |= VLD_OPT_REPORT_TO_FILE;
+    }
+    else {
+        m_options |= VLD_OPT_REPORT_TO_DEBUGGER;
+    }
+
+    // Read the report file encoding (ascii or unicode).
+    getprofilestring(L"Options", L"ReportEncoding", L"", buffer, BSIZE, inipath);
+    if (_wcsicmp(buffer, L"unicode") == 0) {
+        m_options |= VLD_OPT_UNICODE_REPORT;
+    }
+    if ((m_options & VLD_OPT_UNICODE_REPORT) && !(m_options & VLD_OPT_REPORT_TO_FILE)) {
+        // If Unicode report encoding is enabled, then the report needs to be
+        // sent to a file because the debugger will not display Unicode
+        // characters, it will display question marks in their place instead.
+        m_options |= VLD_OPT_REPORT_TO_FILE;
+        m_status |= VLD_STATUS_FORCE_REPORT_TO_FILE;
+    }
+
+    // Read the stack walking method.
+    getprofilestring(L"Options", L"StackWalkMethod", L"", buffer, BSIZE, inipath);
+    if (_wcsicmp(buffer, L"safe") == 0) {
+        m_options |= VLD_OPT_SAFE_STACK_WALK;
+    }
+
+    // Read the trace file. Relative paths are relative to the working
+    // directory.
+    getprofilestring(L"Options", L"TraceFile", L"", filename, MAX_PATH, inipath);
+    if ((wcslen(filename) != 0) && (filename[0] != L'/') && (getcwd(directory, MAX_PATH) != NULL)) {
+        mbstowcs(m_tracefilepath, directory, MAX_PATH);
+        m_tracefilepath[MAX_PATH - 1] = L'\0';
+        wcsncat_s(m_tracefilepath, MAX_PATH, L"/", _TRUNCATE);
+        wcsncat_s(m_tracefilepath, MAX_PATH, (wcsncmp(filename, L"./", 2) == 0) ? filename + 2 : filename, _TRUNCATE);
+    }
+    else {
+        wcsncpy_s(m_tracefilepath, MAX_PATH, filename, _TRUNCATE);
+    }
+
+    // Read the suppression file. Relative paths are relative to the working
+    // directory.
+    getprofilestring(L"Options", L"SuppressionFile", L"", filename, MAX_PATH, inipath);
+    if ((wcslen(filename) != 0) && (filename[0] != L'/') && (getcwd(directory, MAX_PATH) != NULL)) {
+        mbstowcs(m_suppressionfilepath, directory, MAX_PATH);
+        m_suppressionfilepath[MAX_PATH - 1] = L'\0';
+        wcsncat_s(m_suppressionfilepath, MAX_PATH, L"/", _TRUNCATE);
+        wcsncat_s(m_suppressionfilepath, MAX_PATH, (wcsncmp(filename, L"./", 2) == 0) ? filename + 2 : filename,
+                  _TRUNCATE);
+    }
+    else {
+        wcsncpy_s(m_suppressionfilepath, MAX_PATH, filename, _TRUNCATE);
+    }
+
+    // Read the symbol cache directory. By default, symbols are cached in the
+    // user's cache directory, as given by the XDG base directory specification.
+    getprofilestring(L"Options", L"SymbolCache", L"", filename, MAX_PATH, inipath);
+    if (_wcsicmp(filename, L"none") == 0) {
+        symbolizer.setcachedirectory(NULL);
+    }
+    else if (wcslen(filename) != 0) {
+        if (wcstombs(directory, filename, MAX_PATH) != (SIZE_T)-1) {
+            directory[MAX_PATH - 1] = '\0';
+            symbolizer.setcachedirectory(directory);
+        }
+    }
+    else if ((environment = getenv("XDG_CACHE_HOME")) != NULL) {
+        snprintf(directory, MAX_PATH, "%s/vld", environment);
+        symbolizer.setcachedirectory(directory);
+    }
+    else if ((environment = getenv("HOME")) != NULL) {
+        snprintf(directory, MAX_PATH, "%s/.cache/vld", environment);
+        symbolizer.setcachedirectory(directory);
+    }
+}
+
+// enterhandler - Enters one of the POSIX allocation handlers. Allocations are
+//   only tracked while VLD is installed, and not while the calling thread is
+//   already inside VLD's code (where the C runtime allocates memory of its own,
+//   e.g. when the call stack is traced). The number of threads inside the
+//   handlers is counted, so that VLD's destructor can wait for them to leave
+//   before it frees the block maps.
+//
+//  Return Value:
+//
+//    Returns TRUE if the calling thread may track the allocation, in which
+//    case it must call "leavehandler" when it is done. Otherwise returns FALSE.
+//
+BOOL VisualLeakDetector::enterhandler ()
+{
+    if (busy || !(m_status & VLD_STATUS_INSTALLED)) {
+        return FALSE;
+    }
+
+    busy = TRUE;
+    InterlockedIncrement(&m_handlers);
+    if (!(m_status & VLD_STATUS_INSTALLED)) {
+        // VLD is being destroyed.
+        InterlockedDecrement(&m_handlers);
+        busy = FALSE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// excludedcaller - Determines whether the module that initiated the current
+//   allocation is excluded from leak detection, unless the function rules say
+//   otherwise (see "excludedfunction"). The module is looked up in the set of
+//   loaded modules without taking any lock. Only if the caller is in none of
+//   the modules is the set refreshed, and if it still isn't, the caller is
+//   remembered as unknown, so that it doesn't cause the set to be refreshed
+//   again until the modules change.
+//
+//  - framepointer (IN): Frame pointer at the time the allocation first entered
+//      VLD's code. The return address in this frame is in the module that
+//      initiated the allocation.
+//
+//  Return Value:
+//
+//    Returns TRUE if the allocation is excluded from leak detection. Otherwise
+//    returns FALSE.
+//
+BOOL VisualLeakDetector::excludedcaller (SIZE_T framepointer)
+{
+    BOOL              excluded = FALSE;
+    addressrange_t    range;
+    const RangeTable *ranges;
+    SIZE_T            returnaddress;
+    tls_t            *tls = gettls();
+    BOOL              unknown;
+
+    returnaddress = *((SIZE_T*)framepointer + 1);
+    if (!findcaller(tls, returnaddress, &excluded)) {
+        ranges = acquireranges(tls, &m_unknowncallers);
+        unknown = (ranges != NULL) && ranges->contains(returnaddress);
+        releaseranges(tls);
+
+        // The caller may be in a module that has been loaded since the set of
+        // loaded modules was last refreshed. The calling thread may be inside
+        // the dynamic linker, so it must not wait for another thread that is
+        // already refreshing the set.
+        if (!unknown && refreshmodules(FALSE)) {
+            // The set may be refreshed again by another thread in the meantime,
+            // which forgets the unknown callers.
+            enterlock(&m_moduleslock);
+            if (!findcaller(tls, returnaddress, &excluded)) {
+                range.high = returnaddress + 1;
+                range.low = returnaddress;
+                addranges(&m_unknowncallers, &range, 1);
+            }
+            leavelock(&m_moduleslock);
+        }
+    }
+
+    return excludedfunction(returnaddress, excluded);
+}
+
+// findcaller - Looks up the module containing a return address in the set of
+//   loaded modules, without taking any lock (see "acquiremodules").
+//
+//  - tls (IN): Pointer to the calling thread's thread local storage structure.
+//
+//  - returnaddress (IN): The return address to look up.
+//
+//  - excluded (OUT): If the module is found, receives TRUE if it is excluded
+//      from leak detection, or FALSE if it isn't.
+//
+//  Return Value:
+//
+//    Returns TRUE if the module was found. Otherwise returns FALSE.
+//
+BOOL VisualLeakDetector::findcaller (tls_t *tls, SIZE_T returnaddress, BOOL *excluded)
+{
+    BOOL                 found = FALSE;
+    moduleinfo_t         moduleinfo;
+    ModuleSet::Iterator  moduleit;
+    const ModuleSet     *modules;
+
+    moduleinfo.addrhigh = returnaddress;
+    moduleinfo.addrlow  = returnaddress;
+    modules = acquiremodules(tls);
+    moduleit = modules->find(moduleinfo);
+    if (moduleit != modules->end()) {
+        *excluded = ((*moduleit).flags & VLD_MODULE_EXCLUDED) ? TRUE : FALSE;
+        found = TRUE;
+    }
+    releasemodules(tls);
+
+    return found;
+}
+
+// leavehandler - Leaves one of the POSIX allocation handlers, previously
+//   entered by "enterhandler".
+//
+//  - start (IN): Value of the performance counter when the handler began
+//      tracking the allocation.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::leavehandler (ULONGLONG start)
+{
+    addcounter(&gettls()->time, getperfcounter() - start);
+    InterlockedDecrement(&m_handlers);
+    busy = FALSE;
+}
+
+// refreshmodules - Brings the set of loaded modules up to date, if any modules
+//   have been loaded or unloaded since it was last refreshed. The set is never
+//   modified once it is in use. Instead, a new set is built and then replaces
+//   the current one (see "setmodules"). Only the newly loaded modules need to
+//   be examined: the entries of modules that are still loaded are carried over
+//   from the current set, along with their names and paths.
+//
+//  - wait (IN): If TRUE, and another thread is already refreshing the set,
+//      then wait for it to finish and refresh the set again. If FALSE, then
+//      leave the refreshing to the other thread.
+//
+//  Return Value:
+//
+//    Returns TRUE if the set is up to date. Returns FALSE if the refreshing was
+//    left to another thread.
+//
+BOOL VisualLeakDetector::refreshmodules (BOOL wait)
+{
+    SIZE_T               counts [2];
+    ModuleSet            loaded;
+    ModuleSet::Iterator  newit;
+    ModuleSet::Iterator  oldit;
+    modulerefresh_t      refresh;
+    ModuleSet            unloaded;
+
+    while (InterlockedCompareExchange(&m_refreshing, 1, 0) != 0) {
+        if (!wait) {
+            return FALSE;
+        }
+        delay(1);
+    }
+
+    dl_iterate_phdr(countmodules, counts);
+    if ((counts[0] == m_moduleloads) && (counts[1] == m_moduleunloads)) {
+        // No modules have been loaded or unloaded.
+        InterlockedExchange(&m_refreshing, 0);
+        return TRUE;
+    }
+
+    // Only refreshing threads replace the set, so the current set can be read
+    // without acquiring it.
+    refresh.newmodules = new ModuleSet;
+    refresh.newmodules->reserve(MODULESETRESERVE);
+    refresh.oldmodules = m_loadedmodules;
+    dl_iterate_phdr(addloadedmodule, &refresh);
+
+    // Find the modules that have been unloaded, which weren't carried over to
+    // the new set, and the modules that have been loaded. The current set may
+    // be freed as soon as it is replaced.
+    for (oldit = refresh.oldmodules->begin(); oldit != refresh.oldmodules->end(); ++oldit) {
+        newit = refresh.newmodules->find(*oldit);
+        if ((newit == refresh.newmodules->end()) || ((*newit).path != (*oldit).path)) {
+            unloaded.insert(*oldit);
+        }
+    }
+    for (newit = refresh.newmodules->begin(); newit != refresh.newmodules->end(); ++newit) {
+        oldit = refresh.oldmodules->find(*newit);
+        if ((oldit == refresh.oldmodules->end()) || ((*oldit).path != (*newit).path)) {
+            loaded.insert(*newit);
+        }
+    }
+
+    // Start using the new set of loaded modules. Callers that were in none of
+    // the old modules may be in one of the new ones.
+    enterlock(&m_moduleslock);
+    setmodules(refresh.newmodules);
+    setranges(&m_unknowncallers, NULL);
+    leavelock(&m_moduleslock);
+    m_moduleloads = counts[0];
+    m_moduleunloads = counts[1];
+    if (m_tracewriter != NULL) {
+        // Describe the modules in the trace again. The newest description of
+        // the modules at any address takes precedence.
+        Symbolizer::enummodules(tracemodule, m_tracewriter);
+    }
+
+    // Forget the functions of the unloaded modules, then resolve the function
+    // rules for the newly loaded modules, which may have been loaded at the
+    // same addresses.
+    if (unloaded.size() != 0) {
+        pruneranges(&m_excludedranges, &unloaded);
+        pruneranges(&m_forcedranges, &unloaded);
+        pruneranges(&m_internalranges, &unloaded);
+    }
+    if ((wcslen(m_excludedfunctionlist) != 0) || (wcslen(m_forcedfunctionlist) != 0)) {
+        for (newit = loaded.begin(); newit != loaded.end(); ++newit) {
+            resolvefunctionranges((*newit).addrlow, m_excludedfunctionlist, &m_excludedranges);
+            resolvefunctionranges((*newit).addrlow, m_forcedfunctionlist, &m_forcedranges);
+        }
+    }
+
+    // Free the names and paths of the modules that have been unloaded. Threads
+    // still searching the old set only look at the modules' addresses.
+    for (oldit = unloaded.begin(); oldit != unloaded.end(); ++oldit) {
+        delete (*oldit).name;
+        delete (*oldit).path;
+    }
+    InterlockedExchange(&m_refreshing, 0);
+
+    return TRUE;
+}
+
+// releasemodules - Tells that the calling thread is done searching the set of
+//   loaded modules obtained by "acquiremodules", so that the set may be freed
+//   once it has been superseded.
+//
+//  - tls (IN): Pointer to the calling thread's thread local storage structure.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::releasemodules (tls_t *tls)
+{
+    publishcounter(&tls->modules, (const ModuleSet*)NULL);
+}
+
+// resolvefunctionranges - Finds the code occupied by the functions of a newly
+//   loaded module that match a list of function rules (see the ExcludeFunctions
+//   and ForceIncludeFunctions options), and adds it to the rules' table of
+//   ranges. This is done once per module, so that applying the rules to each
+//   allocation is only a matter of searching the table.
+//
+//  - moduleaddress (IN): Any address within the module.
+//
+//  - patterns (IN): The list of patterns. A pattern matches the names of
+//      functions or, if it contains a "/", the paths of their source files.
+//
+//  - table (IN/OUT): The table to which the ranges are added.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::resolvefunctionranges (SIZE_T moduleaddress, LPCWSTR patterns, RangeTable **table)
+{
+    WCHAR            pattern [MAXPATTERNLENGTH];
+    functionrules_t *rules = new functionrules_t;
+
+    rules->count = 0;
+    while ((rules->count < MAXPATTERNS) && ((patterns = nextlistitem(patterns, pattern, MAXPATTERNLENGTH)) != NULL)) {
+        wcstombs(rules->patterns[rules->count], pattern, MAXPATTERNLENGTH);
+        rules->patterns[rules->count][MAXPATTERNLENGTH - 1] = '\0';
+        rules->count++;
+    }
+    if (rules->count != 0) {
+        symbolizer.enumfunctions(moduleaddress, addmatchingfunction, rules);
+        addranges(table, rules->ranges.ranges(), rules->ranges.size());
+    }
+    delete rules;
+}
+
+// resolveinternalranges - Finds the code occupied by each of the allocation
+//   functions internal to the heap (see "internalfunctions") and adds it to the
+//   ranges whose frames are left out of call stacks. The functions are looked up
+//   once, so that walking the stack only needs to compare each frame's program
+//   counter against the ranges, rather than resolving the frame's symbol.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::resolveinternalranges ()
+{
+    LPVOID         address;
+    SIZE_T         count = 0;
+    Dl_info        dlinfo;
+    SIZE_T         index;
+    addressrange_t ranges [INTERNALCOUNT];
+    ElfW(Sym)     *symbol;
+
+    for (index = 0; index < INTERNALCOUNT; index++) {
+        // Look past VLD for the definition, in case VLD defines the function
+        // itself. VLD's own frames are never part of the call stack anyway.
+        address = dlsym(RTLD_NEXT, internalfunctions[index]);
+        if ((address == NULL) || (dladdr1(address, &dlinfo, (void**)&symbol, RTLD_DL_SYMENT) == 0) ||
+            (symbol == NULL) || (symbol->st_size == 0)) {
+            // Either the function isn't defined, or its size isn't known.
+            continue;
+        }
+        ranges[count].low = (SIZE_T)address;
+        ranges[count].high = (SIZE_T)address + symbol->st_size;
+        count++;
+    }
+    addranges(&m_internalranges, ranges, count);
+}
+
+// setmodules - Replaces the set of loaded modules. Other threads may still be
+//   searching the set being replaced, so it is retired, rather than freed,
+//   until none of them is (see "acquiremodules"). Sets retired earlier that no
+//   thread is searching anymore are freed. The modules' names and paths are
+//   carried over to the new set, so they are not freed along with the sets.
+//
+//   Note: The caller must hold the modules lock.
+//
+//  - newmodules (IN): Pointer to the new set.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::setmodules (ModuleSet *newmodules)
+{
+    ModuleSetSet            inuse;
+    const ModuleSet        *modules;
+    ModuleSetSet::Iterator  retiredit;
+    ModuleSetSet           *stillretired;
+    TlsSet::Iterator        tlsit;
+
+    m_retiredmodules->insert(m_loadedmodules);
+    orderedstore(&m_loadedmodules, newmodules);
+
+    // Any thread that starts searching the set from now on finds the new set.
+    // Find the sets that threads may have started searching before.
+    enterlock(&m_tlslock);
+    for (tlsit = m_tlsset->begin(); tlsit != m_tlsset->end(); ++tlsit) {
+        modules = orderedload(&(*tlsit)->modules);
+        if (modules != NULL) {
+            inuse.insert(modules);
+        }
+    }
+    leavelock(&m_tlslock);
+
+    stillretired = new ModuleSetSet;
+    for (retiredit = m_retiredmodules->begin(); retiredit != m_retiredmodules->end(); ++retiredit) {
+        if (inuse.find(*retiredit) != inuse.end()) {
+            stillretired->insert(*retiredit);
+        }
+        else {
+            delete *retiredit;
+        }
+    }
+    delete m_retiredmodules;
+    m_retiredmodules = stillretired;
+}
+
+// takeclassifiedsnapshot - Captures a snapshot of all of the memory blocks that
+//   are currently outstanding. Leaks can't be classified on POSIX systems, so
+//   the blocks are left unclassified.
+//
+//  - snapshot (OUT): Pointer to a snapshot structure to receive the snapshot.
+//      The snapshot must be freed by calling "freesnapshot".
+//
+//  - parallel (IN): Ignored.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::takeclassifiedsnapshot (snapshot_t *snapshot, BOOL parallel)
+{
+    takesnapshot(snapshot, NULL, 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Static Leak Detection Functions (Callbacks)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// addloadedmodule - Callback function for dl_iterate_phdr. Adds the module to
+//   the new ModuleSet being built by "refreshmodules". If the module is in the
+//   current ModuleSet, then its entry is simply carried over. Otherwise, VLD
+//   itself and the system libraries are excluded from leak detection, unless
+//   they are listed in the force-include module list.
+//
+//  - info (IN): Information about the module (its base address, path and
+//      program headers).
+//
+//  - size (IN): Size, in bytes, of the information.
+//
+//  - context (IN): Pointer to the modulerefresh_t holding the new and current
+//      ModuleSets.
+//
+//  Return Value:
+//
+//    Always returns zero, so that the enumeration continues.
+//
+int VisualLeakDetector::addloadedmodule (struct dl_phdr_info *info, size_t size, void *context)
+{
+    SIZE_T               addrhigh = 0;
+    SIZE_T               addrlow = (SIZE_T)-1;
+    UINT                 index;
+    SIZE_T               length;
+    moduleinfo_t         moduleinfo;
+    LPCSTR               modulename;
+    WCHAR                modulenamew [MAXMODULENAME];
+    CHAR                 modulepath [MAX_PATH];
+    ModuleSet::Iterator  oldit;
+    modulerefresh_t     *refresh = (modulerefresh_t*)context;
+    SIZE_T               segmentend;
+
+    // The module occupies the range of addresses spanned by its loadable
+    // segments.
+    for (index = 0; index < info->dlpi_phnum; index++) {
+        if (info->dlpi_phdr[index].p_type != PT_LOAD) {
+            continue;
+        }
+        segmentend = info->dlpi_addr + info->dlpi_phdr[index].p_vaddr + info->dlpi_phdr[index].p_memsz;
+        if (info->dlpi_addr + info->dlpi_phdr[index].p_vaddr < addrlow) {
+            addrlow = info->dlpi_addr + info->dlpi_phdr[index].p_vaddr;
+        }
+        if (segmentend > addrhigh) {
+            addrhigh = segmentend;
+        }
+    }
+    if (addrhigh == 0) {
+        // The module has nothing loaded.
+        return 0;
+    }
+    moduleinfo.addrhigh = addrhigh - 1;
+    moduleinfo.addrlow  = addrlow;
+    oldit = refresh->oldmodules->find(moduleinfo);
+    if ((oldit != refresh->oldmodules->end()) && ((*oldit).addrlow == moduleinfo.addrlow) &&
+        ((*oldit).addrhigh == moduleinfo.addrhigh)) {
+        // This module was already loaded.
+        refresh->newmodules->insert(*oldit);
+        return 0;
+    }
+
+    // The main program is reported without a path.
+    if ((info->dlpi_name == NULL) || (info->dlpi_name[0] == '\0')) {
+        length = readlink("/proc/self/exe", modulepath, MAX_PATH - 1);
+        modulepath[(length == (SIZE_T)-1) ? 0 : length] = '\0';
+    }
+    else {
+        strncpy(modulepath, info->dlpi_name, MAX_PATH);
+        modulepath[MAX_PATH - 1] = '\0';
+    }
+    modulename = strrchr(modulepath, '/');
+    modulename = (modulename == NULL) ? modulepath : modulename + 1;
+
+    moduleinfo.flags    = 0x0;
+    if (((SIZE_T)&vld >= addrlow) && ((SIZE_T)&vld < addrhigh)) {
+        // This is VLD itself. If VLD has been linked into the main program,
+        // then the program is not excluded along with it.
+        if ((info->dlpi_name != NULL) && (info->dlpi_name[0] != '\0')) {
+            moduleinfo.flags |= VLD_MODULE_EXCLUDED;
+        }
+    }
+    else {
+        for (index = 0; index < sizeof(systemmodules) / sizeof(systemmodules[0]); index++) {
+            if (strncmp(modulename, systemmodules[index], strlen(systemmodules[index])) == 0) {
+                // This is a system library. Exclude it, unless it is
+                // forcefully included.
+                mbstowcs(modulenamew, modulename, MAXMODULENAME);
+                modulenamew[MAXMODULENAME - 1] = L'\0';
+                if (wcsstr(vld.m_forcedmodulelist, modulenamew) == NULL) {
+                    moduleinfo.flags |= VLD_MODULE_EXCLUDED;
+                }
+                break;
+            }
+        }
+    }
+
+    // Copy the module's path and name, which are only valid for the duration
+    // of the callback.
+    length = strlen(modulepath) + 1;
+    moduleinfo.path = strncpy(new CHAR [length], modulepath, length);
+    modulename = moduleinfo.path + (modulename - modulepath);
+    length = strlen(modulename) + 1;
+    moduleinfo.name = strncpy(new CHAR [length], modulename, length);
+    refresh->newmodules->insert(moduleinfo);
+
+    return 0;
+}
+
+// forkchild - Called in the child process just after the process has forked.
+//   Releases the locks acquired by "forkprepare". The trace writer's thread
+//   doesn't exist in the child process, so the child process isn't traced: its
+//   copy of the trace writer is abandoned (the trace file belongs to the
+//   parent process).
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::forkchild ()
+{
+    forkrelease();
+    vld.m_tracewriter = NULL;
+}
+
+// forkprepare - Called just before the process forks. Acquires all of VLD's
+//   locks, so that none of them is held by another thread at the time the
+//   process is copied. Such a lock would never be released in the child
+//   process, where only the forking thread exists. For the same reason, any
+//   refresh of the set of loaded modules is allowed to finish first.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::forkprepare ()
+{
+    while (InterlockedCompareExchange(&vld.m_refreshing, 1, 0) != 0) {
+        delay(1);
+    }
+    enterlock(&vld.m_maplock);
+    enterlock(&vld.m_moduleslock);
+    enterlock(&vld.m_tlslock);
+    if (vld.m_tracewriter != NULL) {
+        vld.m_tracewriter->forkprepare();
+    }
+    enterlock(&vldheaplock);
+}
+
+// forkrelease - Called in both the parent and the child process just after
+//   the process has forked. Releases the locks acquired by "forkprepare".
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::forkrelease ()
+{
+    leavelock(&vldheaplock);
+    if (vld.m_tracewriter != NULL) {
+        vld.m_tracewriter->forkrelease();
+    }
+    leavelock(&vld.m_tlslock);
+    leavelock(&vld.m_moduleslock);
+    leavelock(&vld.m_maplock);
+    InterlockedExchange(&vld.m_refreshing, 0);
+}
+
+// threadexit - Called when a thread that has used VLD exits. The thread's
+//   trace buffer is handed back to the trace writer, so that it isn't held, and
+//   scanned for new events, for as long as the process runs. The thread's local
+//   storage structure itself is kept, because its statistics still count.
+//
+//  - value (IN): Pointer to the exiting thread's thread local storage
+//      structure.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::threadexit (LPVOID value)
+{
+    tls_t *tls = (tls_t*)value;
+
+    if ((tls->tracebuffer != NULL) && (vld.m_tracewriter != NULL)) {
+        vld.m_tracewriter->release(tls->tracebuffer);
+        tls->tracebuffer = NULL;
+    }
+
+    // Destructors of other thread local storage may still allocate or free
+    // memory. Keep the structure, rather than letting a new one be created.
+    // This destructor is then called again, up to a system-defined number of
+    // times, in case another buffer was taken.
+    tlssetvalue(vld.m_tlsindex, tls);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Public POSIX Allocation Handlers
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// _calloc - Calls to calloc are routed to this handler. It invokes the real
+//   calloc and then maps the allocated block.
+//
+//  - pcalloc (IN): Pointer to the real calloc.
+//
+//  - fp (IN): Frame pointer from the call that initiated this allocation.
+//
+//  - num (IN): Number of elements in the block to be allocated.
+//
+//  - size (IN): Size, in bytes, of each element.
+//
+//  Return Value:
+//
+//    Returns the value returned by calloc.
+//
+void* VisualLeakDetector::_calloc (calloc_t pcalloc, SIZE_T fp, size_t num, size_t size)
+{
+    void      *block;
+    ULONGLONG  start;
+
+    block = pcalloc(num, size);
+    if ((block != NULL) && enterhandler()) {
+        start = getperfcounter();
+        if (enabled() && !excludedcaller(fp)) {
+            mapblock(CRTHEAP, block, num * size, fp, FALSE);
+        }
+        leavehandler(start);
+    }
+
+    return block;
+}
+
+// _dlclose - Calls to dlclose are routed to this handler. It invokes the real
+//   dlclose and then, if the module was unloaded, refreshes the set of loaded
+//   modules, so that blocks allocated later at the same addresses by another
+//   module are not attributed to the unloaded module.
+//
+//  - pdlclose (IN): Pointer to the real dlclose.
+//
+//  - handle (IN): Handle of the module to close.
+//
+//  Return Value:
+//
+//    Returns the value returned by dlclose.
+//
+int VisualLeakDetector::_dlclose (dlclose_t pdlclose, void *handle)
+{
+    int       result;
+    ULONGLONG start;
+
+    result = pdlclose(handle);
+    if ((result == 0) && enterhandler()) {
+        start = getperfcounter();
+        refreshmodules(TRUE);
+        leavehandler(start);
+    }
+
+    return result;
+}
+
+// _free - Calls to free are routed to this handler. It unmaps the block and
+//   then invokes the real free. The block is unmapped regardless of whether
+//   leak detection is enabled, because it may have been allocated while it
+//   was.
+//
+//  - pfree (IN): Pointer to the real free.
+//
+//  - mem (IN): Pointer to the memory block to be freed.
+//
+//  Return Value:
+//
+//    None.
+//
+void VisualLeakDetector::_free (free_t pfree, void *mem)
+{
+    ULONGLONG start;
+
+    if (enterhandler()) {
+        start = getperfcounter();
+        unmapblock(CRTHEAP, mem);
+        leavehandler(start);
+    }
+
+    pfree(mem);
+}
+
+// _malloc - Calls to malloc, and to the global new operators, are routed to
+//   this handler. It invokes the real malloc and then maps the allocated block.
+//
+//  - pmalloc (IN): Pointer to the real malloc.
+//
+//  - fp (IN): Frame pointer from the call that initiated this allocation.
+//
+//  - size (IN): The size, in bytes, of the memory block to be allocated.
+//
+//  Return Value:
+//
+//    Returns the value returned by malloc.
+//
+void* VisualLeakDetector::_malloc (malloc_t pmalloc, SIZE_T fp, size_t size)
+{
+    void      *block;
+    ULONGLONG  start;
+
+    block = pmalloc(size);
+    if ((block != NULL) && enterhandler()) {
+        start = getperfcounter();
+        if (enabled() && !excludedcaller(fp)) {
+            mapblock(CRTHEAP, block, size, fp, FALSE);
+        }
+        leavehandler(start);
+    }
+
+    return block;
+}
+
+// _posix_memalign - Calls to posix_memalign, and to the other aligned
+//   allocation functions, are routed to this handler. It invokes the real
+//   posix_memalign and then maps the allocated block.
+//
+//  - pposix_memalign (IN): Pointer to the real posix_memalign.
+//
+//  - fp (IN): Frame pointer from the call that initiated this allocation.
+//
+//  - mem (OUT): Receives a pointer to the allocated block.
+//
+//  - alignment (IN): Alignment, in bytes, of the block to be allocated.
+//
+//  - size (IN): The size, in bytes, of the memory block to be allocated.
+//
+//  Return Value:
+//
+//    Returns the value returned by posix_memalign.
+//
+int VisualLeakDetector::_posix_memalign (posix_memalign_t pposix_memalign, SIZE_T fp, void **mem, size_t alignment,
+                                         size_t size)
+{
+    ULONGLONG start;
+    int       status;
+
+    status = pposix_memalign(mem, alignment, size);
+    if ((status == 0) && enterhandler()) {
+        start = getperfcounter();
+        if (enabled() && !excludedcaller(fp)) {
+            mapblock(CRTHEAP, *mem, size, fp, FALSE);
+        }
+        leavehandler(start);
+    }
+
+    return status;
+}
+
+// _realloc - Calls to realloc are routed to this handler. It invokes the real
+//   realloc and then remaps the reallocated block. If leak detection is
+//   disabled, or the module that initiated the reallocation is excluded, the
+//   block is unmapped instead.
+//
+//  - prealloc (IN): Pointer to the real realloc.
+//
+//  - fp (IN): Frame pointer from the call that initiated this reallocation.
+//
+//  - mem (IN): Pointer to the memory block to reallocate.
+//
+//  - size (IN): Size of the memory block to reallocate.
+//
+//  Return Value:
+//
+//    Returns the value returned by realloc.
+//
+void* VisualLeakDetector::_realloc (realloc_t prealloc, SIZE_T fp, void *mem, size_t size)
+{
+    SIZE_T     checkpoint;
+    void      *newmem;
+    ULONGLONG  start;
+
+    checkpoint = readcounter(&m_serialnumber);
+    newmem = prealloc(mem, size);
+    if (enterhandler()) {
+        start = getperfcounter();
+        if (newmem == NULL) {
+            if ((size == 0) && (mem != NULL)) {
+                // Reallocating to zero bytes freed the block.
+                unmapblock(CRTHEAP, mem, checkpoint);
+            }
+            // Otherwise the reallocation failed, and the block is unchanged.
+        }
+        else if (enabled() && !excludedcaller(fp)) {
+            remapblock(CRTHEAP, mem, newmem, size, fp, FALSE, checkpoint);
+        }
+        else if (mem != NULL) {
+            unmapblock(CRTHEAP, mem, checkpoint);
+        }
+        leavehandler(start);
+    }
+
+    return newmem;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Public Custom Allocator Handlers
+//
+//   Unlike the allocation handlers, these don't check whether the caller is in
+//   an excluded module: a custom allocator that reports its blocks wants them
+//   to be tracked.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// trackalloc - Calls to VLDTrackAlloc are routed to this handler. It maps the
+//   block handed out by a custom allocator in the virtual heap.
+//
+//  - fp (IN): Frame pointer from the call that initiated this allocation.
+//
+//  - mem (IN): Pointer to the memory block handed out.
+//
+//  - size (IN): Size, in bytes, of the memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackalloc (SIZE_T fp, LPCVOID mem, SIZE_T size)
+{
+    ULONGLONG start;
+
+    if (enterhandler()) {
+        start = getperfcounter();
+        if (enabled()) {
+            mapblock(VIRTUALHEAP, mem, size, fp, FALSE);
+        }
+        leavehandler(start);
+    }
+}
+
+// trackallocs - Calls to VLDTrackAllocs are routed to this handler. It maps a
+//   batch of blocks of the same size, handed out by a custom allocator, in the
+//   virtual heap.
+//
+//  - fp (IN): Frame pointer from the call that initiated these allocations.
+//
+//  - mems (IN): Array of pointers to the memory blocks handed out.
+//
+//  - count (IN): Number of elements in the "mems" array.
+//
+//  - size (IN): Size, in bytes, of each memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackallocs (SIZE_T fp, LPCVOID const *mems, SIZE_T count, SIZE_T size)
+{
+    ULONGLONG start;
+
+    if (enterhandler()) {
+        start = getperfcounter();
+        if (enabled()) {
+            mapblocks(VIRTUALHEAP, mems, count, size, fp);
+        }
+        leavehandler(start);
+    }
+}
+
+// trackallocsfrom - Calls to VLDTrackAllocsFrom are routed to this handler. It
+//   maps a batch of blocks of the same size, handed out by a custom allocator
+//   to the specified callers, in the virtual heap.
+//
+//  - fp (IN): Frame pointer from the call that initiated these allocations.
+//
+//  - mems (IN): Array of pointers to the memory blocks handed out.
+//
+//  - callers (IN): Array of the addresses the custom allocator returned to, one
+//      for each element of the "mems" array.
+//
+//  - count (IN): Number of elements in the "mems" and "callers" arrays.
+//
+//  - size (IN): Size, in bytes, of each memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackallocsfrom (SIZE_T fp, LPCVOID const *mems, LPCVOID const *callers, SIZE_T count,
+                                          SIZE_T size)
+{
+    ULONGLONG start;
+
+    if (enterhandler()) {
+        start = getperfcounter();
+        if (enabled()) {
+            mapblocksfrom(VIRTUALHEAP, mems, callers, count, size, fp);
+        }
+        leavehandler(start);
+    }
+}
+
+// trackfree - Calls to VLDTrackFree are routed to this handler. It unmaps the
+//   block taken back by a custom allocator from the virtual heap. The block is
+//   unmapped regardless of whether leak detection is enabled, because it may
+//   have been handed out while it was.
+//
+//  - mem (IN): Pointer to the memory block taken back.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackfree (LPCVOID mem)
+{
+    ULONGLONG start;
+
+    if (enterhandler()) {
+        start = getperfcounter();
+        unmapblock(VIRTUALHEAP, mem);
+        leavehandler(start);
+    }
+}
+
+// trackfrees - Calls to VLDTrackFrees are routed to this handler. It unmaps a
+//   batch of blocks taken back by a custom allocator from the virtual heap.
+//
+//  - mems (IN): Array of pointers to the memory blocks taken back.
+//
+//  - count (IN): Number of elements in the "mems" array.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackfrees (LPCVOID const *mems, SIZE_T count)
+{
+    ULONGLONG start;
+
+    if (enterhandler()) {
+        start = getperfcounter();
+        unmapblocks(VIRTUALHEAP, mems, count);
+        leavehandler(start);
+    }
+}
+
+// trackrealloc - Calls to VLDTrackRealloc are routed to this handler. It remaps
+//   the block resized by a custom allocator in the virtual heap. The custom
+//   allocator has already resized the block by the time it reports it, so any
+//   block allocated at the old address since then has not been reported yet.
+//
+//  - fp (IN): Frame pointer from the call that initiated this reallocation.
+//
+//  - mem (IN): Pointer to the memory block that was resized (may be NULL if
+//      the block was newly handed out).
+//
+//  - newmem (IN): Pointer to the resized memory block (may be NULL if the
+//      block was taken back).
+//
+//  - size (IN): Size, in bytes, of the resized memory block.
+//
+//  Return Value:
+//
+//    None.
+//
+VOID VisualLeakDetector::trackrealloc (SIZE_T fp, LPCVOID mem, LPCVOID newmem, SIZE_T size)
+{
+    ULONGLONG start;
+
+    if (enterhandler()) {
+        start = getperfcounter();
+        if (newmem == NULL) {
+            if (mem != NULL) {
+                // The block was taken back.
+                unmapblock(VIRTUALHEAP, mem);
+            }
+        }
+        else if (enabled()) {
+            remapblock(VIRTUALHEAP, mem, newmem, size, fp, FALSE, (SIZE_T)-1);
+        }
+        else if (mem != NULL) {
+            unmapblock(VIRTUALHEAP, mem);
+        }
+        leavehandler(start);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Interposed Allocation Functions
+//
+//   Each of these functions obtains its own frame pointer, so that the return
+//   address of the call that initiated the allocation can be found in it. So
+//   they must be built with frame pointers, and calls from them must not be
+//   turned into tail calls.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// aligned_alloc - Allocates a memory block with the specified alignment.
+//
+//  - alignment (IN): Alignment, in bytes, of the block.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL if the allocation
+//    failed.
+//
+extern "C" void* aligned_alloc (size_t alignment, size_t size) __THROW
+{
+    void   *block = NULL;
+    SIZE_T  fp;
+    int     status;
+
+    FRAMEPOINTER(fp);
+
+    if ((alignment == 0) || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment < sizeof(void*)) {
+        alignment = sizeof(void*);
+    }
+    if (!linkallocator()) {
+        return NULL;
+    }
+    status = vld._posix_memalign(pposix_memalign, fp, &block, alignment, size);
+    if (status != 0) {
+        errno = status;
+        return NULL;
+    }
+
+    return block;
+}
+
+// calloc - Allocates a zeroed array.
+//
+//  - num (IN): Number of elements in the array.
+//
+//  - size (IN): Size, in bytes, of each element.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL if the allocation
+//    failed.
+//
+extern "C" void* calloc (size_t num, size_t size) __THROW
+{
+    SIZE_T fp;
+
+    FRAMEPOINTER(fp);
+
+    if (!linkallocator()) {
+        // Called while linking to the real allocator. The bootstrap buffer is
+        // already zeroed.
+        if ((num != 0) && (size > (SIZE_T)-1 / num)) {
+            return NULL;
+        }
+        return bootstrapalloc(num * size);
+    }
+
+    return vld._calloc(pcalloc, fp, num, size);
+}
+
+// dlclose - Closes a module opened by dlopen, unloading it if it is no longer
+//   referenced. Modules loaded by dlopen are noticed the first time they
+//   allocate memory, so dlopen itself need not be interposed (and must not be:
+//   the dynamic linker takes the caller's address into account).
+//
+//  - handle (IN): Handle of the module to close.
+//
+//  Return Value:
+//
+//    Returns zero on success, or non-zero on error.
+//
+extern "C" int dlclose (void *handle) __THROW
+{
+    if (pdlclose == NULL) {
+        pdlclose = (dlclose_t)dlsym(RTLD_NEXT, "dlclose");
+    }
+
+    return vld._dlclose(pdlclose, handle);
+}
+
+// free - Frees a memory block.
+//
+//  - mem (IN): Pointer to the block to free.
+//
+//  Return Value:
+//
+//    None.
+//
+extern "C" void free (void *mem) __THROW
+{
+    if ((mem == NULL) || isbootstrap(mem)) {
+        // Blocks from the bootstrap buffer are never freed.
+        return;
+    }
+
+    linkallocator();
+    vld._free(pfree, mem);
+}
+
+// malloc - Allocates a memory block.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL if the allocation
+//    failed.
+//
+extern "C" void* malloc (size_t size) __THROW
+{
+    SIZE_T fp;
+
+    FRAMEPOINTER(fp);
+
+    if (!linkallocator()) {
+        // Called while linking to the real allocator.
+        return bootstrapalloc(size);
+    }
+
+    return vld._malloc(pmalloc, fp, size);
+}
+
+// memalign - Allocates a memory block with the specified alignment. Unlike
+//   aligned_alloc and posix_memalign, alignments that aren't powers of two
+//   are rounded up to the next power of two.
+//
+//  - alignment (IN): Alignment, in bytes, of the block.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL if the allocation
+//    failed.
+//
+extern "C" void* memalign (size_t alignment, size_t size) __THROW
+{
+    void   *block = NULL;
+    SIZE_T  fp;
+    size_t  poweroftwo = sizeof(void*);
+    int     status;
+
+    FRAMEPOINTER(fp);
+
+    while ((poweroftwo < alignment) && (poweroftwo != 0)) {
+        poweroftwo <<= 1;
+    }
+    if ((poweroftwo == 0) || !linkallocator()) {
+        errno = (poweroftwo == 0) ? EINVAL : ENOMEM;
+        return NULL;
+    }
+    status = vld._posix_memalign(pposix_memalign, fp, &block, poweroftwo, size);
+    if (status != 0) {
+        errno = status;
+        return NULL;
+    }
+
+    return block;
+}
+
+// posix_memalign - Allocates a memory block with the specified alignment.
+//
+//  - mem (OUT): Receives a pointer to the allocated block.
+//
+//  - alignment (IN): Alignment, in bytes, of the block. Must be a power of two
+//      and a multiple of the size of a pointer.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    Returns zero if the block was allocated. Otherwise returns an error code.
+//
+extern "C" int posix_memalign (void **mem, size_t alignment, size_t size) __THROW
+{
+    SIZE_T fp;
+
+    FRAMEPOINTER(fp);
+
+    if (!linkallocator()) {
+        return ENOMEM;
+    }
+
+    return vld._posix_memalign(pposix_memalign, fp, mem, alignment, size);
+}
+
+// realloc - Changes the size of a memory block, possibly moving it.
+//
+//  - mem (IN): Pointer to the block to reallocate.
+//
+//  - size (IN): New size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    Returns a pointer to the reallocated block, or NULL if the reallocation
+//    failed (or if the block was freed).
+//
+extern "C" void* realloc (void *mem, size_t size) __THROW
+{
+    SIZE_T  fp;
+    LPVOID  newmem;
+    SIZE_T  oldsize;
+
+    FRAMEPOINTER(fp);
+
+    if (isbootstrap(mem)) {
+        // Blocks from the bootstrap buffer are never freed, so the contents
+        // are simply copied to a new block.
+        oldsize = *(SIZE_T*)((PBYTE)mem - 16);
+        newmem = linkallocator() ? vld._malloc(pmalloc, fp, size) : bootstrapalloc(size);
+        if (newmem != NULL) {
+            memcpy(newmem, mem, (oldsize < size) ? oldsize : size);
+        }
+        return newmem;
+    }
+    if (!linkallocator()) {
+        return bootstrapalloc(size);
+    }
+
+    return vld._realloc(prealloc, fp, mem, size);
+}
+
+// The global new operators are defined below. Internally, VLD uses its own new
+// operators, which allocate from its private heap (see vldheap.h), and it also
+// provides the global delete operators, which tell VLD's own blocks apart from
+// those allocated by these new operators (see vldheap.cpp).
+#undef new
+
+// newblock - Allocates a memory block for one of the global new operators.
+//   If the allocation fails, the new handler is called, if there is one, and
+//   the allocation is retried.
+//
+//  - fp (IN): Frame pointer of the new operator.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  - nothrow (IN): If TRUE, failure is reported by returning NULL instead of
+//      by throwing std::bad_alloc.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL if the allocation
+//    failed and nothrow is TRUE.
+//
+static void* newblock (SIZE_T fp, size_t size, BOOL nothrow)
+{
+    void             *block;
+    std::new_handler  handler;
+
+    if (size == 0) {
+        size = 1;
+    }
+    for (;;) {
+        block = linkallocator() ? vld._malloc(pmalloc, fp, size) : bootstrapalloc(size);
+        if (block != NULL) {
+            return block;
+        }
+        handler = std::get_new_handler();
+        if (handler == NULL) {
+            if (nothrow) {
+                return NULL;
+            }
+            throw std::bad_alloc();
+        }
+        if (nothrow) {
+            try {
+                handler();
+            }
+            catch (const std::bad_alloc &) {
+                return NULL;
+            }
+        }
+        else {
+            handler();
+        }
+    }
+}
+
+// scalar new operator - Allocates a scalar memory block.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block. Throws std::bad_alloc if the
+//    allocation fails.
+//
+void* operator new (size_t size)
+{
+    SIZE_T fp;
+
+    FRAMEPOINTER(fp);
+
+    return newblock(fp, size, FALSE);
+}
+
+// vector new operator - Allocates a vector memory block.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block. Throws std::bad_alloc if the
+//    allocation fails.
+//
+void* operator new [] (size_t size)
+{
+    SIZE_T fp;
+
+    FRAMEPOINTER(fp);
+
+    return newblock(fp, size, FALSE);
+}
+
+// scalar new operator - Allocates a scalar memory block, without throwing.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL if the allocation
+//    failed.
+//
+void* operator new (size_t size, const std::nothrow_t &) throw ()
+{
+    SIZE_T fp;
+
+    FRAMEPOINTER(fp);
+
+    return newblock(fp, size, TRUE);
+}
+
+// vector new operator - Allocates a vector memory block, without throwing.
+//
+//  - size (IN): Size, in bytes, of the block.
+//
+//  Return Value:
+//
+//    Returns a pointer to the allocated block, or NULL if the allocation
+//    failed.
+//
+void* operator new [] (size_t size, const std::nothrow_t &) throw ()
+{
+    SIZE_T fp;
+
+    FRAMEPOINTER(fp);
+
+    return newblock(fp, size, TRUE);
+}